@@ -0,0 +1,33 @@
+#include <Arduino.h>
+#include <M16-planner.h>
+
+// Five nodes with four sensors each, polled once a minute.
+DeploymentPlan plan = {
+    .nodes = 5,
+    .sensorsPerNode = 4,
+    .samplePeriodMs = 60000,
+    .turnaroundMs = 300,
+    .reportEachCycle = true,
+};
+
+void setup()
+{
+    Serial.begin(115200);
+
+    AirtimePlanner planner(plan);
+    PlanResult result = planner.evaluate();
+
+    Serial.println("Node slot: " + String(result.nodeSlotMs) + " ms");
+    Serial.println("Cycle time: " + String(result.cycleTimeMs) + " ms");
+    Serial.println("Poll period: " + String(result.pollPeriodMs) + " ms");
+    Serial.println("Utilization: " + String(result.utilization * 100.0f) + " %");
+    Serial.println("Headroom: " + String(result.headroomMs) + " ms");
+    Serial.println("Worst alarm latency: " + String(result.worstAlarmLatencyMs) + " ms");
+    Serial.println("Max nodes: " + String(result.maxNodes));
+    Serial.println(result.feasible ? "Plan is feasible." : "Plan does not fit the sample period.");
+    Serial.println(planner.validate() ? "Schedule replay agrees with the model." : "Schedule replay differs from the model.");
+}
+
+void loop()
+{
+}
@@ -0,0 +1,40 @@
+#include <Arduino.h>
+#include <M16-clock.h>
+
+// Simulates a node clock that drifts against the server for 30 days, with one
+// server block per minute, and compares the guard interval needed with and without
+// drift correction. 2% of the blocks are detected late and must be rejected. The
+// largest error of the first hour, while the fit settles, is shown on its own.
+
+struct Scenario
+{
+    const char *name;
+    float skewPpm;
+    float wanderPpm;
+    float jitterMs;
+};
+
+Scenario scenarios[] = {
+    {"steady 20 ppm", 20.0f, 0.0f, 50.0f},
+    {"20 ppm, 5 ppm daily swing", 20.0f, 5.0f, 50.0f},
+    {"-40 ppm, 10 ppm daily swing", -40.0f, 10.0f, 200.0f},
+};
+
+void setup()
+{
+    Serial.begin(115200);
+    Serial.println("Scenario\t\t\tUncorrected ms\tWarm-up max ms\tMax error ms\tMean guard ms\tCoverage\tRejected");
+    for (const Scenario &scenario : scenarios)
+    {
+        ClockSimulation simulation;
+        ClockResult result = simulation.run(scenario.skewPpm, scenario.wanderPpm, scenario.jitterMs, 0.02f, 60000,
+                                            30 * 24 * 60);
+        Serial.printf("%-28s\t%.0f\t\t%.0f\t\t%.0f\t\t%.0f\t\t%.4f\t\t%u\n", scenario.name,
+                      result.maxUncorrectedMs, result.maxWarmupErrorMs, result.maxErrorMs, result.meanGuardMs,
+                      result.coverage, result.rejected);
+    }
+}
+
+void loop()
+{
+}
@@ -0,0 +1,45 @@
+#include <Arduino.h>
+#include <M16-coalesce.h>
+
+// Measures the blocks saved by coalescing small sends over one simulated hour.
+// Values in a burst are sent 5 ms apart. Every block carries an id and a command,
+// so coalescing only helps when values can be packed tighter than one per block,
+// and only with a hold that covers the whole burst: the 20 ms hold splits the
+// bursts of 8 and 16 values and can cost more blocks than not coalescing.
+
+struct Trace
+{
+    const char *name;
+    CoalesceSource sources[3];
+    uint8_t count;
+};
+
+Trace traces[] = {
+    {"4 sensors, 8 bits, each minute", {{TEMP_SENSOR, 8, 0, 60000, 1, 0.0f}, {PRESSURE_SENSOR, 8, 0, 60000, 1, 0.0f}, {PH_SENSOR, 8, 0, 60000, 2, 0.0f}}, 3},
+    {"8 temperatures of 10 bits", {{TEMP_SENSOR, 10, 0, 60000, 8, 0.0f}}, 1},
+    {"16 leak flags of 1 bit", {{FINISHED, 1, 0, 30000, 16, 0.0f}}, 1},
+    {"mixed with urgent alarms", {{TEMP_SENSOR, 10, 0, 60000, 8, 0.0f}, {PH_SENSOR, 3, 0, 60000, 8, 0.0f}, {FINISHED, 1, 20000, 5000, 1, 0.2f}}, 3},
+};
+
+unsigned long holds[] = {0, 20, 100};
+
+void setup()
+{
+    Serial.begin(115200);
+    Serial.println("Trace\t\t\t\tHold ms\tValues\tPlain\tBlocks\tOverhead\tDelay ms");
+    for (const Trace &trace : traces)
+    {
+        for (unsigned long hold : holds)
+        {
+            CoalesceSimulation simulation;
+            CoalesceResult result = simulation.run(trace.sources, trace.count, hold, 3600000);
+            Serial.printf("%-32s%lu\t%u\t%u\t%u\t%.2f -> %.2f\t%.1f\n", trace.name, hold, result.values,
+                          result.plainBlocks, result.blocks, result.plainOverhead, result.overhead, result.meanDelayMs);
+        }
+    }
+    Serial.println("A hold shorter than the span of a burst splits it into batches that cost extra blocks.");
+}
+
+void loop()
+{
+}
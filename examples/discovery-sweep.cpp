@@ -0,0 +1,31 @@
+#include <Arduino.h>
+#include <M16-discovery.h>
+
+// Compares the time to discover the nodes in range by polling all 16 ids with HI
+// against a discovery sweep, for every population size. The sweep is run once
+// expecting the default number of nodes and once knowing the population from a
+// previous sweep, and once more with 10 % block loss and 30 % capture. Every
+// block takes a block time to arrive, so each query also waits a round trip.
+
+void setup()
+{
+    Serial.begin(115200);
+
+    Serial.println("Nodes\tPoll s\tSweep s\tKnown s\tLossy s\tFound\tPoll found");
+    for (uint8_t nodes = 0; nodes <= M16_MAX_NODES; nodes++)
+    {
+        DiscoverySimulation fresh(1), known(2), lossy(3);
+        DiscoveryResult first = fresh.run(nodes, 1000);
+        DiscoveryResult repeat = known.run(nodes, 1000, 0.0f, 0.0f, nodes);
+        DiscoveryResult lost = lossy.run(nodes, 1000, 0.1f, 0.3f, nodes);
+        Serial.printf("%u\t%.0f\t%.0f\t%.0f\t%.0f\t%.3f\t%.3f\n", nodes,
+                      first.pingBlocks * M16_BLOCK_INTERVAL_MS / 1000.0f,
+                      first.sweepBlocks * M16_BLOCK_INTERVAL_MS / 1000.0f,
+                      repeat.sweepBlocks * M16_BLOCK_INTERVAL_MS / 1000.0f,
+                      lost.sweepBlocks * M16_BLOCK_INTERVAL_MS / 1000.0f, lost.sweepFound, lost.pingFound);
+    }
+}
+
+void loop()
+{
+}
@@ -0,0 +1,40 @@
+#include <Arduino.h>
+#include <M16-fair.h>
+
+// Compares round robin polling with weighted fair scheduling when one node has a
+// backlog of long transfers. Node 0 queues 32-block transfers faster than the
+// channel can carry them, the others send a few blocks now and then. Node 4 has
+// twice the weight of the others.
+
+FairWorkload workload[] = {
+    {1, 0.04f, 32},
+    {1, 0.02f, 2},
+    {1, 0.02f, 2},
+    {1, 0.02f, 2},
+    {2, 0.02f, 4},
+    {1, 0.01f, 1},
+};
+
+void printResult(const char *name, const FairResult &result)
+{
+    Serial.printf("%s: utilization %.3f, fairness %.3f\n", name, result.utilization, result.fairness);
+    Serial.println("Node\tShare\tMean latency s\tMax latency s");
+    for (uint8_t i = 0; i < 6; i++)
+    {
+        Serial.printf("%u\t%.3f\t%.0f\t\t%.0f\n", i, result.share[i], result.meanLatencyMs[i] / 1000,
+                      result.maxLatencyMs[i] / 1000);
+    }
+}
+
+void setup()
+{
+    Serial.begin(115200);
+
+    FairSimulation roundRobin, fair;
+    printResult("Round robin", roundRobin.run(workload, 6, false, 100000));
+    printResult("Weighted fair", fair.run(workload, 6, true, 100000));
+}
+
+void loop()
+{
+}
@@ -0,0 +1,90 @@
+#include <Arduino.h>
+#include <M16-lib.h>
+#include <M16-fastrx.h>
+#include "esp_timer.h"
+
+#define RX_GPIO 32
+#define TX_GPIO 33
+#define ROUNDS 100
+
+// Compares the receive latency of readRxBuff() with the fast interrupt path.
+// The UART is put in loopback, so no modem needs to be attached.
+
+M16 m16(UART_NUM_2);
+FastRx fastRx;
+
+void printStats(const char *name, uint32_t minUs, uint32_t maxUs, uint64_t totalUs, uint32_t samples)
+{
+    Serial.printf("%s: min %u us, max %u us, mean %u us over %u packets\n",
+                  name, minUs, maxUs, (uint32_t)(totalUs / (samples ? samples : 1)), samples);
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    m16.begin(RX_GPIO, TX_GPIO);
+    uart_set_loop_back(UART_NUM_2, true);
+
+    // Driver path: time from the write until readRxBuff() returns both bytes.
+    uint32_t minUs = UINT32_MAX, maxUs = 0, samples = 0;
+    uint64_t totalUs = 0;
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        uint8_t data[2];
+        int64_t start = esp_timer_get_time();
+        m16.sendPacket(i & 0x0f, TEMP_SENSOR, i);
+        if (m16.readRxBuff(data, 2) == 2)
+        {
+            uint32_t elapsed = esp_timer_get_time() - start;
+            minUs = min(minUs, elapsed);
+            maxUs = max(maxUs, elapsed);
+            totalUs += elapsed;
+            samples++;
+        }
+        vTaskDelay(pdMS_TO_TICKS(20));
+    }
+    printStats("readRxBuff()", minUs, maxUs, totalUs, samples);
+    uint32_t driverSamples = samples;
+
+    // Fast path: same measurement, plus the interrupt to handler latency alone.
+    if (!m16.enableFastRx(fastRx))
+    {
+        Serial.println("Fast receive path is not supported on this ESP-IDF version.");
+        return;
+    }
+    minUs = UINT32_MAX, maxUs = 0, samples = 0, totalUs = 0;
+    uint32_t timeouts = 0;
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        uint16_t packet;
+        bool received = false;
+        int64_t start = esp_timer_get_time();
+        m16.sendPacket(i & 0x0f, TEMP_SENSOR, i);
+        while (!(received = fastRx.pop(packet)) && esp_timer_get_time() - start < 100000)
+        {
+        }
+        if (received)
+        {
+            uint32_t elapsed = esp_timer_get_time() - start;
+            minUs = min(minUs, elapsed);
+            maxUs = max(maxUs, elapsed);
+            totalUs += elapsed;
+            samples++;
+        }
+        else
+        {
+            timeouts++;
+        }
+        vTaskDelay(pdMS_TO_TICKS(20));
+    }
+    printStats("FastRx", minUs, maxUs, totalUs, samples);
+    Serial.printf("readRxBuff() timeouts: %u, FastRx timeouts: %u\n", ROUNDS - driverSamples, timeouts);
+
+    LatencyStats latency = fastRx.getLatency();
+    printStats("FastRx interrupt to handler", latency.minUs, latency.maxUs, latency.totalUs, latency.samples);
+    m16.disableFastRx(fastRx);
+}
+
+void loop()
+{
+}
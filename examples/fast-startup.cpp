@@ -0,0 +1,32 @@
+#include <Arduino.h>
+#include <M16-lib.h>
+
+#define RX_GPIO 32
+#define TX_GPIO 33
+
+M16 m16(UART_NUM_2);
+
+// Configuration used when nothing is stored in NVS yet.
+ModemConfig defaultConfig = {.channel = 3, .powerLevel = 2};
+
+void setup()
+{
+    Serial.begin(115200);
+    m16.begin(RX_GPIO, TX_GPIO);
+
+    unsigned long start = millis();
+
+    // Only sends the settings the modem does not already report.
+    if (!m16.restoreConfig())
+    {
+        m16.applyConfig(defaultConfig);
+    }
+
+    Serial.println("Modem ready after " + String(millis() - start) + " ms");
+    Serial.println("Channel: " + String(m16.getConfig().channel));
+    Serial.println("Power Level: " + String(m16.getConfig().powerLevel));
+}
+
+void loop()
+{
+}
@@ -0,0 +1,25 @@
+#include <Arduino.h>
+#include <M16-harq.h>
+
+// Compares hybrid ARQ with plain retransmission on a simulated channel.
+// Messages of 16 bytes are sent 200 times at each bit error rate.
+
+float bitErrorRates[] = {0.0f, 0.001f, 0.002f, 0.005f, 0.01f, 0.02f, 0.04f};
+
+void setup()
+{
+    Serial.begin(115200);
+
+    HarqSimulation simulation;
+    Serial.println("BER\tBLER\tHARQ bit/s\tARQ bit/s\tHARQ rounds\tARQ rounds");
+    for (float ber : bitErrorRates)
+    {
+        GoodputResult result = simulation.compare(ber, 16, 200);
+        Serial.printf("%.3f\t%.3f\t%.3f\t\t%.3f\t\t%.2f\t\t%.2f\n", ber, result.blockErrorRate,
+                      result.harqGoodput, result.arqGoodput, result.harqRounds, result.arqRounds);
+    }
+}
+
+void loop()
+{
+}
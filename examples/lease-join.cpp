@@ -0,0 +1,38 @@
+#include <Arduino.h>
+#include <M16-lease.h>
+
+// Simulates nodes without an id joining a server, with every block taking a block
+// time to arrive. Requests that overlap at the server are lost, as are requests
+// that arrive after the server has closed the window. Each row averages 50 runs.
+
+uint8_t slotCounts[] = {4, 8};
+uint8_t nodeCounts[] = {1, 2, 4, 8};
+
+void setup()
+{
+    Serial.begin(115200);
+    Serial.println("Slots\tNodes\tWindows\tRequests\tCollided\tLate\tJoin s");
+    for (uint8_t slots : slotCounts)
+    {
+        for (uint8_t nodes : nodeCounts)
+        {
+            float windows = 0, requests = 0, collisions = 0, late = 0, joinMs = 0;
+            for (uint32_t run = 1; run <= 50; run++)
+            {
+                LeaseSimulation simulation(run);
+                LeaseResult result = simulation.run(nodes, slots, 100);
+                windows += result.windows;
+                requests += result.requests;
+                collisions += result.collisions;
+                late += result.late;
+                joinMs += result.meanJoinMs;
+            }
+            Serial.printf("%u\t%u\t%.2f\t%.2f\t\t%.2f\t\t%.2f\t%.0f\n", slots, nodes, windows / 50, requests / 50,
+                          collisions / 50, late / 50, joinMs / 50 / 1000);
+        }
+    }
+}
+
+void loop()
+{
+}
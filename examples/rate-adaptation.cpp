@@ -0,0 +1,45 @@
+#include <Arduino.h>
+#include <M16-adapt.h>
+
+// Compares rate adaptation with fixed settings on a simulated channel whose bit
+// error rate swings between 1e-4 and 3e-2 every six hours, over one week.
+// Messages not delivered within M16_ADAPT_DEADLINE_MS count as lost, so the fixed
+// settings that keep long messages through the bad hours miss the loss target.
+
+TransmitPlan fixedPlans[] = {
+    {8, 0, M16_ADAPT_MAX_RETRIES, 0.0f},
+    {32, 0, M16_ADAPT_MAX_RETRIES, 0.0f},
+    {16, 2, M16_ADAPT_MAX_RETRIES, 0.0f},
+    {32, 3, M16_ADAPT_MAX_RETRIES, 0.0f},
+};
+
+const unsigned long duration = 7UL * 24 * 3600 * 1000;
+const unsigned long period = 6UL * 3600 * 1000;
+
+void setup()
+{
+    Serial.begin(115200);
+
+    Serial.println("Plans chosen by block error rate:");
+    for (float blockErrorRate = 0.0f; blockErrorRate < 0.45f; blockErrorRate += 0.1f)
+    {
+        TransmitPlan plan = RateAdapter::choose(blockErrorRate);
+        Serial.printf("BLER %.1f: %u bytes, redundancy %u, %u retries, %.2f bit/s\n", blockErrorRate, plan.batch,
+                      plan.redundancy, plan.retries, plan.goodput);
+    }
+
+    Serial.println("Settings\tGoodput bit/s\tMessage loss");
+    AdaptSimulation adaptive;
+    AdaptResult result = adaptive.run(nullptr, duration, period);
+    Serial.printf("adaptive\t%.3f\t\t%.4f\n", result.goodput, result.messageLoss);
+    for (const TransmitPlan &plan : fixedPlans)
+    {
+        AdaptSimulation simulation;
+        result = simulation.run(&plan, duration, period);
+        Serial.printf("%u bytes/%u\t%.3f\t\t%.4f\n", plan.batch, plan.redundancy, result.goodput, result.messageLoss);
+    }
+}
+
+void loop()
+{
+}
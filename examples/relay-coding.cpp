@@ -0,0 +1,38 @@
+#include <Arduino.h>
+#include <M16-netcode.h>
+
+// Compares relay chains that only forward packets with chains that combine
+// packets travelling in opposite directions into one coded block, first on
+// clean links and then with 5% of relay blocks missed by each neighbour.
+// Each chain is simulated for 10000 block times.
+
+void setup()
+{
+    Serial.begin(115200);
+
+    Serial.println("Relays\tForward pkt/block\tCoded pkt/block\tGain\tCorrupted");
+    for (uint8_t relays = 1; relays <= 6; relays++)
+    {
+        NetworkCodingSimulation simulation;
+        ChainResult plain = simulation.run(relays, false, 10000);
+        ChainResult coded = simulation.run(relays, true, 10000);
+        Serial.printf("%u\t%.3f\t\t\t%.3f\t\t\t%.2f\t%u\n", relays, plain.throughput, coded.throughput,
+                      coded.throughput / plain.throughput, plain.corrupted + coded.corrupted);
+    }
+
+    Serial.println();
+    Serial.println("5% of relay blocks missed");
+    Serial.println("Relays\tForward pkt/block\tCoded pkt/block\tGain\tLost\tCorrupted");
+    for (uint8_t relays = 1; relays <= 6; relays++)
+    {
+        NetworkCodingSimulation forwarding, coding;
+        ChainResult plain = forwarding.run(relays, false, 10000, 0.05f);
+        ChainResult coded = coding.run(relays, true, 10000, 0.05f);
+        Serial.printf("%u\t%.3f\t\t\t%.3f\t\t\t%.2f\t%u\t%u\n", relays, plain.throughput, coded.throughput,
+                      coded.throughput / plain.throughput, coded.lost, plain.corrupted + coded.corrupted);
+    }
+}
+
+void loop()
+{
+}
@@ -0,0 +1,80 @@
+#include <Arduino.h>
+#include <Wire.h>
+#include <M16-lib.h>
+#include <M16-flow.h>
+#include <M16-sensor.h>
+
+#define RX_GPIO 32
+#define TX_GPIO 33
+#define TEMP_GPIO 34
+#define NODE_ID 0x03
+#define PRESSURE_ADDRESS 0x76
+
+// Samples a temperature sensor on the ADC and a pressure sensor on I2C in the
+// background, and sends the samples to the server as credit allows.
+// loop() never waits for a sensor. Every sample goes in the data field of one
+// packet, so both sensors are scaled to M16_DATA_BITS bits.
+
+M16 m16(UART_NUM_2);
+FlowSender sender(NODE_ID);
+SensorPipeline sensors;
+
+uint16_t temperature(int32_t milliVolts)
+{
+    // 10 mV per degree and 500 mV at 0 degrees, sent in half degrees from -20 degrees.
+    int32_t halfDegrees = (milliVolts - 300) / 5;
+    return constrain(halfDegrees, 0, (int32_t)PacketLayout::dataMask);
+}
+
+bool pressure(uint16_t &data, void *context)
+{
+    Wire.beginTransmission(PRESSURE_ADDRESS);
+    Wire.write(0xf7);
+    if (Wire.endTransmission(false) != 0 || Wire.requestFrom(PRESSURE_ADDRESS, 1) != 1)
+    {
+        return false;
+    }
+    data = Wire.read() >> (8 - M16_DATA_BITS); // The most significant bits of the raw reading.
+    return true;
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    Wire.begin();
+    m16.begin(RX_GPIO, TX_GPIO);
+    sensors.addAnalog(TEMP_SENSOR, TEMP_GPIO, temperature, 10000);
+    sensors.addBus(PRESSURE_SENSOR, pressure, nullptr, 30000);
+    if (!sensors.begin())
+    {
+        Serial.println("Could not start the sensor pipeline.");
+    }
+}
+
+void loop()
+{
+    unsigned long now = millis();
+    sensors.drain(sender, now);
+
+    if (m16.getRxBuffLength() >= 2)
+    {
+        uint8_t data[2];
+        m16.readRxBuff(data, 2);
+        sender.grantReceived(m16.decode(data), now);
+    }
+
+    ProtocolStructure packet;
+    if (sender.nextPacket(packet, now))
+    {
+        m16.sendPacket(packet);
+    }
+
+    static unsigned long lastPrint = 0;
+    if (now - lastPrint > 60000)
+    {
+        lastPrint = now;
+        Serial.printf("ring peak %u, overflows %u, stale %u, oversized %u, failed reads %u\n", sensors.getQueuePeak(),
+                      sensors.getOverflows(), sensors.getStale(), sensors.getOversized(), sensors.getFailures());
+    }
+    vTaskDelay(pdMS_TO_TICKS(10));
+}
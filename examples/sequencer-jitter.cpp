@@ -0,0 +1,36 @@
+#include <Arduino.h>
+#include <M16-lib.h>
+#include <M16-sequencer.h>
+
+#define RX_GPIO 32
+#define TX_GPIO 33
+
+M16 m16(UART_NUM_2);
+Sequencer sequencer(M16::sequencerSink, &m16);
+
+void setup()
+{
+    Serial.begin(115200);
+    m16.begin(RX_GPIO, TX_GPIO);
+
+    // Toggle the operation mode twice so the modem ends up where it started.
+    for (int i = 0; i < 2; i++)
+    {
+        m16.switchOperationMode(sequencer);
+        while (sequencer.busy())
+        {
+            // The loop is free to do other work while the command is emitted.
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+    }
+
+    JitterStats jitter = sequencer.getJitter();
+    Serial.println("Bytes emitted: " + String(jitter.samples));
+    Serial.println("Min lateness: " + String(jitter.minLateUs) + " us");
+    Serial.println("Max lateness: " + String(jitter.maxLateUs) + " us");
+    Serial.println("Mean lateness: " + String((long)(jitter.totalLateUs / jitter.samples)) + " us");
+}
+
+void loop()
+{
+}
@@ -0,0 +1,110 @@
+/**
+ * @file M16-adapt.h
+ * @brief Rate adaptation of multi-block messages from the link quality.
+ *
+ * For each destination, a LinkEstimator tracks the probability that a transport
+ * block is lost. It learns from the modem reports and from the feedback of the
+ * hybrid ARQ receiver. The RateAdapter then picks the message length, the first
+ * round redundancy level and the retry budget with the highest expected goodput
+ * for that loss probability, much like rate control picks a modulation on Wi-Fi.
+ * A message that is not delivered within `M16_ADAPT_DEADLINE_MS` is worthless, so
+ * longer messages get fewer rounds, and on poor links shorter messages win.
+ *
+ * A report describes the last block the local modem received, so it is attributed
+ * to the node that block came from. The acoustic channel is assumed to be about as
+ * good in both directions.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_ADAPT_H
+#define M16_ADAPT_H
+
+#include "M16-harq.h"
+
+#ifndef M16_ADAPT_BER_SCALE
+#define M16_ADAPT_BER_SCALE 1000.0f // Report.bitErrorRate counts wrong bits per this many bits.
+#endif
+#define M16_ADAPT_SMOOTHING 0.25f	// Weight of a new sample in the loss estimate.
+#define M16_ADAPT_SNR_STEP 6		// Change in signal minus noise power that restarts the estimate.
+#define M16_ADAPT_REPLAN 0.2f		// Relative change in the estimate that triggers a new plan.
+#define M16_ADAPT_MAX_RETRIES 15	// Largest retry budget, in rounds after the first.
+#define M16_ADAPT_TARGET_LOSS 0.01f // Message loss the retry budget aims for.
+#define M16_ADAPT_MARGIN 2.0f		// Factor on the loss estimate when sizing the retry budget.
+#define M16_ADAPT_LOSS_FLOOR 0.02f	// Added to the loss estimate when sizing the retry budget.
+#define M16_ADAPT_BATCHES 4			// Message lengths considered, see RateAdapter::choose().
+#define M16_ADAPT_DEADLINE_MS 300000UL // Messages not delivered within this time are dropped.
+
+/**
+ * @brief How to send messages to one destination.
+ */
+struct TransmitPlan
+{
+	uint8_t batch;		///< Bytes per message.
+	uint8_t redundancy; ///< Redundancy level of the first round, see harqRedundancy().
+	uint8_t retries;	///< Rounds after the first before the message is dropped, passed to `HarqSender::begin()`.
+	float goodput;		///< Expected payload bits per second.
+};
+
+class LinkEstimator
+{
+private:
+	float blockErrorRate;
+	bool valid;
+	bool restart; // The next sample replaces the estimate.
+	int16_t snr;
+	bool haveSnr;
+	void sample(float blockErrorRate);
+
+public:
+	LinkEstimator();
+	void reportReceived(const Report &report);
+	void blocksObserved(uint8_t sent, uint8_t lost);
+	float getBlockErrorRate();
+	bool isValid();
+};
+
+class RateAdapter
+{
+private:
+	LinkEstimator links[M16_MAX_NODES];
+	TransmitPlan plans[M16_MAX_NODES];
+	float plannedFor[M16_MAX_NODES]; // Loss estimate each plan was made for, negative if none.
+
+public:
+	RateAdapter();
+	LinkEstimator &link(uint8_t id);
+	TransmitPlan plan(uint8_t id);
+	static TransmitPlan choose(float blockErrorRate);
+	static uint8_t deadlineRetries(uint8_t batch, uint8_t redundancy);
+	static float expectedGoodput(float blockErrorRate, uint8_t batch, uint8_t redundancy, uint8_t retries,
+								 float *delivery = nullptr);
+};
+
+/**
+ * @brief Result of sending messages over a simulated time-varying channel.
+ */
+struct AdaptResult
+{
+	float goodput;		  ///< Delivered payload bits per second.
+	float messageLoss;	  ///< Fraction of messages dropped after the retry budget or the deadline.
+	float meanBatch;	  ///< Average bytes per message.
+	float meanRedundancy; ///< Average redundancy level.
+};
+
+class AdaptSimulation
+{
+private:
+	uint32_t seed;
+	uint32_t next();
+	float random();
+
+public:
+	AdaptSimulation(uint32_t seed = 1);
+	static float bitErrorRate(unsigned long now, unsigned long periodMs);
+	AdaptResult run(const TransmitPlan *fixed, unsigned long durationMs, unsigned long periodMs);
+};
+
+#endif // M16_ADAPT_H
@@ -0,0 +1,122 @@
+/**
+ * @file M16-arrow.h
+ * @brief Export of decoded traffic as Apache Arrow record batches on a shore host.
+ *
+ * ArrowTrafficWriter decodes packets and report frames straight into Arrow column
+ * builders and writes a record batch every `batchRows` rows. Packets and reports go
+ * to separate files since each IPC stream holds a single schema. Written in the IPC
+ * file format, the output can be memory-mapped and queried by pyarrow, DuckDB or
+ * Polars without a parsing step. The stream format suits piping to another process.
+ *
+ * If a record batch cannot be written, the file of that table is closed and later
+ * rows for it are refused until `open()` is called again, see `getError()`.
+ *
+ * The writer is only compiled on hosts where the Arrow C++ headers are found, which
+ * sets `M16_HAVE_ARROW`. Link with `-larrow` and build with the C++ standard the
+ * installed Arrow release requires, C++20 for recent releases.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_ARROW_H
+#define M16_ARROW_H
+
+#include "M16-protocol.h"
+
+#if !defined(ESP_PLATFORM) && defined(__has_include)
+#if __has_include(<arrow/api.h>)
+#define M16_HAVE_ARROW 1
+#endif
+#endif
+
+#define M16_ARROW_BATCH_ROWS 4096 // Rows buffered before a record batch is written.
+
+/**
+ * @brief Arrow IPC formats the writer can produce.
+ */
+enum ArrowFormat : uint8_t
+{
+	ARROW_STREAM, ///< Sequential stream, read from start to end.
+	ARROW_FILE	  ///< Random access file with a footer, can be memory-mapped.
+};
+
+#if defined(M16_HAVE_ARROW)
+#include <memory>
+#include <string>
+#include <arrow/api.h>
+#include <arrow/io/api.h>
+#include <arrow/ipc/api.h>
+
+class ArrowTrafficWriter
+{
+private:
+	/**
+	 * @brief One output file and the schema of its record batches.
+	 */
+	struct Output
+	{
+		std::shared_ptr<arrow::Schema> schema;
+		std::shared_ptr<arrow::io::FileOutputStream> sink;
+		std::shared_ptr<arrow::ipc::RecordBatchWriter> writer;
+		int64_t rows;
+	};
+
+	int64_t batchRows;
+	std::string error;
+	Output packets;
+	Output reports;
+
+	arrow::TimestampBuilder packetTime;
+	arrow::UInt8Builder packetModem;
+	arrow::UInt16Builder packetRaw;
+	arrow::UInt8Builder packetId;
+	arrow::UInt8Builder packetCommand;
+	arrow::UInt16Builder packetData;
+
+	arrow::TimestampBuilder reportTime;
+	arrow::UInt8Builder reportModem;
+	arrow::UInt16Builder reportTransportBlock;
+	arrow::UInt8Builder reportBitErrorRate;
+	arrow::UInt8Builder reportSignalPower;
+	arrow::UInt8Builder reportNoisePower;
+	arrow::UInt16Builder reportPacketValid;
+	arrow::UInt8Builder reportPacketInvalid;
+	arrow::UInt8Builder reportFirmwareVersion;
+	arrow::UInt32Builder reportTimeSinceBoot;
+	arrow::UInt16Builder reportChipId;
+	arrow::UInt8Builder reportHwRev;
+	arrow::UInt8Builder reportChannel;
+	arrow::BooleanBuilder reportTbValid;
+	arrow::BooleanBuilder reportTxComplete;
+	arrow::BooleanBuilder reportDiagnostic;
+	arrow::UInt8Builder reportPowerLevel;
+
+	bool check(const arrow::Status &status);
+	bool openOutput(Output &output, const char *path, ArrowFormat format);
+	bool reservePackets();
+	bool reserveReports();
+	bool writePackets();
+	bool writeReports();
+	bool closeOutput(Output &output);
+	void abandon(Output &output);
+
+public:
+	ArrowTrafficWriter(int64_t batchRows = M16_ARROW_BATCH_ROWS);
+	~ArrowTrafficWriter();
+	ArrowTrafficWriter(const ArrowTrafficWriter &) = delete;
+	ArrowTrafficWriter &operator=(const ArrowTrafficWriter &) = delete;
+
+	bool open(const char *packetPath, const char *reportPath, ArrowFormat format = ARROW_FILE);
+	bool packet(uint16_t raw, int64_t timeMs, uint8_t modem = 0);
+	bool packet(const uint8_t *bytes, int64_t timeMs, uint8_t modem = 0);
+	bool report(const Report &report, int64_t timeMs, uint8_t modem = 0);
+	bool reportFrame(const uint8_t *bytes, int64_t timeMs, uint8_t modem = 0);
+	bool flush();
+	bool close();
+	const std::string &getError();
+};
+#endif
+
+#endif // M16_ARROW_H
@@ -0,0 +1,94 @@
+/**
+ * @file M16-clock.h
+ * @brief Clock drift estimation from the blocks of the server.
+ *
+ * The server sends its blocks on a schedule both sides know, for example a poll at
+ * the start of every cycle. Each time a node receives one, ClockEstimator pairs the
+ * local time of reception with the scheduled server time and fits the offset between
+ * the clocks as a straight line in local time, which gives both the offset and the
+ * skew. Older pairs are forgotten exponentially, so the fit follows a skew that
+ * changes with temperature over a long deployment.
+ *
+ * The node then plans its own slots in server time with `toLocal()`, and sizes its
+ * guard intervals with `guardMs()` from how well the line has predicted recent
+ * blocks, instead of from the worst case drift of an uncorrected clock. The
+ * propagation delay and the receive latency of the modem are part of the fitted
+ * offset.
+ *
+ * The line is kept relative to the latest pair, so neither the wrap of `millis()`
+ * nor months of elapsed time cost precision.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_CLOCK_H
+#define M16_CLOCK_H
+
+#include "M16-protocol.h"
+
+#define M16_CLOCK_FORGETTING 0.98		 // Weight an old pair keeps for each new pair.
+#define M16_CLOCK_MIN_SAMPLES 4			 // Pairs before the fit is used and outliers are rejected.
+#define M16_CLOCK_OUTLIER_SIGMAS 5.0	 // Prediction errors above this many deviations are rejected.
+#define M16_CLOCK_OUTLIER_FLOOR_MS 50.0	 // Prediction errors below this are never rejected.
+#define M16_CLOCK_MAX_OUTLIERS 3		 // Rejected pairs in a row that restart the fit.
+#define M16_CLOCK_GUARD_SIGMAS 4.0		 // Deviations of prediction error a guard interval covers.
+#define M16_CLOCK_MIN_GUARD_MS 20		 // Shortest guard interval returned.
+#define M16_CLOCK_DEFAULT_GUARD_MS 2000	 // Guard interval before the fit is used.
+
+class ClockEstimator
+{
+private:
+	unsigned long last; // Local time of the latest pair, all x below are relative to it.
+	double weight;		// Weighted sums over pairs of x, local time, and y, server minus local time.
+	double sumX;
+	double sumY;
+	double sumXX;
+	double sumXY;
+	double variance; // Average squared prediction error.
+	uint32_t samples;
+	uint8_t outliers; // Rejected pairs in a row.
+	uint32_t rejected;
+	double offset(double x);
+
+public:
+	ClockEstimator();
+	bool blockReceived(unsigned long local, unsigned long scheduled);
+	bool isValid();
+	unsigned long toServer(unsigned long local);
+	unsigned long toLocal(unsigned long server, unsigned long now);
+	double getSkewPpm();
+	double getDeviationMs();
+	unsigned long guardMs(unsigned long now);
+	uint32_t getRejected();
+	void reset();
+};
+
+/**
+ * @brief Result of simulating a drifting node clock.
+ */
+struct ClockResult
+{
+	float maxErrorMs;			///< Largest error of the corrected prediction of a server block, after the warm-up.
+	float maxWarmupErrorMs;		///< Largest error while the first pairs still dominate the fit.
+	float maxUncorrectedMs;		///< Largest error when only the first offset is used.
+	float meanGuardMs;			///< Average guard interval from `guardMs()`.
+	float coverage;				///< Fraction of blocks that arrived within the guard interval.
+	uint32_t rejected;			///< Pairs rejected as outliers.
+};
+
+class ClockSimulation
+{
+private:
+	uint32_t seed;
+	uint32_t next();
+	float random();
+
+public:
+	ClockSimulation(uint32_t seed = 1);
+	ClockResult run(float skewPpm, float wanderPpm, float jitterMs, float outlierRate, unsigned long periodMs,
+					uint32_t blocks);
+};
+
+#endif // M16_CLOCK_H
@@ -0,0 +1,158 @@
+/**
+ * @file M16-coalesce.h
+ * @brief Coalescing of small sends into shared multi-block messages.
+ *
+ * A Coalescer holds the values an application sends to a destination for a short
+ * time, like Nagle's algorithm on TCP. When it flushes, it groups the values by
+ * command and packs each group behind one byte holding the command and the count,
+ * with every value taking only the bits its command needs. The packed message goes
+ * out through a HarqSender. If sending the values as single packets takes fewer
+ * blocks, which is usual for a few values of `M16_DATA_BITS`, the batch is returned
+ * as packets instead, each carrying one value in its data field. A batch holding a
+ * value wider than the data field always goes as a message: split over packets of
+ * the same command, the parts of consecutive values could not be told apart once
+ * one of them is lost.
+ *
+ * Every block of a message still carries the id and command fields, so coalescing
+ * saves airtime only by dropping the command of each value and by packing values
+ * narrower or wider than the data field, such as status flags or 12-bit readings.
+ *
+ * A destination is flushed when its values fill a message, when the oldest has
+ * waited the hold time, or right away when a value is sent as urgent. Both ends
+ * must use the same bit width for each command, see `setWidth()`.
+ *
+ * The hold time must cover the span of a burst. A shorter hold splits the burst into
+ * several small batches, and each message repeats its header, so it can cost more
+ * blocks than sending every value on its own. The default covers bursts of up to 20
+ * values 5 ms apart.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_COALESCE_H
+#define M16_COALESCE_H
+
+#include "M16-protocol.h"
+#include "M16-harq.h"
+
+#define M16_COALESCE_TYPE 0xb1		  // Type byte of a coalesced message.
+#define M16_COALESCE_HOLD_MS 100	  // Default time a value may wait for others.
+#define M16_COALESCE_DESTINATIONS 4	  // Destinations with values held at the same time.
+#define M16_COALESCE_MAX_VALUES 32	  // Values held for one destination.
+#define M16_COALESCE_RUN_LENGTH 16	  // Values behind one command byte.
+#define M16_COALESCE_SIMULATED_SOURCES 8 // Sources the simulation supports.
+
+/**
+ * @brief A value sent through the coalescer.
+ */
+struct CoalescedValue
+{
+	Command command;
+	uint16_t value;
+};
+
+/**
+ * @brief Values flushed for one destination, either as packets or as one message.
+ */
+struct CoalescedBatch
+{
+	uint8_t id;								   ///< The destination.
+	bool message;							   ///< Whether to send `data` as a message instead of `packets`.
+	uint8_t count;							   ///< Number of packets.
+	ProtocolStructure packets[M16_COALESCE_MAX_VALUES]; ///< Single packets, when `message` is false.
+	uint8_t length;							   ///< Bytes in `data`.
+	uint8_t data[M16_HARQ_MAX_LENGTH];		   ///< The message, when `message` is true.
+};
+
+/**
+ * @brief Values sent and blocks used by a coalescer.
+ */
+struct CoalesceStats
+{
+	uint32_t values;		///< Values passed to `send()`.
+	uint32_t plainBlocks;	///< Blocks the values would take as single packets.
+	uint32_t blocks;		///< Blocks of the first round of every batch.
+	uint32_t messages;		///< Batches sent as messages.
+	uint32_t packets;		///< Single packets.
+	uint32_t sizeFlushes;	///< Flushes because a message was full.
+	uint32_t deadlineFlushes; ///< Flushes because the hold time ran out.
+	uint32_t urgentFlushes; ///< Flushes because of an urgent value.
+	uint32_t rejected;		///< Values refused because their destination was full or no slot was free.
+};
+
+class Coalescer
+{
+private:
+	struct Destination
+	{
+		bool used;
+		bool urgent;
+		bool full; // Another value might not fit in the message.
+		uint8_t id;
+		uint8_t count;
+		unsigned long oldest;
+		CoalescedValue values[M16_COALESCE_MAX_VALUES];
+	};
+	Destination destinations[M16_COALESCE_DESTINATIONS];
+	uint8_t widths[COMMAND_COUNT];
+	unsigned long holdMs;
+	uint8_t level;
+	CoalesceStats stats;
+	uint16_t packedBits(const CoalescedValue *values, uint8_t count, const CoalescedValue *extra);
+	uint16_t plainBlocks(const CoalescedValue *values, uint8_t count);
+	uint8_t parts(Command command);
+	uint16_t messageBlocks(uint16_t bits);
+	void flush(Destination &destination, CoalescedBatch &batch);
+
+public:
+	Coalescer(unsigned long holdMs = M16_COALESCE_HOLD_MS, uint8_t level = 0);
+	bool setWidth(Command command, uint8_t bits);
+	uint8_t getWidth(Command command);
+	bool send(uint8_t id, Command command, uint16_t value, unsigned long now, bool urgent = false);
+	bool poll(CoalescedBatch &batch, unsigned long now);
+	bool flushAll(CoalescedBatch &batch);
+	uint8_t unpack(const uint8_t *buffer, uint8_t length, CoalescedValue *values, uint8_t maxValues);
+	const CoalesceStats &getStats();
+};
+
+/**
+ * @brief A stream of values in the simulation.
+ */
+struct CoalesceSource
+{
+	Command command;	///< Command of the values.
+	uint8_t width;		///< Bits of each value.
+	uint32_t offsetMs;	///< Time of the first burst.
+	uint32_t periodMs;	///< Time between bursts.
+	uint8_t burst;		///< Values in each burst, sent a few milliseconds apart.
+	float urgentRate;	///< Fraction of values sent as urgent.
+};
+
+/**
+ * @brief Result of a coalescing simulation.
+ */
+struct CoalesceResult
+{
+	uint32_t values;		   ///< Values sent.
+	uint32_t plainBlocks;	   ///< Blocks used without coalescing.
+	uint32_t blocks;		   ///< Blocks used with coalescing, first round only.
+	float plainOverhead;	   ///< Fraction of the bits sent that are not values, without coalescing.
+	float overhead;			   ///< Fraction of the bits sent that are not values, with coalescing.
+	float meanDelayMs;		   ///< Average time a value was held.
+};
+
+class CoalesceSimulation
+{
+private:
+	uint32_t seed;
+	uint32_t next();
+	float random();
+
+public:
+	CoalesceSimulation(uint32_t seed = 1);
+	CoalesceResult run(const CoalesceSource *sources, uint8_t count, unsigned long holdMs, unsigned long durationMs);
+};
+
+#endif // M16_COALESCE_H
@@ -0,0 +1,142 @@
+/**
+ * @file M16-discovery.h
+ * @brief Discovery of the nodes in acoustic range with a Q-ary splitting tree.
+ *
+ * Instead of polling every id in turn, the server sends a DISCOVER query for a
+ * prefix of the id, followed by a number of reply slots. Every node whose id starts
+ * with the prefix replies in the slot given by the next bits of its id. A slot with
+ * a clean reply finds that node, a silent slot rules out all its ids at once, and
+ * only a slot where replies collided is queried again with a longer prefix. The
+ * number of slots follows the expected number of nodes, so a sparse deployment is
+ * swept in a few block times and a full one in about as many slots as ids.
+ *
+ * A query carries the prefix in the id field, aligned to the most significant bit,
+ * and in its data the prefix length in bits 0-2, the number of slot bits in bits 3-5
+ * and `M16_DISCOVERY_QUERY_FLAG`. A reply carries the id of the node and the signal
+ * quality it measured on the query.
+ *
+ * A node counts its slots from when the query has arrived, and its reply needs
+ * another block time to reach the server. The slots of the server therefore start
+ * `M16_ROUND_TRIP_MS` after it sent the query, see `DiscoverySweep::slotEndMs()`,
+ * and each query costs one block time more than its slots and itself.
+ *
+ * All classes only depend on the protocol definitions and take the current time
+ * as a parameter.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_DISCOVERY_H
+#define M16_DISCOVERY_H
+
+#include "M16-protocol.h"
+
+#define M16_DISCOVERY_EXPECTED 4		   // Nodes expected before the first sweep.
+#define M16_DISCOVERY_COLLISION_NODES 2.39f // Expected nodes behind a collided slot.
+#define M16_DISCOVERY_PING_BLOCKS 2		   // Block times to poll one id with HI and wait for the reply.
+#define M16_DISCOVERY_QUERY_FLAG 0x80	   // Set in the data of a query, clear in a reply.
+#define M16_DISCOVERY_MARGIN_MASK 0x7f	   // Largest signal quality a reply can carry.
+
+static_assert(M16_ID_BITS < 8 && M16_DATA_BITS >= 6, "The prefix and slot lengths must fit in a query.");
+
+/**
+ * @brief What the server heard in a reply slot.
+ */
+enum DiscoveryOutcome : uint8_t
+{
+	SLOT_IDLE,	   ///< Nothing was received.
+	SLOT_SUCCESS,  ///< One node replied.
+	SLOT_COLLISION ///< Several nodes replied at once.
+};
+
+/**
+ * @brief What is known about a node after a sweep.
+ */
+struct DiscoveredNode
+{
+	bool present;			///< The node replied during the last sweep.
+	uint8_t signalPower;	///< Signal power of the reply, from the server modem report.
+	uint8_t noisePower;		///< Noise power during the reply, from the server modem report.
+	uint8_t bitErrorRate;	///< Bit error rate of the reply, from the server modem report.
+	uint8_t downlinkMargin; ///< Signal minus noise power the node measured on the query.
+	unsigned long seen;		///< Time of the reply.
+};
+
+class DiscoverySweep
+{
+private:
+	struct Query
+	{
+		uint8_t prefix;	  // Prefix value in the low bits.
+		uint8_t bits;	  // Prefix length.
+		uint8_t slotBits; // Reply slots are 2^slotBits.
+	};
+	Query pending[M16_MAX_NODES];
+	uint8_t pendingCount;
+	Query current;
+	bool active;
+	DiscoveredNode nodes[M16_MAX_NODES];
+	float expected;
+	uint8_t foundCount;
+	uint32_t blocks;
+	uint32_t collisions;
+	static uint8_t slotBitsFor(float nodes, uint8_t freeBits);
+	uint8_t slotId(uint8_t slot);
+
+public:
+	DiscoverySweep(float expected = M16_DISCOVERY_EXPECTED);
+	void begin();
+	bool nextQuery(ProtocolStructure &packet);
+	uint8_t slots();
+	static unsigned long slotEndMs(uint8_t slot);
+	DiscoveryOutcome slotEnded(uint8_t slot, const ProtocolStructure *packet, bool energy, const Report *report,
+							   unsigned long now);
+	bool done();
+	bool isPresent(uint8_t id);
+	const DiscoveredNode &getNode(uint8_t id);
+	uint8_t found();
+	uint32_t getBlocks();
+	uint32_t getCollisions();
+};
+
+class DiscoveryResponder
+{
+private:
+	uint8_t id;
+	bool pending;
+	unsigned long sendAt;
+	uint8_t margin;
+
+public:
+	DiscoveryResponder(uint8_t id = 0);
+	void setId(uint8_t id);
+	bool packetReceived(ProtocolStructure packet, unsigned long now, uint8_t margin = 0);
+	bool nextPacket(ProtocolStructure &packet, unsigned long now);
+};
+
+/**
+ * @brief Cost and completeness of discovering a population of nodes.
+ */
+struct DiscoveryResult
+{
+	float sweepBlocks; ///< Mean block times of a sweep.
+	float pingBlocks;  ///< Block times of polling every id in turn.
+	float sweepFound;  ///< Fraction of the nodes found by a sweep.
+	float pingFound;   ///< Fraction of the nodes found by polling.
+};
+
+class DiscoverySimulation
+{
+private:
+	uint32_t seed;
+	float random();
+
+public:
+	DiscoverySimulation(uint32_t seed = 1);
+	DiscoveryResult run(uint8_t population, uint16_t trials, float blockErrorRate = 0.0f, float capture = 0.0f,
+						float expected = M16_DISCOVERY_EXPECTED);
+};
+
+#endif // M16_DISCOVERY_H
@@ -0,0 +1,117 @@
+/**
+ * @file M16-energy.h
+ * @brief Airtime and energy accounting of the blocks a modem sends.
+ *
+ * An AirtimeLedger is told about every block sent, together with the power level
+ * in use. Attached to an M16 with `M16::attachLedger()` this happens inside
+ * `sendPacket()`. Each block costs `M16_BLOCK_TIME_MS` of airtime, the margin up to
+ * `M16_BLOCK_INTERVAL_MS` as guard time, and the energy of the EnergyModel for its
+ * power level. The cost is added to counters per command and per destination.
+ *
+ * Blocks of a multi-block message are grouped by opening the message for its
+ * destination before the first block and closing it when the message is delivered
+ * or dropped. Every round of the hybrid ARQ sender starts with a MESSAGE_START
+ * block, so the blocks after the first round are counted as retransmissions. When
+ * a message is closed, or a single packet is sent outside a message, a
+ * MessageRecord with its total cost is passed to the completion callback.
+ *
+ * The ledger only depends on the protocol definitions, so the server can keep the
+ * same accounts from the blocks it hears.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_ENERGY_H
+#define M16_ENERGY_H
+
+#include "M16-protocol.h"
+
+#define M16_POWER_LEVELS 4		// Power levels of the modem, 1 to 4.
+#define M16_LEDGER_OPEN 4		// Messages that can be open at the same time.
+
+// Electrical power drawn by the modem in watts, measure these for the actual hardware.
+#ifndef M16_ENERGY_TX_W
+#define M16_ENERGY_TX_W {2.0f, 3.5f, 6.0f, 10.0f} // While transmitting at power level 1 to 4.
+#endif
+#ifndef M16_ENERGY_IDLE_W
+#define M16_ENERGY_IDLE_W 0.3f // While listening, including the guard time.
+#endif
+
+/**
+ * @brief Power drawn by the modem in each state.
+ */
+struct EnergyModel
+{
+	float txWatts[M16_POWER_LEVELS]; ///< While transmitting, indexed by power level - 1.
+	float idleWatts;				 ///< While listening.
+};
+
+/**
+ * @brief Cost of the blocks counted under one command or destination.
+ */
+struct AirtimeCounters
+{
+	uint32_t messages;		 ///< Messages and single packets completed.
+	uint32_t blocks;		 ///< Blocks sent, retransmissions included.
+	uint32_t retransmitted;	 ///< Blocks sent after the first round of a message.
+	uint32_t airtimeMs;		 ///< Time spent transmitting.
+	uint32_t guardMs;		 ///< Time kept silent between blocks.
+	float energyJ;			 ///< Estimated energy in joules.
+};
+
+/**
+ * @brief Cost of one message or single packet, passed to the completion callback.
+ */
+struct MessageRecord
+{
+	uint8_t destination;	///< Id the blocks were sent with.
+	Command command;		///< Command of the first block.
+	uint8_t tag;			///< Value given to `AirtimeLedger::open()`, 0 for single packets.
+	uint8_t powerLevel;		///< Power level of the last block.
+	uint16_t blocks;		///< Blocks sent, retransmissions included.
+	uint16_t retransmitted; ///< Blocks sent after the first round.
+	uint8_t rounds;			///< Rounds of the hybrid ARQ sender.
+	uint32_t airtimeMs;		///< Time spent transmitting.
+	uint32_t guardMs;		///< Time kept silent between blocks.
+	float energyJ;			///< Estimated energy in joules.
+	unsigned long started;	///< Time of the first block in milliseconds.
+	unsigned long finished; ///< Time the message was closed in milliseconds.
+	bool delivered;			///< Whether the message was delivered, always true for single packets.
+};
+
+typedef void (*MessageCallback)(const MessageRecord &record, void *context);
+
+class AirtimeLedger
+{
+private:
+	EnergyModel model;
+	MessageRecord pending[M16_LEDGER_OPEN];
+	bool used[M16_LEDGER_OPEN];
+	AirtimeCounters commands[COMMAND_COUNT];
+	AirtimeCounters destinations[M16_MAX_NODES];
+	AirtimeCounters total;
+	uint32_t refused;
+	MessageCallback callback;
+	void *context;
+	int8_t find(uint8_t destination);
+	static void add(AirtimeCounters &counters, uint32_t blocks, uint32_t retransmitted, float energyJ);
+	void complete(MessageRecord &record);
+
+public:
+	AirtimeLedger();
+	AirtimeLedger(const EnergyModel &model);
+	void onComplete(MessageCallback callback, void *context = nullptr);
+	bool open(uint8_t destination, uint8_t tag, unsigned long now);
+	bool close(uint8_t destination, bool delivered, unsigned long now);
+	void blockSent(const ProtocolStructure &packet, uint8_t powerLevel, unsigned long now);
+	float blockEnergyJ(uint8_t powerLevel);
+	const AirtimeCounters &getCommand(Command command);
+	const AirtimeCounters &getDestination(uint8_t id);
+	const AirtimeCounters &getTotal();
+	uint32_t getRefused();
+	void reset();
+};
+
+#endif // M16_ENERGY_H
@@ -0,0 +1,100 @@
+/**
+ * @file M16-fair.h
+ * @brief Weighted fair airtime scheduling of nodes at the server.
+ *
+ * The scheduler decides which node the server polls next and how many transport
+ * blocks it may send in reply. It uses deficit round robin: each node with a backlog
+ * earns `quantumBlocks` times its weight in blocks per round, and a node with a long
+ * multi-block transfer has to wait for the next round to continue it. This bounds
+ * the time any node waits for the channel, regardless of what the others queue.
+ *
+ * Demand is reported by the application, for example from the backlog a node
+ * announces when it is polled. All airtime is counted in blocks of
+ * `M16_BLOCK_INTERVAL_MS`.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_FAIR_H
+#define M16_FAIR_H
+
+#include "M16-protocol.h"
+
+#define M16_FAIR_QUANTUM_BLOCKS 8  // Blocks a node of weight 1 may send per round.
+#define M16_FAIR_POLL_BLOCKS 1	   // Blocks spent on the poll itself.
+#define M16_FAIR_MAX_TRANSFERS 32  // Transfers the simulation queues per node.
+#define M16_FAIR_SIMULATED_NODES 8 // Nodes the simulation supports.
+
+/**
+ * @brief Airtime statistics kept for each node.
+ */
+struct FairNodeStats
+{
+	uint32_t polls;			 ///< Times the node was granted airtime.
+	uint32_t blocksServed;	 ///< Blocks the node sent.
+	unsigned long maxWaitMs; ///< Longest time the node had a backlog without being polled.
+};
+
+class FairScheduler
+{
+private:
+	struct NodeState
+	{
+		uint8_t weight;
+		uint32_t backlog; // Blocks the node still wants to send.
+		uint32_t deficit; // Blocks the node may send before its quantum is used up.
+		unsigned long waitingSince;
+		FairNodeStats stats;
+	};
+	NodeState nodes[M16_MAX_NODES];
+	uint8_t quantumBlocks;
+	uint16_t current;
+
+public:
+	FairScheduler(uint8_t quantumBlocks = M16_FAIR_QUANTUM_BLOCKS);
+	void setWeight(uint8_t id, uint8_t weight);
+	void demand(uint8_t id, uint32_t blocks, unsigned long now);
+	uint32_t getBacklog(uint8_t id);
+	bool next(uint8_t &id, uint16_t &blocks, unsigned long now);
+	void served(uint8_t id, uint16_t blocks, unsigned long now);
+	unsigned long latencyBoundMs(uint8_t id);
+	const FairNodeStats &getStats(uint8_t id);
+};
+
+/**
+ * @brief Traffic offered by one node in the simulation.
+ */
+struct FairWorkload
+{
+	uint8_t weight;			///< Scheduling weight of the node.
+	float arrivalRate;		///< Probability that a transfer arrives in a block time.
+	uint8_t transferBlocks; ///< Blocks in each transfer.
+};
+
+/**
+ * @brief Result of a scheduling simulation.
+ */
+struct FairResult
+{
+	float utilization;							   ///< Fraction of block times carrying node data.
+	float fairness;								   ///< Jain's index of the weighted slowdown of transfers, see `FairSimulation::run()`.
+	float share[M16_FAIR_SIMULATED_NODES];		   ///< Fraction of the data blocks sent by each node.
+	float meanLatencyMs[M16_FAIR_SIMULATED_NODES]; ///< Mean time from arrival to completion of a transfer.
+	float maxLatencyMs[M16_FAIR_SIMULATED_NODES];  ///< Longest time from arrival to completion of a transfer.
+	uint32_t dropped;							   ///< Transfers dropped because a node queue was full.
+};
+
+class FairSimulation
+{
+private:
+	uint32_t seed;
+	float random();
+
+public:
+	FairSimulation(uint32_t seed = 1);
+	FairResult run(const FairWorkload *workload, uint8_t nodes, bool fair, uint32_t slots);
+};
+
+#endif // M16_FAIR_H
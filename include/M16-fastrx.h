@@ -0,0 +1,89 @@
+/**
+ * @file M16-fastrx.h
+ * @brief Header file for the FastRx class.
+ *
+ * This file contains the declaration of the FastRx class, an optional low latency
+ * receive path that replaces the interrupt handler of the UART driver with an IRAM
+ * resident handler. The handler reads the UART FIFO directly, assembles byte pairs,
+ * filters them by address and pushes the packets to a lock-free queue.
+ *
+ * Transmitting keeps working through the driver while the fast path is attached,
+ * but `readRxBuff()` and `requestReport()` receive nothing until it is detached.
+ * The handler can only be replaced on ESP-IDF 4.x, where `uart_isr_register()` exists.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_FASTRX_H
+#define M16_FASTRX_H
+
+#include <Arduino.h>
+#include "driver/uart.h"
+#include "esp_intr_alloc.h"
+#include "M16-protocol.h"
+
+#define M16_FAST_RX_QUEUE_LENGTH 32		// Packets held by the queue, must be a power of two.
+#define M16_FAST_RX_PAIR_TIMEOUT_US 10000 // Gap after which a lone byte is discarded.
+
+/**
+ * @brief A packet received by the interrupt handler.
+ */
+struct FastRxPacket
+{
+	uint16_t packet;  ///< The two bytes of the block, first byte in the high half.
+	int64_t received; ///< esp_timer time when the second byte was read from the FIFO.
+};
+
+/**
+ * @brief Time from the interrupt until a packet is taken from the queue.
+ */
+struct LatencyStats
+{
+	uint32_t samples;
+	uint32_t minUs;
+	uint32_t maxUs;
+	uint64_t totalUs; ///< Sum of all latencies, divide by `samples` for the mean.
+};
+
+class FastRx
+{
+private:
+	uart_port_t uart_num;
+	intr_handle_t handle;
+	int16_t address;
+	FastRxPacket queue[M16_FAST_RX_QUEUE_LENGTH];
+	volatile uint32_t head;
+	volatile uint32_t tail;
+	uint8_t pendingByte;
+	bool pending;
+	int64_t pendingTime;
+	volatile uint32_t dropped;
+	volatile uint32_t filtered;
+	volatile uint32_t resyncs;
+	volatile uint32_t overflows;
+	volatile uint32_t peak;
+	LatencyStats latency;
+	void receive(uint8_t byte, int64_t now);
+	static void isr(void *receiver);
+
+public:
+	FastRx();
+	void setAddressFilter(uint8_t id);
+	void clearAddressFilter();
+	bool attach(uart_port_t uart_num);
+	void detach();
+	bool attached();
+	bool pop(uint16_t &packet);
+	size_t available();
+	uint32_t getDropped();
+	uint32_t getFiltered();
+	uint32_t getResyncs();
+	uint32_t getOverflows();
+	uint32_t getQueuePeak();
+	LatencyStats getLatency();
+	void resetLatency();
+};
+
+#endif // M16_FASTRX_H
@@ -0,0 +1,103 @@
+/**
+ * @file M16-flow.h
+ * @brief Credit-based flow control between a sender and a receiver.
+ *
+ * The receiver grants credit with CREDIT blocks whose data is the number of packets
+ * it can still buffer. The 16-bit packets have no spare bits to piggyback credit on,
+ * so a grant is only sent once half the window has been freed, or repeated after a
+ * silence in case it was lost. Packets sent shortly before a grant arrives may not be
+ * counted in it yet, so the sender subtracts those from the granted credit. Lost
+ * packets therefore never eat into the window for good.
+ *
+ * The sender queues packets with `trySend()`, which never blocks, and only releases
+ * them while it has credit and the previous block has left the modem. Producers watch
+ * the returned status or the watermark callback and slow down instead of stalling.
+ *
+ * Both classes only depend on the protocol definitions and take the current time
+ * as a parameter. Packets returned by `FlowSender::nextPacket()` and
+ * `FlowReceiver::feedback()` are sent with `M16::sendPacket()`.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_FLOW_H
+#define M16_FLOW_H
+
+#include "M16-protocol.h"
+
+#define M16_FLOW_QUEUE_LENGTH 16						 // Packets the sender holds while waiting for credit.
+#define M16_FLOW_WINDOW 8								 // Default credit, in packets.
+#define M16_FLOW_REGRANT_MS 20000						 // Silence before the receiver repeats its grant.
+#define M16_FLOW_REGRANT_MAX_BACKOFF 8					 // Longest repeat interval, in multiples of M16_FLOW_REGRANT_MS.
+#define M16_FLOW_INFLIGHT_MS (2 * M16_BLOCK_INTERVAL_MS) // Packets sent this long before a grant may be missing from it.
+#define M16_FLOW_SEND_HISTORY 4							 // Send times kept to find packets in flight.
+
+/**
+ * @brief Result of `FlowSender::trySend()`.
+ */
+enum FlowStatus : uint8_t
+{
+	FLOW_ACCEPTED,	   ///< The packet was queued.
+	FLOW_BACKPRESSURE, ///< The packet was queued, but the producer should slow down.
+	FLOW_REJECTED	   ///< The queue is full and the packet was dropped.
+};
+
+typedef void (*FlowWatermarkCallback)(bool paused);
+
+class FlowSender
+{
+private:
+	uint8_t id;
+	ProtocolStructure queue[M16_FLOW_QUEUE_LENGTH];
+	uint8_t head;
+	uint8_t count;
+	uint8_t peak;
+	uint8_t highWater;
+	uint8_t lowWater;
+	bool paused;
+	FlowWatermarkCallback callback;
+	uint8_t credit;
+	unsigned long sendTimes[M16_FLOW_SEND_HISTORY];
+	uint8_t sends; // Packets released, saturating at M16_FLOW_SEND_HISTORY.
+	uint8_t lastSend;
+	uint32_t rejected;
+	void setPaused(bool paused);
+
+public:
+	FlowSender(uint8_t id, uint8_t window = M16_FLOW_WINDOW, uint8_t highWater = 3 * M16_FLOW_QUEUE_LENGTH / 4,
+			   uint8_t lowWater = M16_FLOW_QUEUE_LENGTH / 4);
+	void onWatermark(FlowWatermarkCallback callback);
+	FlowStatus trySend(Command command, uint16_t data);
+	bool nextPacket(ProtocolStructure &packet, unsigned long now);
+	bool grantReceived(ProtocolStructure packet, unsigned long now);
+	uint8_t credits();
+	uint8_t queued();
+	bool isPaused();
+	uint32_t getRejected();
+	uint8_t getQueuePeak();
+};
+
+class FlowReceiver
+{
+private:
+	uint8_t id;
+	uint8_t window;
+	uint8_t held;  // Packets accepted but not consumed yet.
+	uint8_t freed; // Packets consumed since the last grant.
+	unsigned long lastActivity;
+	uint8_t backoff;
+	uint32_t overflows;
+
+public:
+	FlowReceiver(uint8_t id, uint8_t window = M16_FLOW_WINDOW);
+	bool packetReceived(ProtocolStructure packet, unsigned long now);
+	void consumed(uint8_t packets = 1);
+	uint8_t buffered();
+	bool feedbackDue(unsigned long now);
+	ProtocolStructure feedback(unsigned long now);
+	uint32_t getOverflows();
+};
+
+#endif // M16_FLOW_H
@@ -0,0 +1,140 @@
+/**
+ * @file M16-harq.h
+ * @brief Hybrid ARQ with incremental redundancy for multi-block messages.
+ *
+ * A message is sent as a MESSAGE_START block carrying its length, followed by one
+ * MESSAGE_DATA block per byte. On poor links the first round can also carry a few
+ * MESSAGE_PARITY blocks after the data, chosen by a redundancy level in the start
+ * block, so that typical losses are repaired without waiting for feedback. The
+ * receiver answers with MESSAGE_ACK carrying the
+ * number of bytes it is still missing. Instead of repeating the message, the sender
+ * answers a non-zero ACK with a round of that many MESSAGE_PARITY blocks. The parity
+ * bytes come from a systematic Cauchy Reed-Solomon code over GF(256), so any
+ * combination of received data and parity bytes as large as the message recovers it.
+ *
+ * Blocks carry no sequence number; the receiver places them by their arrival time
+ * relative to the start block of the round, since the sender spaces them by
+ * `M16_BLOCK_INTERVAL_MS`. Both classes only depend on the protocol definitions and
+ * take the current time as a parameter, so they can be driven by the modem or by
+ * `HarqSimulation`.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_HARQ_H
+#define M16_HARQ_H
+
+#include "M16-protocol.h"
+
+#define M16_HARQ_MAX_LENGTH 32		  // Longest message in bytes.
+#define M16_HARQ_MAX_PARITY 32		  // Parity bytes kept by the receiver.
+#define M16_HARQ_PARITY_FLAG 0x80	  // Set in MESSAGE_START data when a parity round starts.
+#define M16_HARQ_LENGTH_MASK 0x1f	  // Message length minus one in MESSAGE_START data.
+#define M16_HARQ_REDUNDANCY_SHIFT 5	  // Position of the redundancy level in MESSAGE_START data.
+#define M16_HARQ_REDUNDANCY_LEVELS 4	  // Redundancy levels, see harqRedundancy().
+#define M16_HARQ_FEEDBACK_TIMEOUT_MS 6000 // Wait for MESSAGE_ACK before repeating a round.
+
+static_assert(M16_DATA_BITS >= 8, "Incremental redundancy needs a full byte per block.");
+static_assert(M16_HARQ_MAX_LENGTH <= M16_HARQ_LENGTH_MASK + 1, "The message length must fit in the start block.");
+
+class HarqSender
+{
+private:
+	uint8_t id;
+	uint8_t message[M16_HARQ_MAX_LENGTH];
+	uint8_t length;
+	uint8_t level;		// Redundancy level of the first round.
+	bool incremental;
+	bool finished;
+	bool parityRound;	 // Whether the current round carries parity instead of data.
+	uint8_t nextParity;	 // Index of the next unused parity byte.
+	uint8_t roundParity; // Index of the first parity byte in the current round.
+	uint8_t roundLength; // Data or parity blocks in the current round.
+	uint8_t roundSent;	 // Blocks of the current round already returned, header included.
+	uint8_t rounds;
+	uint8_t retries; // Rounds after the first before the message is dropped.
+	bool dropped;
+	void startRound(uint8_t missing);
+
+public:
+	HarqSender(bool incremental = true);
+	bool begin(uint8_t id, const uint8_t *data, uint8_t length, uint8_t level = 0, uint8_t retries = UINT8_MAX);
+	bool nextBlock(ProtocolStructure &packet);
+	void feedback(ProtocolStructure packet);
+	void timeout();
+	bool complete();
+	bool isDropped();
+	uint8_t getRounds();
+};
+
+class HarqReceiver
+{
+private:
+	enum State : uint8_t
+	{
+		IDLE,
+		RECEIVING,
+		WAITING,
+		DONE
+	};
+	State state;
+	bool combine;
+	uint8_t id;
+	uint8_t length;
+	uint8_t symbols[M16_HARQ_MAX_LENGTH];
+	bool known[M16_HARQ_MAX_LENGTH];
+	uint8_t parityIndex[M16_HARQ_MAX_PARITY];
+	uint8_t parityValue[M16_HARQ_MAX_PARITY];
+	uint8_t parityCount;
+	bool parityRound;
+	uint8_t roundParity;
+	uint8_t roundLength;
+	uint8_t requested;
+	unsigned long roundStart;
+	unsigned long feedbackSent;
+	void addParity(uint8_t index, uint8_t value);
+	bool decode();
+
+public:
+	HarqReceiver(bool combine = true);
+	void reset();
+	bool packetReceived(ProtocolStructure packet, unsigned long now);
+	bool feedbackDue(unsigned long now);
+	ProtocolStructure feedback(unsigned long now);
+	uint8_t missing();
+	bool complete();
+	uint8_t read(uint8_t *data);
+};
+
+uint8_t harqParity(const uint8_t *message, uint8_t length, uint8_t index);
+uint8_t harqRedundancy(uint8_t length, uint8_t level);
+
+/**
+ * @brief Result of comparing hybrid ARQ with plain retransmission.
+ */
+struct GoodputResult
+{
+	float blockErrorRate; ///< Probability that a block is lost.
+	float harqGoodput;	  ///< Delivered payload bits per second with incremental redundancy.
+	float arqGoodput;	  ///< Delivered payload bits per second when repeating the message.
+	float harqRounds;	  ///< Average rounds per message with incremental redundancy.
+	float arqRounds;	  ///< Average rounds per message when repeating the message.
+};
+
+class HarqSimulation
+{
+private:
+	uint32_t seed;
+	uint32_t next();
+	bool lost(float blockErrorRate);
+	float run(float blockErrorRate, uint8_t length, bool incremental, uint16_t trials, float &rounds);
+
+public:
+	HarqSimulation(uint32_t seed = 1);
+	static float blockErrorRate(float bitErrorRate);
+	GoodputResult compare(float bitErrorRate, uint8_t length, uint16_t trials);
+};
+
+#endif // M16_HARQ_H
@@ -0,0 +1,149 @@
+/**
+ * @file M16-lease.h
+ * @brief Dynamic assignment of node ids with leases.
+ *
+ * Instead of flashing an id into every node, a new node asks the server for one.
+ * The server opens a contention window with a JOIN block to `M16_LEASE_JOIN_ID`,
+ * and each node without an id answers in a random slot of the window with a random
+ * nonce. After the window the server offers a free id to every nonce it heard, by
+ * sending the nonce back with the offered id. Nodes whose request collided or whose
+ * offer was lost try again in the next window with a new nonce. Two nodes that drew
+ * the same nonce are told apart by their slots, and neither gets an offer.
+ *
+ * The nodes count their slots from when the window block has arrived, and each
+ * request takes a block time to reach the server, so the server keeps the window
+ * open for `M16_ROUND_TRIP_MS` beyond the slots.
+ *
+ * Any packet the server hears from a node renews its lease, so busy nodes never
+ * spend airtime on it. A node that has not heard from the server for half the lease
+ * sends a JOIN renewal, which the server confirms. The server reclaims the id of a
+ * node it has not heard for `leaseMs`, and keeps it out of use for another `leaseMs`.
+ * A node that has heard nothing addressed to it for `leaseMs` gives up its id first,
+ * so a node that drifted out of range never shares an id with its replacement.
+ *
+ * JOIN data:
+ * | Data          | Id                  | Meaning                                    |
+ * |---------------|---------------------|--------------------------------------------|
+ * | 0x00-0x7f     | `M16_LEASE_JOIN_ID` | Node requests an id, data is its nonce.     |
+ * | 0x00-0x7f     | Offered id          | Server offers the id to the nonce.          |
+ * | 0x81-0xfe     | `M16_LEASE_JOIN_ID` | Server opens a window of `data & 0x7f` slots.|
+ * | 0x80          | Leased id           | Renewal by the node, or its confirmation.   |
+ * | 0xff          | Any id              | Server revokes the id, the node must rejoin.|
+ *
+ * Both classes only depend on the protocol definitions and take the current time
+ * as a parameter.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_LEASE_H
+#define M16_LEASE_H
+
+#include "M16-protocol.h"
+
+#define M16_LEASE_JOIN_ID (M16_MAX_NODES - 1) // Id used by nodes without a lease, never leased itself.
+#define M16_LEASE_MS 600000					  // Silence after which a lease ends.
+#define M16_LEASE_WINDOW_SLOTS 4			  // Default request slots in a contention window.
+#define M16_LEASE_QUEUE_LENGTH 8			  // Offers and confirmations the server holds.
+#define M16_LEASE_NONCE_MASK 0x7f			  // Nonce bits in request and offer data.
+#define M16_LEASE_WINDOW_FLAG 0x80			  // Set in the data of a window, renewal or revocation.
+#define M16_LEASE_RENEW 0x80				  // Data of a renewal.
+#define M16_LEASE_REVOKE 0xff				  // Data of a revocation.
+#define M16_LEASE_SIMULATED_NODES (M16_MAX_NODES - 1) // Nodes the simulation supports.
+
+static_assert(M16_DATA_BITS >= 8, "Join blocks need a full byte of data.");
+
+class LeaseServer
+{
+private:
+	struct Lease
+	{
+		bool leased;
+		bool quarantined;		 // Reclaimed, but not offered again yet.
+		unsigned long lastHeard; // Time the node was last heard, or the id was reclaimed.
+	};
+	Lease leases[M16_MAX_NODES];
+	unsigned long leaseMs;
+	bool windowOpen;
+	unsigned long windowEnd;
+	ProtocolStructure queue[M16_LEASE_QUEUE_LENGTH];
+	unsigned long queued[M16_LEASE_QUEUE_LENGTH]; // Time each entry was queued.
+	uint8_t head;
+	uint8_t count;
+	uint32_t reclaimed;
+	uint32_t conflicts;
+	bool enqueue(ProtocolStructure packet, unsigned long now);
+	void remove(uint8_t index);
+	int allocate(unsigned long now);
+
+public:
+	LeaseServer(unsigned long leaseMs = M16_LEASE_MS);
+	ProtocolStructure openWindow(unsigned long now, uint8_t slots = M16_LEASE_WINDOW_SLOTS);
+	bool windowActive(unsigned long now);
+	bool packetReceived(ProtocolStructure packet, unsigned long now);
+	bool nextPacket(ProtocolStructure &packet, unsigned long now);
+	void expire(unsigned long now);
+	bool isLeased(uint8_t id);
+	uint8_t leased();
+	uint32_t getReclaimed();
+	uint32_t getConflicts();
+};
+
+class LeaseClient
+{
+private:
+	enum State : uint8_t
+	{
+		UNASSIGNED, ///< Waiting for a window.
+		REQUESTING, ///< Waiting for the slot of the request.
+		OFFERED,	///< Request sent, waiting for an offer.
+		ASSIGNED
+	};
+	State state;
+	uint8_t id;
+	uint8_t nonce;
+	unsigned long leaseMs;
+	unsigned long sendAt;	   // Time of the request slot.
+	unsigned long offerUntil;  // Time after which the request is given up.
+	unsigned long lastHeard;   // Last block from the server addressed to this node.
+	unsigned long lastRenewal;
+	unsigned long renewJitter; // Random delay of the next renewal, so nodes do not renew together.
+	unsigned long quietUntil;  // End of the current window, renewals wait for it.
+	uint32_t seed;
+	uint32_t next();
+
+public:
+	LeaseClient(uint32_t seed = 1, unsigned long leaseMs = M16_LEASE_MS);
+	bool packetReceived(ProtocolStructure packet, unsigned long now);
+	bool nextPacket(ProtocolStructure &packet, unsigned long now);
+	bool hasId(unsigned long now);
+	uint8_t getId();
+};
+
+/**
+ * @brief Result of nodes joining over a simulated channel.
+ */
+struct LeaseResult
+{
+	uint8_t joined;		 ///< Nodes holding an id at the end.
+	uint32_t windows;	 ///< Windows opened until every node had an id.
+	uint32_t requests;	 ///< Requests sent by the nodes.
+	uint32_t collisions; ///< Requests lost because they overlapped another request.
+	uint32_t late;		 ///< Requests that arrived after the server closed the window.
+	float meanJoinMs;	 ///< Average time from the start until a node had an id.
+};
+
+class LeaseSimulation
+{
+private:
+	uint32_t seed;
+	uint32_t next();
+
+public:
+	LeaseSimulation(uint32_t seed = 1);
+	LeaseResult run(uint8_t nodes, uint8_t slots, uint32_t maxWindows);
+};
+
+#endif // M16_LEASE_H
@@ -16,76 +16,31 @@
 #include <Arduino.h>
 #include <iostream>
 #include "driver/uart.h"
+#include "M16-protocol.h"
 
-#define M16_BAUD 9600
+class FastRx;
+class Sequencer;
+class AirtimeLedger;
 
-/*
-Client: id(ID) Hei, til server (command) password (data)
-Server: id(client ID) request data (command) no data (data)
-Client: id(client ID) what sensor (command) sensor data (data) X sensor amount
-Client: id(client ID) finished (command) no data (data)
-Server: id(client ID) ok (command) sensor amount (data)
-*/
-
-// Max value is 7
-enum Command : uint8_t
-{
-	HI,
-	REQUEST_DATA,
-	FINISHED,
-	TEMP_SENSOR,
-	PRESSURE_SENSOR,
-	CONDUCTIVITY_SENSOR,
-	PH_SENSOR,
-	SENSOR_DATA_RECEIVED
-};
-
-/**
- * @brief Structure representing the components of the communication protocol.
- *
- * The `ProtocolStructure` contains an ID, a command type, and data. These components
- * are used to encode and decode messages for communication.
- *
- * @author Ole Anders Astad
- * @date March 2025
- */
-struct ProtocolStructure
-{
-	unsigned char id;	///< Identification of the device (only first 3 bits used).
-	Command command;	///< The command type indicating the action to perform.
-	unsigned char data; ///< The actual data being transmitted.
-};
-
-struct Report
-{
-	uint8_t startOfFrame;
-	uint16_t transportBlock;
-	uint8_t bitErrorRate;
-	uint8_t signalPower;
-	uint8_t noisePower;
-	uint16_t packetValid;
-	uint8_t packedInvalid;
-	uint8_t firmwareVersion;
-	uint32_t timeSinceBoot;
-	uint16_t chipID;
-	uint8_t hwRev;
-	uint8_t channel;
-	uint8_t tbValid;
-	uint8_t txComplete;
-	uint8_t diagnostic;
-	uint8_t reserved;
-	uint8_t powerLevel;
-	uint8_t reserved2;
-	uint8_t endOfFrame;
-};
+#define M16_UART_RX_BUFFER_SIZE 1024
+#define M16_UART_EVENT_QUEUE_LENGTH 10
 
 class M16
 {
 private:
 	uart_port_t uart_num;
+	ModemConfig config;
+	OperationMode mode;
+	uint32_t reportLatency;
+	QueueHandle_t uartEvents;
+	size_t rxPeak;
+	uint32_t rxOverflows;
+	AirtimeLedger *ledger;
+	void installDriver();
 	void sendByte(uint8_t byte);
+	bool reportMatches(ModemConfig config);
 	bool sendPacket(unsigned short packet);
-	unsigned short encode(unsigned char id, Command command, unsigned char data);
+	unsigned short encode(unsigned char id, Command command, uint16_t data);
 
 public:
 	unsigned short encode(ProtocolStructure send);
@@ -95,15 +50,34 @@ public:
 	M16(uart_port_t uart_num);
 	void begin(uint8_t rx_pin, uint8_t tx_pin);
 	void switchOperationMode();
+	OperationMode getOperationMode();
+	OperationMode detectOperationMode();
 	void setCommunicationChannel(uint8_t channel);
 	void setPowerLevel(uint8_t powerLevel);
-	bool requestReport();
+	bool switchOperationMode(Sequencer &sequencer);
+	bool setCommunicationChannel(uint8_t channel, Sequencer &sequencer);
+	bool setPowerLevel(uint8_t powerLevel, Sequencer &sequencer);
+	static void sequencerSink(uint8_t byte, void *modem);
+	bool requestReport(uint8_t retries = M16_REPORT_READ_RETRIES);
+	uint32_t getReportLatency();
+	ModemConfig getConfig();
+	bool loadConfig(ModemConfig &config);
+	void saveConfig();
+	bool applyConfig(ModemConfig config);
+	bool restoreConfig();
 	bool sendPacket(ProtocolStructure packet);
-	bool sendPacket(unsigned char id, Command command, unsigned char data);
+	bool sendPacket(unsigned char id, Command command, uint16_t data);
 	size_t getRxBuffLength();
+	size_t getRxBuffPeak();
+	uint32_t getRxOverflows();
+	void resetRxStats();
 	void flushTxBuffer();
 	void refreshBaudRate();
+	bool pollUartEvent(uart_event_t &event);
+	bool enableFastRx(FastRx &receiver);
+	void disableFastRx(FastRx &receiver);
 	int readRxBuff(uint8_t *data, size_t length);
+	void attachLedger(AirtimeLedger *ledger);
 };
 
 template <typename T>
@@ -0,0 +1,68 @@
+/**
+ * @file M16-link.h
+ * @brief Header file for the LinkMonitor class.
+ *
+ * This file contains the declaration of the LinkMonitor class, which tracks the
+ * liveness of the links between the server and its nodes from received traffic and
+ * only spends airtime on keepalives when a node has been silent for too long.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_LINK_H
+#define M16_LINK_H
+
+#include "M16-lib.h"
+
+#define M16_LINK_DOWN_BACKOFF 4 // Keepalives to dead nodes are sent this many times less often.
+
+enum LinkState : uint8_t
+{
+	LINK_UNKNOWN,
+	LINK_UP,
+	LINK_DOWN
+};
+
+typedef void (*LinkEventCallback)(uint8_t id, LinkState state);
+
+/**
+ * @brief Liveness information kept for each monitored node.
+ */
+struct LinkStatus
+{
+	bool watched;
+	LinkState state;
+	unsigned long lastHeard;	 ///< millis() when traffic from the node was last received.
+	unsigned long lastKeepalive; ///< millis() when the last keepalive was sent to the node.
+	uint8_t missedKeepalives;	 ///< Keepalives sent since the node was last heard.
+};
+
+class LinkMonitor
+{
+private:
+	M16 &modem;
+	uint32_t silenceMs;
+	uint8_t maxMissed;
+	LinkStatus nodes[M16_MAX_NODES];
+	LinkEventCallback callback;
+	unsigned long lastKeepalive;
+	unsigned long channelActive;
+	Report lastReport;
+	bool haveReport;
+	void setState(uint8_t id, LinkState state);
+
+public:
+	LinkMonitor(M16 &modem, uint32_t silenceMs, uint8_t maxMissed = 2);
+	void watch(uint8_t id);
+	void unwatch(uint8_t id);
+	void onEvent(LinkEventCallback callback);
+	void packetReceived(ProtocolStructure packet);
+	void reportReceived(const Report &report);
+	bool update();
+	bool isAlive(uint8_t id);
+	LinkState getState(uint8_t id);
+};
+
+#endif // M16_LINK_H
@@ -0,0 +1,143 @@
+/**
+ * @file M16-netcode.h
+ * @brief XOR network coding for relays carrying traffic in both directions.
+ *
+ * A relay that holds a packet towards the server and a packet towards a node with
+ * the same id broadcasts one coded block instead of forwarding both. The coded block
+ * carries the relay's own id, which marks it as coded, and the command and data
+ * fields of both packets XORed together. Each neighbour recovers the packet meant
+ * for it by XORing the block with the packet it sent to the relay itself.
+ *
+ * A relay holds one packet in each direction, and a station only sends the next
+ * packet to a relay once the relay has room, so the packet a neighbour decodes with
+ * is always the last one it sent to the relay. A neighbour that misses a block keeps
+ * a packet the relay has already taken, but replaces it with its next packet before
+ * the relay can code again, so a lost block never shifts later decodes. Longer
+ * queues do not raise the throughput of a chain, as only one station sends at a time.
+ *
+ * The packets have no spare bits for a sequence number, so relays use an even id and
+ * set its lowest bit to the parity of the packet towards the node. Together with the
+ * parity of the block this gives each neighbour the parity of its own packet, and a
+ * packet that does not match, for example one that never reached the relay, is
+ * dropped instead of decoding the block into a wrong packet.
+ *
+ * Relay ids and the odd ids after them must not be used by sensor nodes.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_NETCODE_H
+#define M16_NETCODE_H
+
+#include "M16-protocol.h"
+
+#define M16_RELAY_QUEUE_LENGTH 1 // Packets a relay holds in each direction, and a neighbour keeps for decoding.
+
+/**
+ * @brief Kind of block a relay sends next.
+ */
+enum RelayBlock : uint8_t
+{
+	RELAY_NONE,		 ///< Nothing to send yet.
+	RELAY_TO_SERVER, ///< A packet forwarded unchanged towards the server.
+	RELAY_TO_NODE,	 ///< A packet forwarded unchanged towards a node.
+	RELAY_CODED		 ///< Two packets combined into one block.
+};
+
+/**
+ * @brief A packet waiting in a relay or endpoint, with the time it was queued.
+ */
+struct QueuedPacket
+{
+	ProtocolStructure packet;
+	unsigned long queued;
+};
+
+/**
+ * @brief Small FIFO of packets used by relays and endpoints.
+ */
+class PacketQueue
+{
+private:
+	QueuedPacket packets[M16_RELAY_QUEUE_LENGTH];
+	uint8_t head;
+	uint8_t count;
+
+public:
+	PacketQueue();
+	bool push(ProtocolStructure packet, unsigned long now);
+	bool pop(QueuedPacket &packet);
+	const QueuedPacket *front();
+	const QueuedPacket *at(uint8_t index);
+	uint8_t size();
+	bool full();
+};
+
+class NetworkCodingRelay
+{
+private:
+	uint8_t relayId;
+	uint32_t holdMs;
+	bool coding;
+	PacketQueue toServer;
+	PacketQueue toNode;
+	uint32_t coded;
+	uint32_t forwarded;
+
+public:
+	NetworkCodingRelay(uint8_t relayId, uint32_t holdMs, bool coding = true);
+	bool fromServer(ProtocolStructure packet, unsigned long now);
+	bool fromNode(ProtocolStructure packet, unsigned long now);
+	bool acceptsFromServer();
+	bool acceptsFromNode();
+	RelayBlock peekBlock(unsigned long now);
+	RelayBlock nextBlock(ProtocolStructure &packet, unsigned long now);
+	uint32_t getCoded();
+	uint32_t getForwarded();
+};
+
+class NetworkCodingEndpoint
+{
+private:
+	uint8_t relayId;
+	bool towardNode;
+	uint32_t windowMs;
+	PacketQueue sentPackets;
+	void expire(unsigned long now);
+
+public:
+	NetworkCodingEndpoint(uint8_t relayId, bool towardNode, uint32_t windowMs);
+	void sent(ProtocolStructure packet, unsigned long now);
+	void forwarded(ProtocolStructure packet);
+	bool isCoded(ProtocolStructure packet);
+	bool decode(ProtocolStructure coded, unsigned long now, ProtocolStructure &packet);
+};
+
+/**
+ * @brief Result of a relay chain simulation.
+ */
+struct ChainResult
+{
+	uint32_t slots;		///< Block times simulated.
+	uint32_t delivered; ///< Packets delivered end to end, both directions.
+	uint32_t lost;		///< Packets lost because the next station missed the block.
+	uint32_t corrupted; ///< Coded blocks decoded with the wrong packet.
+	float throughput;	///< Delivered packets per block time.
+};
+
+class NetworkCodingSimulation
+{
+private:
+	uint32_t seed;
+	float random();
+	static void deliver(uint8_t station, uint8_t stations, bool down, ProtocolStructure packet, unsigned long now,
+						NetworkCodingRelay **relay, PacketQueue *held, ChainResult &result);
+
+public:
+	NetworkCodingSimulation(uint32_t seed = 1);
+	ChainResult run(uint8_t relays, bool coding, uint32_t slots, float lossRate = 0.0f);
+};
+
+#endif // M16_NETCODE_H
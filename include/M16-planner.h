@@ -0,0 +1,64 @@
+/**
+ * @file M16-planner.h
+ * @brief Airtime budget planner for M16 deployments.
+ *
+ * This file contains the declaration of the AirtimePlanner class, which computes
+ * how much of a single M16 channel a polled deployment uses. It only depends on
+ * the protocol timing model and can be used on the host as well as on the device.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_PLANNER_H
+#define M16_PLANNER_H
+
+#include "M16-protocol.h"
+
+/**
+ * @brief Description of a deployment sharing one M16 channel.
+ *
+ * The server polls every node once per sample period using the exchange described
+ * in M16-protocol.h: REQUEST_DATA, one block per sensor, FINISHED and
+ * SENSOR_DATA_RECEIVED.
+ */
+struct DeploymentPlan
+{
+	uint8_t nodes;			 ///< Number of nodes polled by the server.
+	uint8_t sensorsPerNode;	 ///< Sensor blocks sent by each node per poll.
+	uint32_t samplePeriodMs; ///< Interval between two polls of the same node.
+	uint32_t turnaroundMs;	 ///< Time from the end of a received block until the reply starts.
+	bool reportEachCycle;	 ///< Whether the server requests a modem report every cycle.
+};
+
+/**
+ * @brief Result of evaluating a `DeploymentPlan`.
+ */
+struct PlanResult
+{
+	uint32_t nodeSlotMs;		  ///< Time spent polling one node.
+	uint32_t cycleTimeMs;		  ///< Time spent polling every node once.
+	uint32_t pollPeriodMs;		  ///< Time between two polls of the same node.
+	float utilization;			  ///< Fraction of the poll period the channel is busy.
+	int32_t headroomMs;			  ///< Idle time per sample period, negative if overloaded.
+	uint32_t worstAlarmLatencyMs; ///< Longest time from an alarm on a node until it is received.
+	uint16_t maxNodes;			  ///< Nodes that fit within the sample period.
+	bool feasible;				  ///< Whether every node can be polled within the sample period.
+};
+
+class AirtimePlanner
+{
+private:
+	DeploymentPlan plan;
+
+public:
+	AirtimePlanner(const DeploymentPlan &plan);
+	uint32_t nodeSlotMs();
+	uint32_t reportOverheadMs();
+	PlanResult evaluate();
+	PlanResult simulate(uint8_t cycles = 3);
+	bool validate(uint32_t toleranceMs = 0);
+};
+
+#endif // M16_PLANNER_H
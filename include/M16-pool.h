@@ -0,0 +1,214 @@
+/**
+ * @file M16-pool.h
+ * @brief Fixed-size memory pools for packets, messages and report snapshots.
+ *
+ * A Pool holds storage for a fixed number of objects inside itself, so a pool
+ * declared as a global or static variable needs no heap at all. Free slots are
+ * linked through their own storage and taken and returned with compare-and-swap,
+ * so allocation takes the same short time from tasks and interrupts alike and the
+ * memory can never fragment. A tag next to the list head protects against a slot
+ * being taken and returned between reading the head and swapping it.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_POOL_H
+#define M16_POOL_H
+
+#include <new>
+#include <stddef.h>
+#include <utility>
+#include "M16-protocol.h"
+#include "M16-harq.h"
+
+#ifndef M16_PACKET_POOL_SIZE
+#define M16_PACKET_POOL_SIZE 32 // Packets in the global packet pool.
+#endif
+#ifndef M16_MESSAGE_POOL_SIZE
+#define M16_MESSAGE_POOL_SIZE 8 // Messages in the global message pool.
+#endif
+#ifndef M16_REPORT_POOL_SIZE
+#define M16_REPORT_POOL_SIZE 4 // Report snapshots in the global report pool.
+#endif
+
+#define M16_POOL_END 0xffff // Index marking the end of a free list.
+
+/**
+ * @brief Usage statistics of a pool.
+ */
+struct PoolStats
+{
+	uint16_t capacity;	///< Objects the pool can hold.
+	uint16_t used;		///< Objects allocated now.
+	uint16_t highWater; ///< Most objects allocated at the same time.
+	uint32_t failures;	///< Allocations that failed because the pool was empty.
+};
+
+template <typename T, uint16_t Capacity>
+class Pool
+{
+	static_assert(Capacity > 0 && Capacity < M16_POOL_END, "A pool holds between 1 and 65534 objects.");
+
+private:
+	union Slot
+	{
+		uint16_t next;
+		alignas(T) unsigned char storage[sizeof(T)];
+	};
+	Slot slots[Capacity];
+	uint32_t head; // Index of the first free slot in the low half, tag in the high half.
+	uint32_t used;
+	uint32_t highWater;
+	uint32_t failures;
+
+public:
+	static constexpr uint16_t capacity = Capacity;
+	static constexpr size_t bytes = sizeof(Slot) * Capacity;
+
+	/**
+	 * @brief Constructor for the Pool class, links every slot into the free list.
+	 */
+	Pool() : head(0), used(0), highWater(0), failures(0)
+	{
+		for (uint16_t i = 0; i < Capacity; i++)
+		{
+			this->slots[i].next = i + 1 < Capacity ? i + 1 : M16_POOL_END;
+		}
+	}
+
+	Pool(const Pool &) = delete;
+	Pool &operator=(const Pool &) = delete;
+
+	/**
+	 * @brief Takes an uninitialized slot from the pool.
+	 *
+	 * @return Storage for one object, or nullptr if the pool is empty.
+	 */
+	void *allocate()
+	{
+		uint32_t old = __atomic_load_n(&this->head, __ATOMIC_ACQUIRE);
+		uint16_t index;
+		do
+		{
+			index = old & 0xffff;
+			if (index == M16_POOL_END)
+			{
+				__atomic_add_fetch(&this->failures, 1, __ATOMIC_RELAXED);
+				return nullptr;
+			}
+		} while (!__atomic_compare_exchange_n(&this->head, &old, ((old + 0x10000) & 0xffff0000) | this->slots[index].next,
+											  true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+		uint32_t count = __atomic_add_fetch(&this->used, 1, __ATOMIC_RELAXED);
+		uint32_t peak = __atomic_load_n(&this->highWater, __ATOMIC_RELAXED);
+		while (count > peak && !__atomic_compare_exchange_n(&this->highWater, &peak, count, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		{
+		}
+		return this->slots[index].storage;
+	}
+
+	/**
+	 * @brief Returns a slot to the pool.
+	 *
+	 * @param pointer Storage returned by `allocate()`. Pointers from elsewhere are ignored.
+	 */
+	void release(void *pointer)
+	{
+		Slot *slot = reinterpret_cast<Slot *>(pointer);
+		if (slot < this->slots || slot >= this->slots + Capacity)
+		{
+			return;
+		}
+		uint16_t index = slot - this->slots;
+		uint32_t old = __atomic_load_n(&this->head, __ATOMIC_ACQUIRE);
+		do
+		{
+			slot->next = old & 0xffff;
+		} while (!__atomic_compare_exchange_n(&this->head, &old, ((old + 0x10000) & 0xffff0000) | index, true,
+											  __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+		__atomic_sub_fetch(&this->used, 1, __ATOMIC_RELAXED);
+	}
+
+	/**
+	 * @brief Allocates and constructs an object.
+	 *
+	 * @param args Arguments passed to the constructor of T.
+	 * @return The new object, or nullptr if the pool is empty.
+	 */
+	template <typename... Args>
+	T *create(Args &&...args)
+	{
+		void *storage = this->allocate();
+		return storage != nullptr ? new (storage) T(std::forward<Args>(args)...) : nullptr;
+	}
+
+	/**
+	 * @brief Destroys an object made by `create()` and returns its slot.
+	 *
+	 * @param object The object, nullptr is ignored.
+	 */
+	void destroy(T *object)
+	{
+		if (object == nullptr)
+		{
+			return;
+		}
+		object->~T();
+		this->release(object);
+	}
+
+	/**
+	 * @brief Returns the usage statistics of the pool.
+	 */
+	PoolStats getStats()
+	{
+		return PoolStats{Capacity, (uint16_t)__atomic_load_n(&this->used, __ATOMIC_RELAXED),
+						 (uint16_t)__atomic_load_n(&this->highWater, __ATOMIC_RELAXED),
+						 __atomic_load_n(&this->failures, __ATOMIC_RELAXED)};
+	}
+
+	/**
+	 * @brief Restarts the high-water mark and failure count from the current usage.
+	 */
+	void resetStats()
+	{
+		__atomic_store_n(&this->highWater, __atomic_load_n(&this->used, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+		__atomic_store_n(&this->failures, 0, __ATOMIC_RELAXED);
+	}
+};
+
+template <typename T, uint16_t Capacity>
+constexpr uint16_t Pool<T, Capacity>::capacity;
+template <typename T, uint16_t Capacity>
+constexpr size_t Pool<T, Capacity>::bytes;
+
+/**
+ * @brief A multi-block message waiting to be sent or read.
+ */
+struct MessageBuffer
+{
+	uint8_t id;
+	uint8_t length;
+	uint8_t data[M16_HARQ_MAX_LENGTH];
+};
+
+/**
+ * @brief A report together with the time it was received.
+ */
+struct ReportSnapshot
+{
+	Report report;
+	unsigned long received; ///< Time of the report in milliseconds.
+};
+
+typedef Pool<ProtocolStructure, M16_PACKET_POOL_SIZE> PacketPool;
+typedef Pool<MessageBuffer, M16_MESSAGE_POOL_SIZE> MessagePool;
+typedef Pool<ReportSnapshot, M16_REPORT_POOL_SIZE> ReportPool;
+
+extern PacketPool packetPool;
+extern MessagePool messagePool;
+extern ReportPool reportPool;
+
+#endif // M16_POOL_H
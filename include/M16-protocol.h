@@ -0,0 +1,242 @@
+/**
+ * @file M16-protocol.h
+ * @brief Platform independent protocol definitions for the M16 modem.
+ *
+ * This file contains the commands, packet structures and timing model shared by
+ * the M16 class and by tools that have to reason about the link without talking
+ * to a modem, such as the airtime planner.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_PROTOCOL_H
+#define M16_PROTOCOL_H
+
+#include <stdint.h>
+
+#define M16_BAUD 9600
+
+// Timing model of the modem. All values are in milliseconds.
+#define M16_BLOCK_BYTES 2				// Bytes carried by one transport block.
+#define M16_BLOCK_TIME_MS 1600			// Airtime of one transport block.
+#define M16_BLOCK_INTERVAL_MS 2000		// Spacing of consecutive blocks, block time plus margin.
+#define M16_TURNAROUND_MS 300			// Time from the end of a received block until a reply starts.
+#define M16_ROUND_TRIP_MS (2 * M16_BLOCK_TIME_MS + M16_TURNAROUND_MS) // From sending a block until a reply has arrived.
+#define M16_COMMAND_GUARD_MS 1000		// Silence between the two characters of a command.
+#define M16_POWER_LEVEL_GUARD_MS 1500	// Silence before the power level character.
+#define M16_CHANNEL_CHAR_DELAY_MS 1		// Delay before the channel character.
+#define M16_REPORT_LENGTH 18			// Bytes in a report frame.
+#define M16_REPORT_READ_TIMEOUT_MS 10	// Timeout of a single report read attempt.
+#define M16_REPORT_READ_RETRIES 100		// Read attempts before a report request fails.
+#define M16_PROBE_READ_RETRIES 20		// Read attempts when probing for the operation mode.
+#define M16_BOOT_TIME_MS 2000			// Time for the modem to start after power is applied.
+
+// Packet layout, override with build flags to trade id bits for payload bits. The
+// message, flow control, lease and discovery commands take `COMMAND_COUNT` to 15, so
+// the command field needs at least 4 bits.
+#ifndef M16_ID_BITS
+#define M16_ID_BITS 4
+#endif
+#ifndef M16_COMMAND_BITS
+#define M16_COMMAND_BITS 4
+#endif
+#ifndef M16_DATA_BITS
+#define M16_DATA_BITS 8
+#endif
+
+#define M16_MAX_NODES (1 << M16_ID_BITS) // Number of ids addressable by the id field.
+
+/*
+Client: id(ID) Hei, til server (command) password (data)
+Server: id(client ID) request data (command) no data (data)
+Client: id(client ID) what sensor (command) sensor data (data) X sensor amount
+Client: id(client ID) finished (command) no data (data)
+Server: id(client ID) ok (command) sensor amount (data)
+*/
+
+// Must fit in the command field of the packet layout, see `Layout`. With the
+// transport commands from MESSAGE_START on there are 15 commands, so 4 bits are the
+// smallest command field; only one value is left for a new command.
+enum Command : uint8_t
+{
+	HI,
+	REQUEST_DATA,
+	FINISHED,
+	TEMP_SENSOR,
+	PRESSURE_SENSOR,
+	CONDUCTIVITY_SENSOR,
+	PH_SENSOR,
+	SENSOR_DATA_RECEIVED,
+	MESSAGE_START,	///< Starts a round of a multi-block message, see M16-harq.h.
+	MESSAGE_DATA,	///< A data symbol of a multi-block message.
+	MESSAGE_PARITY, ///< A redundancy symbol of a multi-block message.
+	MESSAGE_ACK,	///< Symbols still missing from a multi-block message, 0 when complete.
+	CREDIT,			///< Packets the receiver can still buffer, see M16-flow.h.
+	JOIN,			///< Id lease request, offer or renewal, see M16-lease.h.
+	DISCOVER,		///< Discovery query or reply, see M16-discovery.h.
+	COMMAND_COUNT ///< Number of commands, not a command itself.
+};
+
+/**
+ * @brief Operation modes of the modem, toggled by `switchOperationMode()`.
+ */
+enum OperationMode : uint8_t
+{
+	UNKNOWN_MODE,
+	TRANSPARENT_MODE, ///< Data is transmitted acoustically, the modem boots in this mode.
+	COMMAND_MODE	  ///< Data is interpreted as commands.
+};
+
+/**
+ * @brief Structure representing the components of the communication protocol.
+ *
+ * The `ProtocolStructure` contains an ID, a command type, and data. These components
+ * are used to encode and decode messages for communication.
+ *
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+struct ProtocolStructure
+{
+	unsigned char id; ///< Identification of the device (only `M16_ID_BITS` bits used).
+	Command command;  ///< The command type indicating the action to perform.
+	uint16_t data;	  ///< The actual data being transmitted (only `M16_DATA_BITS` bits used).
+};
+
+/**
+ * @brief Compile-time layout of the fields in a 16-bit packet.
+ *
+ * The id is placed in the most significant bits, followed by the command and the
+ * data. A layout must fill the 16 bits of a transport block exactly, and every
+ * `Command` value must fit in the command field, which takes at least 4 bits since
+ * the transport commands were added. For example `Layout<2, 4, 10>` addresses 4
+ * nodes and carries 10 bits of data per block.
+ *
+ * @tparam IdBits Width of the id field.
+ * @tparam CommandBits Width of the command field.
+ * @tparam DataBits Width of the data field.
+ */
+template <uint8_t IdBits, uint8_t CommandBits, uint8_t DataBits>
+struct Layout
+{
+	static_assert(IdBits > 0 && CommandBits > 0 && DataBits > 0, "Every field needs at least one bit.");
+	static_assert(IdBits + CommandBits + DataBits == 8 * M16_BLOCK_BYTES, "A layout must fill exactly one transport block.");
+	static_assert(COMMAND_COUNT <= (1 << CommandBits), "Command values do not fit in the command field.");
+
+	static constexpr uint16_t idMask = (1 << IdBits) - 1;
+	static constexpr uint16_t commandMask = (1 << CommandBits) - 1;
+	static constexpr uint16_t dataMask = (1UL << DataBits) - 1;
+	static constexpr uint8_t idShift = CommandBits + DataBits;
+	static constexpr uint8_t commandShift = DataBits;
+
+	/**
+	 * @brief Encodes the fields into a packet, dropping bits that do not fit.
+	 */
+	static constexpr uint16_t encode(uint8_t id, uint8_t command, uint16_t data)
+	{
+		return ((id & idMask) << idShift) | ((command & commandMask) << commandShift) | (data & dataMask);
+	}
+
+	static constexpr uint8_t id(uint16_t packet)
+	{
+		return (packet >> idShift) & idMask;
+	}
+
+	static constexpr uint8_t command(uint16_t packet)
+	{
+		return (packet >> commandShift) & commandMask;
+	}
+
+	static constexpr uint16_t data(uint16_t packet)
+	{
+		return packet & dataMask;
+	}
+
+	static constexpr ProtocolStructure decode(uint16_t packet)
+	{
+		return ProtocolStructure{id(packet), static_cast<Command>(command(packet)), data(packet)};
+	}
+};
+
+typedef Layout<M16_ID_BITS, M16_COMMAND_BITS, M16_DATA_BITS> PacketLayout;
+
+struct Report
+{
+	uint8_t startOfFrame;
+	uint16_t transportBlock;
+	uint8_t bitErrorRate;
+	uint8_t signalPower;
+	uint8_t noisePower;
+	uint16_t packetValid;
+	uint8_t packedInvalid;
+	uint8_t firmwareVersion;
+	uint32_t timeSinceBoot;
+	uint16_t chipID;
+	uint8_t hwRev;
+	uint8_t channel;
+	uint8_t tbValid;
+	uint8_t txComplete;
+	uint8_t diagnostic;
+	uint8_t reserved;
+	uint8_t powerLevel;
+	uint8_t reserved2;
+	uint8_t endOfFrame;
+};
+
+/**
+ * @brief Decodes a report frame read from the modem.
+ *
+ * @param bytes The `M16_REPORT_LENGTH` bytes of the frame.
+ * @return The decoded report, with the reserved fields set to 0.
+ */
+inline Report decodeReport(const uint8_t *bytes)
+{
+	Report report{};
+	report.startOfFrame = bytes[0];
+	report.transportBlock = (bytes[1] << 8) | bytes[2];
+	report.bitErrorRate = bytes[3];
+	report.signalPower = bytes[4];
+	report.noisePower = bytes[5];
+	report.packetValid = (bytes[6] << 8) | bytes[7];
+	report.packedInvalid = bytes[8];
+	report.firmwareVersion = bytes[9];
+	report.timeSinceBoot = ((uint32_t)bytes[10] << 16) | (bytes[11] << 8) | bytes[12];
+	report.chipID = (bytes[13] << 8) | bytes[14];
+	report.hwRev = (bytes[15] & 0b00000011);
+	report.channel = (bytes[15] & 0b00111100) >> 2;
+	report.tbValid = (bytes[15] & 0b01000000) >> 6;
+	report.txComplete = (bytes[15] & 0b10000000) >> 7;
+	report.diagnostic = (bytes[16] & 0b00000001);
+	// report.reserved = (bytes[16] & 0x02) >> 1;
+	report.powerLevel = (bytes[16] & 0b00001100) >> 2;
+	// report.reserved2 = (bytes[16] >> 0 & 0xf0) >> 4;
+	report.endOfFrame = bytes[17];
+	return report;
+}
+
+/**
+ * @brief Modem settings applied through `setCommunicationChannel()` and `setPowerLevel()`.
+ *
+ * A value of 0 means the setting is unknown.
+ */
+struct ModemConfig
+{
+	uint8_t channel;	///< Communication channel (1-12).
+	uint8_t powerLevel; ///< Power level (1-4).
+};
+
+/**
+ * @brief Time needed to move a number of bytes over the serial link to the modem.
+ *
+ * @param bytes The number of bytes to transfer.
+ * @return The transfer time in milliseconds, rounded up.
+ */
+inline uint32_t serialTimeMs(uint32_t bytes)
+{
+	// 8N1 framing gives 10 bits on the wire per byte.
+	return (bytes * 10 * 1000 + M16_BAUD - 1) / M16_BAUD;
+}
+
+#endif // M16_PROTOCOL_H
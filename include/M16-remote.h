@@ -0,0 +1,155 @@
+/**
+ * @file M16-remote.h
+ * @brief Remote configuration and diagnostics of nodes over multi-block messages.
+ *
+ * The server sends a configuration diff as a hybrid ARQ message: a bit mask of the
+ * parameters that change followed by only their new values, so routine changes fit
+ * in a few blocks. The node answers every diff, or an empty diff used as a
+ * diagnostics request, with a digest of its modem report and counters packed into
+ * about twenty bytes.
+ *
+ * A channel change would cut the node off if the two modems switched at different
+ * times, so a diff can ask for the change to take effect after a delay. The server
+ * switches its own modem at the same time, when `RemoteManager::switchDue()` says
+ * so. If the node then hears nothing from the server within
+ * `M16_REMOTE_CONFIRM_MS`, it goes back to the previous settings by itself. The
+ * server likewise goes back to the previous channel if no digest arrives on the
+ * new one within `M16_REMOTE_CONFIRM_MS`, so it should query the node after the
+ * switch.
+ *
+ * The node ignores a diff with the same sequence number as the last one, so the
+ * server starts its sequence from a random seed. Otherwise the first diff after a
+ * reboot of the server would often repeat the last number the node saw.
+ *
+ * Messages start with a type byte so they can share the message layer with the
+ * application. The packing and the server side only depend on the protocol
+ * definitions; the node side applies the settings to an M16 and is only available
+ * on the ESP32.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_REMOTE_H
+#define M16_REMOTE_H
+
+#include "M16-protocol.h"
+#include "M16-harq.h"
+
+#define M16_REMOTE_CONFIG 0xc1			 // Type byte of a configuration diff.
+#define M16_REMOTE_DIGEST 0xd1			 // Type byte of a digest.
+#define M16_REMOTE_CONFIG_MAX_LENGTH 9	 // Bytes in a diff changing every parameter.
+#define M16_REMOTE_DIGEST_LENGTH 21		 // Bytes in a digest.
+#define M16_REMOTE_CONFIRM_MS 120000	 // Time each side waits for the other after switching.
+
+static_assert(M16_REMOTE_DIGEST_LENGTH <= M16_HARQ_MAX_LENGTH, "A digest must fit in one message.");
+
+/**
+ * @brief Parameters a diff can change, combined as a bit mask.
+ */
+enum RemoteParam : uint8_t
+{
+	REMOTE_CHANNEL = 0x01,		 ///< Communication channel (1-12).
+	REMOTE_POWER_LEVEL = 0x02,	 ///< Power level (1-4).
+	REMOTE_REPORT_INTERVAL = 0x04 ///< Seconds between the application's own reports.
+};
+
+/**
+ * @brief Result of a diff on the node, sent back in the digest.
+ */
+enum RemoteStatus : uint8_t
+{
+	REMOTE_IDLE,	   ///< No diff received yet.
+	REMOTE_APPLIED,	   ///< The diff is in effect.
+	REMOTE_PENDING,	   ///< The diff takes effect after its delay.
+	REMOTE_REJECTED,   ///< A value was out of range, nothing was changed.
+	REMOTE_ROLLED_BACK ///< The server was not heard after switching, the old settings are back.
+};
+
+/**
+ * @brief A set of parameter changes.
+ */
+struct RemoteDiff
+{
+	uint8_t sequence;		 ///< Number of the diff, repeats are answered without applying twice.
+	uint8_t mask;			 ///< Parameters to change, see `RemoteParam`.
+	uint16_t delayS;		 ///< Seconds from reception until channel and power level change.
+	uint8_t channel;		 ///< New channel if `REMOTE_CHANNEL` is set.
+	uint8_t powerLevel;		 ///< New power level if `REMOTE_POWER_LEVEL` is set.
+	uint16_t reportIntervalS; ///< New report interval if `REMOTE_REPORT_INTERVAL` is set.
+};
+
+/**
+ * @brief State of a node as sent in a digest.
+ */
+struct RemoteDigest
+{
+	uint8_t sequence;		 ///< Sequence of the last diff received.
+	RemoteStatus status;	 ///< What became of that diff.
+	ModemConfig config;		 ///< Settings in effect.
+	uint16_t reportIntervalS; ///< Report interval in effect.
+	Report report;			 ///< Last report of the node modem.
+	uint16_t rxOverflows;	 ///< Receive overflows of the node UART.
+};
+
+uint8_t remotePackDiff(const RemoteDiff &diff, uint8_t *buffer);
+bool remoteUnpackDiff(const uint8_t *buffer, uint8_t length, RemoteDiff &diff);
+uint8_t remotePackDigest(const RemoteDigest &digest, uint8_t *buffer);
+bool remoteUnpackDigest(const uint8_t *buffer, uint8_t length, RemoteDigest &digest);
+
+class RemoteManager
+{
+private:
+	uint8_t sequence;
+	uint8_t channel; // Channel of the server modem.
+	bool switchPending;
+	unsigned long switchAt;
+	uint8_t switchChannel;
+	bool confirmPending; // Switched, but no digest heard on the new channel yet.
+	unsigned long confirmBy;
+	uint8_t previousChannel;
+	RemoteDigest digests[M16_MAX_NODES];
+	bool known[M16_MAX_NODES];
+	RemoteDiff sent;
+
+public:
+	RemoteManager(uint8_t channel, uint32_t seed);
+	uint8_t configure(const RemoteDiff &diff, uint8_t *buffer);
+	uint8_t query(uint8_t *buffer);
+	void delivered(unsigned long now);
+	bool switchDue(unsigned long now, uint8_t &channel);
+	bool digestReceived(uint8_t id, const uint8_t *buffer, uint8_t length);
+	const RemoteDigest *getDigest(uint8_t id);
+};
+
+#if defined(ESP_PLATFORM)
+#include "M16-lib.h"
+
+class RemoteNode
+{
+private:
+	M16 &modem;
+	RemoteDigest state;
+	bool received; // Whether any diff has been received, so `state.sequence` is valid.
+	RemoteDiff pending;
+	bool hasPending;
+	unsigned long activateAt;
+	ModemConfig previous;
+	bool awaitingServer;
+	unsigned long confirmBy;
+	bool digestPending;
+	void apply(ModemConfig config);
+
+public:
+	RemoteNode(M16 &modem, uint16_t reportIntervalS = 0);
+	bool messageReceived(const uint8_t *data, uint8_t length, unsigned long now);
+	void heard(unsigned long now);
+	void update(unsigned long now);
+	bool digestDue();
+	uint8_t digest(uint8_t *buffer, bool refresh = true);
+	uint16_t getReportInterval();
+};
+#endif
+
+#endif // M16_REMOTE_H
@@ -0,0 +1,119 @@
+/**
+ * @file M16-sensor.h
+ * @brief Header file for the SensorPipeline class.
+ *
+ * This file contains the declaration of the SensorPipeline class, which samples the
+ * sensors in its own task instead of in `loop()`. Analog sensors are converted by
+ * the ADC in continuous mode, which fills its DMA buffer without the CPU and raises
+ * an interrupt when a frame is complete. The task then averages each channel over
+ * its sampling period, converts it with a callback and pushes it, timestamped, to a
+ * lock-free ring. Sensors on a bus, like I2C, are read by a callback in the same
+ * task, so a slow transaction never stalls the modem.
+ *
+ * `loop()` only moves the samples from the ring to a FlowSender, so sampling,
+ * encoding and transmitting overlap. Each sample is sent as one packet, so a value
+ * must fit in the `M16_DATA_BITS` of the data field. Wider values are dropped and
+ * counted, see `getOversized()`. ADC continuous mode needs version 3 of the
+ * Arduino core; on older cores the task reads the analog channels one at a time.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_SENSOR_H
+#define M16_SENSOR_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "M16-protocol.h"
+#include "M16-flow.h"
+
+#define M16_SENSOR_CHANNELS 4			 // Sensors in a pipeline, one for each sensor command.
+#define M16_SENSOR_QUEUE_LENGTH 32		 // Samples held by the ring, must be a power of two.
+#define M16_SENSOR_ADC_RATE_HZ 20000	 // Conversions per second in ADC continuous mode.
+#define M16_SENSOR_ADC_FRAME 64			 // Conversions per channel in each DMA frame.
+#define M16_SENSOR_TASK_STACK 3072		 // Stack of the acquisition task, in bytes.
+#define M16_SENSOR_IDLE_MS 10			 // Longest sleep of the task between checks.
+#define M16_SENSOR_MAX_AGE_MS 60000		 // Samples older than this are dropped instead of sent.
+
+/**
+ * @brief Converts the averaged voltage of an analog sensor to the data of a packet.
+ *
+ * The result must not exceed `PacketLayout::dataMask`.
+ */
+typedef uint16_t (*SensorConvert)(int32_t milliVolts);
+
+/**
+ * @brief Reads a sensor on a bus. Runs in the acquisition task and may block.
+ *
+ * @return false if the sensor did not answer, the sample is then skipped.
+ */
+typedef bool (*SensorRead)(uint16_t &data, void *context);
+
+/**
+ * @brief A timestamped sensor value waiting to be sent.
+ */
+struct SensorSample
+{
+	Command command;	  ///< The sensor command the value is sent with.
+	uint16_t data;		  ///< The encoded value.
+	unsigned long time; ///< `millis()` when the sample was taken.
+};
+
+class SensorPipeline
+{
+private:
+	struct Channel
+	{
+		Command command;
+		int16_t pin; // Analog pin, or -1 for a sensor read by callback.
+		SensorConvert convert;
+		SensorRead read;
+		void *context;
+		uint32_t periodMs;
+		unsigned long last;
+		int64_t sum; // Sum and count of the conversions in the current period.
+		uint32_t conversions;
+	};
+	Channel channels[M16_SENSOR_CHANNELS];
+	uint8_t channelCount;
+	SensorSample queue[M16_SENSOR_QUEUE_LENGTH];
+	uint32_t head; // Shared between the tasks, accessed with the __atomic builtins.
+	uint32_t tail;
+	uint32_t peak;
+	uint32_t overflows;
+	uint32_t stale;
+	uint32_t oversized;
+	uint32_t failures;
+	TaskHandle_t task;
+	bool continuous;
+	bool running;
+	static SensorPipeline *active;
+	bool addChannel(Command command, int16_t pin, SensorConvert convert, SensorRead read, void *context,
+					uint32_t periodMs);
+	void push(Command command, uint16_t data, unsigned long time);
+	void acquire();
+	void readFrame();
+	static void run(void *pipeline);
+	static void conversionDone();
+
+public:
+	SensorPipeline();
+	bool addAnalog(Command command, uint8_t pin, SensorConvert convert, uint32_t periodMs);
+	bool addBus(Command command, SensorRead read, void *context, uint32_t periodMs);
+	bool begin(UBaseType_t priority = 2, BaseType_t core = tskNO_AFFINITY);
+	void end();
+	bool pop(SensorSample &sample);
+	size_t available();
+	uint8_t drain(FlowSender &sender, unsigned long now);
+	uint32_t getQueuePeak();
+	uint32_t getOverflows();
+	uint32_t getStale();
+	uint32_t getOversized();
+	uint32_t getFailures();
+	TaskHandle_t getTask();
+};
+
+#endif // M16_SENSOR_H
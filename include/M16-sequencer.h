@@ -0,0 +1,86 @@
+/**
+ * @file M16-sequencer.h
+ * @brief Header file for the Sequencer class.
+ *
+ * This file contains the declaration of the Sequencer class, which emits command
+ * bytes at precise microsecond offsets from one-shot timer callbacks instead of
+ * blocking a task with tick based delays. On the ESP32 it is driven by `esp_timer`;
+ * on the host a timer thread is used.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_SEQUENCER_H
+#define M16_SEQUENCER_H
+
+#include "M16-protocol.h"
+
+#if defined(ESP_PLATFORM)
+#include "esp_timer.h"
+#else
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+#define M16_SEQUENCE_LENGTH 4 // Steps in the longest command sequence.
+
+typedef void (*ByteSink)(uint8_t byte, void *context);
+
+/**
+ * @brief A byte to emit and its offset from the start of the sequence.
+ */
+struct SequenceStep
+{
+	uint32_t offsetUs;
+	uint8_t byte;
+};
+
+/**
+ * @brief Timing error of emitted bytes, measured against their scheduled offsets.
+ */
+struct JitterStats
+{
+	uint32_t samples;	 ///< Bytes emitted since the last reset.
+	int32_t minLateUs;	 ///< Earliest emission relative to its schedule.
+	int32_t maxLateUs;	 ///< Latest emission relative to its schedule.
+	int64_t totalLateUs; ///< Sum of all deviations, divide by `samples` for the mean.
+};
+
+class Sequencer
+{
+private:
+	ByteSink sink;
+	void *context;
+	SequenceStep steps[M16_SEQUENCE_LENGTH];
+	uint8_t length; // Shared with the timer callback, accessed with the __atomic builtins.
+	uint8_t next;
+	bool running;
+	int64_t startUs;
+	JitterStats jitter;
+#if defined(ESP_PLATFORM)
+	esp_timer_handle_t timer;
+#else
+	std::thread worker;
+	std::mutex lock;
+	std::condition_variable wakeup;
+	void run();
+#endif
+	void arm();
+	static void fire(void *sequencer);
+
+public:
+	Sequencer(ByteSink sink, void *context);
+	~Sequencer();
+	bool add(uint32_t offsetUs, uint8_t byte);
+	bool start();
+	void cancel();
+	bool busy();
+	JitterStats getJitter();
+	void resetJitter();
+	static int64_t nowUs();
+};
+
+#endif // M16_SEQUENCER_H
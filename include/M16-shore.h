@@ -0,0 +1,221 @@
+/**
+ * @file M16-shore.h
+ * @brief Multi-threaded processing of the traffic from several topside modems on a shore host.
+ *
+ * ShoreHub reads each topside modem on its own I/O thread. The thread only pairs
+ * bytes into packets, stamps them with the time they were read and pushes them to
+ * a lock-free queue of its stream, so a busy worker or consumer never delays the
+ * serial reads. A pool of worker threads, one per core by default, runs duplicate
+ * removal, multi-block reassembly and the hybrid ARQ decoding of M16-harq.h. Each
+ * stream is owned by one worker, so its output keeps the order the packets were
+ * read in, and throughput scales with cores as long as there are at least as many
+ * streams as workers.
+ *
+ * The application takes decoded events from each stream with `read()`. A stream
+ * whose consumer falls behind drops its own events, counted in its statistics,
+ * without affecting the other streams. Events carry a sequence number per stream
+ * so such gaps are visible.
+ *
+ * Blocks of a multi-block message are placed by their arrival time, so the time
+ * stamped by the I/O thread is used throughout and the decoding is correct however
+ * late a worker gets to it.
+ *
+ * Only available on Linux hosts.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_SHORE_H
+#define M16_SHORE_H
+
+#include "M16-protocol.h"
+#include "M16-harq.h"
+
+#if defined(__linux__) && !defined(ESP_PLATFORM)
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <thread>
+#include <vector>
+
+#define M16_SHORE_MAX_STREAMS 16				// Topside modems one hub can serve.
+#define M16_SHORE_INPUT_LENGTH 256				// Packets queued between reader and worker, must be a power of two.
+#define M16_SHORE_OUTPUT_LENGTH 256				// Events queued for the consumer, must be a power of two.
+#define M16_SHORE_FEEDBACK_LENGTH 16			// Feedback blocks queued for the modem, must be a power of two.
+#define M16_SHORE_DEDUP_MS M16_BLOCK_TIME_MS	// Identical packets closer than this are one block read twice.
+#define M16_SHORE_RESYNC_MS (M16_BLOCK_INTERVAL_MS / 2) // Silence after which an unpaired byte is discarded.
+#define M16_SHORE_IDLE_MS 100					// Longest sleep of an idle reader or worker.
+
+/**
+ * @brief Single-producer single-consumer lock-free queue.
+ *
+ * @tparam T Type of the queued values.
+ * @tparam Length Number of slots, a power of two. One slot is always left empty.
+ */
+template <typename T, uint32_t Length>
+class ShoreQueue
+{
+	static_assert(Length >= 2 && (Length & (Length - 1)) == 0, "The queue length must be a power of two.");
+
+private:
+	T slots[Length];
+	uint32_t head;
+	uint32_t tail;
+
+public:
+	ShoreQueue() : slots{}, head(0), tail(0) {}
+
+	/**
+	 * @brief Adds a value, only called by the producer.
+	 *
+	 * @return false if the queue is full, true otherwise.
+	 */
+	bool push(const T &value)
+	{
+		uint32_t head = this->head;
+		uint32_t next = (head + 1) & (Length - 1);
+		if (next == __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE))
+		{
+			return false;
+		}
+		this->slots[head] = value;
+		__atomic_store_n(&this->head, next, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	/**
+	 * @brief Takes the oldest value, only called by the consumer.
+	 *
+	 * @return false if the queue is empty, true otherwise.
+	 */
+	bool pop(T &value)
+	{
+		uint32_t tail = this->tail;
+		if (tail == __atomic_load_n(&this->head, __ATOMIC_ACQUIRE))
+		{
+			return false;
+		}
+		value = this->slots[tail];
+		__atomic_store_n(&this->tail, (tail + 1) & (Length - 1), __ATOMIC_RELEASE);
+		return true;
+	}
+
+	/**
+	 * @brief Returns whether the queue is empty, exact only for the consumer.
+	 */
+	bool empty()
+	{
+		return __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE) == __atomic_load_n(&this->head, __ATOMIC_ACQUIRE);
+	}
+};
+
+/**
+ * @brief Kinds of events produced by the hub.
+ */
+enum ShoreEventType : uint8_t
+{
+	SHORE_PACKET, ///< A single packet that is not part of a multi-block message.
+	SHORE_MESSAGE ///< A complete multi-block message.
+};
+
+/**
+ * @brief A decoded packet or message from one stream.
+ */
+struct ShoreEvent
+{
+	uint32_t sequence;	///< Number of the event in its stream, gaps mean dropped events.
+	unsigned long time; ///< Time the packet, or the last block of the message, was read.
+	ShoreEventType type;
+	ProtocolStructure packet;			///< The packet, or the sender id of a message.
+	uint8_t length;						///< Bytes in `data` for a message.
+	uint8_t data[M16_HARQ_MAX_LENGTH]; ///< Message bytes.
+};
+
+/**
+ * @brief Counters of one stream.
+ */
+struct ShoreStats
+{
+	uint64_t bytesRead;	   ///< Bytes read from the modem.
+	uint64_t packets;	   ///< Packets handed to the worker.
+	uint64_t overruns;	   ///< Packets dropped because the worker fell behind.
+	uint64_t duplicates;   ///< Packets removed as duplicates.
+	uint64_t messages;	   ///< Multi-block messages decoded.
+	uint64_t feedback;	   ///< Feedback blocks written to the modem.
+	uint64_t outputDrops;  ///< Events dropped because the consumer fell behind.
+};
+
+class ShoreHub
+{
+private:
+	struct Stream
+	{
+		int fd; // -1 for a stream fed with `inject()`.
+		uint8_t pendingByte;
+		bool pending;
+		unsigned long pendingTime;
+		struct Input
+		{
+			uint16_t raw;
+			unsigned long time;
+		};
+		ShoreQueue<Input, M16_SHORE_INPUT_LENGTH> input;
+		ShoreQueue<ShoreEvent, M16_SHORE_OUTPUT_LENGTH> output;
+		ShoreQueue<uint16_t, M16_SHORE_FEEDBACK_LENGTH> feedback;
+		HarqReceiver receivers[M16_MAX_NODES];
+		uint16_t lastRaw;
+		unsigned long lastTime;
+		bool haveLast;
+		uint32_t sequence;
+		unsigned long clock; // Latest time the worker has seen on this stream.
+		ShoreStats stats;
+		uint8_t worker;
+		std::thread reader;
+	};
+	struct Worker
+	{
+		std::mutex lock;
+		std::condition_variable wake;
+		bool sleeping;
+		std::thread thread;
+	};
+
+	std::unique_ptr<Stream> streams[M16_SHORE_MAX_STREAMS];
+	uint8_t streamCount;
+	std::vector<std::unique_ptr<Worker>> workers;
+	uint8_t workerCount;
+	bool reading;
+	bool working;
+
+	int addStream(int fd);
+	void received(Stream &stream, const uint8_t *bytes, size_t length, unsigned long now);
+	void notify(Stream &stream);
+	void readLoop(Stream &stream);
+	void workLoop(uint8_t index);
+	bool process(Stream &stream);
+	void feedback(Stream &stream, HarqReceiver &receiver, unsigned long now);
+	void emit(Stream &stream, ShoreEvent &event);
+	static void count(uint64_t &counter, uint64_t amount = 1);
+
+public:
+	ShoreHub(uint8_t workers = 0);
+	~ShoreHub();
+	ShoreHub(const ShoreHub &) = delete;
+	ShoreHub &operator=(const ShoreHub &) = delete;
+
+	int addSerial(const char *path);
+	int addStream();
+	bool start();
+	void stop();
+	bool inject(uint8_t stream, const uint8_t *bytes, size_t length, unsigned long now);
+	bool read(uint8_t stream, ShoreEvent &event);
+	ShoreStats getStats(uint8_t stream);
+	uint8_t getWorkers();
+	static unsigned long millis();
+};
+#endif
+
+#endif // M16_SHORE_H
@@ -0,0 +1,80 @@
+/**
+ * @file M16-supervisor.h
+ * @brief Header file for the Supervisor class.
+ *
+ * This file contains the declaration of the Supervisor class, which watches the
+ * modem for report failures and UART errors and brings it back through a staged
+ * recovery ladder.
+ *
+ * Failed report requests count until a report is received again. Overflows and line
+ * errors only count while they come in a burst: a UART fault more than
+ * `M16_SUPERVISOR_FAULT_WINDOW_MS` after the previous one starts the count again, so
+ * isolated errors on a healthy modem never add up to a recovery.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_SUPERVISOR_H
+#define M16_SUPERVISOR_H
+
+#include "M16-lib.h"
+
+#define M16_SUPERVISOR_FAULT_WINDOW_MS 10000 // Quiet time after which UART faults are forgotten.
+
+/**
+ * @brief Steps of the recovery ladder, in the order they are tried.
+ */
+enum RecoveryStep : uint8_t
+{
+	RECOVERY_FLUSH,			 ///< Discard received data.
+	RECOVERY_BAUD_REFRESH,	 ///< Reapply the baud rate with `refreshBaudRate()`.
+	RECOVERY_MODE_RESYNC,	 ///< Bring the modem back to Transparent Mode.
+	RECOVERY_POWER_CYCLE,	 ///< Power cycle the modem through the user hook.
+	RECOVERY_CONFIG_RESTORE, ///< Reapply the configuration after a power cycle.
+	RECOVERY_STEPS
+};
+
+typedef void (*PowerCycleHook)();
+
+/**
+ * @brief Fault and recovery counters kept by the supervisor.
+ */
+struct RecoveryStats
+{
+	uint16_t reportFailures;				///< Report requests that timed out.
+	uint16_t lineErrors;					///< Framing and parity errors.
+	uint16_t overflows;						///< Receive FIFO and buffer overflows.
+	uint16_t attempts[RECOVERY_STEPS];		///< Times each step was run.
+	uint16_t successes[RECOVERY_STEPS];		///< Times each step brought the modem back.
+	uint32_t stepTimeMs[RECOVERY_STEPS];	///< Total time spent in each step.
+	uint16_t recoveries;					///< Recoveries that ended with a responding modem.
+	uint16_t failedRecoveries;				///< Recoveries where every step failed.
+	uint32_t totalRecoveryMs;				///< Total time spent in successful recoveries.
+};
+
+class Supervisor
+{
+private:
+	M16 &modem;
+	uint8_t faultThreshold;
+	uint8_t faults;			   // Consecutive failed report requests.
+	uint8_t uartFaults;		   // Overflows and line errors in the current burst.
+	unsigned long lastUartFault;
+	PowerCycleHook powerCycle;
+	RecoveryStats stats;
+	void uartFault(unsigned long now);
+	bool runStep(RecoveryStep step);
+
+public:
+	Supervisor(M16 &modem, uint8_t faultThreshold = 3);
+	void onPowerCycle(PowerCycleHook hook);
+	void reportResult(bool received);
+	bool update();
+	bool recover();
+	RecoveryStats getStats();
+	uint32_t meanTimeToRecover();
+};
+
+#endif // M16_SUPERVISOR_H
@@ -0,0 +1,100 @@
+/**
+ * @file M16-telemetry.h
+ * @brief Delta-compressed link telemetry from the nodes to the server.
+ *
+ * A node records the reports of its own modem in a LinkHistory. Whenever the
+ * application has nothing else to send, it takes a telemetry message from the
+ * history and sends it with a HarqSender. The message holds the oldest sample in
+ * full and every following sample as the difference to the one before, each packed
+ * into 4-bit groups, so a sample with small changes takes about three bytes instead
+ * of a full report. On the server, LinkMap combines these with the reports of its
+ * own modem into a view of both directions of every link.
+ *
+ * All classes only depend on the protocol definitions and take the current time
+ * as a parameter.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_TELEMETRY_H
+#define M16_TELEMETRY_H
+
+#include "M16-protocol.h"
+#include "M16-harq.h"
+
+#define M16_TELEMETRY_TYPE 0xe1		   // Type byte of a telemetry message.
+#define M16_TELEMETRY_HISTORY 16	   // Samples a node keeps until they are sent.
+#define M16_TELEMETRY_BATCH 8		   // Samples that make a message worth sending.
+#define M16_TELEMETRY_MAX_AGE_MS 3600000 // Age of the oldest sample that makes a message worth sending.
+#define M16_TELEMETRY_HEADER_LENGTH 12 // Bytes before the first difference.
+#define M16_TELEMETRY_SMOOTHING 0.25f  // Weight of a new sample in the link map averages.
+
+/**
+ * @brief The link quality seen by one modem at one time.
+ */
+struct LinkSample
+{
+	uint32_t time;		  ///< Time of the sample in seconds, 24 bits are sent.
+	uint8_t signalPower;  ///< Signal power of the last received block.
+	uint8_t noisePower;	  ///< Noise power of the last received block.
+	uint8_t bitErrorRate; ///< Bit error rate of the last received block.
+	uint16_t packetValid; ///< Counter of valid blocks.
+	uint8_t packetInvalid; ///< Counter of invalid blocks.
+};
+
+uint8_t telemetryPack(const LinkSample *samples, uint8_t count, uint8_t sequence, uint8_t *buffer, uint8_t &packed);
+uint8_t telemetryUnpack(const uint8_t *buffer, uint8_t length, LinkSample *samples, uint8_t maxSamples,
+						uint8_t &sequence);
+
+class LinkHistory
+{
+private:
+	LinkSample samples[M16_TELEMETRY_HISTORY];
+	unsigned long recorded[M16_TELEMETRY_HISTORY]; // Time each sample was recorded, in milliseconds.
+	uint8_t head;
+	uint8_t count;
+	uint8_t sequence;
+	uint32_t overwritten;
+
+public:
+	LinkHistory();
+	void record(const Report &report, unsigned long now);
+	uint8_t size();
+	bool due(unsigned long now);
+	uint8_t nextMessage(uint8_t *buffer);
+	uint32_t getOverwritten();
+};
+
+/**
+ * @brief Both directions of the link between the server and one node.
+ */
+struct LinkMapEntry
+{
+	bool hasUplink;		  ///< The server has heard the node.
+	bool hasDownlink;	  ///< The node has sent telemetry.
+	float uplinkSnr;	  ///< Average signal minus noise power at the server.
+	float uplinkBer;	  ///< Average bit error rate at the server.
+	float downlinkSnr;	  ///< Average signal minus noise power at the node.
+	float downlinkBer;	  ///< Average bit error rate at the node.
+	float downlinkLoss;	  ///< Fraction of invalid blocks at the node over the last message.
+	uint32_t downlinkTime; ///< Node time of the newest telemetry sample, in seconds.
+	uint8_t sequence;	  ///< Sequence of the last telemetry message.
+	uint32_t lostMessages; ///< Telemetry messages missing from the sequence.
+};
+
+class LinkMap
+{
+private:
+	LinkMapEntry entries[M16_MAX_NODES];
+	static void smooth(float &average, float sample, bool first);
+
+public:
+	LinkMap();
+	void uplink(uint8_t id, const Report &report);
+	bool telemetryReceived(uint8_t id, const uint8_t *buffer, uint8_t length);
+	const LinkMapEntry &get(uint8_t id);
+};
+
+#endif // M16_TELEMETRY_H
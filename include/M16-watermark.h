@@ -0,0 +1,81 @@
+/**
+ * @file M16-watermark.h
+ * @brief High-water marks of the buffers, queues, pools and stacks used by the library.
+ *
+ * Watermarks collects the peak fill level and overflow count of every buffer the
+ * library uses into one WatermarkSnapshot. The snapshot can be printed locally, or
+ * packed into a single multi-block message and sent to the server, so memory can be
+ * sized per deployment from field data instead of guesswork.
+ *
+ * The snapshot format is platform independent so the server can unpack it; the
+ * Watermarks class itself is only available on the ESP32.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+
+#ifndef M16_WATERMARK_H
+#define M16_WATERMARK_H
+
+#include "M16-protocol.h"
+#include "M16-harq.h"
+
+#define M16_WATERMARK_TASKS 4		 // Tasks whose stacks can be watched.
+#define M16_WATERMARK_VERSION 1		 // First byte of a packed snapshot.
+#define M16_WATERMARK_PACKED_SIZE 25 // Bytes in a packed snapshot.
+
+static_assert(M16_WATERMARK_PACKED_SIZE <= M16_HARQ_MAX_LENGTH, "A snapshot must fit in one message.");
+
+/**
+ * @brief Peak usage of every buffer since the last reset.
+ *
+ * Counters saturate instead of wrapping.
+ */
+struct WatermarkSnapshot
+{
+	uint16_t rxBufferPeak;	 ///< Most bytes in the driver receive buffer.
+	uint16_t rxOverflows;	 ///< Receive overflows reported by the driver.
+	uint8_t fastRxPeak;		 ///< Most packets in the fast receive queue.
+	uint16_t fastRxDropped;	 ///< Packets lost to a full fast receive queue or FIFO.
+	uint8_t flowQueuePeak;	 ///< Most packets waiting for credit.
+	uint16_t flowRejected;	 ///< Packets rejected by a full flow control queue.
+	uint8_t packetPoolPeak;	 ///< Most packets allocated from `packetPool`.
+	uint8_t messagePoolPeak; ///< Most messages allocated from `messagePool`.
+	uint8_t reportPoolPeak;	 ///< Most snapshots allocated from `reportPool`.
+	uint16_t poolFailures;	 ///< Failed allocations from all three pools.
+	uint8_t tasks;			 ///< Number of valid entries in `stackFree`.
+	uint16_t stackFree[M16_WATERMARK_TASKS]; ///< Least free stack of each watched task, in bytes.
+};
+
+uint8_t packWatermarks(const WatermarkSnapshot &snapshot, uint8_t *buffer);
+bool unpackWatermarks(const uint8_t *buffer, uint8_t length, WatermarkSnapshot &snapshot);
+
+#if defined(ESP_PLATFORM)
+#include "M16-lib.h"
+#include "M16-fastrx.h"
+#include "M16-flow.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+class Watermarks
+{
+private:
+	M16 &modem;
+	FastRx *fastRx;
+	FlowSender *flow;
+	TaskHandle_t tasks[M16_WATERMARK_TASKS];
+	uint8_t taskCount;
+
+public:
+	Watermarks(M16 &modem);
+	void watchFastRx(FastRx &receiver);
+	void watchFlow(FlowSender &sender);
+	bool watchTask(TaskHandle_t task = NULL);
+	void sample();
+	WatermarkSnapshot snapshot();
+	void reset();
+};
+#endif
+
+#endif // M16_WATERMARK_H
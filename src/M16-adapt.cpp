@@ -0,0 +1,457 @@
+/**
+ * @file M16-adapt.cpp
+ * @brief Implementation of rate adaptation for multi-block messages.
+ *
+ * This file contains the LinkEstimator, the RateAdapter with its goodput model,
+ * and the AdaptSimulation used to compare adaptation with fixed settings on a
+ * channel that changes over time.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-adapt.h"
+#include <math.h>
+#include <stdlib.h>
+
+/**
+ * @brief Constructor for the LinkEstimator class.
+ */
+LinkEstimator::LinkEstimator() : blockErrorRate(0.0f), valid(false), restart(false), snr(0), haveSnr(false) {}
+
+/**
+ * @brief Adds a sample of the block loss probability to the estimate.
+ */
+void LinkEstimator::sample(float blockErrorRate)
+{
+	if (!this->valid || this->restart)
+	{
+		this->blockErrorRate = blockErrorRate;
+		this->valid = true;
+		this->restart = false;
+		return;
+	}
+	this->blockErrorRate += M16_ADAPT_SMOOTHING * (blockErrorRate - this->blockErrorRate);
+}
+
+/**
+ * @brief Updates the estimate from a modem report.
+ *
+ * The bit error rate of the report is turned into a block loss probability. A large
+ * change in signal to noise ratio means the channel changed, so the estimate starts
+ * over from the next sample instead of slowly drifting towards it.
+ *
+ * @param report The report received by `requestReport()`.
+ */
+void LinkEstimator::reportReceived(const Report &report)
+{
+	int16_t snr = (int16_t)report.signalPower - (int16_t)report.noisePower;
+	if (this->haveSnr && abs(snr - this->snr) >= M16_ADAPT_SNR_STEP)
+	{
+		this->restart = true;
+	}
+	this->snr = snr;
+	this->haveSnr = true;
+
+	float bitErrorRate = report.bitErrorRate / M16_ADAPT_BER_SCALE;
+	this->sample(HarqSimulation::blockErrorRate(bitErrorRate < 0.5f ? bitErrorRate : 0.5f));
+}
+
+/**
+ * @brief Updates the estimate from the outcome of a round.
+ *
+ * @param sent The number of blocks sent in the round.
+ * @param lost The number of those blocks that were lost.
+ */
+void LinkEstimator::blocksObserved(uint8_t sent, uint8_t lost)
+{
+	if (sent == 0)
+	{
+		return;
+	}
+	this->sample((float)(lost < sent ? lost : sent) / sent);
+}
+
+/**
+ * @brief Returns the estimated probability that a block is lost.
+ */
+float LinkEstimator::getBlockErrorRate()
+{
+	return this->valid ? this->blockErrorRate : 0.0f;
+}
+
+/**
+ * @brief Checks whether any sample has been received.
+ */
+bool LinkEstimator::isValid()
+{
+	return this->valid;
+}
+
+/**
+ * @brief Constructor for the RateAdapter class.
+ */
+RateAdapter::RateAdapter() : plans{}
+{
+	for (uint16_t id = 0; id < M16_MAX_NODES; id++)
+	{
+		this->plannedFor[id] = -1.0f;
+	}
+}
+
+/**
+ * @brief Returns the link estimate of a destination.
+ *
+ * @param id The id of the destination.
+ */
+LinkEstimator &RateAdapter::link(uint8_t id)
+{
+	return this->links[id < M16_MAX_NODES ? id : 0];
+}
+
+/**
+ * @brief Returns how to send the next message to a destination.
+ *
+ * The plan is only recalculated when the estimate has moved by `M16_ADAPT_REPLAN`.
+ *
+ * @param id The id of the destination.
+ * @return The message length, redundancy level and retry budget to use.
+ */
+TransmitPlan RateAdapter::plan(uint8_t id)
+{
+	if (id >= M16_MAX_NODES)
+	{
+		id = 0;
+	}
+	float blockErrorRate = this->links[id].getBlockErrorRate();
+	float planned = this->plannedFor[id];
+	if (planned < 0.0f || fabsf(blockErrorRate - planned) > M16_ADAPT_REPLAN * (planned > 0.001f ? planned : 0.001f))
+	{
+		this->plans[id] = RateAdapter::choose(blockErrorRate);
+		this->plannedFor[id] = blockErrorRate;
+	}
+	return this->plans[id];
+}
+
+/**
+ * @brief Picks the settings with the highest expected goodput.
+ *
+ * Every message length and redundancy level is evaluated with the rounds that fit
+ * within `M16_ADAPT_DEADLINE_MS`. A plan is only eligible if it delivers all but
+ * `M16_ADAPT_TARGET_LOSS` of the messages at a loss probability `M16_ADAPT_MARGIN`
+ * times the estimate plus `M16_ADAPT_LOSS_FLOOR`, since the estimate lags a channel
+ * that is getting worse and cannot see losses below the resolution of the report.
+ * Long messages need fewer rounds but each round takes longer, so they run out of
+ * time first as the link gets worse. If no plan is eligible, the one that delivers
+ * the most messages in time is used.
+ *
+ * The retry budget is then the smallest that still meets the target, so hopeless
+ * messages give up their airtime early.
+ *
+ * @param blockErrorRate Probability that a block is lost.
+ * @return The best plan.
+ */
+TransmitPlan RateAdapter::choose(float blockErrorRate)
+{
+	static const uint8_t batches[M16_ADAPT_BATCHES] = {4, 8, 16, M16_HARQ_MAX_LENGTH};
+	TransmitPlan best{batches[0], 0, 0, 0.0f};
+	bool bestEligible = false;
+	float bestDelivered = -1.0f;
+	float delivery[M16_ADAPT_MAX_RETRIES + 1];
+
+	float pessimistic = blockErrorRate * M16_ADAPT_MARGIN + M16_ADAPT_LOSS_FLOOR;
+	if (pessimistic > 0.5f)
+	{
+		pessimistic = 0.5f;
+	}
+
+	for (uint8_t b = 0; b < M16_ADAPT_BATCHES; b++)
+	{
+		for (uint8_t level = 0; level < M16_HARQ_REDUNDANCY_LEVELS; level++)
+		{
+			uint8_t retries = RateAdapter::deadlineRetries(batches[b], level);
+			RateAdapter::expectedGoodput(pessimistic, batches[b], level, retries, delivery);
+			bool eligible = delivery[retries] >= 1.0f - M16_ADAPT_TARGET_LOSS;
+			float goodput = RateAdapter::expectedGoodput(blockErrorRate, batches[b], level, retries);
+			if (eligible ? !bestEligible || goodput > best.goodput : !bestEligible && delivery[retries] > bestDelivered)
+			{
+				best = TransmitPlan{batches[b], level, retries, goodput};
+				bestEligible = eligible;
+				bestDelivered = delivery[retries];
+			}
+		}
+	}
+
+	RateAdapter::expectedGoodput(pessimistic, best.batch, best.redundancy, best.retries, delivery);
+	for (uint8_t r = 0; r < best.retries; r++)
+	{
+		if (delivery[r] >= 1.0f - M16_ADAPT_TARGET_LOSS)
+		{
+			best.retries = r;
+			best.goodput = RateAdapter::expectedGoodput(blockErrorRate, best.batch, best.redundancy, r);
+			break;
+		}
+	}
+	return best;
+}
+
+/**
+ * @brief Calculates the retry budget that always ends within the deadline.
+ *
+ * In the worst case every round repeats the first one and waits for the feedback
+ * timeout, so the budget does not depend on the loss probability.
+ *
+ * @param batch Bytes per message.
+ * @param redundancy Redundancy level of the first round.
+ * @return Rounds after the first, at most `M16_ADAPT_MAX_RETRIES`.
+ */
+uint8_t RateAdapter::deadlineRetries(uint8_t batch, uint8_t redundancy)
+{
+	unsigned long round = (1UL + batch + harqRedundancy(batch, redundancy)) * M16_BLOCK_INTERVAL_MS + M16_HARQ_FEEDBACK_TIMEOUT_MS;
+	unsigned long rounds = M16_ADAPT_DEADLINE_MS / round;
+	if (rounds == 0)
+	{
+		return 0;
+	}
+	return rounds - 1 < M16_ADAPT_MAX_RETRIES ? rounds - 1 : M16_ADAPT_MAX_RETRIES;
+}
+
+/**
+ * @brief Calculates the expected goodput of hybrid ARQ with independent block losses.
+ *
+ * The distribution of the bytes still missing is carried from round to round. A
+ * round costs its blocks and the feedback block, and a lost start or feedback block
+ * costs `M16_HARQ_FEEDBACK_TIMEOUT_MS` instead.
+ *
+ * @param blockErrorRate Probability that a block is lost.
+ * @param batch Bytes per message.
+ * @param redundancy Redundancy level of the first round.
+ * @param retries Rounds after the first before the message is dropped.
+ * @param delivery If not nullptr, receives the probability that the message is
+ *                 delivered within 1 to `retries` + 1 rounds.
+ * @return Expected delivered payload bits per second.
+ */
+float RateAdapter::expectedGoodput(float blockErrorRate, uint8_t batch, uint8_t redundancy, uint8_t retries, float *delivery)
+{
+	const float block = M16_BLOCK_INTERVAL_MS;
+	const float timeout = M16_HARQ_FEEDBACK_TIMEOUT_MS;
+	float p = blockErrorRate;
+	float q = 1.0f - p;
+	uint8_t first = batch + harqRedundancy(batch, redundancy);
+	float feedback = q * (block + p * timeout) + p * timeout;
+
+	float unstarted = 1.0f; // The start block of the data round has not arrived yet.
+	float missing[M16_HARQ_MAX_LENGTH + 1] = {};
+	float nextMissing[M16_HARQ_MAX_LENGTH + 1];
+	float row[M16_HARQ_MAX_LENGTH + M16_HARQ_MAX_LENGTH / 2 + 2]; // Binomial probabilities of received blocks.
+	float delivered = 0.0f;
+	float time = 0.0f;
+
+	for (uint8_t round = 0; round <= retries; round++)
+	{
+		time += unstarted * ((1 + first) * block + feedback);
+		for (uint8_t m = 1; m <= batch; m++)
+		{
+			time += missing[m] * ((1 + m) * block + feedback);
+			nextMissing[m] = missing[m] * p;
+		}
+		float nextUnstarted = unstarted * p;
+
+		// Build the binomial rows one length at a time, and use each when it is reached.
+		row[0] = 1.0f;
+		for (uint8_t n = 0; n <= first; n++)
+		{
+			if (n > 0)
+			{
+				row[n] = 0.0f;
+				for (uint8_t x = n; x > 0; x--)
+				{
+					row[x] = row[x] * p + row[x - 1] * q;
+				}
+				row[0] *= p;
+			}
+			float mass = n <= batch && n > 0 ? missing[n] : 0.0f;
+			for (uint8_t x = 0; x <= n && mass > 0.0f; x++)
+			{
+				uint8_t left = n - x;
+				if (left == 0)
+				{
+					delivered += mass * q * row[x];
+				}
+				else
+				{
+					nextMissing[left] += mass * q * row[x];
+				}
+			}
+			if (n == first)
+			{
+				for (uint8_t x = 0; x <= n; x++)
+				{
+					uint8_t left = x >= batch ? 0 : batch - x;
+					if (left == 0)
+					{
+						delivered += unstarted * q * row[x];
+					}
+					else
+					{
+						nextMissing[left] += unstarted * q * row[x];
+					}
+				}
+			}
+		}
+
+		unstarted = nextUnstarted;
+		for (uint8_t m = 1; m <= batch; m++)
+		{
+			missing[m] = nextMissing[m];
+		}
+		if (delivery != nullptr)
+		{
+			delivery[round] = delivered;
+		}
+	}
+	return time > 0.0f ? 8.0f * batch * delivered * 1000.0f / time : 0.0f;
+}
+
+/**
+ * @brief Constructor for the AdaptSimulation class.
+ *
+ * @param seed Seed of the random generator, runs with the same seed see the same losses.
+ */
+AdaptSimulation::AdaptSimulation(uint32_t seed) : seed(seed ? seed : 1) {}
+
+/**
+ * @brief Returns the next value of the xorshift32 generator.
+ */
+uint32_t AdaptSimulation::next()
+{
+	this->seed ^= this->seed << 13;
+	this->seed ^= this->seed >> 17;
+	this->seed ^= this->seed << 5;
+	return this->seed;
+}
+
+/**
+ * @brief Returns a uniform random number in [0, 1).
+ */
+float AdaptSimulation::random()
+{
+	return (float)this->next() / 4294967296.0f;
+}
+
+/**
+ * @brief Bit error rate of the simulated channel.
+ *
+ * The rate swings between 1e-4 and 3e-2 on a log scale, like a link that fades in
+ * and out with the tide.
+ *
+ * @param now The time in milliseconds.
+ * @param periodMs The duration of one swing.
+ * @return The probability that a bit is wrong.
+ */
+float AdaptSimulation::bitErrorRate(unsigned long now, unsigned long periodMs)
+{
+	float phase = 2.0f * (float)M_PI * (float)(now % periodMs) / periodMs;
+	return powf(10.0f, -2.75f + 1.25f * sinf(phase));
+}
+
+/**
+ * @brief Sends messages with hybrid ARQ over the simulated channel.
+ *
+ * Every feedback block that arrives updates the link estimate with the losses it
+ * reveals, and with a report whose bit error rate is measured with up to 50% error.
+ * Messages still missing bytes after the retry budget or `M16_ADAPT_DEADLINE_MS`
+ * are dropped.
+ *
+ * @param fixed The settings to use, or nullptr to adapt them with a RateAdapter.
+ * @param durationMs Simulated time.
+ * @param periodMs Duration of one swing of the channel.
+ * @return Goodput, message loss and the average settings used.
+ */
+AdaptResult AdaptSimulation::run(const TransmitPlan *fixed, unsigned long durationMs, unsigned long periodMs)
+{
+	const uint8_t id = 1;
+	RateAdapter adapter;
+	HarqSender sender(true);
+	HarqReceiver receiver(true);
+	uint8_t message[M16_HARQ_MAX_LENGTH];
+	uint8_t received[M16_HARQ_MAX_LENGTH];
+	unsigned long now = 0;
+	uint32_t delivered = 0, messages = 0, dropped = 0, batches = 0, levels = 0;
+	AdaptResult result{};
+
+	while (now < durationMs)
+	{
+		TransmitPlan plan = fixed != nullptr ? *fixed : adapter.plan(id);
+		for (uint8_t i = 0; i < plan.batch; i++)
+		{
+			message[i] = this->next();
+		}
+		sender.begin(id, message, plan.batch, plan.redundancy, plan.retries);
+		receiver.reset();
+		unsigned long started = now;
+		messages++;
+		batches += plan.batch;
+		levels += plan.redundancy;
+
+		uint8_t extra = harqRedundancy(plan.batch, plan.redundancy);
+		uint8_t roundSize = plan.batch + extra;
+		bool dataRound = true;
+		while (!sender.complete() && !sender.isDropped() && now - started <= M16_ADAPT_DEADLINE_MS)
+		{
+
+			ProtocolStructure packet;
+			while (sender.nextBlock(packet))
+			{
+				if (this->random() >= HarqSimulation::blockErrorRate(bitErrorRate(now, periodMs)))
+				{
+					receiver.packetReceived(packet, now);
+				}
+				now += M16_BLOCK_INTERVAL_MS;
+			}
+
+			if (receiver.feedbackDue(now))
+			{
+				ProtocolStructure ack = receiver.feedback(now);
+				float ber = bitErrorRate(now, periodMs);
+				now += M16_BLOCK_INTERVAL_MS;
+				if (this->random() >= HarqSimulation::blockErrorRate(ber))
+				{
+					sender.feedback(ack);
+					// Losses within the redundancy of the first round do not show up in the feedback.
+					uint8_t lost = ack.data == 0 ? 0 : ack.data + (dataRound ? extra : 0);
+					adapter.link(id).blocksObserved(roundSize, lost);
+
+					Report report{};
+					float measured = ber * (0.5f + this->random());
+					float snr = 10.0f * log10f(0.1f / ber);
+					report.bitErrorRate = measured * M16_ADAPT_BER_SCALE < 255.0f ? lroundf(measured * M16_ADAPT_BER_SCALE) : 255;
+					report.noisePower = 40;
+					report.signalPower = report.noisePower + lroundf(snr);
+					adapter.link(id).reportReceived(report);
+
+					roundSize = ack.data;
+					dataRound = false;
+					continue;
+				}
+			}
+			now += M16_HARQ_FEEDBACK_TIMEOUT_MS;
+			sender.timeout();
+		}
+
+		if (sender.complete() && now - started <= M16_ADAPT_DEADLINE_MS && receiver.read(received) == plan.batch)
+		{
+			delivered += plan.batch;
+		}
+		else
+		{
+			dropped++;
+		}
+	}
+
+	result.goodput = now > 0 ? delivered * 8 * 1000.0f / now : 0.0f;
+	result.messageLoss = messages > 0 ? (float)dropped / messages : 0.0f;
+	result.meanBatch = messages > 0 ? (float)batches / messages : 0.0f;
+	result.meanRedundancy = messages > 0 ? (float)levels / messages : 0.0f;
+	return result;
+}
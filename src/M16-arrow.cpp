@@ -0,0 +1,411 @@
+/**
+ * @file M16-arrow.cpp
+ * @brief Implementation of the Arrow export of decoded traffic.
+ *
+ * This file contains the ArrowTrafficWriter class, compiled only when the Arrow
+ * C++ headers are available on the host.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-arrow.h"
+
+#if defined(M16_HAVE_ARROW)
+#include <string>
+#include <vector>
+
+/**
+ * @brief Constructor for the ArrowTrafficWriter class.
+ *
+ * Larger batches compress and scan better, smaller batches reach the file sooner.
+ *
+ * @param batchRows Rows of each table buffered before a record batch is written.
+ */
+ArrowTrafficWriter::ArrowTrafficWriter(int64_t batchRows)
+	: batchRows(batchRows > 0 ? batchRows : M16_ARROW_BATCH_ROWS), packets{}, reports{},
+	  packetTime(arrow::timestamp(arrow::TimeUnit::MILLI, "UTC"), arrow::default_memory_pool()),
+	  reportTime(arrow::timestamp(arrow::TimeUnit::MILLI, "UTC"), arrow::default_memory_pool())
+{
+	auto time = arrow::timestamp(arrow::TimeUnit::MILLI, "UTC");
+	auto layout = arrow::key_value_metadata({"m16.id_bits", "m16.command_bits", "m16.data_bits"},
+											{std::to_string(M16_ID_BITS), std::to_string(M16_COMMAND_BITS),
+											 std::to_string(M16_DATA_BITS)});
+	this->packets.schema = arrow::schema({arrow::field("time", time, false),
+										  arrow::field("modem", arrow::uint8(), false),
+										  arrow::field("raw", arrow::uint16(), false),
+										  arrow::field("id", arrow::uint8(), false),
+										  arrow::field("command", arrow::uint8(), false),
+										  arrow::field("data", arrow::uint16(), false)},
+										 layout);
+	this->reports.schema = arrow::schema({arrow::field("time", time, false),
+										  arrow::field("modem", arrow::uint8(), false),
+										  arrow::field("transport_block", arrow::uint16(), false),
+										  arrow::field("bit_error_rate", arrow::uint8(), false),
+										  arrow::field("signal_power", arrow::uint8(), false),
+										  arrow::field("noise_power", arrow::uint8(), false),
+										  arrow::field("packet_valid", arrow::uint16(), false),
+										  arrow::field("packet_invalid", arrow::uint8(), false),
+										  arrow::field("firmware_version", arrow::uint8(), false),
+										  arrow::field("time_since_boot", arrow::uint32(), false),
+										  arrow::field("chip_id", arrow::uint16(), false),
+										  arrow::field("hw_rev", arrow::uint8(), false),
+										  arrow::field("channel", arrow::uint8(), false),
+										  arrow::field("tb_valid", arrow::boolean(), false),
+										  arrow::field("tx_complete", arrow::boolean(), false),
+										  arrow::field("diagnostic", arrow::boolean(), false),
+										  arrow::field("power_level", arrow::uint8(), false)});
+}
+
+/**
+ * @brief Destructor, writes the buffered rows and closes the files.
+ */
+ArrowTrafficWriter::~ArrowTrafficWriter()
+{
+	this->close();
+}
+
+/**
+ * @brief Remembers the message of a failed Arrow call.
+ *
+ * @return true if the call succeeded, false otherwise.
+ */
+bool ArrowTrafficWriter::check(const arrow::Status &status)
+{
+	if (!status.ok())
+	{
+		this->error = status.ToString();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Creates a file and writes the schema of its table.
+ */
+bool ArrowTrafficWriter::openOutput(Output &output, const char *path, ArrowFormat format)
+{
+	auto sink = arrow::io::FileOutputStream::Open(path);
+	if (!this->check(sink.status()))
+	{
+		return false;
+	}
+	output.sink = *sink;
+	auto writer = format == ARROW_FILE ? arrow::ipc::MakeFileWriter(output.sink, output.schema)
+									   : arrow::ipc::MakeStreamWriter(output.sink, output.schema);
+	if (!this->check(writer.status()))
+	{
+		output.sink.reset();
+		return false;
+	}
+	output.writer = *writer;
+	output.rows = 0;
+	return true;
+}
+
+/**
+ * @brief Reserves a full batch in every packet column, so rows are appended without checks.
+ */
+bool ArrowTrafficWriter::reservePackets()
+{
+	arrow::ArrayBuilder *builders[] = {&this->packetTime, &this->packetModem, &this->packetRaw,
+									   &this->packetId, &this->packetCommand, &this->packetData};
+	for (arrow::ArrayBuilder *builder : builders)
+	{
+		if (!this->check(builder->Reserve(this->batchRows)))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Reserves a full batch in every report column, so rows are appended without checks.
+ */
+bool ArrowTrafficWriter::reserveReports()
+{
+	arrow::ArrayBuilder *builders[] = {
+		&this->reportTime, &this->reportModem, &this->reportTransportBlock, &this->reportBitErrorRate,
+		&this->reportSignalPower, &this->reportNoisePower, &this->reportPacketValid, &this->reportPacketInvalid,
+		&this->reportFirmwareVersion, &this->reportTimeSinceBoot, &this->reportChipId, &this->reportHwRev,
+		&this->reportChannel, &this->reportTbValid, &this->reportTxComplete, &this->reportDiagnostic,
+		&this->reportPowerLevel};
+	for (arrow::ArrayBuilder *builder : builders)
+	{
+		if (!this->check(builder->Reserve(this->batchRows)))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Closes a file after a failed write, keeping the message of the failure.
+ *
+ * The builders of the table are no longer reserved, so rows must not be appended
+ * until the file is opened again.
+ */
+void ArrowTrafficWriter::abandon(Output &output)
+{
+	std::string error = this->error;
+	this->closeOutput(output);
+	this->error = error;
+}
+
+/**
+ * @brief Writes the buffered packets as one record batch.
+ *
+ * If the batch cannot be written, the packet file is closed and later packets are refused.
+ */
+bool ArrowTrafficWriter::writePackets()
+{
+	if (this->packets.rows == 0)
+	{
+		return true;
+	}
+	arrow::ArrayBuilder *builders[] = {&this->packetTime, &this->packetModem, &this->packetRaw,
+									   &this->packetId, &this->packetCommand, &this->packetData};
+	std::vector<std::shared_ptr<arrow::Array>> columns(sizeof(builders) / sizeof(builders[0]));
+	bool ok = true;
+	for (size_t i = 0; i < columns.size() && ok; i++)
+	{
+		ok = this->check(builders[i]->Finish(&columns[i]));
+	}
+	if (ok)
+	{
+		auto batch = arrow::RecordBatch::Make(this->packets.schema, this->packets.rows, columns);
+		ok = this->check(this->packets.writer->WriteRecordBatch(*batch));
+	}
+	this->packets.rows = 0;
+	if (ok && this->reservePackets())
+	{
+		return true;
+	}
+	for (arrow::ArrayBuilder *builder : builders)
+	{
+		builder->Reset();
+	}
+	this->abandon(this->packets);
+	return false;
+}
+
+/**
+ * @brief Writes the buffered reports as one record batch.
+ *
+ * If the batch cannot be written, the report file is closed and later reports are refused.
+ */
+bool ArrowTrafficWriter::writeReports()
+{
+	if (this->reports.rows == 0)
+	{
+		return true;
+	}
+	arrow::ArrayBuilder *builders[] = {
+		&this->reportTime, &this->reportModem, &this->reportTransportBlock, &this->reportBitErrorRate,
+		&this->reportSignalPower, &this->reportNoisePower, &this->reportPacketValid, &this->reportPacketInvalid,
+		&this->reportFirmwareVersion, &this->reportTimeSinceBoot, &this->reportChipId, &this->reportHwRev,
+		&this->reportChannel, &this->reportTbValid, &this->reportTxComplete, &this->reportDiagnostic,
+		&this->reportPowerLevel};
+	std::vector<std::shared_ptr<arrow::Array>> columns(sizeof(builders) / sizeof(builders[0]));
+	bool ok = true;
+	for (size_t i = 0; i < columns.size() && ok; i++)
+	{
+		ok = this->check(builders[i]->Finish(&columns[i]));
+	}
+	if (ok)
+	{
+		auto batch = arrow::RecordBatch::Make(this->reports.schema, this->reports.rows, columns);
+		ok = this->check(this->reports.writer->WriteRecordBatch(*batch));
+	}
+	this->reports.rows = 0;
+	if (ok && this->reserveReports())
+	{
+		return true;
+	}
+	for (arrow::ArrayBuilder *builder : builders)
+	{
+		builder->Reset();
+	}
+	this->abandon(this->reports);
+	return false;
+}
+
+/**
+ * @brief Finishes a file, writing the footer in the file format.
+ */
+bool ArrowTrafficWriter::closeOutput(Output &output)
+{
+	bool ok = true;
+	if (output.writer)
+	{
+		ok = this->check(output.writer->Close());
+		output.writer.reset();
+	}
+	if (output.sink)
+	{
+		ok = this->check(output.sink->Close()) && ok;
+		output.sink.reset();
+	}
+	output.rows = 0;
+	return ok;
+}
+
+/**
+ * @brief Creates the output files, replacing existing files.
+ *
+ * @param packetPath File for the packet table, or nullptr to not export packets.
+ * @param reportPath File for the report table, or nullptr to not export reports.
+ * @param format The IPC format of both files.
+ * @return false if a file could not be created, see `getError()`, true otherwise.
+ */
+bool ArrowTrafficWriter::open(const char *packetPath, const char *reportPath, ArrowFormat format)
+{
+	this->close();
+	if (packetPath != nullptr && !(this->openOutput(this->packets, packetPath, format) && this->reservePackets()))
+	{
+		this->closeOutput(this->packets);
+		return false;
+	}
+	if (reportPath != nullptr && !(this->openOutput(this->reports, reportPath, format) && this->reserveReports()))
+	{
+		this->closeOutput(this->packets);
+		this->closeOutput(this->reports);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Decodes a received packet into the packet table.
+ *
+ * @param raw The 16-bit packet as received.
+ * @param timeMs Receive time in milliseconds since the Unix epoch.
+ * @param modem Topside modem the packet was received on.
+ * @return false if packets are not exported or the batch could not be written, true otherwise.
+ */
+bool ArrowTrafficWriter::packet(uint16_t raw, int64_t timeMs, uint8_t modem)
+{
+	if (!this->packets.writer)
+	{
+		return false;
+	}
+	this->packetTime.UnsafeAppend(timeMs);
+	this->packetModem.UnsafeAppend(modem);
+	this->packetRaw.UnsafeAppend(raw);
+	this->packetId.UnsafeAppend(PacketLayout::id(raw));
+	this->packetCommand.UnsafeAppend(PacketLayout::command(raw));
+	this->packetData.UnsafeAppend(PacketLayout::data(raw));
+	if (++this->packets.rows == this->batchRows)
+	{
+		return this->writePackets();
+	}
+	return true;
+}
+
+/**
+ * @brief Decodes a received packet into the packet table.
+ *
+ * @param bytes The two bytes of the packet in the order they were received.
+ * @param timeMs Receive time in milliseconds since the Unix epoch.
+ * @param modem Topside modem the packet was received on.
+ * @return false if packets are not exported or the batch could not be written, true otherwise.
+ */
+bool ArrowTrafficWriter::packet(const uint8_t *bytes, int64_t timeMs, uint8_t modem)
+{
+	return this->packet((uint16_t)((bytes[0] << 8) | bytes[1]), timeMs, modem);
+}
+
+/**
+ * @brief Adds a report to the report table.
+ *
+ * @param report The report, for example `M16::report` after `requestReport()`.
+ * @param timeMs Time of the report in milliseconds since the Unix epoch.
+ * @param modem Topside modem the report was read from.
+ * @return false if reports are not exported or the batch could not be written, true otherwise.
+ */
+bool ArrowTrafficWriter::report(const Report &report, int64_t timeMs, uint8_t modem)
+{
+	if (!this->reports.writer)
+	{
+		return false;
+	}
+	this->reportTime.UnsafeAppend(timeMs);
+	this->reportModem.UnsafeAppend(modem);
+	this->reportTransportBlock.UnsafeAppend(report.transportBlock);
+	this->reportBitErrorRate.UnsafeAppend(report.bitErrorRate);
+	this->reportSignalPower.UnsafeAppend(report.signalPower);
+	this->reportNoisePower.UnsafeAppend(report.noisePower);
+	this->reportPacketValid.UnsafeAppend(report.packetValid);
+	this->reportPacketInvalid.UnsafeAppend(report.packedInvalid);
+	this->reportFirmwareVersion.UnsafeAppend(report.firmwareVersion);
+	this->reportTimeSinceBoot.UnsafeAppend(report.timeSinceBoot);
+	this->reportChipId.UnsafeAppend(report.chipID);
+	this->reportHwRev.UnsafeAppend(report.hwRev);
+	this->reportChannel.UnsafeAppend(report.channel);
+	this->reportTbValid.UnsafeAppend(report.tbValid != 0);
+	this->reportTxComplete.UnsafeAppend(report.txComplete != 0);
+	this->reportDiagnostic.UnsafeAppend(report.diagnostic != 0);
+	this->reportPowerLevel.UnsafeAppend(report.powerLevel);
+	if (++this->reports.rows == this->batchRows)
+	{
+		return this->writeReports();
+	}
+	return true;
+}
+
+/**
+ * @brief Decodes a report frame into the report table.
+ *
+ * @param bytes The `M16_REPORT_LENGTH` bytes of the frame.
+ * @param timeMs Time of the report in milliseconds since the Unix epoch.
+ * @param modem Topside modem the report was read from.
+ * @return false if reports are not exported or the batch could not be written, true otherwise.
+ */
+bool ArrowTrafficWriter::reportFrame(const uint8_t *bytes, int64_t timeMs, uint8_t modem)
+{
+	return this->report(decodeReport(bytes), timeMs, modem);
+}
+
+/**
+ * @brief Writes the buffered rows of both tables as record batches.
+ *
+ * @return false if a batch could not be written, see `getError()`, true otherwise.
+ */
+bool ArrowTrafficWriter::flush()
+{
+	bool ok = true;
+	if (this->packets.writer)
+	{
+		ok = this->writePackets();
+	}
+	if (this->reports.writer)
+	{
+		ok = this->writeReports() && ok;
+	}
+	return ok;
+}
+
+/**
+ * @brief Writes the buffered rows and closes both files.
+ *
+ * @return false if the files could not be completed, see `getError()`, true otherwise.
+ */
+bool ArrowTrafficWriter::close()
+{
+	bool ok = this->flush();
+	ok = this->closeOutput(this->packets) && ok;
+	ok = this->closeOutput(this->reports) && ok;
+	return ok;
+}
+
+/**
+ * @brief Returns the message of the last failed Arrow call.
+ */
+const std::string &ArrowTrafficWriter::getError()
+{
+	return this->error;
+}
+
+#endif
@@ -0,0 +1,307 @@
+/**
+ * @file M16-clock.cpp
+ * @brief Implementation of the clock drift estimation.
+ *
+ * This file contains the ClockEstimator, which fits the offset between the local
+ * and the server clock, and a simulation of a drifting node clock.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-clock.h"
+#include <math.h>
+
+/**
+ * @brief Constructor for the ClockEstimator class.
+ */
+ClockEstimator::ClockEstimator()
+{
+	this->reset();
+}
+
+/**
+ * @brief Forgets every pair and the rejected count.
+ */
+void ClockEstimator::reset()
+{
+	this->last = 0;
+	this->weight = 0.0;
+	this->sumX = 0.0;
+	this->sumY = 0.0;
+	this->sumXX = 0.0;
+	this->sumXY = 0.0;
+	this->variance = 0.0;
+	this->samples = 0;
+	this->outliers = 0;
+	this->rejected = 0;
+}
+
+/**
+ * @brief Returns the fitted server minus local time.
+ *
+ * @param x Local time relative to the latest pair, in milliseconds.
+ */
+double ClockEstimator::offset(double x)
+{
+	if (this->weight <= 0.0)
+	{
+		return 0.0;
+	}
+	double determinant = this->weight * this->sumXX - this->sumX * this->sumX;
+	if (this->samples < 2 || determinant <= 0.0)
+	{
+		return this->sumY / this->weight;
+	}
+	double slope = (this->weight * this->sumXY - this->sumX * this->sumY) / determinant;
+	return (this->sumY - slope * this->sumX) / this->weight + slope * x;
+}
+
+/**
+ * @brief Adds a block received from the server.
+ *
+ * Once the fit is in use, a block that arrives much later or earlier than predicted,
+ * for example one detected late in noise, is rejected. Several in a row mean the
+ * clock of either side has jumped, and the fit starts over.
+ *
+ * @param local The local time the block was received, in milliseconds.
+ * @param scheduled The server time the block was scheduled for, in milliseconds.
+ * @return false if the block was rejected as an outlier, true otherwise.
+ */
+bool ClockEstimator::blockReceived(unsigned long local, unsigned long scheduled)
+{
+	double y = (int32_t)(uint32_t)(scheduled - local);
+	if (this->samples > 0)
+	{
+		// Move the origin of x to the new pair.
+		double shift = (uint32_t)(local - this->last);
+		this->sumXX += shift * (shift * this->weight - 2.0 * this->sumX);
+		this->sumXY -= shift * this->sumY;
+		this->sumX -= shift * this->weight;
+		this->last = local;
+
+		double error = y - this->offset(0.0);
+		if (this->samples >= M16_CLOCK_MIN_SAMPLES)
+		{
+			double limit = fmax(M16_CLOCK_OUTLIER_SIGMAS * sqrt(this->variance), M16_CLOCK_OUTLIER_FLOOR_MS);
+			if (fabs(error) > limit)
+			{
+				this->rejected++;
+				if (++this->outliers < M16_CLOCK_MAX_OUTLIERS)
+				{
+					return false;
+				}
+				uint32_t rejected = this->rejected;
+				this->reset();
+				this->rejected = rejected;
+				return this->blockReceived(local, scheduled);
+			}
+			this->variance += (1.0 - M16_CLOCK_FORGETTING) * (error * error - this->variance);
+		}
+		else
+		{
+			this->variance += (error * error - this->variance) / this->samples;
+		}
+	}
+
+	this->weight = M16_CLOCK_FORGETTING * this->weight + 1.0;
+	this->sumX *= M16_CLOCK_FORGETTING;
+	this->sumY = M16_CLOCK_FORGETTING * this->sumY + y;
+	this->sumXX *= M16_CLOCK_FORGETTING;
+	this->sumXY *= M16_CLOCK_FORGETTING;
+	this->last = local;
+	this->samples++;
+	this->outliers = 0;
+	return true;
+}
+
+/**
+ * @brief Checks if enough blocks have been received to use the fit.
+ */
+bool ClockEstimator::isValid()
+{
+	return this->samples >= M16_CLOCK_MIN_SAMPLES;
+}
+
+/**
+ * @brief Converts a local time to server time.
+ *
+ * @param local The local time in milliseconds.
+ * @return The server time in milliseconds.
+ */
+unsigned long ClockEstimator::toServer(unsigned long local)
+{
+	double x = (int32_t)(uint32_t)(local - this->last);
+	return local + (long)lround(this->offset(x));
+}
+
+/**
+ * @brief Converts a server time to the local time it will happen at.
+ *
+ * Use this to set local timers for slots that are scheduled in server time.
+ *
+ * @param server The server time in milliseconds.
+ * @param now The current local time in milliseconds.
+ * @return The local time in milliseconds.
+ */
+unsigned long ClockEstimator::toLocal(unsigned long server, unsigned long now)
+{
+	unsigned long local = server - (long)lround(this->offset((int32_t)(uint32_t)(now - this->last)));
+	return server - (long)lround(this->offset((int32_t)(uint32_t)(local - this->last)));
+}
+
+/**
+ * @brief Returns how much faster the server clock runs than the local clock.
+ *
+ * @return The skew in parts per million, positive if the local clock is slow.
+ */
+double ClockEstimator::getSkewPpm()
+{
+	double determinant = this->weight * this->sumXX - this->sumX * this->sumX;
+	if (this->samples < 2 || determinant <= 0.0)
+	{
+		return 0.0;
+	}
+	return 1e6 * (this->weight * this->sumXY - this->sumX * this->sumY) / determinant;
+}
+
+/**
+ * @brief Returns the standard deviation of the recent prediction errors, in milliseconds.
+ */
+double ClockEstimator::getDeviationMs()
+{
+	return sqrt(this->variance);
+}
+
+/**
+ * @brief Returns the guard interval needed around a server block at a given time.
+ *
+ * The interval grows with the distance from the pairs the line was fitted to, since
+ * an error in the skew adds up over time.
+ *
+ * @param now The local time of the block in milliseconds.
+ * @return The guard interval on each side of the block, in milliseconds.
+ */
+unsigned long ClockEstimator::guardMs(unsigned long now)
+{
+	if (!this->isValid())
+	{
+		return M16_CLOCK_DEFAULT_GUARD_MS;
+	}
+	double x = (int32_t)(uint32_t)(now - this->last);
+	double mean = this->sumX / this->weight;
+	double spread = this->sumXX - this->sumX * mean;
+	double factor = 1.0 + 1.0 / this->weight + (spread > 0.0 ? (x - mean) * (x - mean) / spread : 0.0);
+	unsigned long guard = (unsigned long)ceil(M16_CLOCK_GUARD_SIGMAS * sqrt(this->variance * factor));
+	return guard > M16_CLOCK_MIN_GUARD_MS ? guard : M16_CLOCK_MIN_GUARD_MS;
+}
+
+/**
+ * @brief Returns the number of blocks rejected as outliers.
+ */
+uint32_t ClockEstimator::getRejected()
+{
+	return this->rejected;
+}
+
+/**
+ * @brief Constructor for the ClockSimulation class.
+ *
+ * @param seed Seed of the random number generator, must not be 0.
+ */
+ClockSimulation::ClockSimulation(uint32_t seed) : seed(seed) {}
+
+/**
+ * @brief Returns the next number from a xorshift generator.
+ */
+uint32_t ClockSimulation::next()
+{
+	this->seed ^= this->seed << 13;
+	this->seed ^= this->seed >> 17;
+	this->seed ^= this->seed << 5;
+	return this->seed;
+}
+
+/**
+ * @brief Returns a uniform random number in [0, 1).
+ */
+float ClockSimulation::random()
+{
+	return (float)this->next() / 4294967296.0f;
+}
+
+/**
+ * @brief Simulates a node that receives a server block every period.
+ *
+ * The skew of the node clock swings by `wanderPpm` around `skewPpm` once a day, like
+ * a crystal following the temperature. Each block arrives after a fixed propagation
+ * delay plus uniform jitter, and some are detected late by up to three seconds. The
+ * local clock starts just before `millis()` wraps.
+ *
+ * Until the first pairs have mostly been forgotten, an early late block can still
+ * pull the fit by hundreds of milliseconds, so errors from that warm-up are kept
+ * apart from the maximum error after it.
+ *
+ * @param skewPpm Average skew of the node clock in parts per million.
+ * @param wanderPpm Amplitude of the daily swing of the skew.
+ * @param jitterMs Largest reception jitter in milliseconds.
+ * @param outlierRate Fraction of blocks detected late.
+ * @param periodMs Time between server blocks in milliseconds.
+ * @param blocks Number of blocks to simulate.
+ * @return The prediction errors and guard intervals, late blocks not included.
+ */
+ClockResult ClockSimulation::run(float skewPpm, float wanderPpm, float jitterMs, float outlierRate,
+								 unsigned long periodMs, uint32_t blocks)
+{
+	ClockEstimator estimator;
+	ClockResult result = {};
+	double clock = 4294967295.0 - 3600000.0; // Local time of the current server time.
+	double firstOffset = 0.0;
+	double guards = 0.0;
+	uint32_t measured = 0;
+	uint32_t covered = 0;
+	uint32_t warmup = M16_CLOCK_MIN_SAMPLES + (uint32_t)(1.0 / (1.0 - M16_CLOCK_FORGETTING));
+	for (uint32_t i = 0; i < blocks; i++)
+	{
+		double serverTime = (double)i * periodMs;
+		double skew = skewPpm + wanderPpm * sin(2.0 * M_PI * serverTime / 86400000.0);
+		clock += i == 0 ? 0.0 : periodMs * (1.0 + skew * 1e-6);
+		double arrival = clock + 700.0 + this->random() * jitterMs;
+		bool late = this->random() < outlierRate;
+		if (late)
+		{
+			arrival += 500.0 + this->random() * 2500.0;
+		}
+		uint32_t local = (uint32_t)(uint64_t)llround(arrival);
+		uint32_t scheduled = (uint32_t)(uint64_t)serverTime;
+		if (i == 0)
+		{
+			firstOffset = arrival - serverTime;
+		}
+
+		if (estimator.isValid() && !late)
+		{
+			uint32_t predicted = estimator.toLocal(scheduled, local);
+			float error = fabsf((float)(int32_t)(local - predicted));
+			float uncorrected = fabsf((float)(arrival - serverTime - firstOffset));
+			unsigned long guard = estimator.guardMs(predicted);
+			if (i < warmup)
+			{
+				result.maxWarmupErrorMs = fmaxf(result.maxWarmupErrorMs, error);
+			}
+			else
+			{
+				result.maxErrorMs = fmaxf(result.maxErrorMs, error);
+			}
+			result.maxUncorrectedMs = fmaxf(result.maxUncorrectedMs, uncorrected);
+			guards += guard;
+			covered += error <= guard;
+			measured++;
+		}
+		estimator.blockReceived(local, scheduled);
+	}
+	result.meanGuardMs = measured > 0 ? guards / measured : 0.0f;
+	result.coverage = measured > 0 ? (float)covered / measured : 0.0f;
+	result.rejected = estimator.getRejected();
+	return result;
+}
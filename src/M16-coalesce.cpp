@@ -0,0 +1,486 @@
+/**
+ * @file M16-coalesce.cpp
+ * @brief Implementation of the Coalescer class and its simulation.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-coalesce.h"
+
+/**
+ * @brief Constructor for the Coalescer class.
+ *
+ * Every command starts with a width of `M16_DATA_BITS`.
+ *
+ * @param holdMs Longest time a value waits for others to the same destination.
+ * @param level Redundancy level the messages are sent with, used to count their blocks.
+ */
+Coalescer::Coalescer(unsigned long holdMs, uint8_t level) : holdMs(holdMs), level(level), stats{}
+{
+	for (uint8_t i = 0; i < M16_COALESCE_DESTINATIONS; i++)
+	{
+		this->destinations[i].used = false;
+		this->destinations[i].count = 0;
+	}
+	for (uint8_t i = 0; i < COMMAND_COUNT; i++)
+	{
+		this->widths[i] = M16_DATA_BITS;
+	}
+}
+
+/**
+ * @brief Returns the packets a value of a command would take if split over the data field.
+ */
+uint8_t Coalescer::parts(Command command)
+{
+	return (this->widths[command] + M16_DATA_BITS - 1) / M16_DATA_BITS;
+}
+
+/**
+ * @brief Sets the number of bits the values of a command take in a message.
+ *
+ * Higher bits of a value are dropped when it is sent.
+ *
+ * @param command The command.
+ * @param bits The width (1-16).
+ * @return false if the command or width is out of range, true otherwise.
+ */
+bool Coalescer::setWidth(Command command, uint8_t bits)
+{
+	if (command >= COMMAND_COUNT || bits == 0 || bits > 16)
+	{
+		return false;
+	}
+	this->widths[command] = bits;
+	return true;
+}
+
+/**
+ * @brief Returns the number of bits the values of a command take in a message.
+ */
+uint8_t Coalescer::getWidth(Command command)
+{
+	return command < COMMAND_COUNT ? this->widths[command] : 0;
+}
+
+/**
+ * @brief Returns the bits of a message holding the given values.
+ *
+ * @param values The values.
+ * @param count The number of values.
+ * @param extra One more value to include, or nullptr.
+ */
+uint16_t Coalescer::packedBits(const CoalescedValue *values, uint8_t count, const CoalescedValue *extra)
+{
+	uint8_t perCommand[COMMAND_COUNT] = {};
+	for (uint8_t i = 0; i < count; i++)
+	{
+		perCommand[values[i].command]++;
+	}
+	if (extra != nullptr)
+	{
+		perCommand[extra->command]++;
+	}
+	uint16_t bits = 8;
+	for (uint8_t command = 0; command < COMMAND_COUNT; command++)
+	{
+		uint8_t runs = (perCommand[command] + M16_COALESCE_RUN_LENGTH - 1) / M16_COALESCE_RUN_LENGTH;
+		bits += runs * 8 + perCommand[command] * this->widths[command];
+	}
+	return bits;
+}
+
+/**
+ * @brief Returns the blocks the values would take as single packets.
+ */
+uint16_t Coalescer::plainBlocks(const CoalescedValue *values, uint8_t count)
+{
+	uint16_t blocks = 0;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		blocks += this->parts(values[i].command);
+	}
+	return blocks;
+}
+
+/**
+ * @brief Returns the blocks of the first round of a message with the given bits.
+ */
+uint16_t Coalescer::messageBlocks(uint16_t bits)
+{
+	uint8_t length = (bits + 7) / 8;
+	return 1 + length + harqRedundancy(length, this->level);
+}
+
+/**
+ * @brief Holds a value until its destination is flushed.
+ *
+ * @param id The destination.
+ * @param command The command of the value.
+ * @param value The value, only the width of the command is kept.
+ * @param now The current time in milliseconds.
+ * @param urgent Flush the destination at the next `poll()`.
+ * @return false if the destination has to be flushed first or no slot is free, true otherwise.
+ */
+bool Coalescer::send(uint8_t id, Command command, uint16_t value, unsigned long now, bool urgent)
+{
+	if (command >= COMMAND_COUNT)
+	{
+		return false;
+	}
+	Destination *destination = nullptr;
+	for (uint8_t i = 0; i < M16_COALESCE_DESTINATIONS && destination == nullptr; i++)
+	{
+		if (this->destinations[i].used && this->destinations[i].id == id)
+		{
+			destination = &this->destinations[i];
+		}
+	}
+	for (uint8_t i = 0; i < M16_COALESCE_DESTINATIONS && destination == nullptr; i++)
+	{
+		if (!this->destinations[i].used)
+		{
+			destination = &this->destinations[i];
+			destination->used = true;
+			destination->urgent = false;
+			destination->full = false;
+			destination->id = id;
+			destination->count = 0;
+			destination->oldest = now;
+		}
+	}
+
+	CoalescedValue entry = {command, (uint16_t)(value & ((1UL << this->widths[command]) - 1))};
+	if (destination == nullptr || destination->count == M16_COALESCE_MAX_VALUES ||
+		this->packedBits(destination->values, destination->count, &entry) > 8 * M16_HARQ_MAX_LENGTH)
+	{
+		this->stats.rejected++;
+		return false;
+	}
+	destination->values[destination->count++] = entry;
+	destination->urgent |= urgent;
+	// Full once a value of a new command at the largest width might not fit.
+	destination->full = destination->count == M16_COALESCE_MAX_VALUES ||
+						this->packedBits(destination->values, destination->count, nullptr) + 8 + 16 >
+							8 * M16_HARQ_MAX_LENGTH;
+	this->stats.values++;
+	this->stats.plainBlocks += this->plainBlocks(&entry, 1);
+	return true;
+}
+
+/**
+ * @brief Packs the values of a destination into a batch and frees its slot.
+ */
+void Coalescer::flush(Destination &destination, CoalescedBatch &batch)
+{
+	batch.id = destination.id;
+	batch.count = 0;
+	batch.length = 0;
+	uint16_t bits = this->packedBits(destination.values, destination.count, nullptr);
+	uint16_t asMessage = this->messageBlocks(bits);
+	uint16_t asPackets = this->plainBlocks(destination.values, destination.count);
+
+	// A value wider than the data field would need several packets, so it forces a message.
+	batch.message = asMessage < asPackets || asPackets > destination.count;
+	if (!batch.message)
+	{
+		for (uint8_t i = 0; i < destination.count; i++)
+		{
+			const CoalescedValue &value = destination.values[i];
+			batch.packets[batch.count++] = ProtocolStructure{destination.id, value.command, value.value};
+		}
+		this->stats.blocks += asPackets;
+		this->stats.packets += batch.count;
+	}
+	else
+	{
+		// Values of the same command go behind one command byte, in the order they were sent.
+		uint32_t accumulator = M16_COALESCE_TYPE;
+		uint8_t pending = 8;
+		for (uint8_t command = 0; command < COMMAND_COUNT; command++)
+		{
+			uint8_t index = 0;
+			while (true)
+			{
+				uint8_t run[M16_COALESCE_RUN_LENGTH];
+				uint8_t length = 0;
+				for (; index < destination.count && length < M16_COALESCE_RUN_LENGTH; index++)
+				{
+					if (destination.values[index].command == command)
+					{
+						run[length++] = index;
+					}
+				}
+				if (length == 0)
+				{
+					break;
+				}
+				accumulator = (accumulator << 8) | (command << 4) | (length - 1);
+				pending += 8;
+				for (uint8_t i = 0; i <= length; i++)
+				{
+					while (pending >= 8)
+					{
+						pending -= 8;
+						batch.data[batch.length++] = accumulator >> pending;
+					}
+					if (i < length)
+					{
+						uint8_t width = this->widths[command];
+						accumulator = (accumulator << width) | destination.values[run[i]].value;
+						pending += width;
+					}
+				}
+			}
+		}
+		if (pending > 0)
+		{
+			batch.data[batch.length++] = accumulator << (8 - pending);
+		}
+		this->stats.blocks += asMessage;
+		this->stats.messages++;
+	}
+
+	destination.used = false;
+	destination.count = 0;
+}
+
+/**
+ * @brief Flushes the next destination that is due.
+ *
+ * Urgent destinations go first, then full ones, then those whose oldest value has
+ * waited the hold time. Call this at least as often as the hold time.
+ *
+ * @param batch The batch to fill.
+ * @param now The current time in milliseconds.
+ * @return true if a batch was filled, false if nothing is due.
+ */
+bool Coalescer::poll(CoalescedBatch &batch, unsigned long now)
+{
+	Destination *due = nullptr;
+	uint32_t *counter = nullptr;
+	for (uint8_t i = 0; i < M16_COALESCE_DESTINATIONS; i++)
+	{
+		Destination &destination = this->destinations[i];
+		if (!destination.used)
+		{
+			continue;
+		}
+		if (destination.urgent)
+		{
+			due = &destination;
+			counter = &this->stats.urgentFlushes;
+			break;
+		}
+		if (destination.full && counter != &this->stats.sizeFlushes)
+		{
+			due = &destination;
+			counter = &this->stats.sizeFlushes;
+		}
+		else if (due == nullptr && now - destination.oldest >= this->holdMs)
+		{
+			due = &destination;
+			counter = &this->stats.deadlineFlushes;
+		}
+	}
+	if (due == nullptr)
+	{
+		return false;
+	}
+	(*counter)++;
+	this->flush(*due, batch);
+	return true;
+}
+
+/**
+ * @brief Flushes any destination with values, regardless of the hold time.
+ *
+ * @param batch The batch to fill.
+ * @return true if a batch was filled, false if no values are held.
+ */
+bool Coalescer::flushAll(CoalescedBatch &batch)
+{
+	for (uint8_t i = 0; i < M16_COALESCE_DESTINATIONS; i++)
+	{
+		if (this->destinations[i].used)
+		{
+			this->flush(this->destinations[i], batch);
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Unpacks a coalesced message.
+ *
+ * The values come out grouped by command, in the order they were sent within
+ * each command.
+ *
+ * @param buffer The message bytes.
+ * @param length The number of bytes.
+ * @param values Array to fill.
+ * @param maxValues The size of the array.
+ * @return The number of values, 0 if the message is not a valid coalesced message.
+ */
+uint8_t Coalescer::unpack(const uint8_t *buffer, uint8_t length, CoalescedValue *values, uint8_t maxValues)
+{
+	if (length < 2 || buffer[0] != M16_COALESCE_TYPE)
+	{
+		return 0;
+	}
+	uint16_t position = 8;
+	uint16_t end = 8 * length;
+	uint8_t count = 0;
+	auto read = [&](uint8_t bits) -> uint16_t
+	{
+		uint16_t value = 0;
+		for (uint8_t i = 0; i < bits; i++, position++)
+		{
+			value = (value << 1) | ((buffer[position / 8] >> (7 - position % 8)) & 1);
+		}
+		return value;
+	};
+	// The last byte is padded with fewer than 8 zero bits.
+	while (end - position >= 8)
+	{
+		uint8_t header = read(8);
+		uint8_t command = header >> 4;
+		uint8_t runLength = (header & 0x0f) + 1;
+		if (command >= COMMAND_COUNT || count + runLength > maxValues ||
+			end - position < (uint16_t)runLength * this->widths[command])
+		{
+			return 0;
+		}
+		for (uint8_t i = 0; i < runLength; i++)
+		{
+			values[count++] = CoalescedValue{(Command)command, read(this->widths[command])};
+		}
+	}
+	return count;
+}
+
+/**
+ * @brief Returns the statistics since construction.
+ */
+const CoalesceStats &Coalescer::getStats()
+{
+	return this->stats;
+}
+
+/**
+ * @brief Constructor for the CoalesceSimulation class.
+ *
+ * @param seed Seed of the random number generator, must not be 0.
+ */
+CoalesceSimulation::CoalesceSimulation(uint32_t seed) : seed(seed) {}
+
+/**
+ * @brief Returns the next number from a xorshift generator.
+ */
+uint32_t CoalesceSimulation::next()
+{
+	this->seed ^= this->seed << 13;
+	this->seed ^= this->seed >> 17;
+	this->seed ^= this->seed << 5;
+	return this->seed;
+}
+
+/**
+ * @brief Returns a uniform random number in [0, 1).
+ */
+float CoalesceSimulation::random()
+{
+	return (float)this->next() / 4294967296.0f;
+}
+
+/**
+ * @brief Sends the values of several sources from one node through a coalescer.
+ *
+ * Each source sends a burst of values 5 ms apart every period, starting at its
+ * offset plus up to 10 ms of jitter, so sources with the same offset are sampled
+ * together. The coalescer is polled every millisecond.
+ *
+ * @param sources The sources.
+ * @param count The number of sources, at most `M16_COALESCE_SIMULATED_SOURCES`.
+ * @param holdMs Hold time of the coalescer.
+ * @param durationMs Time to simulate.
+ * @return Blocks and overhead with and without coalescing.
+ */
+CoalesceResult CoalesceSimulation::run(const CoalesceSource *sources, uint8_t count, unsigned long holdMs,
+									   unsigned long durationMs)
+{
+	const uint8_t id = 1;
+	const unsigned long spacingMs = 5;
+	Coalescer coalescer(holdMs);
+	unsigned long burstStart[M16_COALESCE_SIMULATED_SOURCES]; // Burst time before jitter.
+	unsigned long nextBurst[M16_COALESCE_SIMULATED_SOURCES];
+	uint8_t remaining[M16_COALESCE_SIMULATED_SOURCES] = {};
+	count = count < M16_COALESCE_SIMULATED_SOURCES ? count : M16_COALESCE_SIMULATED_SOURCES;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		coalescer.setWidth(sources[i].command, sources[i].width);
+		burstStart[i] = sources[i].offsetMs;
+		nextBurst[i] = burstStart[i] + this->next() % 10;
+	}
+
+	CoalesceResult result = {};
+	uint32_t payloadBits = 0;
+	double heldSince = 0.0; // Sum of the arrival times of the values held.
+	uint32_t held = 0;
+	double delay = 0.0;
+	CoalescedBatch batch;
+	for (unsigned long now = 0; now < durationMs || held > 0; now++)
+	{
+		for (uint8_t i = 0; i < count && now < durationMs; i++)
+		{
+			if (now < nextBurst[i])
+			{
+				continue;
+			}
+			if (remaining[i] == 0)
+			{
+				remaining[i] = sources[i].burst;
+			}
+			uint16_t value = this->next();
+			if (coalescer.send(id, sources[i].command, value, now, this->random() < sources[i].urgentRate))
+			{
+				payloadBits += sources[i].width;
+				heldSince += now;
+				held++;
+				if (--remaining[i] > 0)
+				{
+					nextBurst[i] = now + spacingMs;
+				}
+				else
+				{
+					burstStart[i] += sources[i].periodMs;
+					nextBurst[i] = burstStart[i] + this->next() % 10;
+				}
+			}
+		}
+		while (coalescer.poll(batch, now) || (now >= durationMs && coalescer.flushAll(batch)))
+		{
+			CoalescedValue values[M16_COALESCE_MAX_VALUES];
+			uint8_t flushed = 0;
+			if (batch.message)
+			{
+				flushed = coalescer.unpack(batch.data, batch.length, values, M16_COALESCE_MAX_VALUES);
+			}
+			flushed += batch.count;
+			delay += (double)flushed * now - heldSince;
+			heldSince = 0.0;
+			held = 0;
+		}
+	}
+
+	const CoalesceStats &stats = coalescer.getStats();
+	result.values = stats.values;
+	result.plainBlocks = stats.plainBlocks;
+	result.blocks = stats.blocks;
+	result.plainOverhead = stats.plainBlocks > 0 ? 1.0f - (float)payloadBits / (16.0f * stats.plainBlocks) : 0.0f;
+	result.overhead = stats.blocks > 0 ? 1.0f - (float)payloadBits / (16.0f * stats.blocks) : 0.0f;
+	result.meanDelayMs = stats.values > 0 ? delay / stats.values : 0.0f;
+	return result;
+}
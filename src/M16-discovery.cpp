@@ -0,0 +1,413 @@
+/**
+ * @file M16-discovery.cpp
+ * @brief Implementation of the discovery sweep.
+ *
+ * This file contains the server side DiscoverySweep, the node side
+ * DiscoveryResponder, and the DiscoverySimulation comparing a sweep with polling
+ * every id in turn.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-discovery.h"
+
+/**
+ * @brief Constructor for the DiscoverySweep class.
+ *
+ * @param expected Number of nodes expected in range, sets the slots of the first
+ * query. Later sweeps use the number found by the previous one.
+ */
+DiscoverySweep::DiscoverySweep(float expected)
+	: pending{}, pendingCount(0), current{}, active(false), nodes{}, expected(expected), foundCount(0), blocks(0),
+	  collisions(0) {}
+
+/**
+ * @brief Picks about one reply slot per expected node.
+ *
+ * @param nodes Expected number of nodes below the prefix.
+ * @param freeBits Id bits not covered by the prefix.
+ * @return The number of slot bits.
+ */
+uint8_t DiscoverySweep::slotBitsFor(float nodes, uint8_t freeBits)
+{
+	uint8_t bits = 0;
+	while (bits < freeBits && (float)(1 << bits) < nodes)
+	{
+		bits++;
+	}
+	return bits;
+}
+
+/**
+ * @brief Returns the prefix selecting the ids that reply in a slot of the current query.
+ */
+uint8_t DiscoverySweep::slotId(uint8_t slot)
+{
+	return (this->current.prefix << this->current.slotBits) | slot;
+}
+
+/**
+ * @brief Starts a new sweep, forgetting the nodes found before.
+ */
+void DiscoverySweep::begin()
+{
+	for (DiscoveredNode &node : this->nodes)
+	{
+		node.present = false;
+	}
+	this->pending[0] = Query{0, 0, slotBitsFor(this->expected, M16_ID_BITS)};
+	this->pendingCount = 1;
+	this->active = true;
+	this->foundCount = 0;
+	this->blocks = 0;
+	this->collisions = 0;
+}
+
+/**
+ * @brief Returns the next query to send.
+ *
+ * After sending the query, report what was heard in each of its `slots()` with
+ * `slotEnded()` once the slot has ended, `slotEndMs()` after the query was sent.
+ * Replies reach the server a round trip after the query, so the first slot ends
+ * `M16_ROUND_TRIP_MS` plus one block interval after it.
+ *
+ * @param packet The query block.
+ * @return true if a query was returned, false when the sweep is complete.
+ */
+bool DiscoverySweep::nextQuery(ProtocolStructure &packet)
+{
+	if (this->pendingCount == 0)
+	{
+		if (this->active)
+		{
+			this->active = false;
+			this->expected = this->foundCount;
+		}
+		return false;
+	}
+	this->current = this->pending[--this->pendingCount];
+	// The query, the round trip until the first reply has arrived, and the slots.
+	this->blocks += 2 + this->slots();
+	uint8_t prefix = this->current.bits == 0 ? 0 : this->current.prefix << (M16_ID_BITS - this->current.bits);
+	packet = ProtocolStructure{prefix, DISCOVER,
+							   (uint16_t)(M16_DISCOVERY_QUERY_FLAG | this->current.bits | (this->current.slotBits << 3))};
+	return true;
+}
+
+/**
+ * @brief Returns the number of reply slots after the current query.
+ */
+uint8_t DiscoverySweep::slots()
+{
+	return 1 << this->current.slotBits;
+}
+
+/**
+ * @brief Returns the time from sending a query until one of its reply slots has ended.
+ *
+ * A node replies in slot k (k + 1) block intervals after the query has arrived,
+ * so its reply arrives `M16_ROUND_TRIP_MS` later than that counted from the send,
+ * less the turnaround, which is left as margin.
+ *
+ * @param slot The slot, from 0 to `slots() - 1`.
+ * @return The time in milliseconds.
+ */
+unsigned long DiscoverySweep::slotEndMs(uint8_t slot)
+{
+	return M16_ROUND_TRIP_MS + (unsigned long)(slot + 1) * M16_BLOCK_INTERVAL_MS;
+}
+
+/**
+ * @brief Records what was heard in a reply slot of the current query.
+ *
+ * A collided slot is queried again later with a longer prefix. A reply from an id
+ * that does not belong to the slot can only be a garbled block, and counts as a
+ * collision too, as does a signal that could not be decoded.
+ *
+ * @param slot The slot, from 0 to `slots() - 1`.
+ * @param packet The block received in the slot, or nullptr if none was decoded.
+ * @param energy Whether the modem heard a signal it could not decode, for example
+ * from an increase of `Report::packedInvalid`.
+ * @param report The modem report of the received block, or nullptr if not read.
+ * @param now The current time in milliseconds.
+ * @return What the slot held.
+ */
+DiscoveryOutcome DiscoverySweep::slotEnded(uint8_t slot, const ProtocolStructure *packet, bool energy,
+										   const Report *report, unsigned long now)
+{
+	uint8_t prefix = this->slotId(slot);
+	uint8_t bits = this->current.bits + this->current.slotBits;
+	uint8_t shift = M16_ID_BITS - bits;
+
+	if (packet != nullptr && packet->command == DISCOVER && !(packet->data & M16_DISCOVERY_QUERY_FLAG) &&
+		(packet->id >> shift) == prefix)
+	{
+		DiscoveredNode &node = this->nodes[packet->id];
+		if (!node.present)
+		{
+			this->foundCount++;
+		}
+		node.present = true;
+		node.signalPower = report != nullptr ? report->signalPower : 0;
+		node.noisePower = report != nullptr ? report->noisePower : 0;
+		node.bitErrorRate = report != nullptr ? report->bitErrorRate : 0;
+		node.downlinkMargin = packet->data & M16_DISCOVERY_MARGIN_MASK;
+		node.seen = now;
+		return SLOT_SUCCESS;
+	}
+	if (packet == nullptr && !energy)
+	{
+		return SLOT_IDLE;
+	}
+
+	this->collisions++;
+	// A slot of a single id is asked once more on its own, in case the reply was only damaged.
+	if ((shift > 0 || this->current.bits < M16_ID_BITS) && this->pendingCount < M16_MAX_NODES)
+	{
+		this->pending[this->pendingCount++] = Query{prefix, bits, slotBitsFor(M16_DISCOVERY_COLLISION_NODES, shift)};
+	}
+	return SLOT_COLLISION;
+}
+
+/**
+ * @brief Checks whether every query of the sweep has been sent.
+ */
+bool DiscoverySweep::done()
+{
+	return this->pendingCount == 0;
+}
+
+/**
+ * @brief Checks whether a node replied during the last sweep.
+ */
+bool DiscoverySweep::isPresent(uint8_t id)
+{
+	return id < M16_MAX_NODES && this->nodes[id].present;
+}
+
+/**
+ * @brief Returns what is known about a node.
+ */
+const DiscoveredNode &DiscoverySweep::getNode(uint8_t id)
+{
+	return this->nodes[id % M16_MAX_NODES];
+}
+
+/**
+ * @brief Returns the number of nodes found by the sweep.
+ */
+uint8_t DiscoverySweep::found()
+{
+	return this->foundCount;
+}
+
+/**
+ * @brief Returns the block times used by the sweep, queries, round trips and reply slots.
+ */
+uint32_t DiscoverySweep::getBlocks()
+{
+	return this->blocks;
+}
+
+/**
+ * @brief Returns the number of collided slots in the sweep.
+ */
+uint32_t DiscoverySweep::getCollisions()
+{
+	return this->collisions;
+}
+
+/**
+ * @brief Constructor for the DiscoveryResponder class.
+ *
+ * @param id The id of this node.
+ */
+DiscoveryResponder::DiscoveryResponder(uint8_t id) : id(id), pending(false), sendAt(0), margin(0) {}
+
+/**
+ * @brief Changes the id the node replies with, for example after a new lease.
+ */
+void DiscoveryResponder::setId(uint8_t id)
+{
+	this->id = id;
+	this->pending = false;
+}
+
+/**
+ * @brief Handles a block received from the server.
+ *
+ * @param packet The received block.
+ * @param now The current time in milliseconds.
+ * @param margin Signal minus noise power of the block from the local modem report,
+ * sent back to the server. 0 if not known.
+ * @return true if the block was a DISCOVER block, false otherwise.
+ */
+bool DiscoveryResponder::packetReceived(ProtocolStructure packet, unsigned long now, uint8_t margin)
+{
+	if (packet.command != DISCOVER)
+	{
+		return false;
+	}
+	if (!(packet.data & M16_DISCOVERY_QUERY_FLAG))
+	{
+		return true;
+	}
+	uint8_t bits = packet.data & 0x07;
+	uint8_t slotBits = (packet.data >> 3) & 0x07;
+	if (bits + slotBits > M16_ID_BITS)
+	{
+		return true;
+	}
+	uint8_t shift = M16_ID_BITS - bits;
+	if (bits > 0 && (this->id >> shift) != (packet.id >> shift))
+	{
+		return true;
+	}
+	uint8_t slot = (this->id >> (shift - slotBits)) & ((1 << slotBits) - 1);
+	this->sendAt = now + (unsigned long)(slot + 1) * M16_BLOCK_INTERVAL_MS;
+	this->margin = margin > M16_DISCOVERY_MARGIN_MASK ? M16_DISCOVERY_MARGIN_MASK : margin;
+	this->pending = true;
+	return true;
+}
+
+/**
+ * @brief Returns the reply once its slot has come.
+ *
+ * @param packet The reply block.
+ * @param now The current time in milliseconds.
+ * @return true if a reply was returned, false otherwise.
+ */
+bool DiscoveryResponder::nextPacket(ProtocolStructure &packet, unsigned long now)
+{
+	if (!this->pending || (long)(now - this->sendAt) < 0)
+	{
+		return false;
+	}
+	packet = ProtocolStructure{this->id, DISCOVER, this->margin};
+	this->pending = false;
+	return true;
+}
+
+/**
+ * @brief Constructor for the DiscoverySimulation class.
+ *
+ * @param seed Seed of the random generator, runs with the same seed are identical.
+ */
+DiscoverySimulation::DiscoverySimulation(uint32_t seed) : seed(seed ? seed : 1) {}
+
+/**
+ * @brief Returns a uniform random number in [0, 1) from a xorshift32 generator.
+ */
+float DiscoverySimulation::random()
+{
+	this->seed ^= this->seed << 13;
+	this->seed ^= this->seed >> 17;
+	this->seed ^= this->seed << 5;
+	return (float)this->seed / 4294967296.0f;
+}
+
+/**
+ * @brief Sweeps random populations of nodes and compares with polling every id.
+ *
+ * Every block arrives a block time after it is sent, and the server closes each
+ * slot at `DiscoverySweep::slotEndMs()`. Every block is lost independently. A lost
+ * reply still leaves a signal the modem notices, so it looks like a collision. When replies collide, one of them is
+ * captured and decoded cleanly with probability `capture`.
+ *
+ * @param population Nodes in range, placed on random distinct ids.
+ * @param trials Number of sweeps to average.
+ * @param blockErrorRate Probability that a block is lost.
+ * @param capture Probability that one of several colliding replies is decoded.
+ * @param expected Nodes the sweep expects, for example the result of the previous sweep.
+ * @return Mean cost and fraction of nodes found of both methods.
+ */
+DiscoveryResult DiscoverySimulation::run(uint8_t population, uint16_t trials, float blockErrorRate, float capture,
+										 float expected)
+{
+	if (population > M16_MAX_NODES)
+	{
+		population = M16_MAX_NODES;
+	}
+	DiscoveryResult result{};
+	result.pingBlocks = M16_MAX_NODES * M16_DISCOVERY_PING_BLOCKS;
+	if (trials == 0)
+	{
+		return result;
+	}
+	uint32_t blocks = 0;
+	uint32_t sweepFound = 0;
+	uint32_t pingFound = 0;
+
+	for (uint16_t trial = 0; trial < trials; trial++)
+	{
+		// Shuffle the ids and place the nodes on the first ones.
+		uint8_t ids[M16_MAX_NODES];
+		for (uint8_t i = 0; i < M16_MAX_NODES; i++)
+		{
+			ids[i] = i;
+		}
+		for (uint8_t i = M16_MAX_NODES - 1; i > 0; i--)
+		{
+			uint8_t j = (uint8_t)(this->random() * (i + 1));
+			uint8_t swap = ids[i];
+			ids[i] = ids[j];
+			ids[j] = swap;
+		}
+		DiscoveryResponder responders[M16_MAX_NODES];
+		for (uint8_t i = 0; i < population; i++)
+		{
+			responders[i].setId(ids[i]);
+			// Polling finds a node if both the poll and the reply arrive.
+			pingFound += this->random() >= blockErrorRate && this->random() >= blockErrorRate;
+		}
+
+		DiscoverySweep sweep(expected);
+		sweep.begin();
+		unsigned long sent = 0;
+		ProtocolStructure query;
+		while (sweep.nextQuery(query))
+		{
+			for (uint8_t i = 0; i < population; i++)
+			{
+				if (this->random() >= blockErrorRate)
+				{
+					responders[i].packetReceived(query, sent + M16_BLOCK_TIME_MS);
+				}
+			}
+			for (uint8_t slot = 0; slot < sweep.slots(); slot++)
+			{
+				// Replies sent a block time before the end of the slot have arrived.
+				unsigned long now = sent + DiscoverySweep::slotEndMs(slot);
+				ProtocolStructure replies[M16_MAX_NODES];
+				uint8_t count = 0;
+				for (uint8_t i = 0; i < population; i++)
+				{
+					if (responders[i].nextPacket(replies[count], now - M16_BLOCK_TIME_MS))
+					{
+						count++;
+					}
+				}
+				bool decoded = false;
+				if (count == 1)
+				{
+					decoded = this->random() >= blockErrorRate;
+				}
+				else if (count > 1 && this->random() < capture)
+				{
+					replies[0] = replies[(uint8_t)(this->random() * count)];
+					decoded = true;
+				}
+				sweep.slotEnded(slot, decoded ? &replies[0] : nullptr, count > 0, nullptr, now);
+			}
+			sent += (unsigned long)(2 + sweep.slots()) * M16_BLOCK_INTERVAL_MS;
+		}
+		blocks += sweep.getBlocks();
+		sweepFound += sweep.found();
+	}
+
+	result.sweepBlocks = (float)blocks / trials;
+	result.sweepFound = population > 0 ? (float)sweepFound / ((uint32_t)population * trials) : 1.0f;
+	result.pingFound = population > 0 ? (float)pingFound / ((uint32_t)population * trials) : 1.0f;
+	return result;
+}
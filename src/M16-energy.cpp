@@ -0,0 +1,269 @@
+/**
+ * @file M16-energy.cpp
+ * @brief Implementation of the AirtimeLedger class.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-energy.h"
+
+/**
+ * @brief Constructor for the AirtimeLedger class with the default energy model.
+ */
+AirtimeLedger::AirtimeLedger() : AirtimeLedger(EnergyModel{M16_ENERGY_TX_W, M16_ENERGY_IDLE_W}) {}
+
+/**
+ * @brief Constructor for the AirtimeLedger class.
+ *
+ * @param model Power drawn by the modem, for example measured on the deployment hardware.
+ */
+AirtimeLedger::AirtimeLedger(const EnergyModel &model) : model(model), callback(nullptr), context(nullptr)
+{
+	this->reset();
+}
+
+/**
+ * @brief Sets the function called with the record of every completed message.
+ *
+ * @param callback The function, or nullptr to stop the calls.
+ * @param context Passed to the callback.
+ */
+void AirtimeLedger::onComplete(MessageCallback callback, void *context)
+{
+	this->callback = callback;
+	this->context = context;
+}
+
+/**
+ * @brief Returns the open message slot of a destination.
+ *
+ * @return The index of the slot, or -1 if no message is open.
+ */
+int8_t AirtimeLedger::find(uint8_t destination)
+{
+	for (uint8_t i = 0; i < M16_LEDGER_OPEN; i++)
+	{
+		if (this->used[i] && this->pending[i].destination == destination)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Starts grouping the blocks sent to a destination into one message.
+ *
+ * @param destination The id the blocks of the message are sent with.
+ * @param tag A value identifying the message in its record, such as its type byte.
+ * @param now The current time in milliseconds.
+ * @return false if a message to the destination is already open or all slots are in use.
+ */
+bool AirtimeLedger::open(uint8_t destination, uint8_t tag, unsigned long now)
+{
+	if (this->find(destination) >= 0)
+	{
+		return false;
+	}
+	for (uint8_t i = 0; i < M16_LEDGER_OPEN; i++)
+	{
+		if (!this->used[i])
+		{
+			this->pending[i] = MessageRecord{};
+			this->pending[i].destination = destination;
+			this->pending[i].command = COMMAND_COUNT;
+			this->pending[i].tag = tag;
+			this->pending[i].started = now;
+			this->used[i] = true;
+			return true;
+		}
+	}
+	this->refused++;
+	return false;
+}
+
+/**
+ * @brief Ends the message to a destination and reports its record.
+ *
+ * @param destination The id given to `open()`.
+ * @param delivered Whether the message was delivered or dropped.
+ * @param now The current time in milliseconds.
+ * @return false if no message to the destination is open, true otherwise.
+ */
+bool AirtimeLedger::close(uint8_t destination, bool delivered, unsigned long now)
+{
+	int8_t slot = this->find(destination);
+	if (slot < 0)
+	{
+		return false;
+	}
+	MessageRecord &record = this->pending[slot];
+	record.finished = now;
+	record.delivered = delivered;
+	this->used[slot] = false;
+	this->complete(record);
+	return true;
+}
+
+/**
+ * @brief Adds the cost of one block to a set of counters.
+ */
+void AirtimeLedger::add(AirtimeCounters &counters, uint32_t blocks, uint32_t retransmitted, float energyJ)
+{
+	counters.blocks += blocks;
+	counters.retransmitted += retransmitted;
+	counters.airtimeMs += blocks * M16_BLOCK_TIME_MS;
+	counters.guardMs += blocks * (M16_BLOCK_INTERVAL_MS - M16_BLOCK_TIME_MS);
+	counters.energyJ += energyJ;
+}
+
+/**
+ * @brief Counts a finished message and passes its record to the callback.
+ */
+void AirtimeLedger::complete(MessageRecord &record)
+{
+	if (record.blocks == 0)
+	{
+		return;
+	}
+	if (record.command < COMMAND_COUNT)
+	{
+		this->commands[record.command].messages++;
+	}
+	if (record.destination < M16_MAX_NODES)
+	{
+		this->destinations[record.destination].messages++;
+	}
+	this->total.messages++;
+	if (this->callback != nullptr)
+	{
+		this->callback(record, this->context);
+	}
+}
+
+/**
+ * @brief Returns the energy of one block, the guard time after it included.
+ *
+ * @param powerLevel The power level (1-4), 0 when unknown is charged as the highest.
+ * @return The energy in joules.
+ */
+float AirtimeLedger::blockEnergyJ(uint8_t powerLevel)
+{
+	if (powerLevel == 0 || powerLevel > M16_POWER_LEVELS)
+	{
+		powerLevel = M16_POWER_LEVELS;
+	}
+	return (this->model.txWatts[powerLevel - 1] * M16_BLOCK_TIME_MS +
+			this->model.idleWatts * (M16_BLOCK_INTERVAL_MS - M16_BLOCK_TIME_MS)) /
+		   1000.0f;
+}
+
+/**
+ * @brief Accounts for a block handed to the modem.
+ *
+ * The block is added to the open message of its id, or completes a message of its
+ * own if none is open.
+ *
+ * @param packet The block.
+ * @param powerLevel The power level in use, 0 if unknown.
+ * @param now The current time in milliseconds.
+ */
+void AirtimeLedger::blockSent(const ProtocolStructure &packet, uint8_t powerLevel, unsigned long now)
+{
+	float energy = this->blockEnergyJ(powerLevel);
+	int8_t slot = this->find(packet.id);
+	MessageRecord single = {};
+	MessageRecord &record = slot >= 0 ? this->pending[slot] : single;
+	if (slot < 0)
+	{
+		record.destination = packet.id;
+		record.started = now;
+		record.finished = now;
+		record.delivered = true;
+	}
+	if (record.blocks == 0)
+	{
+		record.command = packet.command;
+	}
+	if (packet.command == MESSAGE_START)
+	{
+		record.rounds++;
+	}
+	bool retransmission = record.rounds > 1;
+	record.powerLevel = powerLevel;
+	record.blocks++;
+	record.retransmitted += retransmission;
+	record.airtimeMs += M16_BLOCK_TIME_MS;
+	record.guardMs += M16_BLOCK_INTERVAL_MS - M16_BLOCK_TIME_MS;
+	record.energyJ += energy;
+
+	if (packet.command < COMMAND_COUNT)
+	{
+		add(this->commands[packet.command], 1, retransmission, energy);
+	}
+	if (packet.id < M16_MAX_NODES)
+	{
+		add(this->destinations[packet.id], 1, retransmission, energy);
+	}
+	add(this->total, 1, retransmission, energy);
+	if (slot < 0)
+	{
+		this->complete(record);
+	}
+}
+
+/**
+ * @brief Returns the cost of the blocks sent with a command.
+ */
+const AirtimeCounters &AirtimeLedger::getCommand(Command command)
+{
+	return this->commands[command < COMMAND_COUNT ? command : 0];
+}
+
+/**
+ * @brief Returns the cost of the blocks sent to a destination.
+ *
+ * @param id The destination, ids out of range return the counters of id 0.
+ */
+const AirtimeCounters &AirtimeLedger::getDestination(uint8_t id)
+{
+	return this->destinations[id < M16_MAX_NODES ? id : 0];
+}
+
+/**
+ * @brief Returns the cost of every block sent.
+ */
+const AirtimeCounters &AirtimeLedger::getTotal()
+{
+	return this->total;
+}
+
+/**
+ * @brief Returns the number of messages that could not be opened.
+ */
+uint32_t AirtimeLedger::getRefused()
+{
+	return this->refused;
+}
+
+/**
+ * @brief Clears every counter and forgets the open messages.
+ */
+void AirtimeLedger::reset()
+{
+	for (uint8_t i = 0; i < M16_LEDGER_OPEN; i++)
+	{
+		this->used[i] = false;
+	}
+	for (uint8_t i = 0; i < COMMAND_COUNT; i++)
+	{
+		this->commands[i] = AirtimeCounters{};
+	}
+	for (uint8_t i = 0; i < M16_MAX_NODES; i++)
+	{
+		this->destinations[i] = AirtimeCounters{};
+	}
+	this->total = AirtimeCounters{};
+	this->refused = 0;
+}
@@ -0,0 +1,342 @@
+/**
+ * @file M16-fair.cpp
+ * @brief Implementation of weighted fair airtime scheduling.
+ *
+ * This file contains the deficit round robin FairScheduler, and the FairSimulation
+ * used to compare it with plain round robin polling under skewed workloads.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-fair.h"
+
+/**
+ * @brief Constructor for the FairScheduler class.
+ *
+ * All nodes start with weight 0 and are not scheduled until given a weight.
+ *
+ * @param quantumBlocks Blocks a node of weight 1 may send per round.
+ */
+FairScheduler::FairScheduler(uint8_t quantumBlocks)
+	: nodes{}, quantumBlocks(quantumBlocks > 0 ? quantumBlocks : 1), current(M16_MAX_NODES - 1) {}
+
+/**
+ * @brief Sets the share of airtime a node gets relative to the others.
+ *
+ * @param id The id of the node.
+ * @param weight The weight of the node, 0 to stop scheduling it.
+ */
+void FairScheduler::setWeight(uint8_t id, uint8_t weight)
+{
+	if (id >= M16_MAX_NODES)
+	{
+		return;
+	}
+	this->nodes[id].weight = weight;
+	if (weight == 0)
+	{
+		this->nodes[id].backlog = 0;
+		this->nodes[id].deficit = 0;
+	}
+}
+
+/**
+ * @brief Adds to the blocks a node wants to send.
+ *
+ * @param id The id of the node.
+ * @param blocks The number of blocks added to its backlog.
+ * @param now The current time in milliseconds.
+ */
+void FairScheduler::demand(uint8_t id, uint32_t blocks, unsigned long now)
+{
+	if (id >= M16_MAX_NODES || this->nodes[id].weight == 0 || blocks == 0)
+	{
+		return;
+	}
+	if (this->nodes[id].backlog == 0)
+	{
+		this->nodes[id].waitingSince = now;
+	}
+	this->nodes[id].backlog += blocks;
+}
+
+/**
+ * @brief Returns the blocks a node still wants to send.
+ *
+ * @param id The id of the node.
+ */
+uint32_t FairScheduler::getBacklog(uint8_t id)
+{
+	return id < M16_MAX_NODES ? this->nodes[id].backlog : 0;
+}
+
+/**
+ * @brief Picks the next node to poll.
+ *
+ * Nodes with a backlog are visited in id order. Each visit adds the node's quantum
+ * to its deficit, and the node may send as many blocks as its deficit allows.
+ * Unused deficit carries over to the next round, up to two quanta.
+ *
+ * @param id Receives the id of the node to poll.
+ * @param blocks Receives the number of blocks the node may send.
+ * @param now The current time in milliseconds.
+ * @return false if no node has a backlog, true otherwise.
+ */
+bool FairScheduler::next(uint8_t &id, uint16_t &blocks, unsigned long now)
+{
+	for (uint16_t step = 1; step <= M16_MAX_NODES; step++)
+	{
+		uint16_t candidate = (this->current + step) % M16_MAX_NODES;
+		NodeState &node = this->nodes[candidate];
+		if (node.weight == 0 || node.backlog == 0)
+		{
+			continue;
+		}
+
+		uint32_t quantum = (uint32_t)this->quantumBlocks * node.weight;
+		node.deficit += quantum;
+		if (node.deficit > 2 * quantum)
+		{
+			node.deficit = 2 * quantum;
+		}
+		uint32_t grant = node.deficit < node.backlog ? node.deficit : node.backlog;
+
+		if (now - node.waitingSince > node.stats.maxWaitMs)
+		{
+			node.stats.maxWaitMs = now - node.waitingSince;
+		}
+		node.stats.polls++;
+		this->current = candidate;
+		id = candidate;
+		blocks = grant > UINT16_MAX ? UINT16_MAX : grant;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Records the blocks a polled node actually sent.
+ *
+ * @param id The id of the node.
+ * @param blocks The number of blocks received from the node.
+ * @param now The current time in milliseconds, after the last block.
+ */
+void FairScheduler::served(uint8_t id, uint16_t blocks, unsigned long now)
+{
+	if (id >= M16_MAX_NODES)
+	{
+		return;
+	}
+	NodeState &node = this->nodes[id];
+	node.backlog -= blocks < node.backlog ? blocks : node.backlog;
+	node.deficit -= blocks < node.deficit ? blocks : node.deficit;
+	node.stats.blocksServed += blocks;
+	if (node.backlog == 0)
+	{
+		node.deficit = 0;
+	}
+	node.waitingSince = now;
+}
+
+/**
+ * @brief Returns the longest time a node with a backlog waits to be polled.
+ *
+ * Every other node can at most spend two quanta and a poll before it is this node's
+ * turn, provided nodes never send more blocks than they were granted.
+ *
+ * @param id The id of the node.
+ * @return The bound in milliseconds.
+ */
+unsigned long FairScheduler::latencyBoundMs(uint8_t id)
+{
+	unsigned long blocks = 0;
+	for (uint16_t other = 0; other < M16_MAX_NODES; other++)
+	{
+		if (other != id && this->nodes[other].weight > 0)
+		{
+			blocks += 2UL * this->quantumBlocks * this->nodes[other].weight + M16_FAIR_POLL_BLOCKS;
+		}
+	}
+	return blocks * M16_BLOCK_INTERVAL_MS;
+}
+
+/**
+ * @brief Returns the airtime statistics of a node.
+ *
+ * @param id The id of the node.
+ */
+const FairNodeStats &FairScheduler::getStats(uint8_t id)
+{
+	return this->nodes[id < M16_MAX_NODES ? id : 0].stats;
+}
+
+/**
+ * @brief Constructor for the FairSimulation class.
+ *
+ * @param seed Seed of the random arrivals.
+ */
+FairSimulation::FairSimulation(uint32_t seed) : seed(seed ? seed : 1) {}
+
+/**
+ * @brief Returns a uniform random number in [0, 1) from a xorshift32 generator.
+ */
+float FairSimulation::random()
+{
+	this->seed ^= this->seed << 13;
+	this->seed ^= this->seed >> 17;
+	this->seed ^= this->seed << 5;
+	return (float)this->seed / 4294967296.0f;
+}
+
+/**
+ * @brief Simulates the server polling a set of nodes.
+ *
+ * Transfers arrive at random and every node announces its full backlog when
+ * polled. Each poll costs `M16_FAIR_POLL_BLOCKS`. Round robin lets the polled node
+ * send its whole backlog, while the fair scheduler limits it to its grant.
+ *
+ * Fairness is Jain's index of the weighted slowdown of each node: the time its
+ * transfers would take on an idle channel over their mean latency, divided by the
+ * weight. Counting served blocks instead would call round robin fair, since every
+ * node eventually gets all it asked for, even when small transfers wait behind a
+ * long backlog for as long as the transfers making up that backlog.
+ *
+ * @param workload Traffic of each node, node i uses id i.
+ * @param nodes The number of nodes, at most `M16_FAIR_SIMULATED_NODES`.
+ * @param fair Whether to use the fair scheduler, or round robin.
+ * @param slots Block times to simulate.
+ * @return Utilization, fairness and transfer latencies.
+ */
+FairResult FairSimulation::run(const FairWorkload *workload, uint8_t nodes, bool fair, uint32_t slots)
+{
+	struct Transfer
+	{
+		uint32_t arrival;
+		uint8_t remaining;
+	};
+	Transfer queues[M16_FAIR_SIMULATED_NODES][M16_FAIR_MAX_TRANSFERS];
+	uint8_t head[M16_FAIR_SIMULATED_NODES] = {};
+	uint8_t count[M16_FAIR_SIMULATED_NODES] = {};
+	uint32_t backlog[M16_FAIR_SIMULATED_NODES] = {};
+	uint32_t servedBlocks[M16_FAIR_SIMULATED_NODES] = {};
+	uint32_t completed[M16_FAIR_SIMULATED_NODES] = {};
+	float latencySum[M16_FAIR_SIMULATED_NODES] = {};
+	FairResult result{};
+
+	if (nodes > M16_FAIR_SIMULATED_NODES)
+	{
+		nodes = M16_FAIR_SIMULATED_NODES;
+	}
+	FairScheduler scheduler;
+	for (uint8_t i = 0; i < nodes; i++)
+	{
+		scheduler.setWeight(i, workload[i].weight);
+	}
+
+	uint32_t busyUntil = 0;
+	uint8_t lastPolled = nodes - 1;
+	uint32_t dataBlocks = 0;
+
+	for (uint32_t slot = 0; slot < slots; slot++)
+	{
+		unsigned long now = (unsigned long)slot * M16_BLOCK_INTERVAL_MS;
+		for (uint8_t i = 0; i < nodes; i++)
+		{
+			if (this->random() >= workload[i].arrivalRate)
+			{
+				continue;
+			}
+			if (count[i] == M16_FAIR_MAX_TRANSFERS)
+			{
+				result.dropped++;
+				continue;
+			}
+			queues[i][(head[i] + count[i]) % M16_FAIR_MAX_TRANSFERS] = Transfer{slot, workload[i].transferBlocks};
+			count[i]++;
+			backlog[i] += workload[i].transferBlocks;
+			scheduler.demand(i, workload[i].transferBlocks, now);
+		}
+
+		if (slot < busyUntil)
+		{
+			continue;
+		}
+
+		uint8_t id = 0;
+		uint16_t grant = 0;
+		if (fair)
+		{
+			if (!scheduler.next(id, grant, now))
+			{
+				continue;
+			}
+		}
+		else
+		{
+			bool found = false;
+			for (uint8_t step = 1; step <= nodes && !found; step++)
+			{
+				id = (lastPolled + step) % nodes;
+				found = backlog[id] > 0;
+			}
+			if (!found)
+			{
+				continue;
+			}
+			lastPolled = id;
+			grant = backlog[id] > UINT16_MAX ? UINT16_MAX : backlog[id];
+		}
+
+		// The poll takes the first blocks, then the node sends its blocks back to back.
+		uint32_t end = slot + M16_FAIR_POLL_BLOCKS;
+		for (uint16_t sent = 0; sent < grant && count[id] > 0; sent++)
+		{
+			end++;
+			Transfer &transfer = queues[id][head[id]];
+			if (--transfer.remaining == 0)
+			{
+				float latency = (float)(end - transfer.arrival) * M16_BLOCK_INTERVAL_MS;
+				latencySum[id] += latency;
+				if (latency > result.maxLatencyMs[id])
+				{
+					result.maxLatencyMs[id] = latency;
+				}
+				completed[id]++;
+				head[id] = (head[id] + 1) % M16_FAIR_MAX_TRANSFERS;
+				count[id]--;
+			}
+		}
+		uint16_t sent = end - slot - M16_FAIR_POLL_BLOCKS;
+		backlog[id] -= sent;
+		servedBlocks[id] += sent;
+		dataBlocks += sent;
+		if (fair)
+		{
+			scheduler.served(id, sent, (unsigned long)end * M16_BLOCK_INTERVAL_MS);
+		}
+		busyUntil = end;
+	}
+
+	// A transfer sent as soon as it arrives takes the poll and its own blocks. Each node
+	// scores that time over its mean latency, divided by its weight so that a node of
+	// twice the weight is expected to wait half as long.
+	float sum = 0.0f, squares = 0.0f;
+	uint8_t counted = 0;
+	for (uint8_t i = 0; i < nodes; i++)
+	{
+		result.share[i] = dataBlocks > 0 ? (float)servedBlocks[i] / dataBlocks : 0.0f;
+		result.meanLatencyMs[i] = completed[i] > 0 ? latencySum[i] / completed[i] : 0.0f;
+		if (completed[i] > 0 && workload[i].weight > 0)
+		{
+			float alone = (float)(M16_FAIR_POLL_BLOCKS + workload[i].transferBlocks) * M16_BLOCK_INTERVAL_MS;
+			float x = alone / (result.meanLatencyMs[i] * workload[i].weight);
+			sum += x;
+			squares += x * x;
+			counted++;
+		}
+	}
+	result.fairness = squares > 0.0f ? sum * sum / (counted * squares) : 1.0f;
+	result.utilization = slots > 0 ? (float)dataBlocks / slots : 0.0f;
+	return result;
+}
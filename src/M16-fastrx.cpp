@@ -0,0 +1,288 @@
+/**
+ * @file M16-fastrx.cpp
+ * @brief Implementation of the FastRx class.
+ *
+ * This file contains the implementation of the FastRx class and its IRAM resident
+ * UART interrupt handler.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-fastrx.h"
+#include "esp_idf_version.h"
+#include "esp_timer.h"
+#include "hal/uart_ll.h"
+
+/**
+ * @brief Constructor for the FastRx class.
+ */
+FastRx::FastRx()
+	: uart_num(0), handle(nullptr), address(-1), queue{}, head(0), tail(0), pendingByte(0), pending(false),
+	  pendingTime(0), dropped(0), filtered(0), resyncs(0), overflows(0), peak(0), latency{0, UINT32_MAX, 0, 0} {}
+
+/**
+ * @brief Only queue packets addressed to the given id.
+ *
+ * The id is taken from the packet according to `PacketLayout`.
+ *
+ * @param id The id to accept.
+ */
+void FastRx::setAddressFilter(uint8_t id)
+{
+	this->address = id & PacketLayout::idMask;
+}
+
+/**
+ * @brief Queue packets regardless of their id.
+ */
+void FastRx::clearAddressFilter()
+{
+	this->address = -1;
+}
+
+/**
+ * @brief Replaces the interrupt handler of the UART driver with the fast path.
+ *
+ * The driver must already be installed, which `M16::begin()` does. The receive FIFO
+ * raises an interrupt as soon as it holds one block, or after a short idle time.
+ *
+ * @param uart_num The UART port the modem is attached to.
+ * @return true if the handler was installed, false otherwise.
+ */
+bool FastRx::attach(uart_port_t uart_num)
+{
+#if ESP_IDF_VERSION_MAJOR >= 5
+	(void)uart_num;
+	return false;
+#else
+	if (this->handle != nullptr)
+	{
+		return false;
+	}
+	this->uart_num = uart_num;
+	this->head = 0;
+	this->tail = 0;
+	this->pending = false;
+
+	if (uart_isr_free(uart_num) != ESP_OK)
+	{
+		return false;
+	}
+	if (uart_isr_register(uart_num, &FastRx::isr, this, ESP_INTR_FLAG_IRAM, &this->handle) != ESP_OK)
+	{
+		this->handle = nullptr;
+		return false;
+	}
+
+	uart_dev_t *hw = UART_LL_GET_HW(uart_num);
+	uart_ll_rxfifo_rst(hw);
+	uart_ll_set_rxfifo_full_thr(hw, M16_BLOCK_BYTES);
+	uart_ll_set_rx_tout(hw, 2);
+	uart_ll_clr_intsts_mask(hw, UART_LL_INTR_MASK);
+	uart_ll_ena_intr_mask(hw, UART_INTR_RXFIFO_FULL | UART_INTR_RXFIFO_TOUT | UART_INTR_RXFIFO_OVF);
+	return true;
+#endif
+}
+
+/**
+ * @brief Removes the fast path interrupt handler.
+ *
+ * The UART driver has to be reinstalled afterwards to receive through it again,
+ * which `M16::disableFastRx()` takes care of.
+ */
+void FastRx::detach()
+{
+	if (this->handle == nullptr)
+	{
+		return;
+	}
+	uart_dev_t *hw = UART_LL_GET_HW(this->uart_num);
+	uart_ll_disable_intr_mask(hw, UART_LL_INTR_MASK);
+	esp_intr_free(this->handle);
+	this->handle = nullptr;
+}
+
+/**
+ * @brief Checks whether the fast path handler is installed.
+ *
+ * @return true if the handler is installed.
+ */
+bool FastRx::attached()
+{
+	return this->handle != nullptr;
+}
+
+/**
+ * @brief Assembles received bytes into packets. Runs in interrupt context.
+ *
+ * A byte that waited longer than `M16_FAST_RX_PAIR_TIMEOUT_US` for its partner belongs
+ * to a block that lost a byte, so it is discarded to get back in step with the pairs.
+ *
+ * @param byte The byte read from the FIFO.
+ * @param now The esp_timer time of the interrupt.
+ */
+void IRAM_ATTR FastRx::receive(uint8_t byte, int64_t now)
+{
+	if (this->pending && now - this->pendingTime > M16_FAST_RX_PAIR_TIMEOUT_US)
+	{
+		this->pending = false;
+		this->resyncs++;
+	}
+	if (!this->pending)
+	{
+		this->pendingByte = byte;
+		this->pendingTime = now;
+		this->pending = true;
+		return;
+	}
+	this->pending = false;
+
+	uint16_t packet = (this->pendingByte << 8) | byte;
+	if (this->address >= 0 && PacketLayout::id(packet) != this->address)
+	{
+		this->filtered++;
+		return;
+	}
+
+	uint32_t head = this->head;
+	uint32_t next = (head + 1) & (M16_FAST_RX_QUEUE_LENGTH - 1);
+	if (next == __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE))
+	{
+		this->dropped++;
+		return;
+	}
+	this->queue[head].packet = packet;
+	this->queue[head].received = now;
+	__atomic_store_n(&this->head, next, __ATOMIC_RELEASE);
+
+	uint32_t count = (next - __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE)) & (M16_FAST_RX_QUEUE_LENGTH - 1);
+	if (count > this->peak)
+	{
+		this->peak = count;
+	}
+}
+
+/**
+ * @brief UART interrupt handler that drains the receive FIFO.
+ *
+ * @param receiver The FastRx instance registered with the handler.
+ */
+void IRAM_ATTR FastRx::isr(void *receiver)
+{
+	FastRx *self = static_cast<FastRx *>(receiver);
+	uart_dev_t *hw = UART_LL_GET_HW(self->uart_num);
+	uint32_t status = uart_ll_get_intsts_mask(hw);
+	int64_t now = esp_timer_get_time();
+
+	uint32_t length = uart_ll_get_rxfifo_len(hw);
+	while (length-- > 0)
+	{
+		uint8_t byte;
+		uart_ll_read_rxfifo(hw, &byte, 1);
+		self->receive(byte, now);
+	}
+	if (status & UART_INTR_RXFIFO_OVF)
+	{
+		uart_ll_rxfifo_rst(hw);
+		self->pending = false;
+		self->overflows++;
+	}
+	uart_ll_clr_intsts_mask(hw, status);
+}
+
+/**
+ * @brief Takes the oldest packet from the queue.
+ *
+ * Only one task may take packets from the queue. The time since the interrupt is
+ * added to the latency statistics.
+ *
+ * @param packet The variable to store the packet in, decode it with `M16::decode()`.
+ * @return true if a packet was available, false otherwise.
+ */
+bool FastRx::pop(uint16_t &packet)
+{
+	uint32_t tail = this->tail;
+	if (tail == __atomic_load_n(&this->head, __ATOMIC_ACQUIRE))
+	{
+		return false;
+	}
+	packet = this->queue[tail].packet;
+	uint32_t elapsed = (uint32_t)(esp_timer_get_time() - this->queue[tail].received);
+	__atomic_store_n(&this->tail, (tail + 1) & (M16_FAST_RX_QUEUE_LENGTH - 1), __ATOMIC_RELEASE);
+
+	this->latency.samples++;
+	this->latency.totalUs += elapsed;
+	this->latency.minUs = elapsed < this->latency.minUs ? elapsed : this->latency.minUs;
+	this->latency.maxUs = elapsed > this->latency.maxUs ? elapsed : this->latency.maxUs;
+	return true;
+}
+
+/**
+ * @brief Returns the number of packets waiting in the queue.
+ *
+ * @return The number of queued packets.
+ */
+size_t FastRx::available()
+{
+	uint32_t head = __atomic_load_n(&this->head, __ATOMIC_ACQUIRE);
+	return (head - this->tail) & (M16_FAST_RX_QUEUE_LENGTH - 1);
+}
+
+/**
+ * @brief Returns the number of packets dropped because the queue was full.
+ */
+uint32_t FastRx::getDropped()
+{
+	return this->dropped;
+}
+
+/**
+ * @brief Returns the number of packets discarded by the address filter.
+ */
+uint32_t FastRx::getFiltered()
+{
+	return this->filtered;
+}
+
+/**
+ * @brief Returns the number of lone bytes discarded to resynchronise the pairs.
+ */
+uint32_t FastRx::getResyncs()
+{
+	return this->resyncs;
+}
+
+/**
+ * @brief Returns the number of receive FIFO overflows.
+ */
+uint32_t FastRx::getOverflows()
+{
+	return this->overflows;
+}
+
+/**
+ * @brief Returns the most packets that waited in the queue at the same time.
+ */
+uint32_t FastRx::getQueuePeak()
+{
+	return this->peak;
+}
+
+/**
+ * @brief Returns the interrupt to handler latency measured since the last reset.
+ *
+ * @return A copy of the latency statistics.
+ */
+LatencyStats FastRx::getLatency()
+{
+	return this->latency;
+}
+
+/**
+ * @brief Clears the latency statistics.
+ */
+void FastRx::resetLatency()
+{
+	this->latency = LatencyStats{0, UINT32_MAX, 0, 0};
+}
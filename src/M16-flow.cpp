@@ -0,0 +1,301 @@
+/**
+ * @file M16-flow.cpp
+ * @brief Implementation of credit-based flow control.
+ *
+ * This file contains the implementation of the FlowSender class, which queues
+ * packets until the receiver has granted credit for them, and the FlowReceiver
+ * class, which grants credit as the application consumes packets.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-flow.h"
+
+/**
+ * @brief Constructor for the FlowSender class.
+ *
+ * The sender starts with a full window of credit, since the receiver starts empty.
+ *
+ * @param id The id carried by the packets of this flow.
+ * @param window Credit granted by the receiver before its first grant.
+ * @param highWater Queued packets at which producers are asked to slow down.
+ * @param lowWater Queued packets at which producers may speed up again.
+ */
+FlowSender::FlowSender(uint8_t id, uint8_t window, uint8_t highWater, uint8_t lowWater)
+	: id(id), queue{}, head(0), count(0), peak(0), highWater(highWater), lowWater(lowWater), paused(false), callback(nullptr),
+	  credit(window), sendTimes{}, sends(0), lastSend(0), rejected(0) {}
+
+/**
+ * @brief Sets the function called when the queue crosses a watermark.
+ *
+ * The function is called with true when the queue reaches the high watermark, and
+ * with false when it has drained to the low watermark.
+ *
+ * @param callback The function to call, or nullptr to disable it.
+ */
+void FlowSender::onWatermark(FlowWatermarkCallback callback)
+{
+	this->callback = callback;
+}
+
+/**
+ * @brief Changes the backpressure state and calls the watermark callback if it changed.
+ */
+void FlowSender::setPaused(bool paused)
+{
+	if (this->paused == paused)
+	{
+		return;
+	}
+	this->paused = paused;
+	if (this->callback != nullptr)
+	{
+		this->callback(paused);
+	}
+}
+
+/**
+ * @brief Queues a packet without blocking.
+ *
+ * @param command The command of the packet.
+ * @param data The data of the packet.
+ * @return `FLOW_ACCEPTED` if the packet was queued, `FLOW_BACKPRESSURE` if it was
+ * queued above the high watermark, `FLOW_REJECTED` if the queue is full.
+ */
+FlowStatus FlowSender::trySend(Command command, uint16_t data)
+{
+	if (this->count == M16_FLOW_QUEUE_LENGTH)
+	{
+		this->rejected++;
+		this->setPaused(true);
+		return FLOW_REJECTED;
+	}
+	this->queue[(this->head + this->count) % M16_FLOW_QUEUE_LENGTH] = ProtocolStructure{this->id, command, data};
+	this->count++;
+	if (this->count > this->peak)
+	{
+		this->peak = this->count;
+	}
+	if (this->count >= this->highWater)
+	{
+		this->setPaused(true);
+	}
+	return this->paused ? FLOW_BACKPRESSURE : FLOW_ACCEPTED;
+}
+
+/**
+ * @brief Takes the next packet to send, if the receiver has room for it.
+ *
+ * Packets are released one block interval apart, so the modem is never handed a
+ * block while it is still sending the previous one.
+ *
+ * @param packet Receives the packet to send.
+ * @param now The current time in milliseconds.
+ * @return true if a packet should be sent now, false otherwise.
+ */
+bool FlowSender::nextPacket(ProtocolStructure &packet, unsigned long now)
+{
+	if (this->count == 0 || this->credit == 0)
+	{
+		return false;
+	}
+	if (this->sends > 0 && now - this->sendTimes[this->lastSend] < M16_BLOCK_INTERVAL_MS)
+	{
+		return false;
+	}
+
+	packet = this->queue[this->head];
+	this->head = (this->head + 1) % M16_FLOW_QUEUE_LENGTH;
+	this->count--;
+	this->credit--;
+
+	this->lastSend = (this->lastSend + 1) % M16_FLOW_SEND_HISTORY;
+	this->sendTimes[this->lastSend] = now;
+	if (this->sends < M16_FLOW_SEND_HISTORY)
+	{
+		this->sends++;
+	}
+
+	if (this->count <= this->lowWater)
+	{
+		this->setPaused(false);
+	}
+	return true;
+}
+
+/**
+ * @brief Applies a grant from the receiver.
+ *
+ * Packets sent within `M16_FLOW_INFLIGHT_MS` may have been on their way when the
+ * grant was made, so they are subtracted from it.
+ *
+ * @param packet A packet received from the receiver.
+ * @param now The current time in milliseconds.
+ * @return true if the packet was a grant for this flow, false otherwise.
+ */
+bool FlowSender::grantReceived(ProtocolStructure packet, unsigned long now)
+{
+	if (packet.command != CREDIT || packet.id != this->id)
+	{
+		return false;
+	}
+
+	// The recorded send times are the `sends` entries ending at `lastSend`.
+	uint8_t inFlight = 0;
+	for (uint8_t i = 0; i < this->sends; i++)
+	{
+		if (now - this->sendTimes[(this->lastSend + M16_FLOW_SEND_HISTORY - i) % M16_FLOW_SEND_HISTORY] < M16_FLOW_INFLIGHT_MS)
+		{
+			inFlight++;
+		}
+	}
+	uint16_t granted = packet.data > UINT8_MAX ? UINT8_MAX : packet.data;
+	this->credit = granted > inFlight ? granted - inFlight : 0;
+	return true;
+}
+
+/**
+ * @brief Returns the packets that may be sent before the next grant.
+ */
+uint8_t FlowSender::credits()
+{
+	return this->credit;
+}
+
+/**
+ * @brief Returns the packets waiting for credit.
+ */
+uint8_t FlowSender::queued()
+{
+	return this->count;
+}
+
+/**
+ * @brief Checks whether producers should slow down.
+ *
+ * @return true from when the queue reaches the high watermark until it drains to the low one.
+ */
+bool FlowSender::isPaused()
+{
+	return this->paused;
+}
+
+/**
+ * @brief Returns the number of packets dropped because the queue was full.
+ */
+uint32_t FlowSender::getRejected()
+{
+	return this->rejected;
+}
+
+/**
+ * @brief Returns the most packets that waited for credit at the same time.
+ */
+uint8_t FlowSender::getQueuePeak()
+{
+	return this->peak;
+}
+
+/**
+ * @brief Constructor for the FlowReceiver class.
+ *
+ * @param id The id carried by the packets of this flow.
+ * @param window Packets the application can buffer.
+ */
+FlowReceiver::FlowReceiver(uint8_t id, uint8_t window)
+	: id(id), window(window > PacketLayout::dataMask ? PacketLayout::dataMask : window), held(0), freed(0),
+	  lastActivity(0), backoff(1), overflows(0) {}
+
+/**
+ * @brief Counts a packet received from the sender.
+ *
+ * @param packet The decoded packet.
+ * @param now The current time in milliseconds.
+ * @return false if the packet is not part of this flow or the window is already
+ * full, true if the application should buffer it.
+ */
+bool FlowReceiver::packetReceived(ProtocolStructure packet, unsigned long now)
+{
+	if (packet.id != this->id || packet.command == CREDIT)
+	{
+		return false;
+	}
+	this->lastActivity = now;
+	this->backoff = 1;
+	if (this->held >= this->window)
+	{
+		this->overflows++;
+		return false;
+	}
+	this->held++;
+	return true;
+}
+
+/**
+ * @brief Records that the application has processed buffered packets.
+ *
+ * @param packets The number of packets processed.
+ */
+void FlowReceiver::consumed(uint8_t packets)
+{
+	if (packets > this->held)
+	{
+		packets = this->held;
+	}
+	this->held -= packets;
+	this->freed += packets;
+}
+
+/**
+ * @brief Returns the packets received but not consumed yet.
+ */
+uint8_t FlowReceiver::buffered()
+{
+	return this->held;
+}
+
+/**
+ * @brief Checks whether a grant should be sent.
+ *
+ * A grant is due once half the window has been freed. After a silence it is
+ * repeated with growing intervals, in case the last one was lost while the sender
+ * waits for it.
+ *
+ * @param now The current time in milliseconds.
+ * @return true if `feedback()` should be called and its packet sent, false otherwise.
+ */
+bool FlowReceiver::feedbackDue(unsigned long now)
+{
+	uint8_t threshold = this->window / 2 > 0 ? this->window / 2 : 1;
+	if (this->freed >= threshold)
+	{
+		return true;
+	}
+	return this->held < this->window && now - this->lastActivity >= (unsigned long)M16_FLOW_REGRANT_MS * this->backoff;
+}
+
+/**
+ * @brief Creates a grant with the room left in the window.
+ *
+ * @param now The current time in milliseconds.
+ * @return The CREDIT packet to send to the sender.
+ */
+ProtocolStructure FlowReceiver::feedback(unsigned long now)
+{
+	if (this->freed == 0 && this->backoff < M16_FLOW_REGRANT_MAX_BACKOFF)
+	{
+		this->backoff *= 2;
+	}
+	this->freed = 0;
+	this->lastActivity = now;
+	return ProtocolStructure{this->id, CREDIT, (uint16_t)(this->window - this->held)};
+}
+
+/**
+ * @brief Returns the packets received beyond the window.
+ */
+uint32_t FlowReceiver::getOverflows()
+{
+	return this->overflows;
+}
@@ -0,0 +1,733 @@
+/**
+ * @file M16-harq.cpp
+ * @brief Implementation of hybrid ARQ with incremental redundancy.
+ *
+ * This file contains the GF(256) arithmetic of the Cauchy Reed-Solomon code, the
+ * HarqSender and HarqReceiver state machines, and the HarqSimulation used to compare
+ * them with plain retransmission.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-harq.h"
+#include <math.h>
+#include <string.h>
+
+static uint8_t gfExp[512];
+static uint8_t gfLog[256];
+static bool gfReady = false;
+
+/**
+ * @brief Builds the exponent and logarithm tables of GF(256).
+ *
+ * The field uses the polynomial x^8 + x^4 + x^3 + x^2 + 1 with generator 2.
+ */
+static void gfInit()
+{
+	if (gfReady)
+	{
+		return;
+	}
+	uint16_t value = 1;
+	for (uint16_t i = 0; i < 255; i++)
+	{
+		gfExp[i] = value;
+		gfLog[value] = i;
+		value <<= 1;
+		if (value & 0x100)
+		{
+			value ^= 0x11d;
+		}
+	}
+	for (uint16_t i = 255; i < 512; i++)
+	{
+		gfExp[i] = gfExp[i - 255];
+	}
+	gfReady = true;
+}
+
+static uint8_t gfMultiply(uint8_t a, uint8_t b)
+{
+	if (a == 0 || b == 0)
+	{
+		return 0;
+	}
+	return gfExp[gfLog[a] + gfLog[b]];
+}
+
+static uint8_t gfInverse(uint8_t a)
+{
+	return gfExp[255 - gfLog[a]];
+}
+
+/**
+ * @brief Coefficient of a message byte in a parity byte.
+ *
+ * The Cauchy matrix 1 / (x_j + y_i) with x_j = 0x80 | j and y_i = i has no singular
+ * square submatrix, so every set of parity bytes can replace the same number of
+ * lost data bytes.
+ */
+static uint8_t cauchy(uint8_t parity, uint8_t position)
+{
+	return gfInverse((M16_HARQ_PARITY_FLAG | parity) ^ position);
+}
+
+/**
+ * @brief Calculates a parity byte of a message.
+ *
+ * @param message The message bytes.
+ * @param length The number of bytes in the message.
+ * @param index The index of the parity byte (0-127).
+ * @return The parity byte.
+ */
+uint8_t harqParity(const uint8_t *message, uint8_t length, uint8_t index)
+{
+	gfInit();
+	uint8_t parity = 0;
+	for (uint8_t i = 0; i < length; i++)
+	{
+		parity ^= gfMultiply(cauchy(index, i), message[i]);
+	}
+	return parity;
+}
+
+/**
+ * @brief Returns the parity bytes sent in the first round at a redundancy level.
+ *
+ * The levels add none, an eighth, a quarter and half of the message length in
+ * parity, rounded up.
+ *
+ * @param length The number of bytes in the message.
+ * @param level The redundancy level (0 to `M16_HARQ_REDUNDANCY_LEVELS` - 1).
+ * @return The number of parity bytes.
+ */
+uint8_t harqRedundancy(uint8_t length, uint8_t level)
+{
+	static const uint8_t eighths[M16_HARQ_REDUNDANCY_LEVELS] = {0, 1, 2, 4};
+	if (level >= M16_HARQ_REDUNDANCY_LEVELS)
+	{
+		level = M16_HARQ_REDUNDANCY_LEVELS - 1;
+	}
+	return (length * eighths[level] + 7) / 8;
+}
+
+/**
+ * @brief Constructor for the HarqSender class.
+ *
+ * @param incremental Answer missing bytes with parity rounds; if false the whole
+ *                    message is repeated, which is plain ARQ.
+ */
+HarqSender::HarqSender(bool incremental)
+	: id(0), message{}, length(0), level(0), incremental(incremental), finished(true), parityRound(false), nextParity(0),
+	  roundParity(0), roundLength(0), roundSent(0), rounds(0), retries(UINT8_MAX), dropped(false) {}
+
+/**
+ * @brief Starts sending a message.
+ *
+ * @param id The id placed in every block of the message.
+ * @param data The bytes to send.
+ * @param length The number of bytes (1 to `M16_HARQ_MAX_LENGTH`).
+ * @param level Redundancy level of the first round, see harqRedundancy().
+ * @param retries Rounds after the first before the message is dropped, `UINT8_MAX` to never give up.
+ * @return true if the message was accepted, false if the length or level is invalid.
+ */
+bool HarqSender::begin(uint8_t id, const uint8_t *data, uint8_t length, uint8_t level, uint8_t retries)
+{
+	if (length == 0 || length > M16_HARQ_MAX_LENGTH || level >= M16_HARQ_REDUNDANCY_LEVELS)
+	{
+		return false;
+	}
+	this->id = id;
+	memcpy(this->message, data, length);
+	this->length = length;
+	this->level = level;
+	this->finished = false;
+	this->nextParity = harqRedundancy(length, level);
+	this->rounds = 0;
+	this->retries = retries;
+	this->dropped = false;
+	this->startRound(0);
+	return true;
+}
+
+/**
+ * @brief Prepares the next round of blocks.
+ *
+ * The message is dropped instead once the retry budget is used up.
+ *
+ * @param missing The number of parity bytes to send, or 0 to send the data. A data
+ *                round repeats the parity bytes of the first round.
+ */
+void HarqSender::startRound(uint8_t missing)
+{
+	if (this->rounds > 0 && this->rounds - 1 >= this->retries)
+	{
+		this->dropped = true;
+		this->finished = true;
+		return;
+	}
+	// Parity indices are limited to 7 bits by the start block.
+	if (missing > 0 && this->nextParity + missing > M16_HARQ_PARITY_FLAG)
+	{
+		missing = 0;
+	}
+	this->parityRound = missing > 0;
+	this->roundParity = this->nextParity;
+	this->roundLength = this->parityRound ? missing : this->length + harqRedundancy(this->length, this->level);
+	this->nextParity += missing;
+	this->roundSent = 0;
+	this->rounds++;
+}
+
+/**
+ * @brief Returns the next block of the current round.
+ *
+ * Each round starts with a MESSAGE_START block. Send the returned blocks
+ * `M16_BLOCK_INTERVAL_MS` apart, the receiver places them by their arrival time.
+ *
+ * @param packet The structure to fill with the block.
+ * @return true if a block was returned, false if the round is sent.
+ */
+bool HarqSender::nextBlock(ProtocolStructure &packet)
+{
+	if (this->finished || this->roundSent > this->roundLength)
+	{
+		return false;
+	}
+
+	packet.id = this->id;
+	if (this->roundSent == 0)
+	{
+		packet.command = MESSAGE_START;
+		packet.data = this->parityRound ? (M16_HARQ_PARITY_FLAG | this->roundParity)
+										: ((this->length - 1) | (this->level << M16_HARQ_REDUNDANCY_SHIFT));
+	}
+	else if (this->parityRound)
+	{
+		packet.command = MESSAGE_PARITY;
+		packet.data = harqParity(this->message, this->length, this->roundParity + this->roundSent - 1);
+	}
+	else if (this->roundSent <= this->length)
+	{
+		packet.command = MESSAGE_DATA;
+		packet.data = this->message[this->roundSent - 1];
+	}
+	else
+	{
+		packet.command = MESSAGE_PARITY;
+		packet.data = harqParity(this->message, this->length, this->roundSent - 1 - this->length);
+	}
+	this->roundSent++;
+	return true;
+}
+
+/**
+ * @brief Handles the MESSAGE_ACK sent by the receiver after a round.
+ *
+ * @param packet The received feedback block.
+ */
+void HarqSender::feedback(ProtocolStructure packet)
+{
+	if (this->finished || packet.command != MESSAGE_ACK || packet.id != this->id)
+	{
+		return;
+	}
+	if (packet.data == 0)
+	{
+		this->finished = true;
+		return;
+	}
+	this->startRound(this->incremental ? packet.data : 0);
+}
+
+/**
+ * @brief Repeats the current round when no feedback arrived in time.
+ *
+ * A lost parity round is replaced by fresh parity bytes, which are as useful to the
+ * receiver as the lost ones and also cover a lost second feedback.
+ */
+void HarqSender::timeout()
+{
+	if (this->finished)
+	{
+		return;
+	}
+	this->startRound(this->incremental && this->parityRound ? this->roundLength : 0);
+}
+
+/**
+ * @brief Checks whether the receiver has acknowledged the whole message.
+ */
+bool HarqSender::complete()
+{
+	return this->finished && !this->dropped;
+}
+
+/**
+ * @brief Checks whether the message was given up after the retry budget.
+ */
+bool HarqSender::isDropped()
+{
+	return this->dropped;
+}
+
+/**
+ * @brief Returns the number of rounds sent for the current message.
+ */
+uint8_t HarqSender::getRounds()
+{
+	return this->rounds;
+}
+
+/**
+ * @brief Constructor for the HarqReceiver class.
+ *
+ * @param combine Keep bytes from earlier rounds; if false every repetition of the
+ *                message starts over, which is plain ARQ.
+ */
+HarqReceiver::HarqReceiver(bool combine) : combine(combine)
+{
+	gfInit();
+	this->reset();
+}
+
+/**
+ * @brief Discards the message being received.
+ */
+void HarqReceiver::reset()
+{
+	this->state = IDLE;
+	this->id = 0;
+	this->length = 0;
+	memset(this->known, 0, sizeof(this->known));
+	this->parityCount = 0;
+	this->parityRound = false;
+	this->roundParity = 0;
+	this->roundLength = 0;
+	this->requested = 0;
+	this->roundStart = 0;
+	this->feedbackSent = 0;
+}
+
+/**
+ * @brief Handles a received block.
+ *
+ * @param packet The decoded block.
+ * @param now The time the block was received, in milliseconds.
+ * @return true if the block belongs to a multi-block message, false otherwise.
+ */
+bool HarqReceiver::packetReceived(ProtocolStructure packet, unsigned long now)
+{
+	switch (packet.command)
+	{
+	case MESSAGE_START:
+		if (packet.data & M16_HARQ_PARITY_FLAG)
+		{
+			if (this->state == IDLE || packet.id != this->id)
+			{
+				return true;
+			}
+			this->parityRound = true;
+			this->roundParity = packet.data & ~M16_HARQ_PARITY_FLAG;
+			this->roundLength = this->requested;
+		}
+		else
+		{
+			uint8_t length = (packet.data & M16_HARQ_LENGTH_MASK) + 1;
+			uint8_t level = (packet.data >> M16_HARQ_REDUNDANCY_SHIFT) & (M16_HARQ_REDUNDANCY_LEVELS - 1);
+			if (length > M16_HARQ_MAX_LENGTH)
+			{
+				return true;
+			}
+			bool repeat = this->state != IDLE && packet.id == this->id && length == this->length;
+			if (!repeat || (!this->combine && this->state != DONE))
+			{
+				this->reset();
+			}
+			this->id = packet.id;
+			this->length = length;
+			this->parityRound = false;
+			this->roundLength = length + harqRedundancy(length, level);
+		}
+		this->roundStart = now;
+		this->state = RECEIVING;
+		return true;
+
+	case MESSAGE_DATA:
+	case MESSAGE_PARITY:
+	{
+		if (this->state != RECEIVING || packet.id != this->id)
+		{
+			return true;
+		}
+		unsigned long slot = (now - this->roundStart + M16_BLOCK_INTERVAL_MS / 2) / M16_BLOCK_INTERVAL_MS;
+		if (slot < 1 || slot > this->roundLength)
+		{
+			return true;
+		}
+		uint8_t index = slot - 1;
+		// Data rounds carry the data first and the parity of the redundancy level after it.
+		bool parity = this->parityRound || index >= this->length;
+		if (parity != (packet.command == MESSAGE_PARITY))
+		{
+			return true;
+		}
+		if (!parity)
+		{
+			this->symbols[index] = packet.data;
+			this->known[index] = true;
+		}
+		else
+		{
+			this->addParity(this->parityRound ? this->roundParity + index : index - this->length, packet.data);
+		}
+		return true;
+	}
+
+	default:
+		return false;
+	}
+}
+
+/**
+ * @brief Stores a received parity byte unless it is already known.
+ *
+ * @param index The index of the parity byte.
+ * @param value The parity byte.
+ */
+void HarqReceiver::addParity(uint8_t index, uint8_t value)
+{
+	for (uint8_t i = 0; i < this->parityCount; i++)
+	{
+		if (this->parityIndex[i] == index)
+		{
+			return;
+		}
+	}
+	if (this->parityCount < M16_HARQ_MAX_PARITY)
+	{
+		this->parityIndex[this->parityCount] = index;
+		this->parityValue[this->parityCount] = value;
+		this->parityCount++;
+	}
+}
+
+/**
+ * @brief Checks whether a MESSAGE_ACK should be sent.
+ *
+ * Feedback is due once the last block of a round should have arrived. If the start
+ * block of a requested parity round was lost, the request is repeated after
+ * `M16_HARQ_FEEDBACK_TIMEOUT_MS`.
+ *
+ * @param now The current time in milliseconds.
+ * @return true if `feedback()` should be called and its block sent.
+ */
+bool HarqReceiver::feedbackDue(unsigned long now)
+{
+	if (this->state == RECEIVING)
+	{
+		return now - this->roundStart >= (unsigned long)this->roundLength * M16_BLOCK_INTERVAL_MS + M16_BLOCK_INTERVAL_MS / 2;
+	}
+	if (this->state == WAITING)
+	{
+		return now - this->feedbackSent >= (unsigned long)(this->requested + 1) * M16_BLOCK_INTERVAL_MS + M16_HARQ_FEEDBACK_TIMEOUT_MS;
+	}
+	return false;
+}
+
+/**
+ * @brief Combines everything received so far and builds the MESSAGE_ACK block.
+ *
+ * @param now The current time in milliseconds.
+ * @return The feedback block, carrying the number of bytes still missing.
+ */
+ProtocolStructure HarqReceiver::feedback(unsigned long now)
+{
+	this->decode();
+	uint8_t missing = this->missing();
+	if (missing == 0)
+	{
+		this->state = DONE;
+	}
+	else
+	{
+		this->requested = missing;
+		this->state = WAITING;
+	}
+	this->feedbackSent = now;
+	return ProtocolStructure{this->id, MESSAGE_ACK, missing};
+}
+
+/**
+ * @brief Recovers lost data bytes from the received parity bytes.
+ *
+ * Every parity byte is a known linear combination of the data bytes, so with as
+ * many parity bytes as lost data bytes the lost bytes follow from Gaussian
+ * elimination over GF(256).
+ *
+ * @return true if every data byte is known afterwards.
+ */
+bool HarqReceiver::decode()
+{
+	uint8_t unknown[M16_HARQ_MAX_LENGTH];
+	uint8_t count = 0;
+	for (uint8_t i = 0; i < this->length; i++)
+	{
+		if (!this->known[i])
+		{
+			unknown[count++] = i;
+		}
+	}
+	if (count == 0)
+	{
+		return true;
+	}
+	if (this->parityCount < count)
+	{
+		return false;
+	}
+
+	// One equation per parity byte, with the known data bytes moved to the right side.
+	uint8_t matrix[M16_HARQ_MAX_LENGTH][M16_HARQ_MAX_LENGTH + 1];
+	for (uint8_t row = 0; row < count; row++)
+	{
+		uint8_t parity = this->parityIndex[row];
+		uint8_t value = this->parityValue[row];
+		for (uint8_t i = 0; i < this->length; i++)
+		{
+			if (this->known[i])
+			{
+				value ^= gfMultiply(cauchy(parity, i), this->symbols[i]);
+			}
+		}
+		for (uint8_t column = 0; column < count; column++)
+		{
+			matrix[row][column] = cauchy(parity, unknown[column]);
+		}
+		matrix[row][count] = value;
+	}
+
+	for (uint8_t column = 0; column < count; column++)
+	{
+		uint8_t pivot = column;
+		while (pivot < count && matrix[pivot][column] == 0)
+		{
+			pivot++;
+		}
+		if (pivot == count)
+		{
+			return false;
+		}
+		if (pivot != column)
+		{
+			for (uint8_t k = 0; k <= count; k++)
+			{
+				uint8_t swap = matrix[column][k];
+				matrix[column][k] = matrix[pivot][k];
+				matrix[pivot][k] = swap;
+			}
+		}
+		uint8_t scale = gfInverse(matrix[column][column]);
+		for (uint8_t k = column; k <= count; k++)
+		{
+			matrix[column][k] = gfMultiply(matrix[column][k], scale);
+		}
+		for (uint8_t row = 0; row < count; row++)
+		{
+			uint8_t factor = matrix[row][column];
+			if (row == column || factor == 0)
+			{
+				continue;
+			}
+			for (uint8_t k = column; k <= count; k++)
+			{
+				matrix[row][k] ^= gfMultiply(factor, matrix[column][k]);
+			}
+		}
+	}
+
+	for (uint8_t i = 0; i < count; i++)
+	{
+		this->symbols[unknown[i]] = matrix[i][count];
+		this->known[unknown[i]] = true;
+	}
+	return true;
+}
+
+/**
+ * @brief Returns the number of additional parity bytes needed to recover the message.
+ */
+uint8_t HarqReceiver::missing()
+{
+	uint8_t unknown = 0;
+	for (uint8_t i = 0; i < this->length; i++)
+	{
+		if (!this->known[i])
+		{
+			unknown++;
+		}
+	}
+	return unknown > this->parityCount ? unknown - this->parityCount : 0;
+}
+
+/**
+ * @brief Checks whether every byte of the message is known.
+ */
+bool HarqReceiver::complete()
+{
+	if (this->length == 0)
+	{
+		return false;
+	}
+	for (uint8_t i = 0; i < this->length; i++)
+	{
+		if (!this->known[i])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Takes the received message and gets ready for the next one.
+ *
+ * @param data Buffer of at least `M16_HARQ_MAX_LENGTH` bytes.
+ * @return The number of bytes copied, or 0 if the message is not complete.
+ */
+uint8_t HarqReceiver::read(uint8_t *data)
+{
+	if (!this->complete())
+	{
+		return 0;
+	}
+	uint8_t length = this->length;
+	memcpy(data, this->symbols, length);
+	this->reset();
+	return length;
+}
+
+/**
+ * @brief Constructor for the HarqSimulation class.
+ *
+ * @param seed Seed of the block loss generator, runs with the same seed are identical.
+ */
+HarqSimulation::HarqSimulation(uint32_t seed) : seed(seed ? seed : 1) {}
+
+/**
+ * @brief Converts a bit error probability into a block loss probability.
+ *
+ * A block is lost if any of its 16 bits is wrong.
+ *
+ * @param bitErrorRate Probability that a single bit is wrong.
+ * @return Probability that a block is lost.
+ */
+float HarqSimulation::blockErrorRate(float bitErrorRate)
+{
+	return 1.0f - powf(1.0f - bitErrorRate, 8 * M16_BLOCK_BYTES);
+}
+
+/**
+ * @brief Returns the next value of the xorshift32 generator.
+ */
+uint32_t HarqSimulation::next()
+{
+	this->seed ^= this->seed << 13;
+	this->seed ^= this->seed >> 17;
+	this->seed ^= this->seed << 5;
+	return this->seed;
+}
+
+/**
+ * @brief Draws whether a block is lost.
+ */
+bool HarqSimulation::lost(float blockErrorRate)
+{
+	return (float)this->next() / 4294967296.0f < blockErrorRate;
+}
+
+/**
+ * @brief Sends a number of messages over a lossy channel on a virtual clock.
+ *
+ * Every block, feedback included, takes `M16_BLOCK_INTERVAL_MS` and is lost with
+ * the given probability. A round without feedback costs `M16_HARQ_FEEDBACK_TIMEOUT_MS`.
+ *
+ * @return Delivered payload bits per second.
+ */
+float HarqSimulation::run(float blockErrorRate, uint8_t length, bool incremental, uint16_t trials, float &rounds)
+{
+	HarqSender sender(incremental);
+	HarqReceiver receiver(incremental);
+	uint8_t message[M16_HARQ_MAX_LENGTH];
+	uint8_t received[M16_HARQ_MAX_LENGTH];
+	unsigned long now = 0;
+	uint32_t delivered = 0;
+	uint32_t totalRounds = 0;
+
+	for (uint16_t trial = 0; trial < trials; trial++)
+	{
+		for (uint8_t i = 0; i < length; i++)
+		{
+			message[i] = this->next();
+		}
+		sender.begin(1, message, length);
+		receiver.reset();
+
+		while (!sender.complete() && sender.getRounds() < 100)
+		{
+			ProtocolStructure packet;
+			while (sender.nextBlock(packet))
+			{
+				if (!this->lost(blockErrorRate))
+				{
+					receiver.packetReceived(packet, now);
+				}
+				now += M16_BLOCK_INTERVAL_MS;
+			}
+
+			if (receiver.feedbackDue(now))
+			{
+				ProtocolStructure ack = receiver.feedback(now);
+				now += M16_BLOCK_INTERVAL_MS;
+				if (!this->lost(blockErrorRate))
+				{
+					sender.feedback(ack);
+					continue;
+				}
+			}
+			now += M16_HARQ_FEEDBACK_TIMEOUT_MS;
+			sender.timeout();
+		}
+
+		totalRounds += sender.getRounds();
+		if (sender.complete() && receiver.read(received) == length && memcmp(received, message, length) == 0)
+		{
+			delivered += length;
+		}
+	}
+
+	rounds = trials > 0 ? (float)totalRounds / trials : 0.0f;
+	return now > 0 ? delivered * 8 * 1000.0f / now : 0.0f;
+}
+
+/**
+ * @brief Compares hybrid ARQ with plain retransmission at one bit error rate.
+ *
+ * Both schemes see the same sequence of losses.
+ *
+ * @param bitErrorRate Probability that a single bit is wrong.
+ * @param length Bytes per message.
+ * @param trials Messages sent with each scheme.
+ * @return Goodput and average rounds of both schemes.
+ */
+GoodputResult HarqSimulation::compare(float bitErrorRate, uint8_t length, uint16_t trials)
+{
+	GoodputResult result{};
+	uint32_t start = this->seed;
+	result.blockErrorRate = HarqSimulation::blockErrorRate(bitErrorRate);
+	result.harqGoodput = this->run(result.blockErrorRate, length, true, trials, result.harqRounds);
+	this->seed = start;
+	result.arqGoodput = this->run(result.blockErrorRate, length, false, trials, result.arqRounds);
+	return result;
+}
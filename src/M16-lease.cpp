@@ -0,0 +1,590 @@
+/**
+ * @file M16-lease.cpp
+ * @brief Implementation of the id lease protocol.
+ *
+ * This file contains the server side, which hands out and reclaims ids, and the
+ * node side, which requests and keeps an id.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-lease.h"
+
+/**
+ * @brief Constructor for the LeaseServer class.
+ *
+ * All ids except `M16_LEASE_JOIN_ID` start out free.
+ *
+ * @param leaseMs Silence after which the id of a node is reclaimed.
+ */
+LeaseServer::LeaseServer(unsigned long leaseMs)
+	: leases{}, leaseMs(leaseMs), windowOpen(false), windowEnd(0), queue{}, queued{}, head(0), count(0), reclaimed(0),
+	  conflicts(0) {}
+
+bool LeaseServer::enqueue(ProtocolStructure packet, unsigned long now)
+{
+	if (this->count == M16_LEASE_QUEUE_LENGTH)
+	{
+		return false;
+	}
+	uint8_t tail = (this->head + this->count) % M16_LEASE_QUEUE_LENGTH;
+	this->queue[tail] = packet;
+	this->queued[tail] = now;
+	this->count++;
+	return true;
+}
+
+/**
+ * @brief Removes an entry from the queue, keeping the order of the others.
+ *
+ * @param index Position of the entry counted from the head.
+ */
+void LeaseServer::remove(uint8_t index)
+{
+	for (uint8_t i = index; i + 1 < this->count; i++)
+	{
+		uint8_t to = (this->head + i) % M16_LEASE_QUEUE_LENGTH;
+		uint8_t from = (to + 1) % M16_LEASE_QUEUE_LENGTH;
+		this->queue[to] = this->queue[from];
+		this->queued[to] = this->queued[from];
+	}
+	this->count--;
+}
+
+/**
+ * @brief Leases the lowest free id.
+ *
+ * @return The id, or -1 if every id is leased or quarantined.
+ */
+int LeaseServer::allocate(unsigned long now)
+{
+	this->expire(now);
+	for (uint8_t id = 0; id < M16_MAX_NODES; id++)
+	{
+		if (id != M16_LEASE_JOIN_ID && !this->leases[id].leased && !this->leases[id].quarantined)
+		{
+			this->leases[id].leased = true;
+			this->leases[id].lastHeard = now;
+			return id;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief Starts a contention window for nodes without an id.
+ *
+ * The returned block must be sent right away. Nodes answer in one of the `slots`
+ * block times after it has arrived, and offers are held back until the last request
+ * has had time to arrive, `M16_ROUND_TRIP_MS` after the last slot. Use about twice
+ * as many slots as nodes expected to join to keep collisions rare.
+ *
+ * @param now The current time in milliseconds.
+ * @param slots Request slots in the window, at most 126.
+ * @return The window block.
+ */
+ProtocolStructure LeaseServer::openWindow(unsigned long now, uint8_t slots)
+{
+	if (slots == 0)
+	{
+		slots = 1;
+	}
+	if (slots > M16_LEASE_NONCE_MASK - 1)
+	{
+		slots = M16_LEASE_NONCE_MASK - 1;
+	}
+	this->windowOpen = true;
+	this->windowEnd = now + (unsigned long)(slots + 1) * M16_BLOCK_INTERVAL_MS + M16_ROUND_TRIP_MS;
+	return ProtocolStructure{M16_LEASE_JOIN_ID, JOIN, (uint16_t)(M16_LEASE_WINDOW_FLAG | slots)};
+}
+
+/**
+ * @brief Checks whether nodes may still send requests.
+ *
+ * @param now The current time in milliseconds.
+ * @return true while the window is open, false otherwise.
+ */
+bool LeaseServer::windowActive(unsigned long now)
+{
+	if (this->windowOpen && (long)(now - this->windowEnd) >= 0)
+	{
+		this->windowOpen = false;
+	}
+	return this->windowOpen;
+}
+
+/**
+ * @brief Handles a block received from a node.
+ *
+ * Every block is passed here, since any block from a node renews its lease. A block
+ * from an id that is not leased comes from a node that lost its lease, and the id
+ * is revoked so the node joins again.
+ *
+ * @param packet The received block.
+ * @param now The current time in milliseconds.
+ * @return true if the block was a JOIN block handled here, false if it is for the application.
+ */
+bool LeaseServer::packetReceived(ProtocolStructure packet, unsigned long now)
+{
+	if (packet.id == M16_LEASE_JOIN_ID)
+	{
+		if (packet.command != JOIN)
+		{
+			return false;
+		}
+		if (packet.data & M16_LEASE_WINDOW_FLAG || !this->windowActive(now))
+		{
+			return true;
+		}
+		for (uint8_t i = 0; i < this->count; i++)
+		{
+			uint8_t index = (this->head + i) % M16_LEASE_QUEUE_LENGTH;
+			ProtocolStructure offer = this->queue[index];
+			if (offer.data != packet.data)
+			{
+				continue;
+			}
+			// The same block heard twice, or two nodes with the same nonce in different slots.
+			if (now - this->queued[index] >= M16_BLOCK_TIME_MS)
+			{
+				this->leases[offer.id].leased = false;
+				this->remove(i);
+				this->conflicts++;
+			}
+			return true;
+		}
+		if (this->count < M16_LEASE_QUEUE_LENGTH)
+		{
+			int id = this->allocate(now);
+			if (id >= 0)
+			{
+				this->enqueue(ProtocolStructure{(unsigned char)id, JOIN, packet.data}, now);
+			}
+		}
+		return true;
+	}
+
+	Lease &lease = this->leases[packet.id];
+	if (!lease.leased)
+	{
+		this->enqueue(ProtocolStructure{packet.id, JOIN, M16_LEASE_REVOKE}, now);
+		return packet.command == JOIN;
+	}
+	lease.lastHeard = now;
+	if (packet.command != JOIN)
+	{
+		return false;
+	}
+	if (packet.data == M16_LEASE_RENEW)
+	{
+		this->enqueue(ProtocolStructure{packet.id, JOIN, M16_LEASE_RENEW}, now);
+	}
+	return true;
+}
+
+/**
+ * @brief Returns the next offer, confirmation or revocation to send.
+ *
+ * Nothing is returned while a window is open, so the server does not talk over
+ * the requests. Blocks are spaced by the caller like any other block.
+ *
+ * @param packet The block to send.
+ * @param now The current time in milliseconds.
+ * @return true if a block was returned, false otherwise.
+ */
+bool LeaseServer::nextPacket(ProtocolStructure &packet, unsigned long now)
+{
+	if (this->count == 0 || this->windowActive(now))
+	{
+		return false;
+	}
+	packet = this->queue[this->head];
+	this->head = (this->head + 1) % M16_LEASE_QUEUE_LENGTH;
+	this->count--;
+	return true;
+}
+
+/**
+ * @brief Reclaims the ids of nodes that have been silent for the lease time.
+ *
+ * A reclaimed id is only offered again after another lease time, when the node
+ * that held it has given it up on its side as well.
+ *
+ * @param now The current time in milliseconds.
+ */
+void LeaseServer::expire(unsigned long now)
+{
+	for (Lease &lease : this->leases)
+	{
+		if (now - lease.lastHeard < this->leaseMs)
+		{
+			continue;
+		}
+		if (lease.leased)
+		{
+			lease.leased = false;
+			lease.quarantined = true;
+			lease.lastHeard = now;
+			this->reclaimed++;
+		}
+		else
+		{
+			lease.quarantined = false;
+		}
+	}
+}
+
+/**
+ * @brief Checks whether an id is leased to a node.
+ */
+bool LeaseServer::isLeased(uint8_t id)
+{
+	return id < M16_MAX_NODES && this->leases[id].leased;
+}
+
+/**
+ * @brief Returns the number of leased ids.
+ */
+uint8_t LeaseServer::leased()
+{
+	uint8_t leased = 0;
+	for (const Lease &lease : this->leases)
+	{
+		leased += lease.leased;
+	}
+	return leased;
+}
+
+/**
+ * @brief Returns the number of ids reclaimed from silent nodes.
+ */
+uint32_t LeaseServer::getReclaimed()
+{
+	return this->reclaimed;
+}
+
+/**
+ * @brief Returns the number of requests dropped because two nodes drew the same nonce.
+ */
+uint32_t LeaseServer::getConflicts()
+{
+	return this->conflicts;
+}
+
+/**
+ * @brief Constructor for the LeaseClient class.
+ *
+ * @param seed Seed of the nonce and slot choice, should differ between nodes, for
+ * example the chip id or MAC address.
+ * @param leaseMs Lease time, must match the server.
+ */
+LeaseClient::LeaseClient(uint32_t seed, unsigned long leaseMs)
+	: state(UNASSIGNED), id(M16_LEASE_JOIN_ID), nonce(0), leaseMs(leaseMs), sendAt(0), offerUntil(0), lastHeard(0),
+	  lastRenewal(0), renewJitter(0), quietUntil(0), seed(seed ? seed : 1)
+{
+	// Seeds such as consecutive chip ids start out alike, mix them before the first nonce.
+	for (uint8_t i = 0; i < 8; i++)
+	{
+		this->next();
+	}
+}
+
+uint32_t LeaseClient::next()
+{
+	this->seed ^= this->seed << 13;
+	this->seed ^= this->seed >> 17;
+	this->seed ^= this->seed << 5;
+	return this->seed;
+}
+
+/**
+ * @brief Handles a block received from the server.
+ *
+ * Every block is passed here, since blocks addressed to the node keep its lease.
+ *
+ * @param packet The received block.
+ * @param now The current time in milliseconds.
+ * @return true if the block was a JOIN block handled here, false if it is for the application.
+ */
+bool LeaseClient::packetReceived(ProtocolStructure packet, unsigned long now)
+{
+	if (packet.command != JOIN)
+	{
+		if (this->state == ASSIGNED && packet.id == this->id)
+		{
+			this->lastHeard = now;
+		}
+		return false;
+	}
+
+	bool flagged = packet.data & M16_LEASE_WINDOW_FLAG;
+	if (packet.id == M16_LEASE_JOIN_ID)
+	{
+		uint8_t slots = packet.data & M16_LEASE_NONCE_MASK;
+		if (!flagged || packet.data == M16_LEASE_REVOKE || slots == 0)
+		{
+			return true;
+		}
+		this->quietUntil = now + (unsigned long)(slots + 1) * M16_BLOCK_INTERVAL_MS + M16_ROUND_TRIP_MS;
+		if (this->state == UNASSIGNED)
+		{
+			this->nonce = this->next() & M16_LEASE_NONCE_MASK;
+			this->sendAt = now + (unsigned long)(this->next() % slots + 1) * M16_BLOCK_INTERVAL_MS;
+			// Offers follow the window, at most one queue of them.
+			this->offerUntil = now + (unsigned long)(slots + M16_LEASE_QUEUE_LENGTH + 2) * M16_BLOCK_INTERVAL_MS +
+							   M16_ROUND_TRIP_MS;
+			this->state = REQUESTING;
+		}
+		return true;
+	}
+
+	if (this->state == OFFERED && !flagged && packet.data == this->nonce)
+	{
+		this->id = packet.id;
+		this->lastHeard = now;
+		this->lastRenewal = now;
+		this->renewJitter = this->next() % (this->leaseMs / 4 + 1);
+		this->state = ASSIGNED;
+	}
+	else if (this->state == ASSIGNED && packet.id == this->id)
+	{
+		if (packet.data == M16_LEASE_REVOKE)
+		{
+			this->id = M16_LEASE_JOIN_ID;
+			this->state = UNASSIGNED;
+		}
+		else
+		{
+			this->lastHeard = now;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Returns the next request or renewal to send.
+ *
+ * Call this regularly; a request is returned when its slot in the window comes up.
+ * A renewal is only needed when the server has not addressed the node for half the
+ * lease plus a random delay, and is repeated every eighth of the lease until it is
+ * confirmed. Renewals
+ * wait for an open window to pass, so they do not collide with join requests.
+ *
+ * @param packet The block to send.
+ * @param now The current time in milliseconds.
+ * @return true if a block was returned, false otherwise.
+ */
+bool LeaseClient::nextPacket(ProtocolStructure &packet, unsigned long now)
+{
+	switch (this->state)
+	{
+	case REQUESTING:
+		if ((long)(now - this->sendAt) < 0)
+		{
+			return false;
+		}
+		packet = ProtocolStructure{M16_LEASE_JOIN_ID, JOIN, this->nonce};
+		this->state = OFFERED;
+		return true;
+
+	case OFFERED:
+		if ((long)(now - this->offerUntil) >= 0)
+		{
+			this->state = UNASSIGNED;
+		}
+		return false;
+
+	case ASSIGNED:
+		if (!this->hasId(now))
+		{
+			return false;
+		}
+		if (now - this->lastHeard < this->leaseMs / 2 + this->renewJitter || now - this->lastRenewal < this->leaseMs / 8 ||
+			(long)(now - this->quietUntil) < 0)
+		{
+			return false;
+		}
+		packet = ProtocolStructure{this->id, JOIN, M16_LEASE_RENEW};
+		this->lastRenewal = now;
+		this->renewJitter = this->next() % (this->leaseMs / 4 + 1);
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/**
+ * @brief Checks whether the node holds a lease, giving up an expired one.
+ *
+ * @param now The current time in milliseconds.
+ * @return true if `getId()` may be used to send, false if the node has to join first.
+ */
+bool LeaseClient::hasId(unsigned long now)
+{
+	if (this->state == ASSIGNED && now - this->lastHeard >= this->leaseMs)
+	{
+		this->id = M16_LEASE_JOIN_ID;
+		this->state = UNASSIGNED;
+	}
+	return this->state == ASSIGNED;
+}
+
+/**
+ * @brief Returns the leased id, or `M16_LEASE_JOIN_ID` without a lease.
+ */
+uint8_t LeaseClient::getId()
+{
+	return this->id;
+}
+
+/**
+ * @brief Constructor for the LeaseSimulation class.
+ *
+ * @param seed Seed of the random number generator, must not be 0.
+ */
+LeaseSimulation::LeaseSimulation(uint32_t seed) : seed(seed ? seed : 1) {}
+
+/**
+ * @brief Returns the next number from a xorshift generator.
+ */
+uint32_t LeaseSimulation::next()
+{
+	this->seed ^= this->seed << 13;
+	this->seed ^= this->seed >> 17;
+	this->seed ^= this->seed << 5;
+	return this->seed;
+}
+
+/**
+ * @brief Simulates nodes without an id joining a server.
+ *
+ * Every block arrives a block time after it is sent, and two requests that overlap
+ * at the server are both lost. The server opens a window, sends the offers one block
+ * interval apart after it, and opens the next window once the nodes that were not
+ * offered an id have given up waiting.
+ *
+ * @param nodes Nodes joining, at most `M16_LEASE_SIMULATED_NODES`.
+ * @param slots Request slots in each window.
+ * @param maxWindows Windows to open before giving up.
+ * @return Windows needed, requests lost and the time to join.
+ */
+LeaseResult LeaseSimulation::run(uint8_t nodes, uint8_t slots, uint32_t maxWindows)
+{
+	struct Block
+	{
+		ProtocolStructure packet;
+		unsigned long arrives;
+		bool lost;
+	};
+	const unsigned long tickMs = 100;
+	const unsigned long windowPeriodMs =
+		(unsigned long)(slots + M16_LEASE_QUEUE_LENGTH + 3) * M16_BLOCK_INTERVAL_MS + M16_ROUND_TRIP_MS;
+
+	if (nodes > M16_LEASE_SIMULATED_NODES)
+	{
+		nodes = M16_LEASE_SIMULATED_NODES;
+	}
+	LeaseServer server;
+	LeaseClient clients[M16_LEASE_SIMULATED_NODES];
+	unsigned long joinedAt[M16_LEASE_SIMULATED_NODES] = {};
+	for (uint8_t i = 0; i < nodes; i++)
+	{
+		clients[i] = LeaseClient(this->next());
+	}
+	Block down = {};
+	bool downPending = false;
+	Block up[M16_LEASE_SIMULATED_NODES];
+	uint8_t upCount = 0;
+	unsigned long serverFree = 0;
+	unsigned long nextWindow = 0;
+	uint8_t joined = 0;
+	LeaseResult result{};
+
+	for (unsigned long now = 0; joined < nodes && (result.windows < maxWindows || (long)(now - nextWindow) < 0);
+		 now += tickMs)
+	{
+		if (downPending && now >= down.arrives)
+		{
+			for (uint8_t i = 0; i < nodes; i++)
+			{
+				clients[i].packetReceived(down.packet, now);
+			}
+			downPending = false;
+		}
+		for (uint8_t i = 0; i < upCount;)
+		{
+			if (now < up[i].arrives)
+			{
+				i++;
+				continue;
+			}
+			if (up[i].lost)
+			{
+				result.collisions++;
+			}
+			else
+			{
+				if (up[i].packet.id == M16_LEASE_JOIN_ID && !server.windowActive(now))
+				{
+					result.late++;
+				}
+				server.packetReceived(up[i].packet, now);
+			}
+			up[i] = up[--upCount];
+		}
+
+		if (now >= serverFree)
+		{
+			ProtocolStructure packet;
+			if (now >= nextWindow && result.windows < maxWindows)
+			{
+				down = Block{server.openWindow(now, slots), now + M16_BLOCK_TIME_MS, false};
+				downPending = true;
+				serverFree = now + M16_BLOCK_INTERVAL_MS;
+				nextWindow = now + windowPeriodMs;
+				result.windows++;
+			}
+			else if (server.nextPacket(packet, now))
+			{
+				down = Block{packet, now + M16_BLOCK_TIME_MS, false};
+				downPending = true;
+				serverFree = now + M16_BLOCK_INTERVAL_MS;
+			}
+		}
+
+		for (uint8_t i = 0; i < nodes; i++)
+		{
+			ProtocolStructure packet;
+			if (clients[i].nextPacket(packet, now))
+			{
+				Block block = {packet, now + M16_BLOCK_TIME_MS, false};
+				for (uint8_t j = 0; j < upCount; j++)
+				{
+					if (block.arrives - up[j].arrives < M16_BLOCK_TIME_MS || up[j].arrives - block.arrives < M16_BLOCK_TIME_MS)
+					{
+						block.lost = true;
+						up[j].lost = true;
+					}
+				}
+				up[upCount++] = block;
+				result.requests += packet.id == M16_LEASE_JOIN_ID;
+			}
+			if (joinedAt[i] == 0 && clients[i].hasId(now))
+			{
+				joinedAt[i] = now;
+				joined++;
+			}
+		}
+	}
+
+	float joinMs = 0.0f;
+	for (uint8_t i = 0; i < nodes; i++)
+	{
+		joinMs += joinedAt[i];
+	}
+	result.joined = joined;
+	result.meanJoinMs = joined > 0 ? joinMs / joined : 0.0f;
+	return result;
+}
@@ -10,6 +10,10 @@
  * @date March 2025
  */
 #include "M16-lib.h"
+#include "M16-fastrx.h"
+#include "M16-sequencer.h"
+#include "M16-energy.h"
+#include <Preferences.h>
 
 /**
  * @brief Constructor for the M16 class.
@@ -18,7 +22,8 @@
  *
  * @param uart_num A reference to a uart_port_t object used for serial communication.
  */
-M16::M16(uart_port_t uart_num) : uart_num(uart_num) {}
+M16::M16(uart_port_t uart_num) : uart_num(uart_num), config{0, 0}, mode(UNKNOWN_MODE), reportLatency(0), uartEvents(NULL),
+	  rxPeak(0), rxOverflows(0), ledger(nullptr) {}
 
 /**
  * @brief Initializes the M16 module with the specified RX and TX pins.
@@ -48,12 +53,50 @@ void M16::begin(uint8_t rx_pin, uint8_t tx_pin)
 	{
 		Serial.println("Failed to set UART pins for M16.");
 	}
-	if (uart_driver_install(this->uart_num, 1024, 0, 0, NULL, 0) != ESP_OK)
+	this->installDriver();
+}
+
+/**
+ * @brief Installs the UART driver with the receive buffer and event queue used by M16.
+ */
+void M16::installDriver()
+{
+	if (uart_driver_install(this->uart_num, M16_UART_RX_BUFFER_SIZE, 0, M16_UART_EVENT_QUEUE_LENGTH, &this->uartEvents, 0) != ESP_OK)
 	{
 		Serial.println("Failed to install UART driver for M16.");
 	}
 }
 
+/**
+ * @brief Switches reception to the low latency interrupt path.
+ *
+ * Received packets are taken from `receiver` instead of `readRxBuff()` until
+ * `disableFastRx()` is called. Report requests are not answered in the meantime.
+ *
+ * @param receiver The fast receive path to attach.
+ * @return true if the fast path is active, false if it is not supported.
+ */
+bool M16::enableFastRx(FastRx &receiver)
+{
+	return receiver.attach(this->uart_num);
+}
+
+/**
+ * @brief Switches reception back to the UART driver.
+ *
+ * @param receiver The fast receive path to detach.
+ */
+void M16::disableFastRx(FastRx &receiver)
+{
+	if (!receiver.attached())
+	{
+		return;
+	}
+	receiver.detach();
+	uart_driver_delete(this->uart_num);
+	this->installDriver();
+}
+
 /**
  * @brief Sends a single byte of data through the M16 modem.
  *
@@ -80,6 +123,10 @@ bool M16::sendPacket(unsigned short packet)
 	Serial.printf("Byte[1] from packet %s\n", convertToBinary(bytes[1]));
 #endif
 	uart_write_bytes(this->uart_num, (const char *)&bytes, 2);
+	if (this->ledger != nullptr)
+	{
+		this->ledger->blockSent(this->decode(packet), this->config.powerLevel, millis());
+	}
 
 	// TODO: Implement error checking and return value.
 	return true;
@@ -92,13 +139,83 @@ bool M16::sendPacket(unsigned short packet)
  * a mode switch. It then waits for 1000 milliseconds before sending
  * the byte again to complete the mode switch process.
  *
- * The modem boots into Transparent Mode by default.
+ * The modem boots into Transparent Mode by default. After an MCU-only reset the
+ * modem may be in either mode, see `detectOperationMode()`.
  */
 void M16::switchOperationMode()
 {
 	this->sendByte(0x6d);
-	vTaskDelay(pdMS_TO_TICKS(1000));
+	vTaskDelay(pdMS_TO_TICKS(M16_COMMAND_GUARD_MS));
 	this->sendByte(0x6d);
+
+	if (this->mode == TRANSPARENT_MODE)
+	{
+		this->mode = COMMAND_MODE;
+	}
+	else if (this->mode == COMMAND_MODE)
+	{
+		this->mode = TRANSPARENT_MODE;
+	}
+}
+
+/**
+ * @brief Returns the operation mode the modem is believed to be in.
+ *
+ * @return The tracked mode, or `UNKNOWN_MODE` before `detectOperationMode()` has run.
+ */
+OperationMode M16::getOperationMode()
+{
+	return this->mode;
+}
+
+/**
+ * @brief Detects which operation mode the modem is in.
+ *
+ * The modem only answers report requests in Transparent Mode, and a report frame
+ * arrives within a few tens of milliseconds of the request. A single report request
+ * with a short read window is therefore enough to recognise Transparent Mode. If it
+ * stays unanswered the mode is switched once and the probe repeated; an answer then
+ * means the modem was in Command Mode. If neither probe is answered the modem is
+ * switched back and considered unresponsive.
+ *
+ * After this function returns the modem is in Transparent Mode, unless it did not
+ * respond at all. On success `report` holds the report received by the probe.
+ *
+ * @return The mode the modem was found in, or `UNKNOWN_MODE` if it did not respond.
+ */
+OperationMode M16::detectOperationMode()
+{
+	// Data received before the probe would be mistaken for the report.
+	uart_flush_input(this->uart_num);
+
+	if (this->requestReport(M16_PROBE_READ_RETRIES))
+	{
+		this->mode = TRANSPARENT_MODE;
+		return TRANSPARENT_MODE;
+	}
+
+	this->mode = UNKNOWN_MODE;
+	this->switchOperationMode();
+	uart_flush_input(this->uart_num);
+	if (this->requestReport(M16_PROBE_READ_RETRIES))
+	{
+		this->mode = TRANSPARENT_MODE;
+		return COMMAND_MODE;
+	}
+
+	// Restore whatever state the modem was in.
+	this->switchOperationMode();
+	return UNKNOWN_MODE;
+}
+
+/**
+ * @brief Returns the time from a report request until the full report was received.
+ *
+ * @return The latency of the last successful report request in milliseconds.
+ */
+uint32_t M16::getReportLatency()
+{
+	return this->reportLatency;
 }
 
 /**
@@ -120,9 +237,10 @@ void M16::setCommunicationChannel(uint8_t channel)
 
 	// Send the channel change command.
 	this->sendByte(0x63);
-	vTaskDelay(pdMS_TO_TICKS(1000));
+	vTaskDelay(pdMS_TO_TICKS(M16_COMMAND_GUARD_MS));
 	this->sendByte(0x63);
-	vTaskDelay(pdMS_TO_TICKS(1));
+	// pdMS_TO_TICKS(1) rounds to zero ticks with the default 100 Hz tick rate.
+	delayMicroseconds(M16_CHANNEL_CHAR_DELAY_MS * 1000);
 
 	// Send the channel character.
 	if (channel <= 9)
@@ -133,6 +251,7 @@ void M16::setCommunicationChannel(uint8_t channel)
 	{
 		this->sendByte(0x61 + (channel - 10)); // Channels 10-12 ('a', 'b', 'c')
 	}
+	this->config.channel = channel;
 }
 
 /**
@@ -153,69 +272,288 @@ void M16::setPowerLevel(uint8_t powerLevel)
 
 	// Set power level command.
 	this->sendByte(0x6c);
-	vTaskDelay(pdMS_TO_TICKS(1000));
+	vTaskDelay(pdMS_TO_TICKS(M16_COMMAND_GUARD_MS));
 	this->sendByte(0x6c);
-	vTaskDelay(pdMS_TO_TICKS(1500));
+	vTaskDelay(pdMS_TO_TICKS(M16_POWER_LEVEL_GUARD_MS));
 
 	// Send the power level character.
 	this->sendByte(0x30 + powerLevel);
+	this->config.powerLevel = powerLevel;
+}
+
+/**
+ * @brief Writes a byte to the modem, for use as the sink of a `Sequencer`.
+ *
+ * @param byte The byte to write.
+ * @param modem The M16 instance passed as the sequencer context.
+ */
+void M16::sequencerSink(uint8_t byte, void *modem)
+{
+	static_cast<M16 *>(modem)->sendByte(byte);
+}
+
+/**
+ * @brief Switches the operation mode without blocking the calling task.
+ *
+ * The command bytes are emitted by the sequencer, which must have been created with
+ * `M16::sequencerSink` and this instance as context.
+ *
+ * @param sequencer The sequencer used to emit the command.
+ * @return true if the command was started, false if the sequencer is busy or refused a
+ * step. A refused sequence is cleared, so no steps are left for the next command.
+ */
+bool M16::switchOperationMode(Sequencer &sequencer)
+{
+	if (sequencer.busy())
+	{
+		return false;
+	}
+	if (!sequencer.add(0, 0x6d) || !sequencer.add(M16_COMMAND_GUARD_MS * 1000UL, 0x6d) || !sequencer.start())
+	{
+		sequencer.cancel();
+		return false;
+	}
+
+	if (this->mode == TRANSPARENT_MODE)
+	{
+		this->mode = COMMAND_MODE;
+	}
+	else if (this->mode == COMMAND_MODE)
+	{
+		this->mode = TRANSPARENT_MODE;
+	}
+	return true;
+}
+
+/**
+ * @brief Sets the communication channel without blocking the calling task.
+ *
+ * The command bytes are emitted by the sequencer at the same offsets as
+ * `setCommunicationChannel(uint8_t)` uses, but with microsecond resolution.
+ *
+ * @param channel The communication channel to set (must be between 1 and 12).
+ * @param sequencer The sequencer used to emit the command.
+ * @return true if the command was started, false if the channel is invalid or the sequencer is busy
+ * or refused a step.
+ */
+bool M16::setCommunicationChannel(uint8_t channel, Sequencer &sequencer)
+{
+	if (channel < 1 || channel > 12 || sequencer.busy())
+	{
+		return false;
+	}
+
+	uint8_t character = channel <= 9 ? 0x30 + channel : 0x61 + (channel - 10);
+	if (!sequencer.add(0, 0x63) || !sequencer.add(M16_COMMAND_GUARD_MS * 1000UL, 0x63) ||
+		!sequencer.add((M16_COMMAND_GUARD_MS + M16_CHANNEL_CHAR_DELAY_MS) * 1000UL, character) || !sequencer.start())
+	{
+		sequencer.cancel();
+		return false;
+	}
+	this->config.channel = channel;
+	return true;
+}
+
+/**
+ * @brief Sets the power level without blocking the calling task.
+ *
+ * @param powerLevel The desired power level (must be between 1 and 4).
+ * @param sequencer The sequencer used to emit the command.
+ * @return true if the command was started, false if the level is invalid or the sequencer is busy
+ * or refused a step.
+ */
+bool M16::setPowerLevel(uint8_t powerLevel, Sequencer &sequencer)
+{
+	if (powerLevel < 1 || powerLevel > 4 || sequencer.busy())
+	{
+		return false;
+	}
+
+	if (!sequencer.add(0, 0x6c) || !sequencer.add(M16_COMMAND_GUARD_MS * 1000UL, 0x6c) ||
+		!sequencer.add((M16_COMMAND_GUARD_MS + M16_POWER_LEVEL_GUARD_MS) * 1000UL, 0x30 + powerLevel) ||
+		!sequencer.start())
+	{
+		sequencer.cancel();
+		return false;
+	}
+	this->config.powerLevel = powerLevel;
+	return true;
 }
 
 /**
  * @brief Requests a report from the M16 device.
  *
  * This function sends a request byte to the M16 device and waits for the report to be available.
- * It retries the request up to 100 times with a delay of 10 milliseconds between each retry.
+ * It retries the request up to `retries` times with a delay of 10 milliseconds between each retry.
  * If the report is available, it reads the report data into the report struct.
  *
+ * @param retries The number of read attempts before giving up.
  * @return true if the report is successfully received, false if the request times out.
  */
-bool M16::requestReport()
+bool M16::requestReport(uint8_t retries)
 {
 	this->sendByte(0x72);
-	vTaskDelay(pdMS_TO_TICKS(1000));
+	vTaskDelay(pdMS_TO_TICKS(M16_COMMAND_GUARD_MS));
 	this->sendByte(0x72);
+	unsigned long requested = millis();
 
-	uint8_t reportBytes[18];
-	uint8_t retries = 0;
+	uint8_t reportBytes[M16_REPORT_LENGTH];
+	uint8_t attempts = 0;
 	size_t bytesRead = 0;
 
 	// Wait until the report is available.
 	while (bytesRead < sizeof(reportBytes))
 	{
-		int result = uart_read_bytes(this->uart_num, reportBytes + bytesRead, sizeof(reportBytes) - bytesRead, pdMS_TO_TICKS(10));
+		int result = uart_read_bytes(this->uart_num, reportBytes + bytesRead, sizeof(reportBytes) - bytesRead, pdMS_TO_TICKS(M16_REPORT_READ_TIMEOUT_MS));
 		if (result > 0)
 		{
 			bytesRead += result;
 		}
 		else
 		{
-			if (retries++ > 100)
+			if (attempts++ > retries)
 			{
 				return false;
 			}
 		}
 	}
-	this->report.startOfFrame = reportBytes[0];
-	this->report.transportBlock = (reportBytes[1] << 8) | reportBytes[2];
-	this->report.bitErrorRate = reportBytes[3];
-	this->report.signalPower = reportBytes[4];
-	this->report.noisePower = reportBytes[5];
-	this->report.packetValid = (reportBytes[6] << 8) | reportBytes[7];
-	this->report.packedInvalid = reportBytes[8];
-	this->report.firmwareVersion = reportBytes[9];
-	this->report.timeSinceBoot = (reportBytes[10] << 16) | (reportBytes[11] << 8) | reportBytes[12];
-	this->report.chipID = (reportBytes[13] << 8) | reportBytes[14];
-	this->report.hwRev = (reportBytes[15] & 0b00000011);
-	this->report.channel = (reportBytes[15] & 0b00111100) >> 2;
-	this->report.tbValid = (reportBytes[15] & 0b01000000) >> 6;
-	this->report.txComplete = (reportBytes[15] & 0b10000000) >> 7;
-	this->report.diagnostic = (reportBytes[16] & 0b00000001);
-	// this->report.reserved = (reportBytes[16] & 0x02) >> 1;
-	this->report.powerLevel = (reportBytes[16] & 0b00001100) >> 2;
-	// this->report.reserved2 = (reportBytes[16] >> 0 & 0xf0) >> 4;
-	this->report.endOfFrame = reportBytes[17];
+	this->reportLatency = millis() - requested;
+	this->report = decodeReport(reportBytes);
+
+	return true;
+}
+
+/**
+ * @brief Returns the configuration last applied to the modem.
+ *
+ * @return The channel and power level, where 0 means the setting is unknown.
+ */
+ModemConfig M16::getConfig()
+{
+	return this->config;
+}
+
+/**
+ * @brief Reads the persisted modem configuration from NVS.
+ *
+ * The configuration is stored per UART port, so several modems can be attached to
+ * the same MCU.
+ *
+ * @param config The structure to fill with the stored configuration.
+ * @return true if a complete configuration was stored, false otherwise.
+ */
+bool M16::loadConfig(ModemConfig &config)
+{
+	char name[16];
+	snprintf(name, sizeof(name), "m16-uart%d", (int)this->uart_num);
+
+	Preferences preferences;
+	if (!preferences.begin(name, true))
+	{
+		return false;
+	}
+	config.channel = preferences.getUChar("channel", 0);
+	config.powerLevel = preferences.getUChar("power", 0);
+	preferences.end();
+
+	return config.channel != 0 && config.powerLevel != 0;
+}
+
+/**
+ * @brief Persists the configuration last applied to the modem in NVS.
+ *
+ * Settings that are unknown are not written, so an earlier stored value is kept.
+ */
+void M16::saveConfig()
+{
+	char name[16];
+	snprintf(name, sizeof(name), "m16-uart%d", (int)this->uart_num);
+
+	Preferences preferences;
+	if (!preferences.begin(name, false))
+	{
+		Serial.println("Failed to open NVS for M16 configuration.");
+		return;
+	}
+	if (this->config.channel != 0 && preferences.getUChar("channel", 0) != this->config.channel)
+	{
+		preferences.putUChar("channel", this->config.channel);
+	}
+	if (this->config.powerLevel != 0 && preferences.getUChar("power", 0) != this->config.powerLevel)
+	{
+		preferences.putUChar("power", this->config.powerLevel);
+	}
+	preferences.end();
+}
+
+/**
+ * @brief Checks whether the last received report shows the given configuration.
+ *
+ * The report stores the power level zero based in two bits, while `setPowerLevel()`
+ * takes it one based.
+ *
+ * @param config The configuration to compare with.
+ * @return true if both channel and power level match.
+ */
+bool M16::reportMatches(ModemConfig config)
+{
+	return this->report.channel == config.channel && this->report.powerLevel + 1 == config.powerLevel;
+}
+
+/**
+ * @brief Applies a configuration to the modem, skipping settings it already has.
+ *
+ * A single report is requested first. Only the settings that differ from the report
+ * are sent, so a modem that kept its configuration over an MCU reset is ready after
+ * one report request instead of the full command guards. If no report arrives, the
+ * operation mode is detected and the probe repeated; if the modem still does not
+ * answer, both settings are sent. The applied configuration is persisted in NVS.
+ *
+ * @param config The channel and power level to apply.
+ * @return true if the modem reported the configuration, false if it had to be sent.
+ */
+bool M16::applyConfig(ModemConfig config)
+{
+	bool probed = this->requestReport();
+	if (!probed)
+	{
+		// The modem may have been left in Command Mode by a brownout.
+		probed = this->detectOperationMode() != UNKNOWN_MODE;
+	}
+	if (probed && this->reportMatches(config))
+	{
+		this->config = config;
+		this->saveConfig();
+		return true;
+	}
+
+	if (!probed || this->report.channel != config.channel)
+	{
+		this->setCommunicationChannel(config.channel);
+	}
+	if (!probed || this->report.powerLevel + 1 != config.powerLevel)
+	{
+		this->setPowerLevel(config.powerLevel);
+	}
+	this->saveConfig();
+	return false;
+}
 
+/**
+ * @brief Applies the configuration persisted in NVS.
+ *
+ * Intended to be called right after `begin()`.
+ *
+ * @return true if a stored configuration was found and applied, false otherwise.
+ */
+bool M16::restoreConfig()
+{
+	ModemConfig stored;
+	if (!this->loadConfig(stored))
+	{
+		return false;
+	}
+	this->applyConfig(stored);
 	return true;
 }
 
@@ -231,19 +569,64 @@ bool M16::sendPacket(ProtocolStructure packet)
 	return sendPacket(encodedPackage);
 }
 
-bool M16::sendPacket(unsigned char id, Command command, unsigned char data)
+bool M16::sendPacket(unsigned char id, Command command, uint16_t data)
 {
 	unsigned short encodedPackage = encode(id, command, data);
 	return sendPacket(encodedPackage);
 }
 
+/**
+ * @brief Returns the number of bytes waiting in the driver receive buffer.
+ *
+ * Every call also updates the peak returned by `getRxBuffPeak()`.
+ *
+ * @return The number of buffered bytes.
+ */
 size_t M16::getRxBuffLength()
 {
 	size_t buffered_size;
 	uart_get_buffered_data_len(this->uart_num, &buffered_size);
+	if (buffered_size > this->rxPeak)
+	{
+		this->rxPeak = buffered_size;
+	}
 	return buffered_size;
 }
 
+/**
+ * @brief Returns the most bytes seen in the driver receive buffer.
+ *
+ * The buffer holds `M16_UART_RX_BUFFER_SIZE` bytes. The peak is sampled by
+ * `getRxBuffLength()`, so short peaks between calls are missed.
+ *
+ * @return The peak in bytes since the last `resetRxStats()`.
+ */
+size_t M16::getRxBuffPeak()
+{
+	return this->rxPeak;
+}
+
+/**
+ * @brief Returns the number of receive overflows reported by the driver.
+ *
+ * Overflows are counted as `pollUartEvent()` takes them from the event queue.
+ *
+ * @return The number of overflows since the last `resetRxStats()`.
+ */
+uint32_t M16::getRxOverflows()
+{
+	return this->rxOverflows;
+}
+
+/**
+ * @brief Restarts the receive buffer peak and the overflow count.
+ */
+void M16::resetRxStats()
+{
+	this->rxPeak = 0;
+	this->rxOverflows = 0;
+}
+
 void M16::flushTxBuffer()
 {
 	uart_flush(this->uart_num);
@@ -254,6 +637,33 @@ void M16::refreshBaudRate()
 	uart_set_baudrate(this->uart_num, M16_BAUD);
 }
 
+/**
+ * @brief Takes the next event reported by the UART driver, without waiting.
+ *
+ * The driver reports receive overflows (`UART_FIFO_OVF`, `UART_BUFFER_FULL`) and line
+ * errors (`UART_FRAME_ERR`, `UART_PARITY_ERR`) through this queue. Events are dropped
+ * by the driver when the queue is full, so it does not have to be drained.
+ *
+ * @param event The structure to fill with the event.
+ * @return true if an event was available, false otherwise.
+ */
+bool M16::pollUartEvent(uart_event_t &event)
+{
+	if (this->uartEvents == NULL)
+	{
+		return false;
+	}
+	if (xQueueReceive(this->uartEvents, &event, 0) != pdTRUE)
+	{
+		return false;
+	}
+	if (event.type == UART_FIFO_OVF || event.type == UART_BUFFER_FULL)
+	{
+		this->rxOverflows++;
+	}
+	return true;
+}
+
 int M16::readRxBuff(uint8_t *data, size_t length)
 {
 	int num = 0;
@@ -262,40 +672,43 @@ int M16::readRxBuff(uint8_t *data, size_t length)
 	return num;
 }
 
+/**
+ * @brief Accounts every packet sent from now on in a ledger.
+ *
+ * The packet is charged at the power level last set with `setPowerLevel()`.
+ *
+ * @param ledger The ledger, or nullptr to stop accounting.
+ */
+void M16::attachLedger(AirtimeLedger *ledger)
+{
+	this->ledger = ledger;
+}
+
 /**
  * @brief Encodes input values into a 16-bit message.
  *
- * This function constructs a 16-bit message by encoding an ID (4 bits), a command (4 bits),
- * and data (8 bits). The format of the final message is:
+ * This function constructs a 16-bit message by encoding an ID, a command and data
+ * according to `PacketLayout`. With the default layout the format is:
  * - bbbb(ID)bbbb(Command)bbbbbbbb(Data) or IIIICCCCDDDD
  *
- * @param id The ID to identify a unit (only the first 3 bits are kept).
- * @param command The command/type of the action (only the first 3 bits are kept).
- * @param data The actual data to send (first 10 bits are used).
+ * @param id The ID to identify a unit (only the first `M16_ID_BITS` bits are kept).
+ * @param command The command/type of the action (only the first `M16_COMMAND_BITS` bits are kept).
+ * @param data The actual data to send (only the first `M16_DATA_BITS` bits are kept).
  * @return The final encoded message as an unsigned short.
  */
-unsigned short M16::encode(unsigned char id, Command command, unsigned char data)
+unsigned short M16::encode(unsigned char id, Command command, uint16_t data)
 {
-	unsigned short codedMessage = 0;
-	codedMessage |= ((0b00001111 & id) << (4 + 8));
-	codedMessage |= ((0b00001111 & command) << (8));
-	codedMessage |= 0b0000000011111111 & data;
-	codedMessage |= ((0b00001111 & id) << (4 + 8));
-	codedMessage |= ((0b00001111 & command) << (8));
-	codedMessage |= 0b0000000011111111 & data;
-	return codedMessage;
+	return PacketLayout::encode(id, command, data);
 }
 
 /**
  * @brief Encodes input values into a 16-bit message.
  *
- * This function constructs a 16-bit message by encoding an ID (4 bits), a command (4 bits),
- * and data (8 bits). The format of the final message is:
+ * This function constructs a 16-bit message by encoding an ID, a command and data
+ * according to `PacketLayout`. With the default layout the format is:
  * - bbbb(ID)bbbb(Command)bbbbbbbb(Data) or IIIICCCCDDDD
  *
- * @param id The ID to identify a unit (only the first 3 bits are kept).
- * @param command The command/type of the action (only the first 3 bits are kept).
- * @param data The actual data to send (first 10 bits are used).
+ * @param send The ID, command and data to encode.
  * @return The final encoded message as an unsigned short.
  */
 unsigned short M16::encode(ProtocolStructure send)
@@ -306,37 +719,29 @@ unsigned short M16::encode(ProtocolStructure send)
 /**
  * @brief Decodes a 16-bit message into a `ProtocolStructure`.
  *
- * This function extracts the ID (4 bits), command (4 bits), and data (8 bits) from the
- * given 16-bit message and returns them in a `ProtocolStructure` object.
+ * This function extracts the ID, command and data from the given 16-bit message
+ * according to `PacketLayout` and returns them in a `ProtocolStructure` object.
  *
  * @param messageToDecode The 16-bit encoded message.
  * @return A `ProtocolStructure` containing the extracted ID, command, and data.
  */
 ProtocolStructure M16::decode(unsigned short messageToDecode)
 {
-	ProtocolStructure result{0, Command::HI, 0};
-	result.id = 0b0000000000001111 & (messageToDecode >> (4 + 8));
-	result.command = static_cast<Command>(0b0000000000001111 & (messageToDecode >> (8)));
-	result.data = (messageToDecode & 0b0000000011111111);
-	return result;
+	return PacketLayout::decode(messageToDecode);
 }
 
 /**
  * @brief Decodes a 16-bit message into a `ProtocolStructure`.
  *
- * This function extracts the ID (4 bits), command (4 bits), and data (8 bits) from the
- * given 16-bit message and returns them in a `ProtocolStructure` object.
+ * This function extracts the ID, command and data from the two received bytes
+ * according to `PacketLayout` and returns them in a `ProtocolStructure` object.
  *
- * @param messageToDecode The 16-bit encoded message.
+ * @param messageToDecode The two bytes of the message, most significant byte first.
  * @return A `ProtocolStructure` containing the extracted ID, command, and data.
  */
 ProtocolStructure M16::decode(uint8_t *messageToDecode)
 {
-	ProtocolStructure result{0, Command::HI, 0};
-	result.id = 0b00001111 & (messageToDecode[0] >> 4);
-	result.command = static_cast<Command>(0b00000111 & (messageToDecode[0]));
-	result.data = messageToDecode[1];
-	return result;
+	return PacketLayout::decode((messageToDecode[0] << 8) | messageToDecode[1]);
 }
 
 /**
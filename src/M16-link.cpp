@@ -0,0 +1,205 @@
+/**
+ * @file M16-link.cpp
+ * @brief Implementation of the LinkMonitor class.
+ *
+ * This file contains the implementation of the LinkMonitor class, which infers
+ * link health from received traffic and modem reports.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-link.h"
+
+/**
+ * @brief Constructor for the LinkMonitor class.
+ *
+ * @param modem The modem used to send keepalives.
+ * @param silenceMs Time without traffic from a node before a keepalive is sent to it.
+ * @param maxMissed Unanswered keepalives before the link is considered down.
+ */
+LinkMonitor::LinkMonitor(M16 &modem, uint32_t silenceMs, uint8_t maxMissed)
+	: modem(modem), silenceMs(silenceMs), maxMissed(maxMissed), nodes{}, callback(nullptr),
+	  lastKeepalive(0), channelActive(0), lastReport{}, haveReport(false) {}
+
+/**
+ * @brief Starts monitoring the link to a node.
+ *
+ * The node is considered silent from now on, so the first keepalive is sent after
+ * `silenceMs` unless traffic arrives first.
+ *
+ * @param id The id of the node.
+ */
+void LinkMonitor::watch(uint8_t id)
+{
+	if (id >= M16_MAX_NODES)
+	{
+		return;
+	}
+	this->nodes[id] = LinkStatus{true, LINK_UNKNOWN, millis(), 0, 0};
+}
+
+/**
+ * @brief Stops monitoring the link to a node.
+ *
+ * @param id The id of the node.
+ */
+void LinkMonitor::unwatch(uint8_t id)
+{
+	if (id >= M16_MAX_NODES)
+	{
+		return;
+	}
+	this->nodes[id].watched = false;
+}
+
+/**
+ * @brief Sets the function called when a link goes up or down.
+ *
+ * @param callback The function to call, or nullptr to disable events.
+ */
+void LinkMonitor::onEvent(LinkEventCallback callback)
+{
+	this->callback = callback;
+}
+
+/**
+ * @brief Changes the state of a link and raises an event if it changed.
+ *
+ * @param id The id of the node.
+ * @param state The new state of the link.
+ */
+void LinkMonitor::setState(uint8_t id, LinkState state)
+{
+	if (this->nodes[id].state == state)
+	{
+		return;
+	}
+	this->nodes[id].state = state;
+	if (this->callback != nullptr)
+	{
+		this->callback(id, state);
+	}
+}
+
+/**
+ * @brief Records a packet received from a node.
+ *
+ * Any traffic counts as proof of life, so application packets make keepalives
+ * unnecessary.
+ *
+ * @param packet The decoded packet.
+ */
+void LinkMonitor::packetReceived(ProtocolStructure packet)
+{
+	unsigned long now = millis();
+	this->channelActive = now;
+
+	if (packet.id >= M16_MAX_NODES || !this->nodes[packet.id].watched)
+	{
+		return;
+	}
+	this->nodes[packet.id].lastHeard = now;
+	this->nodes[packet.id].missedKeepalives = 0;
+	this->setState(packet.id, LINK_UP);
+}
+
+/**
+ * @brief Records a report from the local modem.
+ *
+ * The report cannot be attributed to a node, but growing valid or invalid counters
+ * show that the channel is in use. Keepalives are held back while the channel is busy
+ * so they do not collide with traffic. A `timeSinceBoot` that went backwards means the
+ * modem restarted and its counters start over.
+ *
+ * @param report The report received by `requestReport()`.
+ */
+void LinkMonitor::reportReceived(const Report &report)
+{
+	bool restarted = this->haveReport && report.timeSinceBoot < this->lastReport.timeSinceBoot;
+	if (this->haveReport && !restarted)
+	{
+		if (report.packetValid != this->lastReport.packetValid || report.packedInvalid != this->lastReport.packedInvalid)
+		{
+			this->channelActive = millis();
+		}
+	}
+	this->lastReport = report;
+	this->haveReport = true;
+}
+
+/**
+ * @brief Sends a keepalive if a node has been silent for too long.
+ *
+ * At most one keepalive is sent per call, and not before the reply to the previous
+ * one could have arrived. Nodes with a dead link are probed `M16_LINK_DOWN_BACKOFF`
+ * times less often. Call this function regularly from the main loop.
+ *
+ * @return true if a keepalive was sent, false otherwise.
+ */
+bool LinkMonitor::update()
+{
+	unsigned long now = millis();
+
+	// Leave room for a keepalive and its reply, and stay off a busy channel.
+	if (now - this->lastKeepalive < 2 * M16_BLOCK_TIME_MS || now - this->channelActive < M16_BLOCK_TIME_MS)
+	{
+		return false;
+	}
+
+	for (uint16_t id = 0; id < M16_MAX_NODES; id++)
+	{
+		if (!this->nodes[id].watched)
+		{
+			continue;
+		}
+		LinkStatus &node = this->nodes[id];
+		uint32_t interval = node.state == LINK_DOWN ? this->silenceMs * M16_LINK_DOWN_BACKOFF : this->silenceMs;
+		if (now - node.lastHeard < this->silenceMs || now - node.lastKeepalive < interval)
+		{
+			continue;
+		}
+
+		if (node.missedKeepalives >= this->maxMissed)
+		{
+			this->setState(id, LINK_DOWN);
+		}
+		this->modem.sendPacket(id, HI, 0);
+		node.lastKeepalive = now;
+		if (node.missedKeepalives < UINT8_MAX)
+		{
+			node.missedKeepalives++;
+		}
+		this->lastKeepalive = now;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Checks whether a node should be polled.
+ *
+ * Links that have not been decided yet count as alive.
+ *
+ * @param id The id of the node.
+ * @return false if the link to the node is down, true otherwise.
+ */
+bool LinkMonitor::isAlive(uint8_t id)
+{
+	return this->getState(id) != LINK_DOWN;
+}
+
+/**
+ * @brief Returns the state of the link to a node.
+ *
+ * @param id The id of the node.
+ * @return The state of the link, `LINK_UNKNOWN` for nodes that are not monitored.
+ */
+LinkState LinkMonitor::getState(uint8_t id)
+{
+	if (id >= M16_MAX_NODES || !this->nodes[id].watched)
+	{
+		return LINK_UNKNOWN;
+	}
+	return this->nodes[id].state;
+}
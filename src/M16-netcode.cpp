@@ -0,0 +1,577 @@
+/**
+ * @file M16-netcode.cpp
+ * @brief Implementation of XOR network coding at relays.
+ *
+ * This file contains the PacketQueue used by relays and endpoints, the
+ * NetworkCodingRelay and NetworkCodingEndpoint classes, and the
+ * NetworkCodingSimulation used to measure the throughput of a relay chain.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-netcode.h"
+
+/**
+ * @brief Returns the parity of the command and data fields of a packet.
+ *
+ * The parity of an XOR of two packets is the XOR of their parities, so the parity
+ * of one packet of a coded block follows from the other and the block.
+ */
+static uint8_t codeParity(ProtocolStructure packet)
+{
+	uint16_t bits = packet.command ^ packet.data; // Same parity as both fields together.
+	uint8_t parity = 0;
+	while (bits != 0)
+	{
+		parity ^= bits & 1;
+		bits >>= 1;
+	}
+	return parity;
+}
+
+/**
+ * @brief Checks whether two packets have the same fields.
+ */
+static bool samePacket(ProtocolStructure a, ProtocolStructure b)
+{
+	return a.id == b.id && a.command == b.command && a.data == b.data;
+}
+
+/**
+ * @brief Constructor for the PacketQueue class.
+ */
+PacketQueue::PacketQueue() : packets{}, head(0), count(0) {}
+
+/**
+ * @brief Appends a packet to the queue.
+ *
+ * @param packet The packet to append.
+ * @param now The current time in milliseconds.
+ * @return false if the queue is full, true otherwise.
+ */
+bool PacketQueue::push(ProtocolStructure packet, unsigned long now)
+{
+	if (this->full())
+	{
+		return false;
+	}
+	this->packets[(this->head + this->count) % M16_RELAY_QUEUE_LENGTH] = QueuedPacket{packet, now};
+	this->count++;
+	return true;
+}
+
+/**
+ * @brief Removes the oldest packet from the queue.
+ *
+ * @param packet Receives the removed packet.
+ * @return false if the queue is empty, true otherwise.
+ */
+bool PacketQueue::pop(QueuedPacket &packet)
+{
+	if (this->count == 0)
+	{
+		return false;
+	}
+	packet = this->packets[this->head];
+	this->head = (this->head + 1) % M16_RELAY_QUEUE_LENGTH;
+	this->count--;
+	return true;
+}
+
+/**
+ * @brief Returns the oldest packet without removing it.
+ *
+ * @return The oldest packet, or nullptr if the queue is empty.
+ */
+const QueuedPacket *PacketQueue::front()
+{
+	return this->count == 0 ? nullptr : &this->packets[this->head];
+}
+
+/**
+ * @brief Returns a queued packet without removing it.
+ *
+ * @param index Position in the queue, 0 is the oldest packet.
+ * @return The packet, or nullptr if fewer packets are queued.
+ */
+const QueuedPacket *PacketQueue::at(uint8_t index)
+{
+	return index >= this->count ? nullptr : &this->packets[(this->head + index) % M16_RELAY_QUEUE_LENGTH];
+}
+
+/**
+ * @brief Returns the number of queued packets.
+ */
+uint8_t PacketQueue::size()
+{
+	return this->count;
+}
+
+/**
+ * @brief Checks whether another packet can be queued.
+ */
+bool PacketQueue::full()
+{
+	return this->count == M16_RELAY_QUEUE_LENGTH;
+}
+
+/**
+ * @brief Constructor for the NetworkCodingRelay class.
+ *
+ * @param relayId The even id of the relay, used to mark coded blocks.
+ * @param holdMs How long a packet waits for a partner before it is forwarded unchanged.
+ * @param coding Whether packets are combined, or only forwarded.
+ */
+NetworkCodingRelay::NetworkCodingRelay(uint8_t relayId, uint32_t holdMs, bool coding)
+	: relayId(relayId), holdMs(holdMs), coding(coding), coded(0), forwarded(0) {}
+
+/**
+ * @brief Queues a packet received from the server side.
+ *
+ * The application decides the direction, for example from the command or from the
+ * polling schedule, since the block itself does not say who sent it.
+ *
+ * @param packet The packet to pass on towards the node.
+ * @param now The current time in milliseconds.
+ * @return false if the queue is full and the packet was dropped, true otherwise.
+ */
+bool NetworkCodingRelay::fromServer(ProtocolStructure packet, unsigned long now)
+{
+	return this->toNode.push(packet, now);
+}
+
+/**
+ * @brief Queues a packet received from the node side.
+ *
+ * @param packet The packet to pass on towards the server.
+ * @param now The current time in milliseconds.
+ * @return false if the queue is full and the packet was dropped, true otherwise.
+ */
+bool NetworkCodingRelay::fromNode(ProtocolStructure packet, unsigned long now)
+{
+	return this->toServer.push(packet, now);
+}
+
+/**
+ * @brief Checks whether a packet from the server side can be queued.
+ */
+bool NetworkCodingRelay::acceptsFromServer()
+{
+	return !this->toNode.full();
+}
+
+/**
+ * @brief Checks whether a packet from the node side can be queued.
+ */
+bool NetworkCodingRelay::acceptsFromNode()
+{
+	return !this->toServer.full();
+}
+
+/**
+ * @brief Decides which block the relay would send next without sending it.
+ *
+ * The oldest packets in both directions are coded together when they have the same
+ * id. Otherwise the older packet is forwarded unchanged once it has waited `holdMs`
+ * for a partner. Without coding, the older packet is forwarded at once.
+ *
+ * @param now The current time in milliseconds.
+ * @return The kind of block `nextBlock()` would return.
+ */
+RelayBlock NetworkCodingRelay::peekBlock(unsigned long now)
+{
+	const QueuedPacket *up = this->toServer.front();
+	const QueuedPacket *down = this->toNode.front();
+
+	if (up != nullptr && down != nullptr)
+	{
+		if (this->coding && up->packet.id == down->packet.id)
+		{
+			return RELAY_CODED;
+		}
+		// The heads will never be paired, so there is no point in waiting.
+		return (long)(up->queued - down->queued) <= 0 ? RELAY_TO_SERVER : RELAY_TO_NODE;
+	}
+	uint32_t hold = this->coding ? this->holdMs : 0;
+	if (up != nullptr && now - up->queued >= hold)
+	{
+		return RELAY_TO_SERVER;
+	}
+	if (down != nullptr && now - down->queued >= hold)
+	{
+		return RELAY_TO_NODE;
+	}
+	return RELAY_NONE;
+}
+
+/**
+ * @brief Takes the next block to broadcast.
+ *
+ * A coded block carries the relay id with the parity of the packet towards the node
+ * in its lowest bit, and the XOR of the command and data fields of the two packets
+ * it combines.
+ *
+ * @param packet Receives the block to send.
+ * @param now The current time in milliseconds.
+ * @return The kind of block returned, `RELAY_NONE` if there is nothing to send.
+ */
+RelayBlock NetworkCodingRelay::nextBlock(ProtocolStructure &packet, unsigned long now)
+{
+	RelayBlock block = this->peekBlock(now);
+	QueuedPacket up, down;
+
+	switch (block)
+	{
+	case RELAY_CODED:
+		this->toServer.pop(up);
+		this->toNode.pop(down);
+		packet.id = this->relayId | codeParity(down.packet);
+		packet.command = static_cast<Command>(up.packet.command ^ down.packet.command);
+		packet.data = up.packet.data ^ down.packet.data;
+		this->coded++;
+		break;
+	case RELAY_TO_SERVER:
+		this->toServer.pop(up);
+		packet = up.packet;
+		this->forwarded++;
+		break;
+	case RELAY_TO_NODE:
+		this->toNode.pop(down);
+		packet = down.packet;
+		this->forwarded++;
+		break;
+	default:
+		break;
+	}
+	return block;
+}
+
+/**
+ * @brief Returns the number of coded blocks sent.
+ */
+uint32_t NetworkCodingRelay::getCoded()
+{
+	return this->coded;
+}
+
+/**
+ * @brief Returns the number of packets forwarded unchanged.
+ */
+uint32_t NetworkCodingRelay::getForwarded()
+{
+	return this->forwarded;
+}
+
+/**
+ * @brief Constructor for the NetworkCodingEndpoint class.
+ *
+ * @param relayId The id of the relay the endpoint sends through.
+ * @param towardNode Whether the endpoint sends to the relay from the server side.
+ * @param windowMs How long a sent packet is kept for decoding.
+ */
+NetworkCodingEndpoint::NetworkCodingEndpoint(uint8_t relayId, bool towardNode, uint32_t windowMs)
+	: relayId(relayId), towardNode(towardNode), windowMs(windowMs) {}
+
+/**
+ * @brief Drops sent packets the relay can no longer hold.
+ */
+void NetworkCodingEndpoint::expire(unsigned long now)
+{
+	QueuedPacket dropped;
+	while (this->sentPackets.front() != nullptr && now - this->sentPackets.front()->queued > this->windowMs)
+	{
+		this->sentPackets.pop(dropped);
+	}
+}
+
+/**
+ * @brief Records a packet sent to the relay.
+ *
+ * The oldest packet is dropped if more packets are outstanding than the relay holds.
+ *
+ * @param packet The packet that was sent.
+ * @param now The current time in milliseconds.
+ */
+void NetworkCodingEndpoint::sent(ProtocolStructure packet, unsigned long now)
+{
+	QueuedPacket dropped;
+	this->expire(now);
+	if (this->sentPackets.full())
+	{
+		this->sentPackets.pop(dropped);
+	}
+	this->sentPackets.push(packet, now);
+}
+
+/**
+ * @brief Records that the relay forwarded one of our packets unchanged.
+ *
+ * Older packets were taken by blocks we missed, so they are dropped as well.
+ *
+ * @param packet The packet heard from the relay.
+ */
+void NetworkCodingEndpoint::forwarded(ProtocolStructure packet)
+{
+	QueuedPacket dropped;
+	for (uint8_t i = 0; this->sentPackets.at(i) != nullptr; i++)
+	{
+		if (samePacket(this->sentPackets.at(i)->packet, packet))
+		{
+			for (uint8_t j = 0; j <= i; j++)
+			{
+				this->sentPackets.pop(dropped);
+			}
+			return;
+		}
+	}
+}
+
+/**
+ * @brief Checks whether a block was coded by the relay.
+ *
+ * @param packet The decoded block.
+ * @return true if the block carries the relay id, false otherwise.
+ */
+bool NetworkCodingEndpoint::isCoded(ProtocolStructure packet)
+{
+	return (packet.id | 1) == (this->relayId | 1);
+}
+
+/**
+ * @brief Recovers the packet meant for us from a coded block.
+ *
+ * The oldest sent packet whose parity matches the block is used. Older packets
+ * were taken by blocks we missed, or never reached the relay, and are dropped.
+ *
+ * @param coded The coded block received from the relay.
+ * @param now The current time in milliseconds.
+ * @param packet Receives the recovered packet.
+ * @return false if the block is not coded or we have no packet to decode it with, true otherwise.
+ */
+bool NetworkCodingEndpoint::decode(ProtocolStructure coded, unsigned long now, ProtocolStructure &packet)
+{
+	QueuedPacket own;
+	this->expire(now);
+	if (!this->isCoded(coded))
+	{
+		return false;
+	}
+	// The tag is the parity of the packet towards the node, ours if we sent it.
+	uint8_t parity = (coded.id & 1) ^ (this->towardNode ? 0 : codeParity(coded));
+	while (this->sentPackets.pop(own))
+	{
+		if (codeParity(own.packet) == parity)
+		{
+			packet.id = own.packet.id;
+			packet.command = static_cast<Command>(coded.command ^ own.packet.command);
+			packet.data = coded.data ^ own.packet.data;
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Constructor for the NetworkCodingSimulation class.
+ *
+ * @param seed Seed of the random generator, runs with the same seed are identical.
+ */
+NetworkCodingSimulation::NetworkCodingSimulation(uint32_t seed) : seed(seed ? seed : 1) {}
+
+/**
+ * @brief Returns a uniform random number in [0, 1) from a xorshift32 generator.
+ */
+float NetworkCodingSimulation::random()
+{
+	this->seed ^= this->seed << 13;
+	this->seed ^= this->seed >> 17;
+	this->seed ^= this->seed << 5;
+	return (float)this->seed / 4294967296.0f;
+}
+
+/**
+ * @brief Hands a packet to the station it was sent to.
+ *
+ * Relays queue the packet, and `held` keeps a copy in the same order so the
+ * simulation knows which packets the relay combines. End stations count it.
+ */
+void NetworkCodingSimulation::deliver(uint8_t station, uint8_t stations, bool down, ProtocolStructure packet, unsigned long now,
+									  NetworkCodingRelay **relay, PacketQueue *held, ChainResult &result)
+{
+	if (station == 0 || station == stations - 1)
+	{
+		result.delivered++;
+		return;
+	}
+	down ? relay[station]->fromServer(packet, now) : relay[station]->fromNode(packet, now);
+	held[station].push(packet, now);
+}
+
+/**
+ * @brief Simulates a chain of relays between the server and one node.
+ *
+ * Both ends always have a packet to send, and one station transmits per block time,
+ * chosen round robin among those whose next hop has room. Each neighbour of a relay
+ * misses its blocks independently with probability `lossRate`. A missed block loses
+ * the packet it carried for that neighbour, and leaves a packet the relay has already
+ * taken among those the neighbour decodes with. Every decoded packet is checked
+ * against the packet the relay combined, so decoding errors show up as corrupted
+ * packets.
+ *
+ * @param relays Relays between the server and the node.
+ * @param coding Whether relays combine packets, or only forward them.
+ * @param slots Block times to simulate.
+ * @param lossRate Probability that a neighbour misses a block sent by a relay.
+ * @return The number of packets delivered, lost and corrupted, and the throughput.
+ */
+ChainResult NetworkCodingSimulation::run(uint8_t relays, bool coding, uint32_t slots, float lossRate)
+{
+	const uint8_t nodeId = 1;
+	const uint32_t windowMs = UINT32_MAX;
+	ChainResult result{};
+	result.slots = slots;
+	if (relays == 0 || 2 * relays + 2 > M16_MAX_NODES)
+	{
+		return result;
+	}
+
+	// Station 0 is the server, stations 1 to relays are relays and relays + 1 is the node.
+	// Relay i uses id 2 * i, and the odd id after it for coded blocks.
+	uint8_t stations = relays + 2;
+	NetworkCodingRelay *relay[M16_MAX_NODES] = {};
+	NetworkCodingEndpoint *towardServer[M16_MAX_NODES] = {}; // Packets a station sent to the relay above it.
+	NetworkCodingEndpoint *towardNode[M16_MAX_NODES] = {};	 // Packets a station sent to the relay below it.
+	PacketQueue heldUp[M16_MAX_NODES], heldDown[M16_MAX_NODES]; // Copies of the queues of each relay.
+	for (uint8_t i = 0; i < stations; i++)
+	{
+		if (i >= 1 && i <= relays)
+		{
+			relay[i] = new NetworkCodingRelay(2 * i, 0, coding);
+		}
+		if (i >= 2)
+		{
+			towardServer[i] = new NetworkCodingEndpoint(2 * (i - 1), false, windowMs);
+		}
+		if (i < relays)
+		{
+			towardNode[i] = new NetworkCodingEndpoint(2 * (i + 1), true, windowMs);
+		}
+	}
+
+	uint16_t upSent = 0, downSent = 0;
+	uint8_t turn = 0;
+	unsigned long now = 0;
+
+	for (uint32_t slot = 0; slot < slots; slot++, now += M16_BLOCK_INTERVAL_MS)
+	{
+		for (uint8_t tries = 0; tries < stations; tries++)
+		{
+			uint8_t i = (turn + tries) % stations;
+			ProtocolStructure packet;
+
+			if (i == 0 || i == stations - 1)
+			{
+				// An end station sends a new packet to its neighbouring relay.
+				bool down = i == 0;
+				uint8_t next = down ? 1 : relays;
+				if (!(down ? relay[next]->acceptsFromServer() : relay[next]->acceptsFromNode()))
+				{
+					continue;
+				}
+				uint16_t &sequence = down ? downSent : upSent;
+				packet = ProtocolStructure{nodeId, down ? REQUEST_DATA : TEMP_SENSOR, (uint16_t)(sequence++ & PacketLayout::dataMask)};
+				deliver(next, stations, down, packet, now, relay, down ? heldDown : heldUp, result);
+				(down ? towardNode[0] : towardServer[stations - 1])->sent(packet, now);
+			}
+			else
+			{
+				bool upRoom = i == 1 || relay[i - 1]->acceptsFromNode();
+				bool downRoom = i == relays || relay[i + 1]->acceptsFromServer();
+				RelayBlock block = relay[i]->peekBlock(now);
+				if (block == RELAY_NONE || (block != RELAY_TO_NODE && !upRoom) || (block != RELAY_TO_SERVER && !downRoom))
+				{
+					continue;
+				}
+				relay[i]->nextBlock(packet, now);
+
+				// The packets the relay took, and whether each neighbour heard the block.
+				QueuedPacket up{}, down{};
+				if (block != RELAY_TO_NODE)
+				{
+					heldUp[i].pop(up);
+				}
+				if (block != RELAY_TO_SERVER)
+				{
+					heldDown[i].pop(down);
+				}
+				bool upHeard = this->random() >= lossRate;
+				bool downHeard = this->random() >= lossRate;
+
+				ProtocolStructure upDecoded = up.packet, downDecoded = down.packet;
+				if (block == RELAY_CODED)
+				{
+					// Each neighbour decodes with the packet it sent to this relay.
+					if (upHeard && (!towardNode[i - 1]->decode(packet, now, upDecoded) || !samePacket(upDecoded, up.packet)))
+					{
+						result.corrupted++;
+					}
+					if (downHeard && (!towardServer[i + 1]->decode(packet, now, downDecoded) || !samePacket(downDecoded, down.packet)))
+					{
+						result.corrupted++;
+					}
+				}
+				else if (block == RELAY_TO_SERVER && downHeard)
+				{
+					towardServer[i + 1]->forwarded(packet);
+				}
+				else if (block == RELAY_TO_NODE && upHeard)
+				{
+					towardNode[i - 1]->forwarded(packet);
+				}
+
+				if (block != RELAY_TO_NODE)
+				{
+					if (upHeard)
+					{
+						deliver(i - 1, stations, false, upDecoded, now, relay, heldUp, result);
+					}
+					else
+					{
+						result.lost++;
+					}
+					if (towardServer[i] != nullptr)
+					{
+						towardServer[i]->sent(up.packet, now);
+					}
+				}
+				if (block != RELAY_TO_SERVER)
+				{
+					if (downHeard)
+					{
+						deliver(i + 1, stations, true, downDecoded, now, relay, heldDown, result);
+					}
+					else
+					{
+						result.lost++;
+					}
+					if (towardNode[i] != nullptr)
+					{
+						towardNode[i]->sent(down.packet, now);
+					}
+				}
+			}
+			turn = i + 1;
+			break;
+		}
+	}
+
+	for (uint8_t i = 0; i < stations; i++)
+	{
+		delete relay[i];
+		delete towardServer[i];
+		delete towardNode[i];
+	}
+	result.throughput = slots > 0 ? (float)result.delivered / slots : 0.0f;
+	return result;
+}
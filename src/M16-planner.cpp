@@ -0,0 +1,188 @@
+/**
+ * @file M16-planner.cpp
+ * @brief Implementation of the AirtimePlanner class.
+ *
+ * This file contains the implementation of the AirtimePlanner class, which
+ * computes cycle time, utilization and alarm latency for a polled deployment.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-planner.h"
+
+/**
+ * @brief Constructor for the AirtimePlanner class.
+ *
+ * @param plan The deployment to evaluate.
+ */
+AirtimePlanner::AirtimePlanner(const DeploymentPlan &plan) : plan(plan) {}
+
+/**
+ * @brief Calculates the time spent polling a single node.
+ *
+ * A poll consists of the REQUEST_DATA block from the server, one block per sensor
+ * and a FINISHED block from the node, and the SENSOR_DATA_RECEIVED block from the
+ * server. A modem starts its blocks `M16_BLOCK_INTERVAL_MS` apart, and a block is
+ * received `M16_BLOCK_TIME_MS` after it starts. The link changes direction twice
+ * per poll, and the server can start the next poll one interval after its last block.
+ *
+ * @return The slot length in milliseconds.
+ */
+uint32_t AirtimePlanner::nodeSlotMs()
+{
+	return 2 * (M16_BLOCK_TIME_MS + this->plan.turnaroundMs) + (this->plan.sensorsPerNode + 1) * M16_BLOCK_INTERVAL_MS;
+}
+
+/**
+ * @brief Calculates the time the server spends on a report request each cycle.
+ *
+ * The request consists of two characters separated by the command guard, followed
+ * by the report frame on the serial link.
+ *
+ * @return The report overhead in milliseconds, or 0 if no report is requested.
+ */
+uint32_t AirtimePlanner::reportOverheadMs()
+{
+	if (!this->plan.reportEachCycle)
+	{
+		return 0;
+	}
+	return M16_COMMAND_GUARD_MS + serialTimeMs(2 + M16_REPORT_LENGTH);
+}
+
+/**
+ * @brief Evaluates the deployment analytically.
+ *
+ * An alarm raised on a node just after its data window opened has to wait for the
+ * next poll of that node, so the worst case latency is one poll period plus the
+ * airtime of the block carrying the alarm.
+ *
+ * @return The computed airtime budget.
+ */
+PlanResult AirtimePlanner::evaluate()
+{
+	PlanResult result{};
+	uint32_t overhead = this->reportOverheadMs();
+
+	result.nodeSlotMs = this->nodeSlotMs();
+	result.cycleTimeMs = this->plan.nodes * result.nodeSlotMs + overhead;
+	result.pollPeriodMs = result.cycleTimeMs > this->plan.samplePeriodMs ? result.cycleTimeMs : this->plan.samplePeriodMs;
+	result.utilization = this->plan.samplePeriodMs > 0 ? (float)result.cycleTimeMs / (float)this->plan.samplePeriodMs : 0.0f;
+	result.headroomMs = (int32_t)this->plan.samplePeriodMs - (int32_t)result.cycleTimeMs;
+	result.worstAlarmLatencyMs = result.pollPeriodMs + M16_BLOCK_TIME_MS;
+	result.maxNodes = this->plan.samplePeriodMs > overhead ? (this->plan.samplePeriodMs - overhead) / result.nodeSlotMs : 0;
+	result.feasible = result.cycleTimeMs <= this->plan.samplePeriodMs;
+	return result;
+}
+
+/**
+ * @brief Evaluates the deployment by replaying the poll schedule event by event.
+ *
+ * Every modem is replayed on its own: a block starts when its sender wants to send
+ * it, but no earlier than `M16_BLOCK_INTERVAL_MS` after the previous block of the
+ * same modem, and the receiver reacts `turnaroundMs` after the block has arrived.
+ * The cycle time and alarm latency are measured from the replay and do not use the
+ * formulas of `evaluate()`, so the two can cross-check each other.
+ *
+ * @param cycles The number of poll cycles to replay (at least 2).
+ * @return The airtime budget observed in the replay.
+ */
+PlanResult AirtimePlanner::simulate(uint8_t cycles)
+{
+	PlanResult result = this->evaluate();
+	if (cycles < 2 || this->plan.nodes == 0)
+	{
+		return result;
+	}
+
+	// Earliest start of the next block of each modem, the server is modem 0.
+	uint32_t nextFree[257] = {};
+	auto transmit = [&nextFree](uint16_t modem, uint32_t wanted, uint32_t &start) -> uint32_t
+	{
+		start = wanted > nextFree[modem] ? wanted : nextFree[modem];
+		nextFree[modem] = start + M16_BLOCK_INTERVAL_MS;
+		return start + M16_BLOCK_TIME_MS;
+	};
+
+	uint32_t now = 0;
+	uint32_t longestCycle = 0;
+	uint32_t longestPeriod = 0;
+	uint32_t longestSlot = 0;
+	uint32_t worstLatency = 0;
+	uint32_t firstDataBlock[256] = {};
+
+	for (uint8_t cycle = 0; cycle < cycles; cycle++)
+	{
+		uint32_t cycleStart = now;
+		if (this->plan.reportEachCycle)
+		{
+			now += this->reportOverheadMs(); // The report only uses the serial link.
+		}
+		for (uint8_t node = 0; node < this->plan.nodes; node++)
+		{
+			uint32_t start;
+			uint32_t received = transmit(0, now, start); // REQUEST_DATA
+			uint32_t slotStart = start;
+
+			uint32_t wanted = received + this->plan.turnaroundMs;
+			for (uint8_t block = 0; block <= this->plan.sensorsPerNode; block++) // Sensors and FINISHED.
+			{
+				received = transmit(node + 1, wanted, start);
+				if (block == 0)
+				{
+					// An alarm raised just after the previous data window opened is sent here.
+					if (cycle > 0)
+					{
+						uint32_t latency = received - firstDataBlock[node];
+						worstLatency = latency > worstLatency ? latency : worstLatency;
+					}
+					firstDataBlock[node] = start;
+				}
+			}
+
+			transmit(0, received + this->plan.turnaroundMs, start); // SENSOR_DATA_RECEIVED
+			now = nextFree[0];
+			longestSlot = now - slotStart > longestSlot ? now - slotStart : longestSlot;
+		}
+
+		uint32_t cycleTime = now - cycleStart;
+		longestCycle = cycleTime > longestCycle ? cycleTime : longestCycle;
+
+		// The server waits for the next sample period before polling again.
+		if (cycleTime < this->plan.samplePeriodMs)
+		{
+			now = cycleStart + this->plan.samplePeriodMs;
+		}
+		uint32_t period = now - cycleStart;
+		longestPeriod = period > longestPeriod ? period : longestPeriod;
+	}
+
+	result.nodeSlotMs = longestSlot;
+	result.cycleTimeMs = longestCycle;
+	result.pollPeriodMs = longestPeriod;
+	result.utilization = this->plan.samplePeriodMs > 0 ? (float)longestCycle / (float)this->plan.samplePeriodMs : 0.0f;
+	result.headroomMs = (int32_t)this->plan.samplePeriodMs - (int32_t)longestCycle;
+	result.worstAlarmLatencyMs = worstLatency;
+	result.feasible = longestCycle <= this->plan.samplePeriodMs;
+	return result;
+}
+
+/**
+ * @brief Checks the analytic model against a replay of the schedule.
+ *
+ * @param toleranceMs The largest accepted difference between the two results.
+ * @return true if node slot, cycle time, poll period and alarm latency agree within the tolerance.
+ */
+bool AirtimePlanner::validate(uint32_t toleranceMs)
+{
+	PlanResult computed = this->evaluate();
+	PlanResult replayed = this->simulate();
+
+	uint32_t slotDiff = computed.nodeSlotMs > replayed.nodeSlotMs ? computed.nodeSlotMs - replayed.nodeSlotMs : replayed.nodeSlotMs - computed.nodeSlotMs;
+	uint32_t cycleDiff = computed.cycleTimeMs > replayed.cycleTimeMs ? computed.cycleTimeMs - replayed.cycleTimeMs : replayed.cycleTimeMs - computed.cycleTimeMs;
+	uint32_t periodDiff = computed.pollPeriodMs > replayed.pollPeriodMs ? computed.pollPeriodMs - replayed.pollPeriodMs : replayed.pollPeriodMs - computed.pollPeriodMs;
+	uint32_t latencyDiff = computed.worstAlarmLatencyMs > replayed.worstAlarmLatencyMs ? computed.worstAlarmLatencyMs - replayed.worstAlarmLatencyMs : replayed.worstAlarmLatencyMs - computed.worstAlarmLatencyMs;
+
+	return slotDiff <= toleranceMs && cycleDiff <= toleranceMs && periodDiff <= toleranceMs && latencyDiff <= toleranceMs && computed.feasible == replayed.feasible;
+}
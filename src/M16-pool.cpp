@@ -0,0 +1,17 @@
+/**
+ * @file M16-pool.cpp
+ * @brief Global memory pools of the library.
+ *
+ * This file contains the statically allocated pools for packets, messages and
+ * report snapshots. Their sizes are set with `M16_PACKET_POOL_SIZE`,
+ * `M16_MESSAGE_POOL_SIZE` and `M16_REPORT_POOL_SIZE`.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-pool.h"
+
+PacketPool packetPool;
+MessagePool messagePool;
+ReportPool reportPool;
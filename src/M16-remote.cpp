@@ -0,0 +1,465 @@
+/**
+ * @file M16-remote.cpp
+ * @brief Implementation of remote configuration and diagnostics.
+ *
+ * This file contains the packing of diffs and digests, the server side
+ * RemoteManager, and on the ESP32 the node side RemoteNode.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-remote.h"
+
+/**
+ * @brief Packs a diff into message bytes.
+ *
+ * Only the values selected by the mask are included.
+ *
+ * @param diff The diff to pack.
+ * @param buffer Buffer of at least `M16_REMOTE_CONFIG_MAX_LENGTH` bytes.
+ * @return The number of bytes written.
+ */
+uint8_t remotePackDiff(const RemoteDiff &diff, uint8_t *buffer)
+{
+	uint8_t length = 0;
+	buffer[length++] = M16_REMOTE_CONFIG;
+	buffer[length++] = diff.sequence;
+	buffer[length++] = diff.mask;
+	buffer[length++] = diff.delayS & 0xff;
+	buffer[length++] = diff.delayS >> 8;
+	if (diff.mask & REMOTE_CHANNEL)
+	{
+		buffer[length++] = diff.channel;
+	}
+	if (diff.mask & REMOTE_POWER_LEVEL)
+	{
+		buffer[length++] = diff.powerLevel;
+	}
+	if (diff.mask & REMOTE_REPORT_INTERVAL)
+	{
+		buffer[length++] = diff.reportIntervalS & 0xff;
+		buffer[length++] = diff.reportIntervalS >> 8;
+	}
+	return length;
+}
+
+/**
+ * @brief Unpacks a diff received from the server.
+ *
+ * @param buffer The message bytes.
+ * @param length The number of bytes.
+ * @param diff The diff to fill, values not in the mask are set to 0.
+ * @return false if the message is not a valid diff, true otherwise.
+ */
+bool remoteUnpackDiff(const uint8_t *buffer, uint8_t length, RemoteDiff &diff)
+{
+	if (length < 5 || buffer[0] != M16_REMOTE_CONFIG)
+	{
+		return false;
+	}
+	diff = RemoteDiff{};
+	diff.sequence = buffer[1];
+	diff.mask = buffer[2];
+	diff.delayS = buffer[3] | (buffer[4] << 8);
+	uint8_t index = 5;
+	if (diff.mask & REMOTE_CHANNEL)
+	{
+		if (index + 1 > length)
+		{
+			return false;
+		}
+		diff.channel = buffer[index++];
+	}
+	if (diff.mask & REMOTE_POWER_LEVEL)
+	{
+		if (index + 1 > length)
+		{
+			return false;
+		}
+		diff.powerLevel = buffer[index++];
+	}
+	if (diff.mask & REMOTE_REPORT_INTERVAL)
+	{
+		if (index + 2 > length)
+		{
+			return false;
+		}
+		diff.reportIntervalS = buffer[index] | (buffer[index + 1] << 8);
+		index += 2;
+	}
+	return index == length;
+}
+
+/**
+ * @brief Packs a digest into message bytes.
+ *
+ * The channel and power level share a byte, as do the report flags. The channel
+ * and power level of the report itself are left out, they are the ones in effect.
+ *
+ * @param digest The digest to pack.
+ * @param buffer Buffer of at least `M16_REMOTE_DIGEST_LENGTH` bytes.
+ * @return The number of bytes written.
+ */
+uint8_t remotePackDigest(const RemoteDigest &digest, uint8_t *buffer)
+{
+	const Report &report = digest.report;
+	buffer[0] = M16_REMOTE_DIGEST;
+	buffer[1] = digest.sequence;
+	buffer[2] = digest.status;
+	buffer[3] = (digest.config.channel << 3) | (digest.config.powerLevel & 0x07);
+	buffer[4] = digest.reportIntervalS & 0xff;
+	buffer[5] = digest.reportIntervalS >> 8;
+	buffer[6] = report.signalPower;
+	buffer[7] = report.noisePower;
+	buffer[8] = report.bitErrorRate;
+	buffer[9] = report.packetValid & 0xff;
+	buffer[10] = report.packetValid >> 8;
+	buffer[11] = report.packedInvalid;
+	buffer[12] = report.firmwareVersion;
+	buffer[13] = report.timeSinceBoot & 0xff;
+	buffer[14] = (report.timeSinceBoot >> 8) & 0xff;
+	buffer[15] = (report.timeSinceBoot >> 16) & 0xff;
+	buffer[16] = report.chipID & 0xff;
+	buffer[17] = report.chipID >> 8;
+	buffer[18] = (report.hwRev & 0x03) | (report.tbValid << 2) | (report.txComplete << 3) | (report.diagnostic << 4);
+	buffer[19] = digest.rxOverflows & 0xff;
+	buffer[20] = digest.rxOverflows >> 8;
+	return M16_REMOTE_DIGEST_LENGTH;
+}
+
+/**
+ * @brief Unpacks a digest received from a node.
+ *
+ * @param buffer The message bytes.
+ * @param length The number of bytes.
+ * @param digest The digest to fill.
+ * @return false if the message is not a digest, true otherwise.
+ */
+bool remoteUnpackDigest(const uint8_t *buffer, uint8_t length, RemoteDigest &digest)
+{
+	if (length != M16_REMOTE_DIGEST_LENGTH || buffer[0] != M16_REMOTE_DIGEST)
+	{
+		return false;
+	}
+	digest = RemoteDigest{};
+	Report &report = digest.report;
+	digest.sequence = buffer[1];
+	digest.status = static_cast<RemoteStatus>(buffer[2]);
+	digest.config.channel = buffer[3] >> 3;
+	digest.config.powerLevel = buffer[3] & 0x07;
+	digest.reportIntervalS = buffer[4] | (buffer[5] << 8);
+	report.signalPower = buffer[6];
+	report.noisePower = buffer[7];
+	report.bitErrorRate = buffer[8];
+	report.packetValid = buffer[9] | (buffer[10] << 8);
+	report.packedInvalid = buffer[11];
+	report.firmwareVersion = buffer[12];
+	report.timeSinceBoot = buffer[13] | (buffer[14] << 8) | ((uint32_t)buffer[15] << 16);
+	report.chipID = buffer[16] | (buffer[17] << 8);
+	report.hwRev = buffer[18] & 0x03;
+	report.tbValid = (buffer[18] >> 2) & 1;
+	report.txComplete = (buffer[18] >> 3) & 1;
+	report.diagnostic = (buffer[18] >> 4) & 1;
+	report.channel = digest.config.channel;
+	report.powerLevel = digest.config.powerLevel > 0 ? digest.config.powerLevel - 1 : 0;
+	digest.rxOverflows = buffer[19] | (buffer[20] << 8);
+	return true;
+}
+
+/**
+ * @brief Constructor for the RemoteManager class.
+ *
+ * @param channel The channel the server modem is on.
+ * @param seed A random number to start the sequence from, for example `esp_random()`.
+ */
+RemoteManager::RemoteManager(uint8_t channel, uint32_t seed)
+	: sequence(seed), channel(channel), switchPending(false), switchAt(0), switchChannel(0), confirmPending(false),
+	  confirmBy(0), previousChannel(channel), digests{}, known{}, sent{} {}
+
+/**
+ * @brief Builds the message for a diff.
+ *
+ * Send the message to the node with a HarqSender and call `delivered()` once the
+ * sender completes. Only one diff with a channel change should be in flight.
+ *
+ * @param diff The changes, its sequence number is assigned here.
+ * @param buffer Buffer of at least `M16_REMOTE_CONFIG_MAX_LENGTH` bytes.
+ * @return The number of bytes to send.
+ */
+uint8_t RemoteManager::configure(const RemoteDiff &diff, uint8_t *buffer)
+{
+	this->sent = diff;
+	this->sent.sequence = ++this->sequence;
+	return remotePackDiff(this->sent, buffer);
+}
+
+/**
+ * @brief Builds an empty diff, which only asks the node for a digest.
+ *
+ * @param buffer Buffer of at least `M16_REMOTE_CONFIG_MAX_LENGTH` bytes.
+ * @return The number of bytes to send.
+ */
+uint8_t RemoteManager::query(uint8_t *buffer)
+{
+	return this->configure(RemoteDiff{}, buffer);
+}
+
+/**
+ * @brief Marks the last diff as received by the node.
+ *
+ * @param now The current time in milliseconds.
+ */
+void RemoteManager::delivered(unsigned long now)
+{
+	if (this->sent.mask & REMOTE_CHANNEL)
+	{
+		this->switchPending = true;
+		this->switchAt = now + (unsigned long)this->sent.delayS * 1000;
+		this->switchChannel = this->sent.channel;
+	}
+}
+
+/**
+ * @brief Checks whether the server modem has to change channel now.
+ *
+ * The server follows the node when it switches. If no digest arrives on the new
+ * channel within `M16_REMOTE_CONFIRM_MS`, the node has rolled back or never
+ * switched, and the server goes back to the previous channel.
+ *
+ * @param now The current time in milliseconds.
+ * @param channel The channel to pass to `M16::setCommunicationChannel()`.
+ * @return true when the server has to switch, false otherwise.
+ */
+bool RemoteManager::switchDue(unsigned long now, uint8_t &channel)
+{
+	if (this->switchPending && (long)(now - this->switchAt) >= 0)
+	{
+		this->switchPending = false;
+		this->previousChannel = this->channel;
+		this->channel = this->switchChannel;
+		this->confirmPending = true;
+		this->confirmBy = now + M16_REMOTE_CONFIRM_MS;
+		channel = this->channel;
+		return true;
+	}
+	if (this->confirmPending && (long)(now - this->confirmBy) >= 0)
+	{
+		this->confirmPending = false;
+		this->channel = this->previousChannel;
+		channel = this->channel;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief Stores a digest received from a node.
+ *
+ * A digest on the channel the server switched to confirms the switch.
+ *
+ * @param id The node the message came from.
+ * @param buffer The message bytes.
+ * @param length The number of bytes.
+ * @return false if the message is not a digest, true otherwise.
+ */
+bool RemoteManager::digestReceived(uint8_t id, const uint8_t *buffer, uint8_t length)
+{
+	if (id >= M16_MAX_NODES || !remoteUnpackDigest(buffer, length, this->digests[id]))
+	{
+		return false;
+	}
+	this->known[id] = true;
+	if (this->confirmPending && this->digests[id].config.channel == this->channel)
+	{
+		this->confirmPending = false;
+	}
+	return true;
+}
+
+/**
+ * @brief Returns the last digest of a node.
+ *
+ * @return The digest, or nullptr if the node has not sent one.
+ */
+const RemoteDigest *RemoteManager::getDigest(uint8_t id)
+{
+	return id < M16_MAX_NODES && this->known[id] ? &this->digests[id] : nullptr;
+}
+
+#if defined(ESP_PLATFORM)
+
+/**
+ * @brief Constructor for the RemoteNode class.
+ *
+ * @param modem The modem the settings are applied to.
+ * @param reportIntervalS Report interval until the server changes it.
+ */
+RemoteNode::RemoteNode(M16 &modem, uint16_t reportIntervalS)
+	: modem(modem), state{}, received(false), pending{}, hasPending(false), activateAt(0), previous{},
+	  awaitingServer(false), confirmBy(0), digestPending(false)
+{
+	this->state.status = REMOTE_IDLE;
+	this->state.reportIntervalS = reportIntervalS;
+}
+
+/**
+ * @brief Sends the settings that differ from the modem's current ones.
+ */
+void RemoteNode::apply(ModemConfig config)
+{
+	ModemConfig current = this->modem.getConfig();
+	if (config.channel != 0 && config.channel != current.channel)
+	{
+		this->modem.setCommunicationChannel(config.channel);
+	}
+	if (config.powerLevel != 0 && config.powerLevel != current.powerLevel)
+	{
+		this->modem.setPowerLevel(config.powerLevel);
+	}
+}
+
+/**
+ * @brief Handles a message received from the server.
+ *
+ * A repeated diff is answered again without being applied twice. The report
+ * interval changes at once; the channel and power level change in `update()` after
+ * the delay of the diff.
+ *
+ * @param data The message bytes.
+ * @param length The number of bytes.
+ * @param now The current time in milliseconds.
+ * @return true if the message was a diff, false if it is for the application.
+ */
+bool RemoteNode::messageReceived(const uint8_t *data, uint8_t length, unsigned long now)
+{
+	RemoteDiff diff;
+	if (!remoteUnpackDiff(data, length, diff))
+	{
+		return false;
+	}
+	this->digestPending = true;
+	if (this->received && diff.sequence == this->state.sequence)
+	{
+		return true;
+	}
+	this->received = true;
+	this->state.sequence = diff.sequence;
+
+	if ((diff.mask & REMOTE_CHANNEL && (diff.channel < 1 || diff.channel > 12)) ||
+		(diff.mask & REMOTE_POWER_LEVEL && (diff.powerLevel < 1 || diff.powerLevel > 4)))
+	{
+		this->state.status = REMOTE_REJECTED;
+		return true;
+	}
+	if (diff.mask & REMOTE_REPORT_INTERVAL)
+	{
+		this->state.reportIntervalS = diff.reportIntervalS;
+	}
+	if (diff.mask & (REMOTE_CHANNEL | REMOTE_POWER_LEVEL))
+	{
+		this->pending = diff;
+		this->hasPending = true;
+		this->activateAt = now + (unsigned long)diff.delayS * 1000;
+		this->state.status = REMOTE_PENDING;
+	}
+	else
+	{
+		this->state.status = REMOTE_APPLIED;
+	}
+	return true;
+}
+
+/**
+ * @brief Confirms that the link works after a change.
+ *
+ * Call this for every block received from the server.
+ *
+ * @param now The current time in milliseconds.
+ */
+void RemoteNode::heard(unsigned long now)
+{
+	if (this->awaitingServer && (long)(now - this->activateAt) >= 0)
+	{
+		this->awaitingServer = false;
+		this->modem.saveConfig();
+	}
+}
+
+/**
+ * @brief Applies a pending change when its delay is over, or rolls back an unconfirmed one.
+ *
+ * Blocks for the command guards of the modem while settings are sent.
+ *
+ * @param now The current time in milliseconds.
+ */
+void RemoteNode::update(unsigned long now)
+{
+	if (this->hasPending && (long)(now - this->activateAt) >= 0)
+	{
+		this->hasPending = false;
+		this->previous = this->modem.getConfig();
+		ModemConfig next = this->previous;
+		if (this->pending.mask & REMOTE_CHANNEL)
+		{
+			next.channel = this->pending.channel;
+		}
+		if (this->pending.mask & REMOTE_POWER_LEVEL)
+		{
+			next.powerLevel = this->pending.powerLevel;
+		}
+		this->apply(next);
+		this->state.status = REMOTE_APPLIED;
+		this->awaitingServer = true;
+		this->confirmBy = now + M16_REMOTE_CONFIRM_MS;
+		// The digest on the new settings tells the server the switch worked.
+		this->digestPending = true;
+	}
+	if (this->awaitingServer && (long)(now - this->confirmBy) >= 0)
+	{
+		this->awaitingServer = false;
+		this->apply(this->previous);
+		this->modem.saveConfig();
+		this->state.status = REMOTE_ROLLED_BACK;
+		this->digestPending = true;
+	}
+}
+
+/**
+ * @brief Checks whether a digest should be sent to the server.
+ */
+bool RemoteNode::digestDue()
+{
+	return this->digestPending;
+}
+
+/**
+ * @brief Builds the digest message.
+ *
+ * @param buffer Buffer of at least `M16_REMOTE_DIGEST_LENGTH` bytes.
+ * @param refresh Whether to request a new report from the modem first.
+ * @return The number of bytes to send.
+ */
+uint8_t RemoteNode::digest(uint8_t *buffer, bool refresh)
+{
+	if (refresh)
+	{
+		this->modem.requestReport();
+	}
+	uint32_t overflows = this->modem.getRxOverflows();
+	this->state.config = this->modem.getConfig();
+	this->state.report = this->modem.report;
+	this->state.rxOverflows = overflows > UINT16_MAX ? UINT16_MAX : overflows;
+	this->digestPending = false;
+	return remotePackDigest(this->state, buffer);
+}
+
+/**
+ * @brief Returns the report interval set by the server.
+ */
+uint16_t RemoteNode::getReportInterval()
+{
+	return this->state.reportIntervalS;
+}
+
+#endif
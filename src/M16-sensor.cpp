@@ -0,0 +1,418 @@
+/**
+ * @file M16-sensor.cpp
+ * @brief Implementation of the SensorPipeline class.
+ *
+ * This file contains the acquisition task, the ADC interrupt callback and the
+ * lock-free ring between the task and `loop()`.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-sensor.h"
+#if __has_include("esp_arduino_version.h")
+#include "esp_arduino_version.h"
+#endif
+
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 3
+#define M16_SENSOR_CONTINUOUS 1
+#else
+#define M16_SENSOR_CONTINUOUS 0
+#endif
+
+SensorPipeline *SensorPipeline::active = nullptr;
+
+/**
+ * @brief Constructor for the SensorPipeline class.
+ */
+SensorPipeline::SensorPipeline()
+	: channels{}, channelCount(0), queue{}, head(0), tail(0), peak(0), overflows(0), stale(0), oversized(0), failures(0),
+	  task(NULL), continuous(false), running(false) {}
+
+/**
+ * @brief Adds a sensor to the pipeline, see `addAnalog()` and `addBus()`.
+ */
+bool SensorPipeline::addChannel(Command command, int16_t pin, SensorConvert convert, SensorRead read, void *context,
+								uint32_t periodMs)
+{
+	if (this->task != NULL || this->channelCount == M16_SENSOR_CHANNELS || periodMs == 0)
+	{
+		return false;
+	}
+	Channel &channel = this->channels[this->channelCount++];
+	channel = Channel{};
+	channel.command = command;
+	channel.pin = pin;
+	channel.convert = convert;
+	channel.read = read;
+	channel.context = context;
+	channel.periodMs = periodMs;
+	return true;
+}
+
+/**
+ * @brief Adds an analog sensor.
+ *
+ * The voltage is averaged over every conversion in the period, which also filters
+ * out noise from the transmitter.
+ *
+ * @param command The sensor command the samples are sent with.
+ * @param pin The analog pin.
+ * @param convert Converts the averaged voltage to the data of a packet.
+ * @param periodMs Time between samples in milliseconds.
+ * @return false if the pipeline is running or full, true otherwise.
+ */
+bool SensorPipeline::addAnalog(Command command, uint8_t pin, SensorConvert convert, uint32_t periodMs)
+{
+	return convert != nullptr && this->addChannel(command, pin, convert, nullptr, nullptr, periodMs);
+}
+
+/**
+ * @brief Adds a sensor read by a callback, for example over I2C.
+ *
+ * @param command The sensor command the samples are sent with.
+ * @param read Reads the sensor, it runs in the acquisition task.
+ * @param context Passed to the callback.
+ * @param periodMs Time between samples in milliseconds.
+ * @return false if the pipeline is running or full, true otherwise.
+ */
+bool SensorPipeline::addBus(Command command, SensorRead read, void *context, uint32_t periodMs)
+{
+	return read != nullptr && this->addChannel(command, -1, nullptr, read, context, periodMs);
+}
+
+/**
+ * @brief Starts the ADC and the acquisition task.
+ *
+ * Only one pipeline can run at a time, since the ADC has a single continuous unit.
+ *
+ * @param priority Priority of the acquisition task.
+ * @param core Core the task runs on.
+ * @return false if no sensor was added, a pipeline is already running or the task
+ * could not be created, true otherwise.
+ */
+bool SensorPipeline::begin(UBaseType_t priority, BaseType_t core)
+{
+	if (this->task != NULL || this->channelCount == 0 || active != nullptr)
+	{
+		return false;
+	}
+	active = this;
+	this->continuous = false;
+#if M16_SENSOR_CONTINUOUS
+	uint8_t pins[M16_SENSOR_CHANNELS];
+	size_t pinCount = 0;
+	for (uint8_t i = 0; i < this->channelCount; i++)
+	{
+		if (this->channels[i].pin >= 0)
+		{
+			pins[pinCount++] = this->channels[i].pin;
+		}
+	}
+	if (pinCount > 0)
+	{
+		this->continuous = analogContinuous(pins, pinCount, M16_SENSOR_ADC_FRAME, M16_SENSOR_ADC_RATE_HZ,
+											&SensorPipeline::conversionDone) &&
+						   analogContinuousStart();
+		if (!this->continuous)
+		{
+			analogContinuousDeinit();
+		}
+	}
+#endif
+
+	unsigned long now = millis();
+	for (uint8_t i = 0; i < this->channelCount; i++)
+	{
+		this->channels[i].last = now;
+		this->channels[i].sum = 0;
+		this->channels[i].conversions = 0;
+	}
+	__atomic_store_n(&this->running, true, __ATOMIC_RELEASE);
+	if (xTaskCreatePinnedToCore(&SensorPipeline::run, "m16-sensor", M16_SENSOR_TASK_STACK, this, priority, &this->task,
+								core) != pdPASS)
+	{
+		this->task = NULL;
+		this->end();
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief Stops the acquisition task and the ADC. Samples in the ring are kept.
+ */
+void SensorPipeline::end()
+{
+	__atomic_store_n(&this->running, false, __ATOMIC_RELEASE);
+	if (this->task != NULL)
+	{
+		xTaskNotifyGive(this->task);
+		while (__atomic_load_n(&this->task, __ATOMIC_ACQUIRE) != NULL)
+		{
+			vTaskDelay(1);
+		}
+	}
+#if M16_SENSOR_CONTINUOUS
+	if (this->continuous)
+	{
+		analogContinuousStop();
+		analogContinuousDeinit();
+		this->continuous = false;
+	}
+#endif
+	if (active == this)
+	{
+		active = nullptr;
+	}
+}
+
+/**
+ * @brief Body of the acquisition task.
+ *
+ * @param pipeline The SensorPipeline that started the task.
+ */
+void SensorPipeline::run(void *pipeline)
+{
+	SensorPipeline *self = static_cast<SensorPipeline *>(pipeline);
+	while (__atomic_load_n(&self->running, __ATOMIC_ACQUIRE))
+	{
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(M16_SENSOR_IDLE_MS));
+		self->acquire();
+	}
+	__atomic_store_n(&self->task, (TaskHandle_t)NULL, __ATOMIC_RELEASE);
+	vTaskDelete(NULL);
+}
+
+/**
+ * @brief Called by the ADC driver from its interrupt when a DMA frame is complete.
+ */
+void ARDUINO_ISR_ATTR SensorPipeline::conversionDone()
+{
+	SensorPipeline *self = active;
+	if (self == nullptr || self->task == NULL)
+	{
+		return;
+	}
+	BaseType_t woken = pdFALSE;
+	vTaskNotifyGiveFromISR(self->task, &woken);
+	if (woken == pdTRUE)
+	{
+		portYIELD_FROM_ISR();
+	}
+}
+
+/**
+ * @brief Adds the averages of the last ADC frame to the analog channels.
+ */
+void SensorPipeline::readFrame()
+{
+#if M16_SENSOR_CONTINUOUS
+	adc_continuous_data_t *result = nullptr;
+	if (!analogContinuousRead(&result, 0) || result == nullptr)
+	{
+		return;
+	}
+	size_t index = 0;
+	for (uint8_t i = 0; i < this->channelCount; i++)
+	{
+		Channel &channel = this->channels[i];
+		if (channel.pin >= 0)
+		{
+			channel.sum += result[index++].avg_read_mvolts;
+			channel.conversions++;
+		}
+	}
+#endif
+}
+
+/**
+ * @brief Collects conversions and takes the samples that are due.
+ */
+void SensorPipeline::acquire()
+{
+	if (this->continuous)
+	{
+		this->readFrame();
+	}
+	unsigned long now = millis();
+	for (uint8_t i = 0; i < this->channelCount; i++)
+	{
+		Channel &channel = this->channels[i];
+		if (channel.pin >= 0 && !this->continuous)
+		{
+			channel.sum += analogReadMilliVolts(channel.pin);
+			channel.conversions++;
+		}
+		if (now - channel.last < channel.periodMs)
+		{
+			continue;
+		}
+		channel.last += channel.periodMs * ((now - channel.last) / channel.periodMs);
+
+		if (channel.pin >= 0)
+		{
+			if (channel.conversions > 0)
+			{
+				this->push(channel.command, channel.convert(channel.sum / channel.conversions), now);
+			}
+			channel.sum = 0;
+			channel.conversions = 0;
+			continue;
+		}
+		uint16_t data;
+		if (channel.read(data, channel.context))
+		{
+			this->push(channel.command, data, millis());
+		}
+		else
+		{
+			__atomic_fetch_add(&this->failures, 1, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/**
+ * @brief Adds a sample to the ring, or counts an overflow if it is full.
+ *
+ * A value wider than the data field of a packet would be cut by `Layout::encode()`,
+ * so it is counted and dropped instead.
+ */
+void SensorPipeline::push(Command command, uint16_t data, unsigned long time)
+{
+	if (data > PacketLayout::dataMask)
+	{
+		__atomic_fetch_add(&this->oversized, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	uint32_t head = __atomic_load_n(&this->head, __ATOMIC_RELAXED);
+	uint32_t next = (head + 1) & (M16_SENSOR_QUEUE_LENGTH - 1);
+	if (next == __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE))
+	{
+		__atomic_fetch_add(&this->overflows, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	this->queue[head] = SensorSample{command, data, time};
+	__atomic_store_n(&this->head, next, __ATOMIC_RELEASE);
+
+	uint32_t count = (next - __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE)) & (M16_SENSOR_QUEUE_LENGTH - 1);
+	if (count > __atomic_load_n(&this->peak, __ATOMIC_RELAXED))
+	{
+		__atomic_store_n(&this->peak, count, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * @brief Takes the oldest sample from the ring.
+ *
+ * Only one task may take samples, either with this function or with `drain()`.
+ *
+ * @param sample The variable to store the sample in.
+ * @return true if a sample was available, false otherwise.
+ */
+bool SensorPipeline::pop(SensorSample &sample)
+{
+	uint32_t tail = __atomic_load_n(&this->tail, __ATOMIC_RELAXED);
+	if (tail == __atomic_load_n(&this->head, __ATOMIC_ACQUIRE))
+	{
+		return false;
+	}
+	sample = this->queue[tail];
+	__atomic_store_n(&this->tail, (tail + 1) & (M16_SENSOR_QUEUE_LENGTH - 1), __ATOMIC_RELEASE);
+	return true;
+}
+
+/**
+ * @brief Returns the number of samples waiting in the ring.
+ */
+size_t SensorPipeline::available()
+{
+	uint32_t head = __atomic_load_n(&this->head, __ATOMIC_ACQUIRE);
+	return (head - __atomic_load_n(&this->tail, __ATOMIC_ACQUIRE)) & (M16_SENSOR_QUEUE_LENGTH - 1);
+}
+
+/**
+ * @brief Moves samples from the ring to the transmit queue of a FlowSender.
+ *
+ * Stops when the sender reports backpressure, so samples wait in the ring rather
+ * than being rejected. Samples older than `M16_SENSOR_MAX_AGE_MS` are dropped.
+ *
+ * @param sender The sender the samples are queued with.
+ * @param now The current time in milliseconds.
+ * @return The number of samples queued.
+ */
+uint8_t SensorPipeline::drain(FlowSender &sender, unsigned long now)
+{
+	uint8_t moved = 0;
+	while (!sender.isPaused())
+	{
+		uint32_t tail = __atomic_load_n(&this->tail, __ATOMIC_RELAXED);
+		if (tail == __atomic_load_n(&this->head, __ATOMIC_ACQUIRE))
+		{
+			break;
+		}
+		const SensorSample &sample = this->queue[tail];
+		if (now - sample.time > M16_SENSOR_MAX_AGE_MS)
+		{
+			__atomic_fetch_add(&this->stale, 1, __ATOMIC_RELAXED);
+		}
+		else if (sender.trySend(sample.command, sample.data) == FLOW_REJECTED)
+		{
+			break;
+		}
+		else
+		{
+			moved++;
+		}
+		__atomic_store_n(&this->tail, (tail + 1) & (M16_SENSOR_QUEUE_LENGTH - 1), __ATOMIC_RELEASE);
+	}
+	return moved;
+}
+
+/**
+ * @brief Returns the most samples that have been waiting in the ring at once.
+ */
+uint32_t SensorPipeline::getQueuePeak()
+{
+	return __atomic_load_n(&this->peak, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Returns the number of samples dropped because the ring was full.
+ */
+uint32_t SensorPipeline::getOverflows()
+{
+	return __atomic_load_n(&this->overflows, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Returns the number of samples dropped by `drain()` because they were too old.
+ */
+uint32_t SensorPipeline::getStale()
+{
+	return __atomic_load_n(&this->stale, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Returns the number of samples dropped because they did not fit in the data field.
+ */
+uint32_t SensorPipeline::getOversized()
+{
+	return __atomic_load_n(&this->oversized, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Returns the number of failed reads of bus sensors.
+ */
+uint32_t SensorPipeline::getFailures()
+{
+	return __atomic_load_n(&this->failures, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Returns the acquisition task, for example for `Watermarks::watchTask()`.
+ */
+TaskHandle_t SensorPipeline::getTask()
+{
+	return this->task;
+}
@@ -0,0 +1,259 @@
+/**
+ * @file M16-sequencer.cpp
+ * @brief Implementation of the Sequencer class.
+ *
+ * This file contains the implementation of the Sequencer class, which emits the
+ * bytes of a command sequence from one-shot timer callbacks.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-sequencer.h"
+
+#if !defined(ESP_PLATFORM)
+#include <chrono>
+#endif
+
+/**
+ * @brief Constructor for the Sequencer class.
+ *
+ * @param sink The function that writes a byte to the modem.
+ * @param context Passed to `sink` unchanged, typically the modem instance.
+ */
+Sequencer::Sequencer(ByteSink sink, void *context)
+	: sink(sink), context(context), steps{}, length(0), next(0), running(false), startUs(0), jitter{0, INT32_MAX, INT32_MIN, 0}
+{
+#if defined(ESP_PLATFORM)
+	esp_timer_create_args_t args = {};
+	args.callback = &Sequencer::fire;
+	args.arg = this;
+	args.dispatch_method = ESP_TIMER_TASK;
+	args.name = "m16-sequencer";
+	if (esp_timer_create(&args, &this->timer) != ESP_OK)
+	{
+		this->timer = nullptr;
+	}
+#endif
+}
+
+/**
+ * @brief Destructor for the Sequencer class.
+ *
+ * Cancels a running sequence and releases the timer.
+ */
+Sequencer::~Sequencer()
+{
+	this->cancel();
+#if defined(ESP_PLATFORM)
+	if (this->timer != nullptr)
+	{
+		esp_timer_delete(this->timer);
+	}
+#endif
+}
+
+/**
+ * @brief Returns a monotonic timestamp.
+ *
+ * @return The time in microseconds from an arbitrary starting point.
+ */
+int64_t Sequencer::nowUs()
+{
+#if defined(ESP_PLATFORM)
+	return esp_timer_get_time();
+#else
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**
+ * @brief Appends a byte to the sequence.
+ *
+ * Steps must be added in order of increasing offset, and not while the sequence
+ * is running.
+ *
+ * @param offsetUs The time from the start of the sequence until the byte is emitted.
+ * @param byte The byte to emit.
+ * @return true if the step was added, false if the sequence is running or full.
+ */
+bool Sequencer::add(uint32_t offsetUs, uint8_t byte)
+{
+	uint8_t length = __atomic_load_n(&this->length, __ATOMIC_RELAXED);
+	if (this->busy() || length >= M16_SEQUENCE_LENGTH)
+	{
+		return false;
+	}
+	if (length > 0 && offsetUs < this->steps[length - 1].offsetUs)
+	{
+		return false;
+	}
+	this->steps[length] = SequenceStep{offsetUs, byte};
+	__atomic_store_n(&this->length, length + 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+/**
+ * @brief Starts emitting the sequence.
+ *
+ * The function returns immediately; the bytes are emitted from the timer callback.
+ * Once the last byte is emitted the sequence is cleared so a new one can be added.
+ *
+ * @return true if the sequence was started, false if it is empty or already running.
+ */
+bool Sequencer::start()
+{
+	if (this->busy() || __atomic_load_n(&this->length, __ATOMIC_RELAXED) == 0)
+	{
+		return false;
+	}
+#if defined(ESP_PLATFORM)
+	if (this->timer == nullptr)
+	{
+		return false;
+	}
+#else
+	if (this->worker.joinable())
+	{
+		this->worker.join();
+	}
+#endif
+	__atomic_store_n(&this->next, 0, __ATOMIC_RELAXED);
+	this->startUs = Sequencer::nowUs();
+	__atomic_store_n(&this->running, true, __ATOMIC_RELEASE);
+#if defined(ESP_PLATFORM)
+	this->arm();
+#else
+	this->worker = std::thread(&Sequencer::run, this);
+#endif
+	return true;
+}
+
+/**
+ * @brief Stops a running sequence and discards the remaining steps.
+ */
+void Sequencer::cancel()
+{
+#if defined(ESP_PLATFORM)
+	if (this->timer != nullptr)
+	{
+		esp_timer_stop(this->timer);
+	}
+	__atomic_store_n(&this->running, false, __ATOMIC_RELEASE);
+#else
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		__atomic_store_n(&this->running, false, __ATOMIC_RELEASE);
+	}
+	this->wakeup.notify_all();
+	if (this->worker.joinable())
+	{
+		this->worker.join();
+	}
+#endif
+	__atomic_store_n(&this->length, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Checks whether a sequence is being emitted.
+ *
+ * @return true until the last byte of the sequence has been emitted.
+ */
+bool Sequencer::busy()
+{
+	return __atomic_load_n(&this->running, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Arms the timer for the next step.
+ *
+ * The delay is computed from the start of the sequence rather than from the previous
+ * step, so callback latency does not accumulate over the sequence.
+ */
+void Sequencer::arm()
+{
+#if defined(ESP_PLATFORM)
+	int64_t due = this->startUs + this->steps[__atomic_load_n(&this->next, __ATOMIC_RELAXED)].offsetUs;
+	int64_t delay = due - Sequencer::nowUs();
+	esp_timer_start_once(this->timer, delay > 0 ? delay : 0);
+#endif
+}
+
+#if !defined(ESP_PLATFORM)
+/**
+ * @brief Timer thread used on the host.
+ */
+void Sequencer::run()
+{
+	std::unique_lock<std::mutex> guard(this->lock);
+	while (this->busy())
+	{
+		int64_t due = this->startUs + this->steps[__atomic_load_n(&this->next, __ATOMIC_RELAXED)].offsetUs;
+		std::chrono::steady_clock::time_point deadline{std::chrono::microseconds(due)};
+		if (this->wakeup.wait_until(guard, deadline, [this] { return !this->busy(); }))
+		{
+			return;
+		}
+		guard.unlock();
+		Sequencer::fire(this);
+		guard.lock();
+	}
+}
+#endif
+
+/**
+ * @brief Timer callback that emits the current step.
+ *
+ * Runs on the timer task or thread, so the fields the caller also reads go through
+ * the __atomic builtins. Clearing `running` last with release order publishes the
+ * cleared sequence and the jitter statistics to a caller that sees `busy()` false.
+ *
+ * @param sequencer The sequencer that owns the timer.
+ */
+void Sequencer::fire(void *sequencer)
+{
+	Sequencer *self = static_cast<Sequencer *>(sequencer);
+	if (!self->busy())
+	{
+		return;
+	}
+	uint8_t next = __atomic_load_n(&self->next, __ATOMIC_RELAXED);
+	const SequenceStep &step = self->steps[next];
+	int32_t late = (int32_t)(Sequencer::nowUs() - (self->startUs + step.offsetUs));
+	self->sink(step.byte, self->context);
+
+	JitterStats &jitter = self->jitter;
+	jitter.samples++;
+	jitter.totalLateUs += late;
+	jitter.minLateUs = late < jitter.minLateUs ? late : jitter.minLateUs;
+	jitter.maxLateUs = late > jitter.maxLateUs ? late : jitter.maxLateUs;
+
+	__atomic_store_n(&self->next, next + 1, __ATOMIC_RELAXED);
+	if (next + 1 >= __atomic_load_n(&self->length, __ATOMIC_RELAXED))
+	{
+		__atomic_store_n(&self->length, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&self->running, false, __ATOMIC_RELEASE);
+		return;
+	}
+	self->arm();
+}
+
+/**
+ * @brief Returns the timing error measured since the last reset.
+ *
+ * Call it while `busy()` is false, the statistics are updated by the timer callback.
+ *
+ * @return A copy of the jitter statistics.
+ */
+JitterStats Sequencer::getJitter()
+{
+	return this->jitter;
+}
+
+/**
+ * @brief Clears the jitter statistics.
+ */
+void Sequencer::resetJitter()
+{
+	this->jitter = JitterStats{0, INT32_MAX, INT32_MIN, 0};
+}
@@ -0,0 +1,515 @@
+/**
+ * @file M16-shore.cpp
+ * @brief Implementation of the multi-threaded shore pipeline.
+ *
+ * This file contains the ShoreHub class with its reader and worker threads.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-shore.h"
+
+#if defined(__linux__) && !defined(ESP_PLATFORM)
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+/**
+ * @brief Constructor for the ShoreHub class.
+ *
+ * @param workers Worker threads to start, 0 for one per core. Never more workers
+ * than streams are started.
+ */
+ShoreHub::ShoreHub(uint8_t workers) : streamCount(0), workerCount(workers), reading(false), working(false)
+{
+	if (this->workerCount == 0)
+	{
+		unsigned cores = std::thread::hardware_concurrency();
+		this->workerCount = cores == 0 ? 1 : (cores > M16_SHORE_MAX_STREAMS ? M16_SHORE_MAX_STREAMS : cores);
+	}
+}
+
+/**
+ * @brief Destructor, stops the threads and closes the serial ports.
+ */
+ShoreHub::~ShoreHub()
+{
+	this->stop();
+	for (uint8_t i = 0; i < this->streamCount; i++)
+	{
+		if (this->streams[i]->fd >= 0)
+		{
+			close(this->streams[i]->fd);
+		}
+	}
+}
+
+/**
+ * @brief Current time of the monotonic clock used for all stamps.
+ *
+ * @return The time in milliseconds.
+ */
+unsigned long ShoreHub::millis()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+/**
+ * @brief Adds to a counter that other threads read.
+ */
+void ShoreHub::count(uint64_t &counter, uint64_t amount)
+{
+	__atomic_add_fetch(&counter, amount, __ATOMIC_RELAXED);
+}
+
+int ShoreHub::addStream(int fd)
+{
+	if (this->streamCount == M16_SHORE_MAX_STREAMS || __atomic_load_n(&this->working, __ATOMIC_ACQUIRE))
+	{
+		return -1;
+	}
+	this->streams[this->streamCount].reset(new Stream());
+	this->streams[this->streamCount]->fd = fd;
+	return this->streamCount++;
+}
+
+/**
+ * @brief Opens a topside modem on a serial port as a new stream.
+ *
+ * The port is set up like the ESP32 UART, 9600 baud 8N1 without flow control.
+ * Streams are added before `start()`.
+ *
+ * @param path The serial device, for example `/dev/ttyUSB0`.
+ * @return The stream number, or -1 if the port could not be opened or no stream is free.
+ */
+int ShoreHub::addSerial(const char *path)
+{
+	int fd = open(path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	termios options;
+	if (tcgetattr(fd, &options) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	cfmakeraw(&options);
+	cfsetispeed(&options, B9600);
+	cfsetospeed(&options, B9600);
+	options.c_cflag |= CLOCAL | CREAD;
+	options.c_cflag &= ~(CSTOPB | CRTSCTS);
+	// Return after a tenth of a second without data, so the reader sees `stop()`.
+	options.c_cc[VMIN] = 0;
+	options.c_cc[VTIME] = M16_SHORE_IDLE_MS / 100;
+	if (tcsetattr(fd, TCSANOW, &options) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	tcflush(fd, TCIFLUSH);
+
+	int stream = this->addStream(fd);
+	if (stream < 0)
+	{
+		close(fd);
+	}
+	return stream;
+}
+
+/**
+ * @brief Adds a stream without a serial port, fed with `inject()`.
+ *
+ * Useful to replay recorded traffic through the pipeline. Feedback blocks of such
+ * a stream are discarded.
+ *
+ * @return The stream number, or -1 if no stream is free.
+ */
+int ShoreHub::addStream()
+{
+	return this->addStream(-1);
+}
+
+/**
+ * @brief Starts the worker threads and one reader thread per serial port.
+ *
+ * @return false if the hub is already running, true otherwise.
+ */
+bool ShoreHub::start()
+{
+	if (__atomic_load_n(&this->working, __ATOMIC_ACQUIRE))
+	{
+		return false;
+	}
+	uint8_t count = this->workerCount;
+	if (count > this->streamCount)
+	{
+		count = this->streamCount > 0 ? this->streamCount : 1;
+	}
+	for (uint8_t i = 0; i < this->streamCount; i++)
+	{
+		this->streams[i]->worker = i % count;
+	}
+
+	__atomic_store_n(&this->working, true, __ATOMIC_RELEASE);
+	__atomic_store_n(&this->reading, true, __ATOMIC_RELEASE);
+	this->workers.clear();
+	for (uint8_t i = 0; i < count; i++)
+	{
+		this->workers.emplace_back(new Worker());
+	}
+	for (uint8_t i = 0; i < count; i++)
+	{
+		this->workers[i]->thread = std::thread(&ShoreHub::workLoop, this, i);
+	}
+	for (uint8_t i = 0; i < this->streamCount; i++)
+	{
+		if (this->streams[i]->fd >= 0)
+		{
+			this->streams[i]->reader = std::thread(&ShoreHub::readLoop, this, std::ref(*this->streams[i]));
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Stops the threads after the workers have processed everything read.
+ *
+ * Events already produced can still be taken with `read()`.
+ */
+void ShoreHub::stop()
+{
+	if (!__atomic_load_n(&this->working, __ATOMIC_ACQUIRE))
+	{
+		return;
+	}
+	__atomic_store_n(&this->reading, false, __ATOMIC_RELEASE);
+	for (uint8_t i = 0; i < this->streamCount; i++)
+	{
+		if (this->streams[i]->reader.joinable())
+		{
+			this->streams[i]->reader.join();
+		}
+	}
+	__atomic_store_n(&this->working, false, __ATOMIC_RELEASE);
+	for (auto &worker : this->workers)
+	{
+		{
+			std::lock_guard<std::mutex> lock(worker->lock);
+			worker->wake.notify_one();
+		}
+		worker->thread.join();
+	}
+	this->workers.clear();
+}
+
+/**
+ * @brief Pairs received bytes into packets and hands them to the worker.
+ *
+ * A byte left unpaired for `M16_SHORE_RESYNC_MS` belongs to a damaged block and is
+ * discarded, so one lost byte does not shift every following packet.
+ */
+void ShoreHub::received(Stream &stream, const uint8_t *bytes, size_t length, unsigned long now)
+{
+	if (stream.pending && now - stream.pendingTime > M16_SHORE_RESYNC_MS)
+	{
+		stream.pending = false;
+	}
+	uint64_t packets = 0;
+	uint64_t overruns = 0;
+	for (size_t i = 0; i < length; i++)
+	{
+		if (!stream.pending)
+		{
+			stream.pendingByte = bytes[i];
+			stream.pendingTime = now;
+			stream.pending = true;
+			continue;
+		}
+		stream.pending = false;
+		Stream::Input input{(uint16_t)((stream.pendingByte << 8) | bytes[i]), now};
+		if (stream.input.push(input))
+		{
+			packets++;
+		}
+		else
+		{
+			overruns++;
+		}
+	}
+	count(stream.stats.bytesRead, length);
+	if (packets > 0)
+	{
+		count(stream.stats.packets, packets);
+		this->notify(stream);
+	}
+	if (overruns > 0)
+	{
+		count(stream.stats.overruns, overruns);
+	}
+}
+
+/**
+ * @brief Wakes the worker of a stream if it is sleeping.
+ */
+void ShoreHub::notify(Stream &stream)
+{
+	if (__atomic_load_n(&this->working, __ATOMIC_ACQUIRE) == false || stream.worker >= this->workers.size())
+	{
+		return;
+	}
+	Worker &worker = *this->workers[stream.worker];
+	// Orders the push before reading the flag, pairs with the fence in `workLoop()`.
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&worker.sleeping, __ATOMIC_RELAXED))
+	{
+		std::lock_guard<std::mutex> lock(worker.lock);
+		worker.wake.notify_one();
+	}
+}
+
+/**
+ * @brief Reader thread of a serial stream.
+ *
+ * Only moves bytes: it writes pending feedback blocks and reads what the modem
+ * received. It never waits for a worker or consumer.
+ */
+void ShoreHub::readLoop(Stream &stream)
+{
+	uint8_t buffer[64];
+	while (__atomic_load_n(&this->reading, __ATOMIC_ACQUIRE))
+	{
+		uint16_t raw;
+		while (stream.feedback.pop(raw))
+		{
+			uint8_t bytes[2] = {(uint8_t)(raw >> 8), (uint8_t)(raw & 0xff)};
+			if (write(stream.fd, bytes, sizeof(bytes)) == sizeof(bytes))
+			{
+				count(stream.stats.feedback);
+			}
+		}
+
+		ssize_t length = ::read(stream.fd, buffer, sizeof(buffer));
+		if (length > 0)
+		{
+			this->received(stream, buffer, length, millis());
+		}
+		else if (length < 0 && errno != EINTR && errno != EAGAIN)
+		{
+			// The adapter was unplugged, keep the thread alive until `stop()`.
+			std::this_thread::sleep_for(std::chrono::milliseconds(M16_SHORE_IDLE_MS));
+		}
+	}
+}
+
+/**
+ * @brief Worker thread, processes the streams assigned to it.
+ */
+void ShoreHub::workLoop(uint8_t index)
+{
+	Worker &worker = *this->workers[index];
+	while (true)
+	{
+		bool busy = false;
+		for (uint8_t i = 0; i < this->streamCount; i++)
+		{
+			if (this->streams[i]->worker == index)
+			{
+				busy = this->process(*this->streams[i]) || busy;
+			}
+		}
+		if (busy)
+		{
+			continue;
+		}
+		if (!__atomic_load_n(&this->working, __ATOMIC_ACQUIRE))
+		{
+			return;
+		}
+
+		std::unique_lock<std::mutex> lock(worker.lock);
+		__atomic_store_n(&worker.sleeping, true, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		bool idle = true;
+		for (uint8_t i = 0; i < this->streamCount && idle; i++)
+		{
+			idle = this->streams[i]->worker != index || this->streams[i]->input.empty();
+		}
+		if (idle)
+		{
+			// Also wakes up regularly to send feedback that is due.
+			worker.wake.wait_for(lock, std::chrono::milliseconds(M16_SHORE_IDLE_MS));
+		}
+		__atomic_store_n(&worker.sleeping, false, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * @brief Removes duplicates, decodes and reassembles the queued packets of a stream.
+ *
+ * @return true if any packet was processed, false otherwise.
+ */
+bool ShoreHub::process(Stream &stream)
+{
+	bool busy = false;
+	Stream::Input input;
+	while (stream.input.pop(input))
+	{
+		busy = true;
+		stream.clock = input.time;
+		// Blocks are at least a block interval apart, so a repeat this close is the same block.
+		if (stream.haveLast && input.raw == stream.lastRaw && input.time - stream.lastTime < M16_SHORE_DEDUP_MS)
+		{
+			count(stream.stats.duplicates);
+			continue;
+		}
+		stream.lastRaw = input.raw;
+		stream.lastTime = input.time;
+		stream.haveLast = true;
+
+		ProtocolStructure packet = PacketLayout::decode(input.raw);
+		if (packet.command == MESSAGE_START || packet.command == MESSAGE_DATA || packet.command == MESSAGE_PARITY)
+		{
+			HarqReceiver &receiver = stream.receivers[packet.id];
+			// A new message starting means the previous round is over.
+			if (receiver.feedbackDue(input.time))
+			{
+				this->feedback(stream, receiver, input.time);
+			}
+			receiver.packetReceived(packet, input.time);
+			continue;
+		}
+
+		ShoreEvent event{};
+		event.time = input.time;
+		event.type = SHORE_PACKET;
+		event.packet = packet;
+		this->emit(stream, event);
+	}
+
+	// Replayed streams run on the time of their packets, serial streams on the clock.
+	unsigned long now = stream.fd >= 0 ? millis() : stream.clock;
+	for (HarqReceiver &receiver : stream.receivers)
+	{
+		if (receiver.feedbackDue(now))
+		{
+			this->feedback(stream, receiver, now);
+		}
+	}
+	return busy;
+}
+
+/**
+ * @brief Ends a round of a multi-block message, emitting the message once it is complete.
+ */
+void ShoreHub::feedback(Stream &stream, HarqReceiver &receiver, unsigned long now)
+{
+	ProtocolStructure packet = receiver.feedback(now);
+	if (stream.fd >= 0)
+	{
+		stream.feedback.push(PacketLayout::encode(packet.id, packet.command, packet.data));
+	}
+	if (packet.data != 0)
+	{
+		return;
+	}
+
+	ShoreEvent event{};
+	event.time = now;
+	event.type = SHORE_MESSAGE;
+	event.packet = ProtocolStructure{packet.id, MESSAGE_START, 0};
+	event.length = receiver.read(event.data);
+	count(stream.stats.messages);
+	this->emit(stream, event);
+}
+
+/**
+ * @brief Numbers an event and hands it to the consumer, dropping it if the consumer is behind.
+ */
+void ShoreHub::emit(Stream &stream, ShoreEvent &event)
+{
+	event.sequence = stream.sequence++;
+	if (!stream.output.push(event))
+	{
+		count(stream.stats.outputDrops);
+	}
+}
+
+/**
+ * @brief Feeds bytes to a stream added with `addStream()`.
+ *
+ * Only one thread may feed each stream.
+ *
+ * @param stream The stream number.
+ * @param bytes The bytes as the modem would have delivered them.
+ * @param length The number of bytes.
+ * @param now Time the bytes were received, in milliseconds.
+ * @return false if the stream does not exist or reads a serial port, true otherwise.
+ */
+bool ShoreHub::inject(uint8_t stream, const uint8_t *bytes, size_t length, unsigned long now)
+{
+	if (stream >= this->streamCount || this->streams[stream]->fd >= 0)
+	{
+		return false;
+	}
+	this->received(*this->streams[stream], bytes, length, now);
+	return true;
+}
+
+/**
+ * @brief Takes the next event of a stream.
+ *
+ * Only one thread may read each stream, but different streams can be read from
+ * different threads.
+ *
+ * @param stream The stream number.
+ * @param event The structure to fill.
+ * @return false if no event is waiting, true otherwise.
+ */
+bool ShoreHub::read(uint8_t stream, ShoreEvent &event)
+{
+	if (stream >= this->streamCount)
+	{
+		return false;
+	}
+	return this->streams[stream]->output.pop(event);
+}
+
+/**
+ * @brief Returns the counters of a stream.
+ *
+ * @param stream The stream number.
+ * @return The counters, all 0 if the stream does not exist.
+ */
+ShoreStats ShoreHub::getStats(uint8_t stream)
+{
+	ShoreStats stats{};
+	if (stream >= this->streamCount)
+	{
+		return stats;
+	}
+	ShoreStats &source = this->streams[stream]->stats;
+	stats.bytesRead = __atomic_load_n(&source.bytesRead, __ATOMIC_RELAXED);
+	stats.packets = __atomic_load_n(&source.packets, __ATOMIC_RELAXED);
+	stats.overruns = __atomic_load_n(&source.overruns, __ATOMIC_RELAXED);
+	stats.duplicates = __atomic_load_n(&source.duplicates, __ATOMIC_RELAXED);
+	stats.messages = __atomic_load_n(&source.messages, __ATOMIC_RELAXED);
+	stats.feedback = __atomic_load_n(&source.feedback, __ATOMIC_RELAXED);
+	stats.outputDrops = __atomic_load_n(&source.outputDrops, __ATOMIC_RELAXED);
+	return stats;
+}
+
+/**
+ * @brief Returns the number of worker threads started by `start()`.
+ */
+uint8_t ShoreHub::getWorkers()
+{
+	return this->workers.size();
+}
+
+#endif
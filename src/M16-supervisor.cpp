@@ -0,0 +1,227 @@
+/**
+ * @file M16-supervisor.cpp
+ * @brief Implementation of the Supervisor class.
+ *
+ * This file contains the implementation of the Supervisor class, which counts
+ * modem faults and runs the recovery ladder when they pile up.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-supervisor.h"
+
+/**
+ * @brief Constructor for the Supervisor class.
+ *
+ * @param modem The modem to supervise.
+ * @param faultThreshold Faults before a recovery is started, counting consecutive failed
+ * report requests and UART faults less than `M16_SUPERVISOR_FAULT_WINDOW_MS` apart.
+ */
+Supervisor::Supervisor(M16 &modem, uint8_t faultThreshold)
+	: modem(modem), faultThreshold(faultThreshold), faults(0), uartFaults(0), lastUartFault(0),
+	  powerCycle(nullptr), stats{} {}
+
+/**
+ * @brief Sets the function that power cycles the modem.
+ *
+ * The hook should switch the modem supply off and on again and return once power is
+ * restored. Without a hook the power cycle and configuration restore steps are skipped.
+ *
+ * @param hook The function to call, or nullptr to disable the step.
+ */
+void Supervisor::onPowerCycle(PowerCycleHook hook)
+{
+	this->powerCycle = hook;
+}
+
+/**
+ * @brief Records the outcome of a report request made by the application.
+ *
+ * @param received The value returned by `requestReport()`.
+ */
+void Supervisor::reportResult(bool received)
+{
+	if (received)
+	{
+		this->faults = 0;
+		this->uartFaults = 0;
+		return;
+	}
+	this->stats.reportFailures++;
+	this->faults++;
+}
+
+/**
+ * @brief Counts an overflow or line error, starting a new burst after a quiet period.
+ *
+ * @param now The current time in milliseconds.
+ */
+void Supervisor::uartFault(unsigned long now)
+{
+	if (now - this->lastUartFault > M16_SUPERVISOR_FAULT_WINDOW_MS)
+	{
+		this->uartFaults = 0;
+	}
+	this->lastUartFault = now;
+	this->uartFaults++;
+}
+
+/**
+ * @brief Processes UART events and starts a recovery when faults pile up.
+ *
+ * Overflows leave partial packets in the receive buffer, so the input is flushed
+ * right away. Call this function regularly from the main loop.
+ *
+ * @return true if a recovery was run, false otherwise.
+ */
+bool Supervisor::update()
+{
+	unsigned long now = millis();
+	if (now - this->lastUartFault > M16_SUPERVISOR_FAULT_WINDOW_MS)
+	{
+		this->uartFaults = 0;
+	}
+
+	uart_event_t event;
+	while (this->modem.pollUartEvent(event))
+	{
+		switch (event.type)
+		{
+		case UART_FIFO_OVF:
+		case UART_BUFFER_FULL:
+			this->stats.overflows++;
+			this->uartFault(now);
+			this->modem.flushTxBuffer();
+			break;
+		case UART_FRAME_ERR:
+		case UART_PARITY_ERR:
+			this->stats.lineErrors++;
+			this->uartFault(now);
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (this->faults + this->uartFaults < this->faultThreshold)
+	{
+		return false;
+	}
+	this->recover();
+	return true;
+}
+
+/**
+ * @brief Runs a single step of the recovery ladder and checks the modem afterwards.
+ *
+ * @param step The step to run.
+ * @return true if the modem answers a report request after the step.
+ */
+bool Supervisor::runStep(RecoveryStep step)
+{
+	unsigned long start = millis();
+	bool recovered = false;
+
+	switch (step)
+	{
+	case RECOVERY_FLUSH:
+		this->modem.flushTxBuffer();
+		recovered = this->modem.requestReport(M16_PROBE_READ_RETRIES);
+		break;
+	case RECOVERY_BAUD_REFRESH:
+		this->modem.refreshBaudRate();
+		this->modem.flushTxBuffer();
+		recovered = this->modem.requestReport(M16_PROBE_READ_RETRIES);
+		break;
+	case RECOVERY_MODE_RESYNC:
+		recovered = this->modem.detectOperationMode() != UNKNOWN_MODE;
+		break;
+	case RECOVERY_POWER_CYCLE:
+		this->powerCycle();
+		vTaskDelay(pdMS_TO_TICKS(M16_BOOT_TIME_MS));
+		this->modem.flushTxBuffer();
+		recovered = this->modem.detectOperationMode() != UNKNOWN_MODE;
+		break;
+	case RECOVERY_CONFIG_RESTORE:
+		// Check that the modem still answers once the settings are sent.
+		this->modem.applyConfig(this->modem.getConfig());
+		recovered = this->modem.requestReport(M16_PROBE_READ_RETRIES);
+		break;
+	default:
+		break;
+	}
+
+	this->stats.attempts[step]++;
+	this->stats.stepTimeMs[step] += millis() - start;
+	if (recovered)
+	{
+		this->stats.successes[step]++;
+	}
+	return recovered;
+}
+
+/**
+ * @brief Runs the recovery ladder until the modem responds again.
+ *
+ * The steps are tried from the cheapest to the most disruptive. A power cycle resets
+ * the modem to its defaults, so it is always followed by restoring the configuration.
+ *
+ * @return true if the modem responds after the recovery, false if every step failed.
+ */
+bool Supervisor::recover()
+{
+	unsigned long start = millis();
+	bool recovered = this->runStep(RECOVERY_FLUSH) ||
+					 this->runStep(RECOVERY_BAUD_REFRESH) ||
+					 this->runStep(RECOVERY_MODE_RESYNC);
+
+	if (!recovered && this->powerCycle != nullptr)
+	{
+		this->runStep(RECOVERY_POWER_CYCLE);
+		ModemConfig config = this->modem.getConfig();
+		if (config.channel != 0 && config.powerLevel != 0)
+		{
+			recovered = this->runStep(RECOVERY_CONFIG_RESTORE);
+		}
+		else
+		{
+			recovered = this->modem.requestReport(M16_PROBE_READ_RETRIES);
+		}
+	}
+
+	this->faults = 0;
+	this->uartFaults = 0;
+	if (!recovered)
+	{
+		this->stats.failedRecoveries++;
+		return false;
+	}
+	this->stats.recoveries++;
+	this->stats.totalRecoveryMs += millis() - start;
+	return true;
+}
+
+/**
+ * @brief Returns the fault and recovery counters.
+ *
+ * @return A copy of the counters.
+ */
+RecoveryStats Supervisor::getStats()
+{
+	return this->stats;
+}
+
+/**
+ * @brief Calculates the mean time to recover.
+ *
+ * @return The average duration of successful recoveries in milliseconds.
+ */
+uint32_t Supervisor::meanTimeToRecover()
+{
+	if (this->stats.recoveries == 0)
+	{
+		return 0;
+	}
+	return this->stats.totalRecoveryMs / this->stats.recoveries;
+}
@@ -0,0 +1,405 @@
+/**
+ * @file M16-telemetry.cpp
+ * @brief Implementation of the link telemetry from the nodes.
+ *
+ * This file contains the packing of telemetry messages, the node side
+ * LinkHistory and the server side LinkMap.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-telemetry.h"
+
+/**
+ * @brief Writes 4-bit groups into a message, the high half of each byte first.
+ */
+struct NibbleWriter
+{
+	uint8_t *buffer;
+	uint16_t position; // In 4-bit groups from the start of the buffer.
+	uint16_t limit;
+
+	bool put(uint8_t nibble)
+	{
+		if (this->position >= this->limit)
+		{
+			return false;
+		}
+		uint8_t &byte = this->buffer[this->position / 2];
+		if (this->position % 2 == 0)
+		{
+			byte = nibble << 4;
+		}
+		else
+		{
+			byte |= nibble & 0x0f;
+		}
+		this->position++;
+		return true;
+	}
+
+	/**
+	 * @brief Writes a signed value with three bits per group, the top bit marks that more groups follow.
+	 */
+	bool putSigned(int32_t value)
+	{
+		uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+		while (zigzag >= 8)
+		{
+			if (!this->put((zigzag & 0x07) | 0x08))
+			{
+				return false;
+			}
+			zigzag >>= 3;
+		}
+		return this->put(zigzag);
+	}
+};
+
+/**
+ * @brief Reads 4-bit groups written by NibbleWriter.
+ */
+struct NibbleReader
+{
+	const uint8_t *buffer;
+	uint16_t position;
+	uint16_t limit;
+
+	bool get(uint8_t &nibble)
+	{
+		if (this->position >= this->limit)
+		{
+			return false;
+		}
+		uint8_t byte = this->buffer[this->position / 2];
+		nibble = this->position % 2 == 0 ? byte >> 4 : byte & 0x0f;
+		this->position++;
+		return true;
+	}
+
+	bool getSigned(int32_t &value)
+	{
+		uint32_t zigzag = 0;
+		uint8_t nibble;
+		for (uint8_t shift = 0; shift < 32; shift += 3)
+		{
+			if (!this->get(nibble))
+			{
+				return false;
+			}
+			zigzag |= (uint32_t)(nibble & 0x07) << shift;
+			if (!(nibble & 0x08))
+			{
+				value = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+/**
+ * @brief Packs as many samples as fit into one telemetry message.
+ *
+ * The first sample is written in full and every following one as the difference to
+ * the one before. Samples are usually taken at a steady interval, so the time is
+ * written as the change in the interval instead. Counters are differenced with wrap-around, so a counter that wraps
+ * or restarts after a modem reset still packs into a few groups.
+ *
+ * @param samples The samples, oldest first.
+ * @param count The number of samples.
+ * @param sequence Sequence number of the message.
+ * @param buffer Buffer of at least `M16_HARQ_MAX_LENGTH` bytes.
+ * @param packed Set to the number of samples in the message.
+ * @return The number of bytes written, 0 if there are no samples.
+ */
+uint8_t telemetryPack(const LinkSample *samples, uint8_t count, uint8_t sequence, uint8_t *buffer, uint8_t &packed)
+{
+	packed = 0;
+	if (count == 0)
+	{
+		return 0;
+	}
+	const LinkSample &first = samples[0];
+	buffer[0] = M16_TELEMETRY_TYPE;
+	buffer[1] = sequence;
+	buffer[3] = first.time & 0xff;
+	buffer[4] = (first.time >> 8) & 0xff;
+	buffer[5] = (first.time >> 16) & 0xff;
+	buffer[6] = first.signalPower;
+	buffer[7] = first.noisePower;
+	buffer[8] = first.bitErrorRate;
+	buffer[9] = first.packetValid & 0xff;
+	buffer[10] = first.packetValid >> 8;
+	buffer[11] = first.packetInvalid;
+	packed = 1;
+
+	NibbleWriter writer{buffer + M16_TELEMETRY_HEADER_LENGTH, 0,
+						2 * (M16_HARQ_MAX_LENGTH - M16_TELEMETRY_HEADER_LENGTH)};
+	int32_t interval = 0;
+	while (packed < count)
+	{
+		const LinkSample &previous = samples[packed - 1];
+		const LinkSample &sample = samples[packed];
+		int32_t elapsed = (sample.time - previous.time) & 0xffffff;
+		uint16_t start = writer.position;
+		bool fits = writer.putSigned(elapsed - interval) &&
+					writer.putSigned(sample.signalPower - previous.signalPower) &&
+					writer.putSigned(sample.noisePower - previous.noisePower) &&
+					writer.putSigned(sample.bitErrorRate - previous.bitErrorRate) &&
+					writer.putSigned((int16_t)(sample.packetValid - previous.packetValid)) &&
+					writer.putSigned((int8_t)(sample.packetInvalid - previous.packetInvalid));
+		if (!fits)
+		{
+			writer.position = start;
+			break;
+		}
+		interval = elapsed;
+		packed++;
+	}
+	buffer[2] = packed;
+	return M16_TELEMETRY_HEADER_LENGTH + (writer.position + 1) / 2;
+}
+
+/**
+ * @brief Unpacks a telemetry message.
+ *
+ * @param buffer The message bytes.
+ * @param length The number of bytes.
+ * @param samples Array to fill, oldest first.
+ * @param maxSamples The size of the array.
+ * @param sequence Set to the sequence number of the message.
+ * @return The number of samples, 0 if the message is not valid telemetry.
+ */
+uint8_t telemetryUnpack(const uint8_t *buffer, uint8_t length, LinkSample *samples, uint8_t maxSamples,
+						uint8_t &sequence)
+{
+	if (length < M16_TELEMETRY_HEADER_LENGTH || buffer[0] != M16_TELEMETRY_TYPE || buffer[2] == 0 ||
+		buffer[2] > maxSamples)
+	{
+		return 0;
+	}
+	sequence = buffer[1];
+	uint8_t count = buffer[2];
+	LinkSample &first = samples[0];
+	first.time = buffer[3] | (buffer[4] << 8) | ((uint32_t)buffer[5] << 16);
+	first.signalPower = buffer[6];
+	first.noisePower = buffer[7];
+	first.bitErrorRate = buffer[8];
+	first.packetValid = buffer[9] | (buffer[10] << 8);
+	first.packetInvalid = buffer[11];
+
+	NibbleReader reader{buffer + M16_TELEMETRY_HEADER_LENGTH, 0,
+						(uint16_t)(2 * (length - M16_TELEMETRY_HEADER_LENGTH))};
+	int32_t interval = 0;
+	for (uint8_t i = 1; i < count; i++)
+	{
+		int32_t time, signal, noise, ber, valid, invalid;
+		if (!reader.getSigned(time) || !reader.getSigned(signal) || !reader.getSigned(noise) ||
+			!reader.getSigned(ber) || !reader.getSigned(valid) || !reader.getSigned(invalid))
+		{
+			return 0;
+		}
+		const LinkSample &previous = samples[i - 1];
+		LinkSample &sample = samples[i];
+		interval += time;
+		sample.time = (previous.time + interval) & 0xffffff;
+		sample.signalPower = previous.signalPower + signal;
+		sample.noisePower = previous.noisePower + noise;
+		sample.bitErrorRate = previous.bitErrorRate + ber;
+		sample.packetValid = previous.packetValid + valid;
+		sample.packetInvalid = previous.packetInvalid + invalid;
+	}
+	return count;
+}
+
+/**
+ * @brief Constructor for the LinkHistory class.
+ */
+LinkHistory::LinkHistory() : samples{}, recorded{}, head(0), count(0), sequence(0), overwritten(0)
+{
+}
+
+/**
+ * @brief Records a report of the local modem.
+ *
+ * When the history is full the oldest sample is overwritten, so a node that never
+ * finds spare airtime keeps the most recent view of its link.
+ *
+ * @param report The report.
+ * @param now The current time in milliseconds.
+ */
+void LinkHistory::record(const Report &report, unsigned long now)
+{
+	if (this->count == M16_TELEMETRY_HISTORY)
+	{
+		this->head = (this->head + 1) % M16_TELEMETRY_HISTORY;
+		this->count--;
+		this->overwritten++;
+	}
+	uint8_t index = (this->head + this->count) % M16_TELEMETRY_HISTORY;
+	this->recorded[index] = now;
+	LinkSample &sample = this->samples[index];
+	sample.time = (now / 1000) & 0xffffff;
+	sample.signalPower = report.signalPower;
+	sample.noisePower = report.noisePower;
+	sample.bitErrorRate = report.bitErrorRate;
+	sample.packetValid = report.packetValid;
+	sample.packetInvalid = report.packedInvalid;
+	this->count++;
+}
+
+/**
+ * @brief Returns the number of samples not sent yet.
+ */
+uint8_t LinkHistory::size()
+{
+	return this->count;
+}
+
+/**
+ * @brief Checks if the history is worth a message.
+ *
+ * Telemetry has the lowest priority, so the application should only send it when it
+ * has nothing else queued, and then only when this returns true.
+ *
+ * @param now The current time in milliseconds.
+ * @return true if enough samples have been recorded or the oldest one is getting old.
+ */
+bool LinkHistory::due(unsigned long now)
+{
+	return this->count >= M16_TELEMETRY_BATCH ||
+		   (this->count > 0 && now - this->recorded[this->head] >= M16_TELEMETRY_MAX_AGE_MS);
+}
+
+/**
+ * @brief Takes the oldest samples out of the history and packs them into a message.
+ *
+ * @param buffer Buffer of at least `M16_HARQ_MAX_LENGTH` bytes.
+ * @return The number of bytes written, 0 if the history is empty.
+ */
+uint8_t LinkHistory::nextMessage(uint8_t *buffer)
+{
+	LinkSample ordered[M16_TELEMETRY_HISTORY];
+	for (uint8_t i = 0; i < this->count; i++)
+	{
+		ordered[i] = this->samples[(this->head + i) % M16_TELEMETRY_HISTORY];
+	}
+	uint8_t packed;
+	uint8_t length = telemetryPack(ordered, this->count, this->sequence, buffer, packed);
+	if (length == 0)
+	{
+		return 0;
+	}
+	this->sequence++;
+	this->head = (this->head + packed) % M16_TELEMETRY_HISTORY;
+	this->count -= packed;
+	return length;
+}
+
+/**
+ * @brief Returns the number of samples overwritten before they could be sent.
+ */
+uint32_t LinkHistory::getOverwritten()
+{
+	return this->overwritten;
+}
+
+/**
+ * @brief Constructor for the LinkMap class.
+ */
+LinkMap::LinkMap()
+{
+	for (uint8_t i = 0; i < M16_MAX_NODES; i++)
+	{
+		this->entries[i] = LinkMapEntry{};
+	}
+}
+
+/**
+ * @brief Updates an exponential average, or starts it with the first sample.
+ */
+void LinkMap::smooth(float &average, float sample, bool first)
+{
+	average = first ? sample : average + M16_TELEMETRY_SMOOTHING * (sample - average);
+}
+
+/**
+ * @brief Records a report of the server modem for a block received from a node.
+ *
+ * @param id The node the block came from.
+ * @param report The report.
+ */
+void LinkMap::uplink(uint8_t id, const Report &report)
+{
+	if (id >= M16_MAX_NODES)
+	{
+		return;
+	}
+	LinkMapEntry &entry = this->entries[id];
+	smooth(entry.uplinkSnr, (float)report.signalPower - report.noisePower, !entry.hasUplink);
+	smooth(entry.uplinkBer, report.bitErrorRate, !entry.hasUplink);
+	entry.hasUplink = true;
+}
+
+/**
+ * @brief Records a telemetry message received from a node.
+ *
+ * A message with the same sequence as the last one is a repeat and is ignored.
+ *
+ * @param id The node that sent the message.
+ * @param buffer The message bytes.
+ * @param length The number of bytes.
+ * @return false if the message is not valid telemetry, true otherwise.
+ */
+bool LinkMap::telemetryReceived(uint8_t id, const uint8_t *buffer, uint8_t length)
+{
+	if (id >= M16_MAX_NODES)
+	{
+		return false;
+	}
+	LinkSample samples[M16_HARQ_MAX_LENGTH];
+	uint8_t sequence;
+	uint8_t count = telemetryUnpack(buffer, length, samples, M16_HARQ_MAX_LENGTH, sequence);
+	if (count == 0)
+	{
+		return false;
+	}
+
+	LinkMapEntry &entry = this->entries[id];
+	if (entry.hasDownlink && sequence == entry.sequence)
+	{
+		return true;
+	}
+	if (entry.hasDownlink)
+	{
+		entry.lostMessages += (uint8_t)(sequence - entry.sequence - 1);
+	}
+	for (uint8_t i = 0; i < count; i++)
+	{
+		bool first = !entry.hasDownlink && i == 0;
+		smooth(entry.downlinkSnr, (float)samples[i].signalPower - samples[i].noisePower, first);
+		smooth(entry.downlinkBer, samples[i].bitErrorRate, first);
+	}
+	uint16_t valid = samples[count - 1].packetValid - samples[0].packetValid;
+	uint8_t invalid = samples[count - 1].packetInvalid - samples[0].packetInvalid;
+	if (valid + invalid > 0)
+	{
+		entry.downlinkLoss = (float)invalid / (valid + invalid);
+	}
+	entry.downlinkTime = samples[count - 1].time;
+	entry.sequence = sequence;
+	entry.hasDownlink = true;
+	return true;
+}
+
+/**
+ * @brief Returns both directions of the link to a node.
+ *
+ * @param id The node, ids out of range return the entry of node 0.
+ */
+const LinkMapEntry &LinkMap::get(uint8_t id)
+{
+	return this->entries[id < M16_MAX_NODES ? id : 0];
+}
@@ -0,0 +1,222 @@
+/**
+ * @file M16-watermark.cpp
+ * @brief Implementation of the high-water mark snapshot.
+ *
+ * This file contains the packing of WatermarkSnapshot into message bytes and back,
+ * and on the ESP32 the Watermarks class that fills the snapshot.
+ *
+ * @author Stian Østhus Lund
+ * @author Ole Anders Astad
+ * @date March 2025
+ */
+#include "M16-watermark.h"
+#include "M16-pool.h"
+
+static uint8_t *put16(uint8_t *buffer, uint16_t value)
+{
+	buffer[0] = value & 0xff;
+	buffer[1] = value >> 8;
+	return buffer + 2;
+}
+
+static const uint8_t *get16(const uint8_t *buffer, uint16_t &value)
+{
+	value = buffer[0] | (buffer[1] << 8);
+	return buffer + 2;
+}
+
+/**
+ * @brief Packs a snapshot into bytes to send as one message.
+ *
+ * Multi-byte values are little endian. Unwatched task stacks are sent as 0.
+ *
+ * @param snapshot The snapshot to pack.
+ * @param buffer Buffer of at least `M16_WATERMARK_PACKED_SIZE` bytes.
+ * @return The number of bytes written.
+ */
+uint8_t packWatermarks(const WatermarkSnapshot &snapshot, uint8_t *buffer)
+{
+	uint8_t *out = buffer;
+	*out++ = M16_WATERMARK_VERSION;
+	out = put16(out, snapshot.rxBufferPeak);
+	out = put16(out, snapshot.rxOverflows);
+	*out++ = snapshot.fastRxPeak;
+	out = put16(out, snapshot.fastRxDropped);
+	*out++ = snapshot.flowQueuePeak;
+	out = put16(out, snapshot.flowRejected);
+	*out++ = snapshot.packetPoolPeak;
+	*out++ = snapshot.messagePoolPeak;
+	*out++ = snapshot.reportPoolPeak;
+	out = put16(out, snapshot.poolFailures);
+	*out++ = snapshot.tasks;
+	for (uint8_t i = 0; i < M16_WATERMARK_TASKS; i++)
+	{
+		out = put16(out, i < snapshot.tasks ? snapshot.stackFree[i] : 0);
+	}
+	return out - buffer;
+}
+
+/**
+ * @brief Unpacks a snapshot received from a node.
+ *
+ * @param buffer The received message bytes.
+ * @param length The number of bytes received.
+ * @param snapshot The structure to fill.
+ * @return false if the message is not a snapshot of this version, true otherwise.
+ */
+bool unpackWatermarks(const uint8_t *buffer, uint8_t length, WatermarkSnapshot &snapshot)
+{
+	if (length != M16_WATERMARK_PACKED_SIZE || buffer[0] != M16_WATERMARK_VERSION)
+	{
+		return false;
+	}
+	const uint8_t *in = buffer + 1;
+	in = get16(in, snapshot.rxBufferPeak);
+	in = get16(in, snapshot.rxOverflows);
+	snapshot.fastRxPeak = *in++;
+	in = get16(in, snapshot.fastRxDropped);
+	snapshot.flowQueuePeak = *in++;
+	in = get16(in, snapshot.flowRejected);
+	snapshot.packetPoolPeak = *in++;
+	snapshot.messagePoolPeak = *in++;
+	snapshot.reportPoolPeak = *in++;
+	in = get16(in, snapshot.poolFailures);
+	snapshot.tasks = *in++;
+	if (snapshot.tasks > M16_WATERMARK_TASKS)
+	{
+		return false;
+	}
+	for (uint8_t i = 0; i < M16_WATERMARK_TASKS; i++)
+	{
+		in = get16(in, snapshot.stackFree[i]);
+	}
+	return true;
+}
+
+#if defined(ESP_PLATFORM)
+
+/**
+ * @brief Limits a counter to 16 bits.
+ */
+static uint16_t saturate16(uint32_t value)
+{
+	return value > UINT16_MAX ? UINT16_MAX : value;
+}
+
+/**
+ * @brief Limits a counter to 8 bits.
+ */
+static uint8_t saturate8(uint32_t value)
+{
+	return value > UINT8_MAX ? UINT8_MAX : value;
+}
+
+/**
+ * @brief Constructor for the Watermarks class.
+ *
+ * The driver receive buffer and the global pools are always included. The fast
+ * receive path, flow control and task stacks are added with the watch functions.
+ *
+ * @param modem The modem whose receive buffer is watched.
+ */
+Watermarks::Watermarks(M16 &modem) : modem(modem), fastRx(nullptr), flow(nullptr), tasks{}, taskCount(0) {}
+
+/**
+ * @brief Includes the queue of the fast receive path in the snapshot.
+ */
+void Watermarks::watchFastRx(FastRx &receiver)
+{
+	this->fastRx = &receiver;
+}
+
+/**
+ * @brief Includes the queue of a flow control sender in the snapshot.
+ */
+void Watermarks::watchFlow(FlowSender &sender)
+{
+	this->flow = &sender;
+}
+
+/**
+ * @brief Includes the stack of a task in the snapshot.
+ *
+ * The sequencer runs in the `esp_timer` task, so watch that task to size its callbacks.
+ *
+ * @param task The task to watch, or NULL for the calling task.
+ * @return false if `M16_WATERMARK_TASKS` tasks are already watched, true otherwise.
+ */
+bool Watermarks::watchTask(TaskHandle_t task)
+{
+	if (this->taskCount == M16_WATERMARK_TASKS)
+	{
+		return false;
+	}
+	this->tasks[this->taskCount++] = task != NULL ? task : xTaskGetCurrentTaskHandle();
+	return true;
+}
+
+/**
+ * @brief Samples the driver receive buffer.
+ *
+ * The driver does not keep a peak itself, so call this function as often as the
+ * main loop allows, or right before reading from the modem.
+ */
+void Watermarks::sample()
+{
+	this->modem.getRxBuffLength();
+}
+
+/**
+ * @brief Collects the current high-water marks.
+ *
+ * @return The snapshot.
+ */
+WatermarkSnapshot Watermarks::snapshot()
+{
+	WatermarkSnapshot snapshot{};
+	this->sample();
+	snapshot.rxBufferPeak = saturate16(this->modem.getRxBuffPeak());
+	snapshot.rxOverflows = saturate16(this->modem.getRxOverflows());
+	if (this->fastRx != nullptr)
+	{
+		snapshot.fastRxPeak = saturate8(this->fastRx->getQueuePeak());
+		snapshot.fastRxDropped = saturate16(this->fastRx->getDropped() + this->fastRx->getOverflows());
+	}
+	if (this->flow != nullptr)
+	{
+		snapshot.flowQueuePeak = this->flow->getQueuePeak();
+		snapshot.flowRejected = saturate16(this->flow->getRejected());
+	}
+
+	PoolStats packets = packetPool.getStats();
+	PoolStats messages = messagePool.getStats();
+	PoolStats reports = reportPool.getStats();
+	snapshot.packetPoolPeak = saturate8(packets.highWater);
+	snapshot.messagePoolPeak = saturate8(messages.highWater);
+	snapshot.reportPoolPeak = saturate8(reports.highWater);
+	snapshot.poolFailures = saturate16(packets.failures + messages.failures + reports.failures);
+
+	// On the ESP32 the stack high-water mark is given in bytes.
+	snapshot.tasks = this->taskCount;
+	for (uint8_t i = 0; i < this->taskCount; i++)
+	{
+		snapshot.stackFree[i] = saturate16(uxTaskGetStackHighWaterMark(this->tasks[i]));
+	}
+	return snapshot;
+}
+
+/**
+ * @brief Restarts the receive buffer and pool statistics.
+ *
+ * Queue peaks, dropped packets and task stacks cannot be reset and keep counting
+ * from boot.
+ */
+void Watermarks::reset()
+{
+	this->modem.resetRxStats();
+	packetPool.resetStats();
+	messagePool.resetStats();
+	reportPool.resetStats();
+}
+
+#endif